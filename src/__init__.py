@@ -10,7 +10,10 @@ import pkg_resources
 
 import tempfile
 import csv
+import errno
+from multiprocessing.pool import ThreadPool
 from . import utils
+from . import resources
 
 import json
 
@@ -248,6 +251,43 @@ def index(input, output, threads=None):
     return os.path.abspath("%s" % output)
 
 
+# Oldest samtools and bcftools that can write the index while writing the
+# output (--write-index with the out##idx##index syntax)
+SAMTOOLS_WRITE_INDEX = (1,10)
+BCFTOOLS_WRITE_INDEX = (1,17)
+
+_write_index = None
+
+def check_tool_versions():
+    """Checks once whether samtools and bcftools can write indexes on the fly.
+    With older versions the outputs are indexed in a separate pass.
+
+    Returns a dictionary (tool name -> True if --write-index can be used)
+    """
+    global _write_index
+    if _write_index is None:
+        support = {}
+        for tool,minimum in (("samtools",SAMTOOLS_WRITE_INDEX),("bcftools",BCFTOOLS_WRITE_INDEX)):
+            version = utils.tool_version(tool)
+            support[tool] = version is not None and version >= minimum
+            if version is not None and not support[tool]:
+                logging.warning("%s %s is older than %s, outputs will be indexed in a separate pass"
+                                %(tool,".".join(map(str,version)),".".join(map(str,minimum))))
+        _write_index = support
+    return _write_index
+
+def _index_bam(bam,index):
+    """ Indexes a bam file in a separate pass, for samtools without --write-index
+
+        bam -- bam file
+        index -- index file to write
+    """
+    processIndex = utils.run_tools([["samtools","index",bam]],name="Indexing")
+    if processIndex.wait() != 0:
+        raise ValueError("Error while indexing %s." %(bam))
+    if "%s.bai" %(bam) != index:
+        os.rename("%s.bai" %(bam),index)
+
 def mapping(name=None,index=None,fliInfo=None,file_pe_one=None,file_pe_two=None,
              file_interleaved=None,file_se=None,file_bam=None,outputDir=None,
              paired=False,tmpDir="/tmp/",threads=1,under_conversion=None, over_conversion=None):
@@ -271,6 +311,7 @@ def mapping(name=None,index=None,fliInfo=None,file_pe_one=None,file_pe_two=None,
         
     ## prepare inputs
     index = _prepare_index_parameter(index)
+    utils.trace_sample(name)
     
     ## prepare the input
     bamToFastq = []  
@@ -322,9 +363,28 @@ def mapping(name=None,index=None,fliInfo=None,file_pe_one=None,file_pe_two=None,
     #SAMBAMBA VIEW
     bamView = ["samtools","view","-h","-"]    
     
+    #Admission: gem index plus sort buffers, the sort is shrunk to what is free on the node
+    #and the threads to as many sort buffers as fit in the granted memory
+    threads = max(1,int(threads))
+    mapper_memory = resources.mapping_memory(index)
+    reservation = resources.manager().reserve("mapping %s" %(name),
+                                              mapper_memory + threads * resources.SORT_MEMORY_PER_THREAD,
+                                              threads=threads,
+                                              min_memory=mapper_memory + resources.SORT_MIN_MEMORY_PER_THREAD,
+                                              fixed_memory=mapper_memory,
+                                              thread_memory=resources.SORT_MIN_MEMORY_PER_THREAD)
+    mapping.extend(["-t",str(reservation.threads)])
+
     #SAMBAMBA SORT
+    #The index is written by samtools while sorting (no extra pass over the BAM)
     nameOutput="%s/%s.bam" %(outputDir,name)
-    bamSort = ["samtools","sort","-T","%s/%s"%(tmpDir,name),"-@",threads,"-o",nameOutput,"-"]
+    nameIndex="%s/%s.bai" %(outputDir,name)
+    write_index = check_tool_versions()["samtools"]
+    bamSort = ["samtools","sort","-T","%s/%s"%(tmpDir,name),"-@",str(reservation.threads),"-m",reservation.sort_memory(fixed=mapper_memory)]
+    if write_index:
+        bamSort.extend(["--write-index","-o","%s##idx##%s"%(nameOutput,nameIndex),"-"])
+    else:
+        bamSort.extend(["-o",nameOutput,"-"])
     
     tools = [mapping]
     tools.append(readNameClean)
@@ -334,94 +394,173 @@ def mapping(name=None,index=None,fliInfo=None,file_pe_one=None,file_pe_two=None,
     if file_bam is not None:
         tools.insert(0, bamToFastq)
     
-    process = utils.run_tools(tools, name="bisulphite-mapping")
-    if process.wait() != 0:
-        raise ValueError("Error while executing the Bisulphite bisulphite-mapping")
-    
-    #BAM INDEXING    
-    tools = []
-    
-    bamIndex = ["samtools","index","%s"%(nameOutput)]
-    tools = [bamIndex]
-    
-    processIndex = utils.run_tools(tools, name="index mapped file")
-    if processIndex.wait() != 0:
-        raise ValueError("Error while executing the indexing of the Bisulphite mapped file.")
-        
-    #Rename Index file
-    tools = []
-    nameIndex="%s/%s.bai" %(outputDir,name)
-    renameFile = ["mv","%s.bai"%(nameOutput),"%s"%(nameIndex)]
-    tools = [renameFile]
-    
-    processRename = utils.run_tools(tools, name="Rename Index File")
-    if processRename.wait() != 0:
-        raise ValueError("Error while executing Renaming the index file.")
+    with reservation:
+        process = utils.run_tools(tools, name="bisulphite-mapping")
+        if process.wait() != 0:
+            raise ValueError("Error while executing the Bisulphite bisulphite-mapping")
+
+    if not write_index:
+        _index_bam(nameOutput,nameIndex)
         
     return os.path.abspath("%s" % nameOutput)
     
     
-def merging(inputs=None,threads=None,output_dir=None,tmpDir="/tmp/"):
+def _link_or_copy(source,target):
+    """ Hardlinks source to target. Falls back to a reflink (or plain copy if
+        the filesystem does not support reflinks) when both are on different devices.
+        The link or copy is made under a temporary name and renamed over target,
+        so target is left as it was if this fails.
+    """
+    if os.path.exists(target) and os.path.samefile(source,target):
+        return
+    tmp_target = "%s.%d.tmp" %(target,os.getpid())
+    if os.path.lexists(tmp_target):
+        os.remove(tmp_target)
+    try:
+        try:
+            os.link(source,tmp_target)
+        except OSError, e:
+            if e.errno not in (errno.EXDEV, errno.EPERM, errno.EMLINK):
+                raise
+            process = utils.run_tools([["cp","--reflink=auto",source,tmp_target]],name="bisulphite-merging")
+            if process.wait() != 0:
+                raise ValueError("Error while copying %s" %(source))
+        os.rename(tmp_target,target)
+    finally:
+        if os.path.lexists(tmp_target):
+            os.remove(tmp_target)
+
+
+def _merge_sample(sample,listBams,output_dir,threads):
+    """ Merges the bam files of a single sample
+
+        sample -- sample name
+        listBams -- list of bam files of the sample
+        output_dir -- Directory to output the results
+        threads -- Number of threads used by samtools merge
+    """
+    utils.trace_sample(sample)
+    #bam output file
+    bam_filename = "%s/%s.bam" %(output_dir,sample)
+    #index bam file
+    index_filename = "%s/%s.bai" %(output_dir,sample)
+    #md5 bam file
+    md5_filename = "%s/%s.bam.md5" %(output_dir,sample)
+
+    logging.debug("Merging sample: %s" % sample)
+
+    if len(listBams) > 1 :
+        #Index and md5 are computed while the merged bam is written
+        write_index = check_tool_versions()["samtools"]
+        reservation = resources.manager().reserve("merging %s" %(sample),resources.MERGE_MEMORY,threads=threads)
+        with reservation, utils.StreamOutput(bam_filename,md5_file=md5_filename) as stream:
+            bammerging = ["samtools","merge","-f","-@",str(reservation.threads)]
+            if write_index:
+                bammerging.extend(["--write-index","%s##idx##%s"%(stream.fifo,index_filename)])
+            else:
+                bammerging.append(stream.fifo)
+            bammerging.extend(listBams)
+
+            process = utils.run_tools([bammerging], name="bisulphite-merging")
+            if process.wait() != 0:
+                raise ValueError("Error while executing the Bisulphite merging")
+        if not write_index:
+            _index_bam(bam_filename,index_filename)
+    else:
+        #Single lane, the mapping output and its index are reused as they are.
+        #The md5 is still written so every sample has one
+        _link_or_copy(listBams[0],bam_filename)
+        utils.write_md5(bam_filename,md5_filename)
+        lane_index = "%s.bai" %(listBams[0][:-4])
+        if os.path.isfile(lane_index):
+            _link_or_copy(lane_index,index_filename)
+        else:
+            _index_bam(bam_filename,index_filename)
+
+    return os.path.abspath("%s" % bam_filename)
+
+
+def merging(inputs=None,threads=None,output_dir=None,tmpDir="/tmp/",jobs=None):
     """ Merge bam alignment files 
     
         inputs -- Dictionary of samples and bam list files inputs(Key=sample, Value = [bam1,...,bamN])
         threads -- Number of threads to perform the merging process
         output_dir -- Directory to output the results
         tmpDir -- Temporary directory to perform sorting operations
+        jobs -- Number of samples merged concurrently. By default half the threads.
     """     
-    return_info = {}
-    
-    for sample,listBams  in inputs.iteritems():
-        #bam output file
-        bam_filename = "%s/%s.bam" %(output_dir,sample)
-        #index bam file
-        index_filename = "%s/%s.bai" %(output_dir,sample)
- 
-        bammerging = []       
-       
-        if len(listBams) > 1 :
-            bammerging.extend(["samtools","merge","-f",bam_filename])        
-        
-            for bamFile in listBams:
-                bammerging.append(bamFile)
-        else:
-            bammerging.extend(["cp",listBams[0],bam_filename])
+    #Check output directory
+    if not os.path.exists(output_dir):
+        os.makedirs(output_dir)
+
+    threads = max(1,int(threads)) if threads is not None else 1
+    #Only multi lane samples consume threads, single lanes are just linked
+    n_merges = len([s for s,l in inputs.iteritems() if len(l) > 1])
+    if jobs is None:
+        jobs = max(1,threads // 2)
+    jobs = max(1,min(int(jobs),len(inputs)))
+    merge_threads = max(1,threads // max(1,min(jobs,n_merges)))
+
+    #Largest samples (in bytes) first so the long merges do not end up last
+    samples = sorted(inputs.keys(),key=lambda s: sum(os.path.getsize(b) for b in inputs[s]),reverse=True)
+
+    pool = ThreadPool(jobs)
+    try:
+        outputs = pool.map(lambda s: _merge_sample(s,inputs[s],output_dir,merge_threads),samples)
+    finally:
+        pool.close()
+        pool.join()
+
+    return dict(zip(samples,outputs))
 
-        #Check output directory
-        if not os.path.exists(output_dir):
-            os.makedirs(output_dir)
-        
-        logging.debug("Merging sample: %s" % sample)
-        
-        process = utils.run_tools([bammerging], name="bisulphite-merging",output=bam_filename)
-        if process.wait() != 0:
-            raise ValueError("Error while executing the Bisulphite merging")
-        
-        return_info[sample] = os.path.abspath("%s" % bam_filename)
-        
-        #Samtools index
-        indexing = ["samtools","index","%s"%(bam_filename)]        
-        processIndex = utils.run_tools([indexing],name="Indexing")
-        
-        if processIndex.wait() != 0:
-            raise ValueError("Error while indexing.")
-        
-        
-        #Rename file
-        reName = ['mv',
-                  '%s.bai' %(bam_filename),                         
-                  index_filename
-                 ]        
-        
-        processRename = utils.run_tools([reName],name="Rename Index")
-                
-        if processRename.wait() != 0:
-            raise ValueError("Rename Index.")
-    
-    return return_info 
 
+def _contig_groups(input_bam,chrom_list,jobs):
+    """ Splits the chromosomes into jobs groups of similar number of reads.
+        Read counts are taken from the bam index (samtools idxstats), chromosomes
+        keep their order within each group so every group reads the bam sequentially.
+
+        input_bam -- indexed bam file
+        chrom_list -- Chromosome list
+        jobs -- Number of groups
+    """
+    jobs = max(1,min(jobs,len(chrom_list)))
+    reads = dict.fromkeys(chrom_list,1)
+    idxstats = subprocess.Popen(['samtools','idxstats',input_bam],stdout=subprocess.PIPE,stderr=subprocess.PIPE)
+    out = idxstats.communicate()[0]
+    if idxstats.returncode == 0:
+        for line in out.splitlines():
+            fields = line.split('\t')
+            if len(fields) >= 3 and fields[0] in reads:
+                reads[fields[0]] = int(fields[2]) + 1
+
+    #Largest chromosome to the least loaded group
+    groups = [[] for i in range(jobs)]
+    load = [0] * jobs
+    for chrom in sorted(chrom_list,key=lambda c: reads[c],reverse=True):
+        i = load.index(min(load))
+        groups[i].append(chrom)
+        load[i] += reads[chrom]
+    order = dict((c,i) for i,c in enumerate(chrom_list))
+    return [sorted(g,key=lambda c: order[c]) for g in groups if g]
+
+
+def _bs_call_parameters(reference,sample,paired_end,keep_unmatched,keep_duplicates):
+    """ bs_call command line """
+    parameters_bscall = ['%s' %(executables["bs_call"]),'-r',reference,'-L5','-n',sample]
+
+    if paired_end:
+        parameters_bscall.append('-p')
+
+    if keep_unmatched:
+        parameters_bscall.append('-k')
 
-def methylationCalling(reference=None,species=None,sample_bam=None,chrom_list=None,output_dir=None,paired_end=True,keep_unmatched=False,keep_duplicates=False):
+    if keep_duplicates:
+        parameters_bscall.append('-d')
+
+    return parameters_bscall
+
+
+def methylationCalling(reference=None,species=None,sample_bam=None,chrom_list=None,output_dir=None,paired_end=True,keep_unmatched=False,keep_duplicates=False,threads=1,jobs=1):
     """ Performs the process to make methylation calls.
     
         reference -- fasta reference file
@@ -432,79 +571,54 @@ def methylationCalling(reference=None,species=None,sample_bam=None,chrom_list=No
         paired_end -- Is paired end data
         keep_unmatched -- Do not discard reads that do not form proper pairs
         keep_duplicates -- Do not merge duplicate reads              
+        threads -- Number of bam decompression threads shared by the readers
+        jobs -- Number of chromosomes called concurrently, each with its own bam reader
         
     """
     #Check output directory
     if not os.path.exists(output_dir):
         os.makedirs(output_dir)
+
+    threads = max(1,int(threads))
+    jobs = max(1,int(jobs))
         
     #for each sample 
     for sample,input_bam in sample_bam.iteritems():    
-        list_bcf_files = []
-        #for each chromosome
-        for chrom in chrom_list:
-            bcf_file = "%s/%s_%s.bcf" %(output_dir,sample,chrom)
-            list_bcf_files.append(bcf_file)
-            bsCall = [['samtools','view','-h',input_bam,chrom]]
-
-            #paired_argument = ''
-            #if paired_end:
-            #    paired_argument += '-p'
-                
-            #unmatched_reads = ''
-            #if keep_unmatched:
-            #    unmatched_reads += '-k'
-                
-            #duplicate_reads = ''
-            #if keep_duplicates:
-            #    duplicate_reads += '-d'
+        utils.trace_sample(sample)
+        list_bcf_files = ["%s/%s_%s.bcf" %(output_dir,sample,chrom) for chrom in chrom_list]
+        parameters_bscall = _bs_call_parameters(reference,sample,paired_end,keep_unmatched,keep_duplicates)
 
-            #bsCall.append(['%s' %(executables["bs_call"]),'-r',reference,paired_argument,unmatched_reads,duplicate_reads,'-L5','-n',sample])
-            
-            
-            parameters_bscall = ['%s' %(executables["bs_call"]),'-r',reference,'-L5','-n',sample]
-    
-            #paired_argument = ''
-            if paired_end:
-                parameters_bscall.append('-p')
-                
-            if keep_unmatched:
-                parameters_bscall.append('-k')
-                
-            if keep_duplicates:
-                parameters_bscall.append('-d')
-    
-            bsCall.append(parameters_bscall)             
-                
-            bsCall.append(['bcftools','convert','-o',bcf_file,'-O','b'])
-            process = utils.run_tools(bsCall, name="bisulphite-merging")
-            if process.wait() != 0:
-                raise ValueError("Error while executing the bscall process.")
+        def bs_call(chrom):
+            bcf_file = "%s/%s_%s.bcf" %(output_dir,sample,chrom)
+            return [parameters_bscall,['bcftools','convert','-o',bcf_file,'-O','b']]
+
+        #One samtools view per group of chromosomes, split by chromosome into one bs_call after the other
+        groups = _contig_groups(input_bam,chrom_list,jobs)
+        reader_threads = max(1,threads // len(groups))
+
+        def call_group(chroms):
+            utils.trace_sample(sample)
+            #bs_call runs single threaded next to the reader
+            memory = resources.bs_call_memory(reference,chroms) + resources.MERGE_MEMORY
+            with resources.manager().reserve("bscall %s" %(sample),memory,threads=reader_threads + 1,min_threads=2) as reservation:
+                reader = utils.BamRegionReader(input_bam,chroms,bs_call,threads=reservation.threads - 1,name="bsCalling")
+                try:
+                    return reader.run()
+                except utils.ProcessError, e:
+                    raise ValueError("Error while executing the bscall process: %s" %(str(e)))
+
+        pool = ThreadPool(len(groups))
+        try:
+            pool.map(call_group,groups)
+        finally:
+            pool.close()
+            pool.join()
             
         #Concatenation
         bcfSample = "%s/%s.raw.bcf" %(output_dir,sample)
         bcfSampleMd5 = "%s/%s.raw.bcf.md5" %(output_dir,sample)
         
-        concat = ['bcftools','concat','-O','b','-o',bcfSample]
-        concat.extend(list_bcf_files)        
-        
-        process = utils.run_tools([concat],name="Concatenation Calls")
-        if process.wait() != 0:
-            raise ValueError("Error while concatenating bcf calls.")
-        #Indexing
-        indexing = ['bcftools','index',bcfSample]
-        #md5sum
-        md5sum = ['md5sum',bcfSample]
-        
-        processIndex = utils.run_tools([indexing],name="Index BCF")
-    
-        if processIndex.wait() != 0:
-            raise ValueError("Error while Indexing BCF file.")
-        
-        processMD5 = utils.run_tools([md5sum],name="Index MD5",output=bcfSampleMd5)
-                
-        if processMD5.wait() != 0:
-            raise ValueError("Error while calculating its md5sum when performing bsConcat.")
+        _concat_bcf(list_bcf_files,bcfSample,bcfSampleMd5)
             
     return " ".join(sample_bam.keys())
             
@@ -599,41 +713,53 @@ def bsCalling (reference=None,species=None,input_bam=None,chrom=None,sample_id=N
     if not os.path.exists(output_dir):
         os.makedirs(output_dir)
         
+    utils.trace_sample(sample_id)
+
     #Definition bcf file
     bcf_file = "%s/%s_%s.bcf" %(output_dir,sample_id,chrom)   
     
     #Command bisulphite calling
     bsCall = [['samtools','view','-h',input_bam,chrom]]
-    
-    parameters_bscall = ['%s' %(executables["bs_call"]),'-r',reference,'-L5','-n',sample_id]
-        
-    #paired_argument = ''
-    if paired_end:
-        #paired_argument += '-p'
-        parameters_bscall.append('-p')
-                
-    #unmatched_reads = ''
-    if keep_unmatched:
-        #unmatched_reads += '-k'
-        parameters_bscall.append('-k')
-                
-    #duplicate_reads = ''
-    if keep_duplicates:
-        #duplicate_reads += '-d'
-        parameters_bscall.append('-d')
-    
-    #bsCall.append(['%s' %(executables["bs_call"]),'-r',reference,paired_argument,unmatched_reads,duplicate_reads,'-L5','-n',sample_id])        
-    bsCall.append(parameters_bscall) 
+    bsCall.append(_bs_call_parameters(reference,sample_id,paired_end,keep_unmatched,keep_duplicates))
         
     bsCall.append(['bcftools','convert','-o',bcf_file,'-O','b'])
     
-    process = utils.run_tools(bsCall, name="bsCalling")
-    if process.wait() != 0:
-        raise ValueError("Error while executing the bscall process.")
+    memory = resources.bs_call_memory(reference,[chrom]) + resources.MERGE_MEMORY
+    with resources.manager().reserve("bscall %s %s" %(sample_id,chrom),memory,threads=2):
+        process = utils.run_tools(bsCall, name="bsCalling")
+        if process.wait() != 0:
+            raise ValueError("Error while executing the bscall process.")
     
     return os.path.abspath("%s" % bcf_file)
 
 
+def _concat_bcf(list_bcfs,bcfSample,bcfSampleMd5):
+    """ Concatenates bcf files writing the CSI index and the md5 checksum
+        while the output is written, so the output is never read back.
+
+        list_bcfs -- list of bcf files to be concatenated
+        bcfSample -- output bcf file
+        bcfSampleMd5 -- output md5 file
+    """
+    write_index = check_tool_versions()["bcftools"]
+    with utils.StreamOutput(bcfSample,md5_file=bcfSampleMd5) as stream:
+        concat = ['bcftools','concat','-O','b']
+        if write_index:
+            concat.extend(['--write-index','-o','%s##idx##%s.csi' %(stream.fifo,bcfSample)])
+        else:
+            concat.extend(['-o',stream.fifo])
+        concat.extend(list_bcfs)
+
+        process = utils.run_tools([concat],name="Concatenation Calls")
+        if process.wait() != 0:
+            raise ValueError("Error while concatenating bcf calls.")
+
+    if not write_index:
+        processIndex = utils.run_tools([['bcftools','index','-f',bcfSample]],name="Index Calls")
+        if processIndex.wait() != 0:
+            raise ValueError("Error while indexing %s." %(bcfSample))
+
+
 def bsConcat(list_bcfs=None,sample=None,output_dir=None):
     """ Concatenates all bcf methylation calls files in one output file.
     
@@ -646,32 +772,13 @@ def bsConcat(list_bcfs=None,sample=None,output_dir=None):
     if not os.path.exists(output_dir):
         os.makedirs(output_dir)
         
+    utils.trace_sample(sample)
+
     bcfSample = "%s/%s.raw.bcf" %(output_dir,sample)
     bcfSampleMd5 = "%s/%s.raw.md5" %(output_dir,sample)
    
     #Concatenation
-    #concat = ['bcftools','concat','-O','b','-o',bcfSample," ".join(list_bcfs)]
-    concat = ['bcftools','concat','-O','b','-o',bcfSample]
-    concat.extend(list_bcfs)
-     
-    process = utils.run_tools([concat],name="Concatenation Calls")
-    if process.wait() != 0:
-        raise ValueError("Error while concatenating bcf calls.")
-        
-    #Indexing
-    indexing = ['bcftools','index',bcfSample]
-    #md5sum
-    md5sum = ['md5sum',bcfSample]
-        
-    processIndex = utils.run_tools([indexing],name="Index BCF")
-    
-    if processIndex.wait() != 0:
-        raise ValueError("Error while Indexing BCF file.")
-        
-    processMD5 = utils.run_tools([md5sum],name="Index MD5",output=bcfSampleMd5)
-                
-    if processMD5.wait() != 0:
-        raise ValueError("Error while calculating its md5sum when performing bsConcat.")
+    _concat_bcf(list_bcfs,bcfSample,bcfSampleMd5)
         
     return os.path.abspath("%s" %bcfSample)
     
@@ -2,6 +2,7 @@
 """gemBS commands"""
 import argparse
 import utils
+import resources
 import production
 import sys
 from sys import exit
@@ -17,6 +18,11 @@ def gemBS():
                 description="gemBS is a wrapper to perform the different steps involved in the Bisulfite pipeline."
                 )
         parser.add_argument('--loglevel', dest="loglevel", default=None, help="Log level (error, warn, info, debug)")
+        parser.add_argument('--trace', dest="trace", default=None, metavar="JSON_FILE", help="""Record wall time, cpu time, peak memory and io of every
+                            executed process. Written as Chrome trace JSON plus a per sample summary table (JSON_FILE with .txt suffix).""")
+        parser.add_argument('--max-memory', dest="max_memory", default=None, metavar="SIZE", help="""Memory available to gemBS jobs on this node, shared by all
+                            gemBS processes (e.g. 200G). Jobs wait until they fit. Default: 90%% of the node memory""")
+        parser.add_argument('--max-threads', dest="max_threads", default=None, metavar="THREADS", help="Threads available to gemBS jobs on this node. Default: number of cpus")
         parser.add_argument('-v', '--version', action='version', version='%(prog)s ' + __VERSION__)
 
         commands = {
@@ -49,6 +55,10 @@ def gemBS():
         args = parser.parse_args()
         if args.loglevel is not None:
             src.loglevel(args.loglevel)
+        if args.trace is not None:
+            utils.enable_trace(args.trace)
+        resources.configure(max_memory=args.max_memory, max_threads=args.max_threads)
+        src.check_tool_versions()
            
         try:
             instances[args.command].run(args)
@@ -58,7 +68,7 @@ def gemBS():
     except KeyboardInterrupt:
         exit(1)
     finally:
-        pass
+        utils.write_trace()
 
 if __name__ == "__main__":
     gemBS()
@@ -375,10 +375,13 @@ class MergingAll(BasicPipeline):
         parser.add_argument('-t', '--threads', dest="threads", metavar="THREADS", default="1", help='Number of threads, Default: %s' %self.threads)
         parser.add_argument('-o', '--output-dir', dest="output_dir", metavar="PATH",help='Output directory to store merged results.',required=True)
         parser.add_argument('-d', '--tmp-dir', dest="tmp_dir", metavar="PATH", default="/tmp/", help='Temporary folder to perform sorting operations. Default: %s' %self.tmp_dir)
+        parser.add_argument('-J', '--jobs', dest="jobs", metavar="JOBS", type=int, default=None, help='Number of samples merged concurrently. The threads are shared among them. Default: threads/2')
         
     def run(self, args):
         #Threads
         self.threads = args.threads
+        #Concurrent samples
+        self.jobs = args.jobs
         #Output Directory
         self.output_dir = args.output_dir
         #TMP DIR
@@ -398,7 +401,7 @@ class MergingAll(BasicPipeline):
                     
         #Check list of file
         self.totalFiles = 0
-        for sample,listBams in self.samplesBams:
+        for sample,listBams in self.samplesBams.iteritems():
             self.totalFiles += len(listBams)
               
         if self.totalFiles < 1:
@@ -408,7 +411,7 @@ class MergingAll(BasicPipeline):
             
         self.log_parameter()
         logging.gemBS.gt("Merging process started...")
-        ret = src.merging(inputs=self.samplesBams,threads=self.threads,output_dir=self.output_dir,tmpDir=self.tmp_dir)
+        ret = src.merging(inputs=self.samplesBams,threads=self.threads,output_dir=self.output_dir,tmpDir=self.tmp_dir,jobs=self.jobs)
          
         if ret:
             logging.gemBS.gt("Merging process done!! Output files generated:")
@@ -507,6 +510,8 @@ class MethylationCall(BasicPipeline):
         parser.add_argument('-d','--paired-end', dest="paired_end", action="store_true", default=False, help="Input data is Paired End")
         parser.add_argument('-k','--keep-unmatched', dest="keep_unmatched", action="store_true", default=False, help="Do not discard reads that do not form proper pairs.")
         parser.add_argument('-u','--keep-duplicates', dest="keep_duplicates", action="store_true", default=False, help="Do not merge duplicate reads.")      
+        parser.add_argument('-t','--threads', dest="threads", metavar="THREADS", default="1", help='Number of BAM decompression threads shared by the chromosome readers. Default: %s' %self.threads)
+        parser.add_argument('-J','--jobs', dest="jobs", metavar="JOBS", type=int, default=1, help='Number of chromosomes called concurrently. Default: 1')
         parser.add_argument('-l','--list-chroms',dest="list_chroms",nargs="+",metavar="CHROMS",help="""List of chromosomes to perform the methylation pipeline.
                                                                                                        Can be a file where every line is a chromosome contig. 
                                                                                                        By default human chromosomes: %s """ %self.chroms,
@@ -524,6 +529,8 @@ class MethylationCall(BasicPipeline):
         self.paired = args.paired_end
         self.keep_unmatched = args.keep_unmatched
         self.keep_duplicates = args.keep_duplicates
+        self.threads = args.threads
+        self.jobs = args.jobs
         
         self.list_chroms = []
     
@@ -558,7 +565,8 @@ class MethylationCall(BasicPipeline):
         logging.gemBS.gt("Methylation Calling...")
         if len(args.list_chroms) > 0:
             ret = src.methylationCalling(reference=self.fasta_reference,species=self.species,sample_bam=self.sampleBam,
-                                         chrom_list=self.list_chroms,output_dir=self.output_dir,paired_end=self.paired,keep_unmatched=self.keep_unmatched,keep_duplicates=self.keep_duplicates)   
+                                         chrom_list=self.list_chroms,output_dir=self.output_dir,paired_end=self.paired,keep_unmatched=self.keep_unmatched,keep_duplicates=self.keep_duplicates,
+                                         threads=self.threads,jobs=self.jobs)   
                                    
             if ret:
                 logging.gemBS.gt("Methylation call done, samples performed: %s" %(ret))
@@ -573,6 +581,7 @@ class MethylationCall(BasicPipeline):
         printer("Reference       : %s", self.fasta_reference)
         printer("Species         : %s", self.species)
         printer("Chromosomes     : %s", self.list_chroms)
+        printer("Jobs            : %s", self.jobs)
         printer("json File       : %s", self.json_file)
         for sample,input_bam in self.sampleBam.iteritems():
             printer("Sample: %s    Bam: %s" %(sample,input_bam))
@@ -0,0 +1,251 @@
+# -*- coding: utf-8 -*-
+#!/usr/bin/env python
+"""Local resource manager
+
+Jobs reserve memory and threads before they start and only run while
+the node has headroom. Reservations are kept in a ledger file shared
+by every gemBS process on the node, so several lanes mapped by
+independent gemBS invocations do not overcommit the memory.
+"""
+
+import os
+import json
+import time
+import fcntl
+import errno
+import logging
+import threading
+import multiprocessing
+
+# Approximate memory footprints used to size the jobs
+MB = 1024 * 1024
+GB = 1024 * MB
+
+# samtools sort -m per thread: default and minimum
+SORT_MEMORY_PER_THREAD = 768 * MB
+SORT_MIN_MEMORY_PER_THREAD = 128 * MB
+# gem-mapper working memory on top of the index
+MAPPER_OVERHEAD = 2 * GB
+# bs_call working memory on top of the contig sequence
+BS_CALL_OVERHEAD = 1 * GB
+# samtools merge / view
+MERGE_MEMORY = 256 * MB
+
+_manager = None
+
+def configure(max_memory=None, max_threads=None, ledger=None):
+    """Set up the node resource manager
+
+    max_memory  -- memory available to gemBS jobs in bytes, or a string with K/M/G/T suffix.
+                   Default: 90% of MemTotal from /proc/meminfo
+    max_threads -- threads available to gemBS jobs. Default: number of cpus
+    ledger      -- path of the reservation ledger shared by all gemBS processes
+    """
+    global _manager
+    _manager = ResourceManager(max_memory=max_memory, max_threads=max_threads, ledger=ledger)
+    return _manager
+
+def manager():
+    """Return the node resource manager, creating a default one if needed"""
+    if _manager is None:
+        configure(max_memory=os.getenv("GEMBS_MAX_MEMORY", None),
+                  max_threads=os.getenv("GEMBS_MAX_THREADS", None),
+                  ledger=os.getenv("GEMBS_RESOURCE_LEDGER", None))
+    return _manager
+
+def parse_memory(value):
+    """Parse a memory size like 200G, 512M or a plain number of bytes"""
+    if value is None:
+        return None
+    if isinstance(value, (int, long)):
+        return value
+    value = str(value).strip().upper()
+    units = {"K": 1024, "M": MB, "G": GB, "T": 1024 * GB}
+    if value[-1:] == "B":
+        value = value[:-1]
+    if value[-1:] in units:
+        return int(float(value[:-1]) * units[value[-1]])
+    return int(value)
+
+def _meminfo(key):
+    """Read a value from /proc/meminfo in bytes"""
+    try:
+        with open("/proc/meminfo") as f:
+            for line in f:
+                if line.startswith(key + ":"):
+                    return int(line.split()[1]) * 1024
+    except IOError:
+        pass
+    return None
+
+def _pid_alive(pid):
+    try:
+        os.kill(pid, 0)
+    except OSError, e:
+        return e.errno == errno.EPERM
+    return True
+
+
+def mapping_memory(index):
+    """Memory of the gem-mapper process for the given index"""
+    try:
+        return os.path.getsize(index) + MAPPER_OVERHEAD
+    except OSError:
+        return MAPPER_OVERHEAD
+
+def bs_call_memory(reference, contigs):
+    """Memory of a bs_call job on the given contigs, from the fasta index (.fai)"""
+    lengths = {}
+    try:
+        with open(reference + ".fai") as f:
+            for line in f:
+                fields = line.split("\t")
+                lengths[fields[0]] = int(fields[1])
+    except (IOError, ValueError, IndexError):
+        pass
+    longest = max([lengths.get(c, 0) for c in contigs] + [0])
+    return BS_CALL_OVERHEAD + 2 * longest
+
+
+class Reservation(object):
+    """Granted share of the node resources, released on exit"""
+
+    def __init__(self, manager, key, name, memory, threads):
+        self.manager = manager
+        self.key = key
+        self.name = name
+        self.memory = memory
+        self.threads = threads
+
+    def sort_memory(self, fixed=0):
+        """samtools sort -m value for the memory left after fixed,
+        split over the granted threads. The reservation must have been made
+        with thread_memory=SORT_MIN_MEMORY_PER_THREAD and the same fixed memory,
+        so the sort buffers fit in the granted memory
+        """
+        threads = max(1, self.threads)
+        per_thread = (self.memory - fixed) // threads
+        per_thread = max(SORT_MIN_MEMORY_PER_THREAD, min(SORT_MEMORY_PER_THREAD, per_thread)) // MB * MB
+        if threads * per_thread + fixed > self.memory:
+            raise ValueError("Sort buffers of %s (%d x %d MB) do not fit in the reserved %d MB" %
+                             (self.name, threads, per_thread // MB, (self.memory - fixed) // MB))
+        return "%dM" % (per_thread // MB)
+
+    def release(self):
+        if self.key is not None:
+            self.manager.release(self.key)
+            self.key = None
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, tb):
+        self.release()
+        return False
+
+
+class ResourceManager(object):
+    """Admission control for the jobs on the local node. Memory and threads
+    are reserved in a ledger file protected by flock, entries of processes
+    that died are dropped.
+    """
+
+    def __init__(self, max_memory=None, max_threads=None, ledger=None, poll=5.0):
+        self.max_memory = parse_memory(max_memory)
+        if self.max_memory is None:
+            # the whole node, running gemBS jobs are accounted in the ledger
+            self.max_memory = int(0.9 * (_meminfo("MemTotal") or 8 * GB))
+        self.max_threads = int(max_threads) if max_threads is not None else multiprocessing.cpu_count()
+        if ledger is None:
+            ledger = os.path.join(os.getenv("TMPDIR", "/tmp"), "gemBS.%d.resources" % os.getuid())
+        self.ledger = ledger
+        self.poll = poll
+        self.lock = threading.Lock()
+        self.counter = 0
+
+    def __update(self, function):
+        """Apply function to the ledger dictionary under the file lock"""
+        with self.lock:
+            fd = os.open(self.ledger, os.O_RDWR | os.O_CREAT, 0644)
+            try:
+                fcntl.flock(fd, fcntl.LOCK_EX)
+                with os.fdopen(os.dup(fd), "r+") as f:
+                    data = f.read()
+                    try:
+                        entries = json.loads(data) if data else {}
+                    except ValueError:
+                        entries = {}
+                    for key in entries.keys():
+                        if not _pid_alive(entries[key]["pid"]):
+                            del entries[key]
+                    result = function(entries)
+                    f.seek(0)
+                    f.truncate()
+                    json.dump(entries, f)
+                return result
+            finally:
+                os.close(fd)
+
+    def reserve(self, name, memory, threads=1, min_memory=None, min_threads=1, fixed_memory=0, thread_memory=0):
+        """Block until the job fits on the node and return its Reservation.
+        If the full request does not fit but the minimum does, the job is
+        admitted with whatever is free, so memory and threads can be sized
+        per job. Requests larger than the node are clipped to the node.
+
+        For jobs whose memory grows with the threads, thread_memory is the
+        least memory each thread needs on top of fixed_memory; the granted
+        threads are then capped so that they fit in the granted memory.
+
+        name          -- job name, for logging
+        memory        -- wanted memory in bytes
+        threads       -- wanted threads
+        min_memory    -- minimum memory the job can run with. Default: memory
+        min_threads   -- minimum threads the job can run with
+        fixed_memory  -- memory of the job that does not depend on the threads
+        thread_memory -- minimum memory per thread
+        """
+        threads = max(1, int(threads))
+        min_threads = max(1, min(int(min_threads), threads))
+        if min_memory is None:
+            min_memory = memory
+        min_memory = max(min_memory, fixed_memory + min_threads * thread_memory)
+        min_memory = min(min_memory, memory, self.max_memory)
+        memory = min(memory, self.max_memory)
+        min_threads = min(min_threads, self.max_threads)
+
+        with self.lock:
+            self.counter += 1
+            key = "%d.%d" % (os.getpid(), self.counter)
+
+        def admit(entries):
+            used_memory = sum(e["memory"] for e in entries.values())
+            used_threads = sum(e["threads"] for e in entries.values())
+            free_memory = self.max_memory - used_memory
+            free_threads = self.max_threads - used_threads
+            if free_memory < min_memory or free_threads < min_threads:
+                return None
+            granted_memory = min(memory, free_memory)
+            granted_threads = min(threads, free_threads)
+            if thread_memory > 0:
+                granted_threads = min(granted_threads, (granted_memory - fixed_memory) // thread_memory)
+            granted = (granted_memory, max(min_threads, granted_threads))
+            entries[key] = {"pid": os.getpid(), "name": name, "memory": granted[0], "threads": granted[1]}
+            return granted
+
+        waiting = False
+        while True:
+            granted = self.__update(admit)
+            if granted is not None:
+                break
+            if not waiting:
+                logging.info("Waiting for resources for %s (%d MB, %d threads)" % (name, min_memory // MB, min_threads))
+                waiting = True
+            time.sleep(self.poll)
+
+        logging.debug("Admitted %s with %d MB and %d threads" % (name, granted[0] // MB, granted[1]))
+        return Reservation(self, key, name, granted[0], granted[1])
+
+    def release(self, key):
+        def remove(entries):
+            entries.pop(key, None)
+        self.__update(remove)
@@ -14,6 +14,11 @@ import logging
 import json
 import signal
 import tempfile
+import time
+import errno
+import hashlib
+import shutil
+import threading
 
 
 # Global process registry
@@ -37,6 +42,185 @@ def terminate_processes():
                 os.kill(p._popen.pid, signal.SIGKILL)
                 
                 
+# Global resource trace
+# which collects the wall time, cpu time, peak memory and io
+# of every process started through run_tools. The trace is
+# only kept if enable_trace() was called.
+_resource_trace = None
+
+def enable_trace(trace_file, summary_file=None):
+    """Start collecting per process resource usage. The trace is written
+    as Chrome trace JSON to trace_file and as a summary table
+    to summary_file (default: trace_file with .txt suffix) by write_trace()
+
+    trace_file   -- path to the Chrome trace JSON output
+    summary_file -- optional path to the summary table
+    """
+    global _resource_trace
+    if summary_file is None:
+        if trace_file.endswith(".json"):
+            summary_file = trace_file[:-5] + ".txt"
+        else:
+            summary_file = trace_file + ".txt"
+    _resource_trace = ResourceTrace(trace_file, summary_file)
+    return _resource_trace
+
+def trace_sample(sample):
+    """Set the sample that following processes are accounted to"""
+    if _resource_trace is not None:
+        _resource_trace.sample = sample
+
+def write_trace():
+    """Write the collected resource trace, if any"""
+    if _resource_trace is not None:
+        _resource_trace.write()
+
+
+class ProcessStats(object):
+    """Resource usage of a single finished process"""
+
+    def __init__(self, command, stage, sample, pid, start, end, rusage, io):
+        self.command = command
+        self.stage = stage
+        self.sample = sample
+        self.pid = pid
+        self.start = start
+        self.end = end
+        self.wall = end - start
+        self.user = rusage.ru_utime if rusage is not None else 0.0
+        self.sys = rusage.ru_stime if rusage is not None else 0.0
+        # ru_maxrss is reported in kilobytes on Linux
+        self.max_rss = rusage.ru_maxrss * 1024 if rusage is not None else 0
+        self.rchar = io.get("rchar", 0)
+        self.wchar = io.get("wchar", 0)
+        if "read_bytes" in io:
+            self.read_bytes = io["read_bytes"]
+            self.write_bytes = io["write_bytes"]
+        elif rusage is not None:
+            # no /proc/<pid>/io, block counts are in 512 byte units
+            self.read_bytes = rusage.ru_inblock * 512
+            self.write_bytes = rusage.ru_oublock * 512
+        else:
+            self.read_bytes = 0
+            self.write_bytes = 0
+
+
+class ResourceTrace(object):
+    """Collects ProcessStats and writes them as Chrome trace
+    (chrome://tracing, Perfetto) and as a per sample summary table
+    """
+
+    def __init__(self, trace_file, summary_file):
+        self.trace_file = trace_file
+        self.summary_file = summary_file
+        self.local = threading.local()
+        self.lock = threading.Lock()
+        self.stats = []
+        self.origin = time.time()
+
+    @property
+    def sample(self):
+        """Current sample of the calling thread"""
+        return getattr(self.local, "sample", None)
+
+    @sample.setter
+    def sample(self, sample):
+        self.local.sample = sample
+
+    def add(self, stats):
+        with self.lock:
+            self.stats.append(stats)
+
+    def write(self):
+        samples = []
+        for s in self.stats:
+            if s.sample not in samples:
+                samples.append(s.sample)
+
+        events = []
+        for i, sample in enumerate(samples):
+            events.append({"name": "process_name", "ph": "M", "pid": i + 1,
+                           "args": {"name": sample if sample is not None else "gemBS"}})
+        for s in self.stats:
+            events.append({"name": s.command,
+                           "cat": s.stage,
+                           "ph": "X",
+                           "ts": int((s.start - self.origin) * 1e6),
+                           "dur": int(s.wall * 1e6),
+                           "pid": samples.index(s.sample) + 1,
+                           "tid": s.pid,
+                           "args": {"user": s.user,
+                                    "sys": s.sys,
+                                    "max_rss": s.max_rss,
+                                    "read_bytes": s.read_bytes,
+                                    "write_bytes": s.write_bytes,
+                                    "rchar": s.rchar,
+                                    "wchar": s.wchar}})
+        with open(self.trace_file, "w") as f:
+            json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, f, indent=1)
+
+        mb = 1024.0 * 1024.0
+        header = "%-20s %-24s %-20s %10s %10s %10s %10s %10s %10s %5s\n"
+        row = "%-20s %-24s %-20s %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %5.1f\n"
+        with open(self.summary_file, "w") as f:
+            for sample in samples:
+                f.write(header % ("Sample", "Stage", "Command", "Wall(s)", "User(s)", "Sys(s)",
+                                  "MaxRSS(MB)", "Read(MB)", "Write(MB)", "CPU"))
+                for s in self.stats:
+                    if s.sample != sample:
+                        continue
+                    cpu = (s.user + s.sys) / s.wall if s.wall > 0 else 0.0
+                    f.write(row % (sample, s.stage, s.command, s.wall, s.user, s.sys,
+                                   s.max_rss / mb, s.read_bytes / mb, s.write_bytes / mb, cpu))
+                f.write("\n")
+
+
+def _read_proc_io(pid):
+    """Read the io counters of a process from /proc/<pid>/io. Returns
+    an empty dict if they are not available
+    """
+    io = {}
+    try:
+        with open("/proc/%d/io" % pid) as f:
+            for line in f:
+                k, v = line.split(":")
+                io[k.strip()] = int(v)
+    except (IOError, ValueError):
+        pass
+    return io
+
+
+def _is_zombie(pid):
+    """True if the process has exited but was not yet reaped"""
+    try:
+        with open("/proc/%d/stat" % pid) as f:
+            stat = f.read()
+    except IOError:
+        return True
+    return stat[stat.rfind(")") + 2] == "Z"
+
+
+def _wait_rusage(pid):
+    """Wait for the process and return its exit status, rusage and io counters.
+    The io counters are read from /proc while the process is a zombie, before it is
+    reaped with wait4, as they are gone afterwards.
+    """
+    io = {}
+    if os.path.exists("/proc/%d/io" % pid):
+        delay = 0.01
+        while not _is_zombie(pid):
+            time.sleep(delay)
+            delay = min(delay * 2, 0.5)
+        io = _read_proc_io(pid)
+    while True:
+        try:
+            _, status, rusage = os.wait4(pid, 0)
+            return status, rusage, io
+        except OSError, e:
+            if e.errno != errno.EINTR:
+                raise
+
+
 class CommandException(Exception):
     """Exception thrown by gemtools commands"""
     pass
@@ -183,6 +367,9 @@ class Process(object):
         self.logfile = logfile
         self.parent = parent
         self.input_writer = None
+        self.start_time = None
+        self.sample = None
+        self.stats = None
 
     def run(self):
         """Start the process and return it. If the input is a ProcessInput,
@@ -218,7 +405,10 @@ class Process(object):
 
         print " ".join(self.commands)
 
+        self.start_time = time.time()
         self.process = subprocess.Popen(self.commands, stdin=stdin, stdout=stdout, stderr=stderr, env=self.env, close_fds=False)
+        if _resource_trace is not None:
+            self.sample = _resource_trace.sample
 
         if process_input is not None:
             logging.debug("Starting process input writer")
@@ -248,7 +438,10 @@ class Process(object):
             self.input_writer.wait()
 
         # wait for the process
-        exit_value = self.process.wait()
+        if _resource_trace is not None and self.process.returncode is None:
+            exit_value = self.__wait_traced()
+        else:
+            exit_value = self.process.wait()
         logging.debug("Process '%s' finished with %d", str(self), exit_value)
         if exit_value is not 0:
             logging.error("Process '%s' finished with %d", str(self), exit_value)
@@ -259,6 +452,21 @@ class Process(object):
             raise ProcessError("Process '%s' finished with %d" % (str(self), exit_value))
         return exit_value
 
+    def __wait_traced(self):
+        """Wait for the process reaping it with wait4 and record its resource
+        usage in the global trace
+        """
+        status, rusage, io = _wait_rusage(self.process.pid)
+        end = time.time()
+        if os.WIFSIGNALED(status):
+            self.process.returncode = -os.WTERMSIG(status)
+        else:
+            self.process.returncode = os.WEXITSTATUS(status)
+        self.stats = ProcessStats(str(self).split("/")[-1], self.wrapper.name, self.sample,
+                                  self.process.pid, self.start_time, end, rusage, io)
+        _resource_trace.add(self.stats)
+        return self.process.returncode
+
     def to_bash(self):
         """Returns the bash command representation
         """
@@ -383,6 +591,8 @@ def _prepare_input(input):
         return open(input, 'rb')
     if isinstance(input, file):
         return input
+    if input == subprocess.PIPE:
+        return input
     return None
 
 
@@ -440,6 +650,266 @@ def run_tool(tool, **kwargs):
     """
     return run_tools([tool], **kwargs)
 
+
+_tool_versions = {}
+
+def tool_version(tool):
+    """Version of an htslib style tool (samtools, bcftools) as a tuple of
+    integers, taken from the first line of 'tool --version'. The result is
+    cached. Returns None if the tool can not be run or the version not parsed.
+
+    tool -- name or path of the executable
+    """
+    if tool not in _tool_versions:
+        version = None
+        try:
+            process = subprocess.Popen([tool, "--version"], stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+            out = process.communicate()[0]
+            words = out.split("\n")[0].split()
+            if len(words) > 1:
+                fields = []
+                for field in words[1].split("."):
+                    digits = ""
+                    for c in field:
+                        if not c.isdigit():
+                            break
+                        digits += c
+                    if not digits:
+                        break
+                    fields.append(int(digits))
+                if fields:
+                    version = tuple(fields)
+        except OSError:
+            pass
+        _tool_versions[tool] = version
+    return _tool_versions[tool]
+
+class StreamOutput(object):
+    """Named pipe that a tool writes its output to instead of the final file.
+    A reader thread copies the stream to the final file and computes the md5
+    checksum on the fly, so the output is written once and never read back.
+
+    Use as a context manager and pass the fifo attribute as output path
+    to the tool. The md5 file is written in md5sum format on success.
+    """
+
+    def __init__(self, output, md5_file=None, buffer_size=4 * 1024 * 1024):
+        """Create the fifo for the given output file
+
+        output      -- path to the final output file
+        md5_file    -- optional path to write the md5 checksum to
+        buffer_size -- size of the copy buffer
+        """
+        self.output = output
+        self.md5_file = md5_file
+        self.buffer_size = buffer_size
+        self.tmp_dir = tempfile.mkdtemp(prefix="gemBS_stream.", dir=os.path.dirname(os.path.abspath(output)))
+        self.fifo = os.path.join(self.tmp_dir, os.path.basename(output))
+        os.mkfifo(self.fifo)
+        self.md5 = hashlib.md5()
+        self.opened = threading.Event()
+        self.error = None
+        self.thread = threading.Thread(target=self.__copy, name="StreamOutput")
+        self.thread.daemon = True
+        self.thread.start()
+
+    def __copy(self):
+        try:
+            with open(self.fifo, "rb") as fin:
+                self.opened.set()
+                with open(self.output, "wb") as fout:
+                    while True:
+                        buf = fin.read(self.buffer_size)
+                        if not buf:
+                            break
+                        self.md5.update(buf)
+                        fout.write(buf)
+        except Exception, e:
+            self.error = e
+        finally:
+            self.opened.set()
+
+    def hexdigest(self):
+        return self.md5.hexdigest()
+
+    def close(self):
+        """Wait for the stream to finish and write the md5 file. If the writer
+        never opened the fifo, the reader is released with an empty stream.
+        """
+        while not self.opened.is_set():
+            try:
+                fd = os.open(self.fifo, os.O_WRONLY | os.O_NONBLOCK)
+                os.close(fd)
+                break
+            except OSError, e:
+                # ENXIO until the reader thread is waiting on the fifo
+                if e.errno != errno.ENXIO:
+                    raise
+                time.sleep(0.01)
+        self.thread.join()
+        shutil.rmtree(self.tmp_dir, ignore_errors=True)
+        if self.error is not None:
+            raise ProcessError("Error while writing %s: %s" % (self.output, str(self.error)))
+        if self.md5_file is not None:
+            with open(self.md5_file, "w") as f:
+                f.write("%s  %s\n" % (self.hexdigest(), self.output))
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, exc_type, exc_value, tb):
+        if exc_type is None:
+            self.close()
+        else:
+            self.md5_file = None
+            try:
+                self.close()
+            except ProcessError:
+                pass
+        return False
+
+
+def write_md5(path, md5_file, buffer_size=4 * 1024 * 1024):
+    """Compute the md5 checksum of an existing file and write it to md5_file
+    in md5sum format, the same as StreamOutput does for streamed outputs.
+
+    path        -- file to checksum
+    md5_file    -- path of the md5 file to write
+    buffer_size -- size of the read buffer
+    """
+    md5 = hashlib.md5()
+    with open(path, "rb") as fin:
+        while True:
+            buf = fin.read(buffer_size)
+            if not buf:
+                break
+            md5.update(buf)
+    with open(md5_file, "w") as f:
+        f.write("%s  %s\n" % (md5.hexdigest(), path))
+
+
+# awk program that splits the SAM output of a multi region samtools view by
+# contig. Contig i of the space separated contigs variable goes to the fifo
+# dir/i.sam, preceded by the header; contigs without reads get the header only
+_SPLIT_SAM = r"""
+function next_out(  k) { out = dir "/" i ".sam"; for (k = 1; k <= nh; k++) print h[k] > out }
+BEGIN { FS = "\t"; n = split(contigs, c, " "); i = 0 }
+!body && /^@/ { h[++nh] = $0; next }
+$3 != cur {
+    body = 1
+    if (i) close(out)
+    while (c[++i] != $3) {
+        if (i > n) { print "unexpected contig " $3 > "/dev/stderr"; err = 1; exit 1 }
+        next_out(); close(out)
+    }
+    next_out(); cur = $3
+}
+{ print > out }
+END {
+    if (err) exit 1
+    if (i) close(out)
+    while (++i <= n) { next_out(); close(out) }
+}
+"""
+
+
+class BamRegionReader(object):
+    """Streams several contigs of an indexed, coordinate sorted BAM file through
+    a single samtools view process, so the header and the index are loaded once
+    and the BGZF blocks of the contigs are read sequentially and decompressed
+    with samtools threads.
+
+    The SAM output is split by contig with awk into one fifo per contig, each
+    read by a consumer pipeline started for that contig. Contigs are consumed one
+    after the other; run several readers on disjoint contig sets for parallelism.
+    """
+
+    def __init__(self, input_bam, contigs, consumer, threads=1, name=None):
+        """Create the reader
+
+        input_bam -- indexed BAM file
+        contigs   -- list of contigs to stream, in file order
+        consumer  -- function called with a contig name, returning the list of
+                     tools that read the SAM records of the contig from stdin
+        threads   -- decompression threads of samtools view
+        name      -- optional name for the pipelines
+        """
+        self.input_bam = input_bam
+        self.contigs = contigs
+        self.consumer = consumer
+        self.threads = threads
+        self.name = name
+
+    def __release(self, splitter, fifos, status, done):
+        """Wait for the splitter. If it exits before opening all fifos, release
+        the consumers waiting on them with an empty stream until run() is done
+        """
+        status.append(splitter.wait())
+        # the wrapper stops at the first failed process, the fifos must not be
+        # released while awk may still open them
+        for p in splitter.processes:
+            p.process.wait()
+        while not done.is_set():
+            for fifo in fifos:
+                try:
+                    os.close(os.open(fifo, os.O_WRONLY | os.O_NONBLOCK))
+                except OSError:
+                    # ENXIO if no consumer is waiting on the fifo
+                    pass
+            done.wait(0.01)
+
+    def __unblock(self, fifos):
+        """Release a splitter waiting to open a fifo for a consumer that will
+        never be started; its next write then fails and it stops
+        """
+        for fifo in fifos:
+            try:
+                os.close(os.open(fifo, os.O_RDONLY | os.O_NONBLOCK))
+            except OSError:
+                pass
+
+    def run(self):
+        """Stream all contigs, returns once all consumers finished"""
+        tmp_dir = tempfile.mkdtemp(prefix="gemBS_regions.")
+        fifos = [os.path.join(tmp_dir, "%d.sam" % (i + 1)) for i in range(len(self.contigs))]
+        for fifo in fifos:
+            os.mkfifo(fifo)
+        view = ["samtools", "view", "-h", "-@", str(self.threads), self.input_bam]
+        view.extend(self.contigs)
+        split = ["awk", "-v", "dir=%s" % tmp_dir, "-v", "contigs=%s" % " ".join(self.contigs), _SPLIT_SAM]
+        splitter = run_tools([view, split], name=self.name)
+        # awk has the read end of the samtools pipe, without the copy here samtools
+        # would block instead of failing if awk stops early
+        splitter.processes[0].process.stdout.close()
+        status = []
+        done = threading.Event()
+        release = threading.Thread(target=self.__release, args=(splitter, fifos, status, done), name="BamRegionReader")
+        release.daemon = True
+        release.start()
+
+        completed = False
+        try:
+            for contig, fifo in zip(self.contigs, fifos):
+                # the fifo is closed here once the consumer has it, so the splitter
+                # gets a broken pipe if the consumer dies
+                with open(fifo, "rb") as fin:
+                    process = run_tools(self.consumer(contig), input=fin, name=self.name)
+                if process.wait() != 0:
+                    raise ProcessError("Consumer of contig %s failed" % contig)
+            completed = True
+        finally:
+            done.set()
+            if not completed:
+                while release.is_alive():
+                    self.__unblock(fifos)
+                    release.join(0.01)
+            release.join()
+            shutil.rmtree(tmp_dir, ignore_errors=True)
+        if status[0] != 0:
+            raise ProcessError("Error while reading %s" % self.input_bam)
+        return self.contigs
+
+
 def uniqueList(seq):
     """
     Remove duplicates entries in a list
@@ -0,0 +1,51 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stdio.h>
+
+/* Process wide arenas, one per phase of a run */
+#define ARENA_SETUP 0     /* Lives until exit */
+#define ARENA_ITER 1      /* Scratch, reset at the start of every iteration */
+#define ARENA_OUTPUT 2    /* Scratch for writing output, reset after each write */
+#define N_ARENA_PHASES 3
+
+#define ARENA_ALIGN 16
+#define ARENA_BLOCK_SIZE 65536
+
+struct arena_block {
+  struct arena_block *next;
+  size_t size,pos;
+};
+
+struct arena_stats {
+  unsigned long n_alloc;   /* Allocations made */
+  unsigned long n_malloc;  /* Blocks obtained from malloc() */
+  unsigned long n_reset;
+  size_t in_use,peak;      /* Bytes handed out since the last reset, and the maximum */
+  size_t reserved;         /* Bytes currently held in blocks */
+};
+
+struct arena {
+  struct arena *next;      /* List of all arenas, for arena_report() */
+  struct arena_block *cur; /* Block being filled, full blocks follow it */
+  struct arena_block *spare; /* Blocks kept by arena_reset() for reuse */
+  void *last;              /* Last allocation, can be grown in place */
+  size_t block_size;
+  const char *name;
+  struct arena_stats stats;
+};
+
+struct arena *arena_new(const char *,size_t);
+void *arena_alloc(struct arena *,size_t);
+void *arena_calloc(struct arena *,size_t,size_t);
+void *arena_realloc(struct arena *,void *,size_t,size_t);
+char *arena_strdup(struct arena *,const char *);
+void arena_reset(struct arena *);
+void arena_free(struct arena *);
+struct arena *lk_arena(int);
+struct arena *lk_thread_arena(int);
+void lk_arena_reset(int);
+void lk_arena_free_all(void);
+void arena_report(FILE *);
+
+#endif
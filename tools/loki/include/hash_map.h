@@ -0,0 +1,36 @@
+#ifndef _HASH_MAP_H_
+#define _HASH_MAP_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/* Key types for hmap_new() */
+#define HMAP_STRING 0
+#define HMAP_INT 1
+#define HMAP_NOCASE 2  /* HMAP_STRING only: keys compare case insensitively and are stored upper case */
+
+struct hmap_entry {
+  union {
+    char *str;
+    long value;
+  } key;
+  void *data;
+  uint32_t hash;  /* 0 marks an empty slot */
+};
+
+struct hash_map {
+  struct hmap_entry *slot;
+  size_t size,n;          /* size is a power of 2 */
+  int flags;
+  char *keys;             /* Current block of string keys, blocks are chained through their first word */
+  size_t key_pos,key_size;
+};
+
+struct hash_map *hmap_new(const int,size_t);
+void *hmap_find(const struct hash_map *,const void *);
+struct hmap_entry *hmap_insert(struct hash_map *,const void *,int *);
+struct hmap_entry **hmap_sorted(const struct hash_map *);
+void hmap_traverse(const struct hash_map *,void (*)(struct hmap_entry *,void *),void *);
+void hmap_free(struct hash_map *,void (*)(void *));
+
+#endif
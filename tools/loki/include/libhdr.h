@@ -15,6 +15,12 @@ int child_open(const int,const char *,const char *);
 int child_open1(const int,const char *,const char *,const char *);
 int child_open_rw(int [2],const char *,char *const argv[]);
 FILE *_open_readfile(const char *,int *,const struct lk_compress *,int);
+int codec_available(const int);
+int codec_type(const char *);
+void set_codec_threads(int);
+FILE *codec_open(const int,const char *,const int);
+FILE *filter_open(const int,const char *,const char *);
+FILE *compress_open(const int,const char *,const int,const struct lk_compress *);
 #define open_readfile_and_check(a,b,c) _open_readfile((a),(b),(c),1);
 #define open_readfile(a,b,c) _open_readfile((a),(b),(c),0);
 int getseed(const char *);
@@ -0,0 +1,48 @@
+#ifndef _LINE_READER_H_
+#define _LINE_READER_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+/* Flags for lr_open() */
+#define LR_SYNC 1  /* Never read ahead of the returned line, so the FILE can still be used directly */
+#define LR_CSTR 2  /* NUL terminate returned lines (in place, so mapped files are copied on write) */
+
+#define LR_BUF_SIZE (1<<21)
+
+#define LR_MODE_MMAP 0
+#define LR_MODE_STREAM 1
+#define LR_MODE_SYNC 2
+
+struct lr_chunk {
+  char *buf;
+  size_t n;
+  int full,eof;
+};
+
+struct line_reader {
+  FILE *fptr;
+  int mode,flags;
+  char *ptr,*end;      /* Unread part of the current window */
+  int eof;             /* No more windows after this one */
+  int skip_lf;         /* Last line ended in \r at the end of a window */
+  int term;            /* Terminator of the last line returned, 0 if none */
+  char *map;           /* LR_MODE_MMAP */
+  size_t map_size;
+  char *lbuf;          /* LR_MODE_SYNC: getdelim() buffer */
+  size_t lsize;
+  char *spill;         /* Lines spanning windows are gathered here */
+  size_t spill_len,spill_size;
+  struct lr_chunk chunk[2]; /* LR_MODE_STREAM: double buffered read ahead */
+  int cur,quit;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+};
+
+struct line_reader *lr_open(FILE *,int);
+char *lr_getline(struct line_reader *,size_t *);
+char *lr_getdelim(struct line_reader *,size_t *,int);
+void lr_close(struct line_reader *);
+
+#endif
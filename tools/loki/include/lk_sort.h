@@ -0,0 +1,17 @@
+#ifndef _LK_SORT_H_
+#define _LK_SORT_H_
+
+#include <stddef.h>
+
+#define LK_SORT_DESCEND 1
+
+#define LK_SORT_SMALL 32           /* Insertion sort at or below this size */
+#define LK_SORT_PAR_MIN 262144     /* Elements per thread before the sort is split */
+
+void lk_sort_doubles(double *,size_t);
+void lk_sort_ints(int *,size_t);
+void lk_sort_index(int *,size_t,const double *,const int);
+void lk_sort_by_key(void *,size_t,size_t,const double *,const int);
+void set_sort_threads(int);
+
+#endif
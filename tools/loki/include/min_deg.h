@@ -16,7 +16,12 @@ struct pair_wt {
 	double wt;
 };
 
+#define AMD_MIN_SIZE 2000 /* Graphs this size or bigger go to amd_order() */
+
 int *min_deg(int,int *,int *,int *,int);
 int *greedy(int,int *,int *,int *,double *,struct pair_wt *,int,double *);
+int *amd_order(int,int *,int *,int *,double *,struct pair_wt *,double *);
+void set_amd_min_size(int);
+int get_amd_min_size(void);
 
 #endif
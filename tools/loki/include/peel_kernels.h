@@ -0,0 +1,8 @@
+#ifndef _PEEL_KERNELS_H_
+#define _PEEL_KERNELS_H_
+
+void pk_trans_combine(double *,const int *,const int *,const int *,const int *,const double *,const double *,const int,const int);
+void pk_trans_combine_map(double *,const int *,const int *,const int *,const int *,const double *,const double *,
+			  const double *,const double *,const int *,const int *,const int);
+
+#endif
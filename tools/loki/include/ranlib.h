@@ -1,12 +1,62 @@
 #ifndef _RANLIB_H_
 #define _RANLIB_H_
 
+#include <stdio.h>
+
+#define RNG_MT_N 624
+#define RNG_STREAM_LOG2 64 /* Streams start 2^64 draws apart */
+#define RNG_CHAIN_LOG2 96  /* Chains run together start 2^96 draws apart */
+
+/* Parameter dependent setup kept between calls by the generators in ranlib.c */
+struct sgamma_cache {
+	double aa,aaa,s2,s,d,q0,b,si,c;
+};
+
+struct genbet_cache {
+	double olda,oldb,a,b,alpha,beta,gamm,delta,k1,k2;
+};
+
+struct ignbin_cache {
+	double psave,p,q,xnp,ffm,fm,xnpq,p1,xm,xl,xr,c,xll,xlr,p2,p3,p4,qn,r,g;
+	int nsave,m;
+};
+
+struct ignpoi_cache {
+	double muold,muprev,s,d,omega,b1,b2,c3,c2,c1,c0,c,p,q,p0,pp[35];
+	int ll,m,l;
+};
+
+/* State of one random number stream.  The plain functions (genrand(),
+ * gennor()...) use lk_rng; the _r variants take the stream explicitly
+ * so that each thread can have its own */
+struct rng_ctx {
+	unsigned int state[RNG_MT_N];
+	unsigned int out[RNG_MT_N];      /* Tempered words of state, valid if out_ok is set */
+	int left;                        /* Words of state not yet used */
+	int out_ok;
+	int gen_idx,set,shift0;          /* Generator parameter set (see set_mt_idx()) */
+	unsigned int aa,maskB,maskC;
+	struct sgamma_cache gam;
+	struct genbet_cache bet;
+	struct ignbin_cache bin;
+	struct ignpoi_cache poi;
+};
+
+extern struct rng_ctx lk_rng;
+
 /* Prototypes for all user accessible RANLIB routines */
 
 /* #define ranf genrand*/
 #define ranf genrand
 #define safe_ranf safe_genrand
 #define init_ranf sgenrand
+#define ranf_r genrand_r
+#define safe_ranf_r safe_genrand_r
+#define init_ranf_r sgenrand_r
+#define ranf_block genrand_block
+#define safe_ranf_block safe_genrand_block
+#define ranf_block_r genrand_block_r
+#define safe_ranf_block_r safe_genrand_block_r
 
 extern double genrand(void);
 extern unsigned int genint(void);
@@ -14,9 +64,27 @@ extern double safe_genrand(void);
 extern double test_genrand(void);
 extern int set_mt_idx(int);
 extern void sgenrand(unsigned int sd);
+extern double genrand_r(struct rng_ctx *);
+extern unsigned int genint_r(struct rng_ctx *);
+extern double safe_genrand_r(struct rng_ctx *);
+extern int set_mt_idx_r(struct rng_ctx *,int);
+extern void sgenrand_r(struct rng_ctx *,unsigned int);
+extern void genrand_block(double *,int);
+extern void safe_genrand_block(double *,int);
+extern void genrand_block_r(struct rng_ctx *,double *,int);
+extern void safe_genrand_block_r(struct rng_ctx *,double *,int);
+extern int rng_jump(struct rng_ctx *,int);
+extern int rng_init_streams(int);
+extern void rng_drop_streams(void);
+extern int rng_n_streams(void);
+extern struct rng_ctx *rng_stream(int);
+extern int dumpseed_r(FILE *,struct rng_ctx *,const int);
+extern void ranlib_reset_r(struct rng_ctx *);
 double ppnd(double,int *);
 double trunc_normal(const double,const double,const int,int *);
+double trunc_normal_r(struct rng_ctx *,const double,const double,const int,int *);
 void dirichlet(const int,const double *,double *);
+void dirichlet_r(struct rng_ctx *,const int,const double *,double *);
 extern void advnst(int k);
 extern double genbet(const double,const double);
 extern double genchi(const double);
@@ -37,5 +105,25 @@ extern int mltmod(const int,const int,const int);
 extern double sgamma(const double);
 extern double sexpo(void);
 extern double snorm(void);
+extern double genbet_r(struct rng_ctx *,const double,const double);
+extern double genchi_r(struct rng_ctx *,const double);
+extern double genexp_r(struct rng_ctx *,double const);
+extern double genf_r(struct rng_ctx *,const double,const double);
+extern double gengam_r(struct rng_ctx *,const double,const double);
+extern void genmul_r(struct rng_ctx *,const int,const double *,const int,int *);
+extern double gennch_r(struct rng_ctx *,const double,const double);
+extern double gennf_r(struct rng_ctx *,const double,const double,const double);
+extern double gennor_r(struct rng_ctx *,const double,const double);
+extern void genprm_r(struct rng_ctx *,int *,const int);
+extern double genunf_r(struct rng_ctx *,const double,const double);
+extern int ignbin_r(struct rng_ctx *,const int,const double);
+extern int ignnbn_r(struct rng_ctx *,const int,const double);
+extern int ignpoi_r(struct rng_ctx *,const double);
+extern int ignuin_r(struct rng_ctx *,const int,const int);
+extern double sgamma_r(struct rng_ctx *,const double);
+extern double sexpo_r(struct rng_ctx *);
+extern double snorm_r(struct rng_ctx *);
+extern void snorm_block(double *,int);
+extern void snorm_block_r(struct rng_ctx *,double *,int);
 
 #endif
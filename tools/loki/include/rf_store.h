@@ -0,0 +1,27 @@
+#ifndef _RF_STORE_H_
+#define _RF_STORE_H_
+
+#include "lk_long.h"
+
+#define RFS_DENSE_BITS 16  /* Indices of up to this many bits are mapped directly */
+#define RFS_MIN_BITS 10    /* Smallest hash table */
+
+/* Terms of an R-Function being assembled.  The terms are kept in insertion
+ * order in idx[] and p[] until rfs_sort() puts them in index order */
+struct rf_store {
+  lk_ulong *idx,*idx1;
+  double *p,*p1;           /* p1 holds the cumulative sums after rfs_sort() */
+  int n,size;
+  int *slot;               /* Map from index (or hash of index) to term */
+  unsigned int *stamp;     /* A slot is in use if its stamp is gen */
+  unsigned int gen;
+  int bits,map_bits,map_cap,hash_bits,dense;
+};
+
+void rfs_init(struct rf_store *,const int);
+void rfs_add(struct rf_store *,const lk_ulong,const double);
+void rfs_sort(struct rf_store *);
+int rfs_sample(const struct rf_store *,const double,lk_ulong *);
+void rfs_free(struct rf_store *);
+
+#endif
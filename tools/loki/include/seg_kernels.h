@@ -0,0 +1,19 @@
+#ifndef _SEG_KERNELS_H_
+#define _SEG_KERNELS_H_
+
+#include "ranlib.h"
+
+/* Workspace for sampling the segregation indicators of a batch of meioses
+ * (lanes) along a list of loci.  Lane b at locus k is at k*n_lanes+b */
+struct seg_work {
+  int *s;       /* Segregation indicators, <0 if to be sampled */
+  double *p[2]; /* Forward probabilities of indicators 0 and 1 */
+  int n_loci,n_lanes;
+};
+
+void sk_alloc(struct seg_work *,const int,const int);
+void sk_free(struct seg_work *);
+void sk_forward(struct seg_work *,const int,const int,const int,const double *);
+void sk_backward(struct seg_work *,const int,const int,const double *,struct rng_ctx *);
+
+#endif
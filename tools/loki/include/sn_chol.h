@@ -0,0 +1,31 @@
+#ifndef _SN_CHOL_H_
+#define _SN_CHOL_H_
+
+#include <stddef.h>
+
+#define SN_PAR_MIN 64 /* Supernodes needed before the factorization is threaded */
+
+/* Supernodal LDL' factorization of a sparse symmetric matrix.  Columns are
+ * numbered in elimination order.  The columns f..l-1 of supernode J
+ * (f=sn_start[J], l=sn_start[J+1]) share the row structure
+ * rows[row_ptr[J]..row_ptr[J+1]-1], which starts with f..l-1, and are
+ * stored column major at x+x_ptr[J] with D on the diagonal and L below */
+struct sn_chol {
+  int n,n_sn;
+  int *sn_start,*col_sn,*sn_parent;
+  int *row_ptr,*rows;
+  int *upd_ptr,*upd;      /* Supernodes (and where in their rows) updating each supernode */
+  int *sched;             /* Supernodes by height in the supernodal elimination tree */
+  size_t *x_ptr;
+  double *x;
+};
+
+struct sn_chol *sn_analyse(const int,const int *,const int *,int *);
+void sn_free(struct sn_chol *);
+void sn_zero(struct sn_chol *);
+double *sn_entry(const struct sn_chol *,const int,const int);
+int sn_factor(struct sn_chol *,const double,const int);
+void sn_lsolve(const struct sn_chol *,double *,const int,const int);
+void sn_ltsolve(const struct sn_chol *,double *);
+
+#endif
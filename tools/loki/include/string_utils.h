@@ -16,12 +16,12 @@ struct __string_srep {
 #define _fget_bptr void **
 #endif
 
-#define free_fget_buffer(x) (free(*(x)))
 
 typedef struct _sc_string {
 	struct _sc_string *next;
 	struct string_srep *srep;
 	size_t len;
+	void *pool;
 } string;
 
 string *add_to_string(string *,char);
@@ -44,6 +44,7 @@ int string_cmp(string *,string *);
 string *fget_string(FILE *,string *,_fget_bptr);
 string *fget_string_gen(FILE *,string *,_fget_bptr,int);
 void *get_fget_buffer(_fget_bptr,size_t *);
+void free_fget_buffer(_fget_bptr);
 string *strprintf(string *,const char *, ...);
 string *straprintf(string *,const char *, ...);
 string *strputc(const char,string *);
@@ -69,6 +69,11 @@ typedef struct {
   int size;
 } tokens;
 
+/* Offset and length of a token found by scan_tokens() */
+struct tok_span {
+  int start,len;
+};
+
 struct lk_param {
   int analysis;
   int map_function;
@@ -169,6 +174,8 @@ void set_strcmpfunc(int (*)(const char *,const char *));
 void abt(const char *, const int, const char *, ...) _NR_;
 double strtodnum(const char *,double,double,char **);
 long strtolnum(const char *,long,long,char **);
+long lk_strtol(const char *,char **);
+double lk_strtod(const char *,char **);
 char *getcolumn(const tokens *,const int,const char *,char **);
 char *getstrcolumn(const tokens *,const int,const char *,char **);
 double getdnumcolumn(const tokens *,const int,const char *,char **);
@@ -179,6 +186,7 @@ void print_end_time(void);
 int mystrcmp(const char *, const char *);
 void qstrip(char *);
 tokens *tokenize(char *,const int,tokens *);
+int scan_tokens(const char *,const int,struct tok_span **,int *);
 tokens *copy_ntokens(tokens *,int);
 void gen_perm(int *,int);
 void gnu_qsort(void *const,size_t,size_t,int(*)(const void *,const void *));
@@ -0,0 +1,467 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * amd.c:                                                                   *
+ *                                                                          *
+ * Approximate minimum degree ordering on the quotient graph (Amestoy,      *
+ * Davis and Duff, SIAM J. Matrix Anal. Appl. 17, 1996).  An eliminated     *
+ * node becomes an element holding the list of its uneliminated             *
+ * neighbours, so the graph never grows as fill-in is made.  Elements       *
+ * covered by a new element are absorbed into it, nodes with the same       *
+ * neighbours are merged into supervariables and nodes left adjacent to     *
+ * nothing but the new element are eliminated along with the pivot (mass    *
+ * elimination).  Degrees are upper bounds updated from the element lists   *
+ * rather than counted, so a pivot costs time in proportion to the size of  *
+ * the new element rather than to the fill it makes.                        *
+ *                                                                          *
+ * With weights (the log of the number of states of each node, as passed    *
+ * to greedy()), nodes are chosen by the summed weights of their            *
+ * neighbours, found exactly from the quotient graph, instead of by         *
+ * degree, and the cost of the peeling sequence is returned as it is by     *
+ * greedy().                                                                *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <stdio.h>
+#include <limits.h>
+#include <math.h>
+
+#include "lk_malloc.h"
+#include "min_deg.h"
+
+/* elen[] of a node that is no longer a variable */
+#define AMD_ELEMENT -1
+#define AMD_DEAD -2
+
+/* Variables waiting to be eliminated, smallest score first */
+struct amd_heap {
+  int *h,*pos,n;
+  const double *key;
+  const int *deg;
+};
+
+static int heap_less(const struct amd_heap *hp,const int a,const int b)
+{
+  if(hp->key[a]!=hp->key[b]) return hp->key[a]<hp->key[b];
+  if(hp->deg[a]!=hp->deg[b]) return hp->deg[a]<hp->deg[b];
+  return a<b;
+}
+
+static void heap_up(struct amd_heap *hp,int k)
+{
+  int i,k1;
+
+  i=hp->h[k];
+  while(k) {
+    k1=(k-1)>>1;
+    if(!heap_less(hp,i,hp->h[k1])) break;
+    hp->h[k]=hp->h[k1];
+    hp->pos[hp->h[k]]=k;
+    k=k1;
+  }
+  hp->h[k]=i;
+  hp->pos[i]=k;
+}
+
+static void heap_down(struct amd_heap *hp,int k)
+{
+  int i,k1;
+
+  i=hp->h[k];
+  while((k1=2*k+1)<hp->n) {
+    if(k1+1<hp->n && heap_less(hp,hp->h[k1+1],hp->h[k1])) k1++;
+    if(!heap_less(hp,hp->h[k1],i)) break;
+    hp->h[k]=hp->h[k1];
+    hp->pos[hp->h[k]]=k;
+    k=k1;
+  }
+  hp->h[k]=i;
+  hp->pos[i]=k;
+}
+
+static void heap_insert(struct amd_heap *hp,const int i)
+{
+  hp->h[hp->n++]=i;
+  heap_up(hp,hp->n-1);
+}
+
+static void heap_remove(struct amd_heap *hp,const int i)
+{
+  int k,j;
+
+  if((k=hp->pos[i])<0) return;
+  hp->pos[i]=-1;
+  if(k<--hp->n) {
+    j=hp->h[hp->n];
+    hp->h[k]=j;
+    heap_up(hp,k);
+    heap_down(hp,hp->pos[j]);
+  }
+}
+
+/* Move the lists still in use to the start of iw, returning the new end.
+ * The first entry of each list is parked in pe[] and replaced by a marker
+ * so the lists can be found while sweeping iw */
+static int compact(const int n,int *pe,const int *len,const int *elen,int *iw,const int pfree)
+{
+  int i,j,k,p,q;
+
+  for(i=0;i<n;i++) if(elen[i]!=AMD_DEAD && len[i]) {
+      p=pe[i];
+      pe[i]=iw[p];
+      iw[p]=-2-i;
+    }
+  for(p=q=0;p<pfree;p++) if(iw[p]<0) {
+      i=-2-iw[p];
+      j=pe[i];
+      pe[i]=q;
+      iw[q++]=j;
+      for(k=1;k<len[i];k++) iw[q++]=iw[++p];
+    }
+  return q;
+}
+
+/* Advance the marker for w[], resetting w[] if it would overflow */
+static int next_flag(int wflg,const int step,int *w,const int n)
+{
+  int k;
+
+  if(wflg<INT_MAX-2*step) return wflg+step;
+  for(k=0;k<n;k++) if(w[k]) w[k]=1;
+  return 2;
+}
+
+/* Log size of the function over the nodes in lst, all marked with stamp
+ * in mk[], with a pair of nodes that are both present counted once by
+ * its pair weight */
+static double set_weight(const int *lst,const int k,const int *mk,const int stamp,const double *wt,const struct pair_wt *wt1)
+{
+  int j,x;
+  double z=0.0;
+
+  for(j=0;j<k;j++) {
+    x=wt1?wt1[lst[j]].pair_node:-1;
+    if(x>=0 && mk[x]==stamp) {
+      if(lst[j]<x) z+=wt1[lst[j]].wt;
+    } else z+=wt[lst[j]];
+  }
+  return z;
+}
+
+/* Score supervariable i by the weight of its neighbours, the nodes of
+ * the supervariables it shares an element with or is adjacent to.  If
+ * i has one neighbour or all its neighbours are in one element then its
+ * elimination joins nothing up and cannot make anything else worse, so
+ * it is taken first.  The log size of the function made by eliminating
+ * i goes in *lsize */
+static double var_score(const int i,const int *iw,const int *pe,const int *len,const int *elen,const int *nv,const int *mnext,int *mk,int *lst,const int stamp,const double *wt,const struct pair_wt *wt1,double *lsize)
+{
+  int j,k=0,k1,p,q,q1,x;
+  double z;
+
+  for(p=pe[i];p<pe[i]+len[i];p++) {
+    if(p<pe[i]+elen[i]) {
+      q=pe[iw[p]];
+      q1=q+len[iw[p]];
+    } else {
+      q=p;
+      q1=p+1;
+    }
+    for(;q<q1;q++) {
+      j=iw[q];
+      if(j!=i && nv[j] && mk[j]!=stamp) for(x=j;x>=0;x=mnext[x]) {
+	  lst[k++]=x;
+	  mk[x]=stamp;
+	}
+    }
+  }
+  z=set_weight(lst,k,mk,stamp,wt,wt1);
+  k1=k;
+  for(x=i;x>=0;x=mnext[x]) {
+    lst[k++]=x;
+    mk[x]=stamp;
+  }
+  *lsize=set_weight(lst,k,mk,stamp,wt,wt1);
+  return (k1<=1 || (elen[i]==1 && len[i]==1))?-1.0:z;
+}
+
+/* Order the n nodes of the graph mm (in the form taken by min_deg()).
+ * order gets the elimination order; if group is set, group[i] is 1 for
+ * a pivot and 0 for nodes eliminated with the pivot before them.  If wt
+ * is set, nodes are chosen by the exact log size of the function their
+ * elimination makes (with wt1 giving the weights of node pairs) and, if
+ * cost is also set, the cost of the sequence is added to *cost */
+int *amd_order(int n,int *mm,int *order,int *group,double *wt,struct pair_wt *wt1,double *cost)
+{
+  int i,j,k,e,p,q,p1,p2,p3,pn,nz,iwlen,pfree,pme,pme1,me,ln,eln,elenme,ct=0;
+  int nel=0,nvi,nvj,nvpiv,degme,deg,dext,we,wnvi,wflg,jlast,ok,stamp=0;
+  int *iw,*pe,*len,*elen,*nv,*w,*degree,*hhead,*hnext,*hkey,*mnext,*mtail,*mk,*lst;
+  unsigned int h;
+  double *score,*lsize;
+  struct amd_heap heap;
+
+  if(n<1 || !mm) return 0;
+  pe=lk_malloc(sizeof(int)*n*15);
+  len=pe+n;
+  elen=len+n;
+  nv=elen+n;
+  w=nv+n;
+  degree=w+n;
+  hhead=degree+n;
+  hnext=hhead+n;
+  hkey=hnext+n;
+  mnext=hkey+n;
+  mtail=mnext+n;
+  mk=mtail+n;
+  lst=mk+n;
+  heap.h=lst+n;
+  heap.pos=heap.h+n;
+  score=lk_malloc(sizeof(double)*n*2);
+  lsize=score+n;
+  /* Make the graph symmetric, without self loops or repeated edges */
+  for(i=0;i<n;i++) len[i]=w[i]=0;
+  for(nz=i=0;i<n;i++) for(p=mm[i];p<mm[i+1];p++) if((k=mm[p])!=i) {
+	len[i]++;
+	len[k]++;
+	nz+=2;
+      }
+  iwlen=nz+nz/5+2*n;
+  iw=lk_malloc(sizeof(int)*iwlen);
+  for(p=i=0;i<n;i++) {
+    pe[i]=p;
+    p+=len[i];
+    len[i]=0;
+  }
+  for(i=0;i<n;i++) for(p=mm[i];p<mm[i+1];p++) if((k=mm[p])!=i) {
+	iw[pe[i]+len[i]++]=k;
+	iw[pe[k]+len[k]++]=i;
+      }
+  for(pfree=i=0;i<n;i++) {
+    p=pe[i];
+    pe[i]=pfree;
+    for(q=p;q<p+len[i];q++) {
+      k=iw[q];
+      if(w[k]!=i+1) {
+	w[k]=i+1;
+	iw[pfree++]=k;
+      }
+    }
+    len[i]=pfree-pe[i];
+  }
+  for(i=0;i<n;i++) {
+    w[i]=1;
+    nv[i]=1;
+    elen[i]=0;
+    degree[i]=len[i];
+    hhead[i]=-1;
+    mnext[i]=-1;
+    mtail[i]=i;
+    mk[i]=0;
+  }
+  heap.n=0;
+  heap.key=score;
+  heap.deg=degree;
+  for(i=0;i<n;i++) {
+    if(wt) {
+      score[i]=var_score(i,iw,pe,len,elen,nv,mnext,mk,lst,++stamp,wt,wt1,lsize+i);
+    } else score[i]=(double)degree[i];
+    heap_insert(&heap,i);
+  }
+  wflg=2;
+  while(nel<n) {
+    /* Make sure there is room to build the new element at the end of iw */
+    if(iwlen-pfree<n-nel) {
+      pfree=compact(n,pe,len,elen,iw,pfree);
+      if(iwlen-pfree<n-nel) {
+	iwlen=pfree+n+iwlen/2;
+	iw=lk_realloc(iw,sizeof(int)*iwlen);
+      }
+    }
+    me=heap.h[0];
+    heap_remove(&heap,me);
+    if(wt && cost) *cost+=exp(lsize[me]);
+    elenme=elen[me];
+    nvpiv=nv[me];
+    nel+=nvpiv;
+    /* The new element is the union of the variables adjacent to me and
+     * of the elements adjacent to me, which are absorbed into it */
+    nv[me]=-nvpiv;
+    degme=0;
+    pme1=pfree;
+    p=pe[me];
+    for(k=0;k<=elenme;k++) {
+      if(k<elenme) {
+	e=iw[p++];
+	p1=pe[e];
+	ln=len[e];
+      } else {
+	e=me;
+	p1=p;
+	ln=len[me]-elenme;
+      }
+      for(q=p1;q<p1+ln;q++) {
+	i=iw[q];
+	if((nvi=nv[i])<=0) continue;
+	degme+=nvi;
+	nv[i]=-nvi;
+	iw[pfree++]=i;
+	heap_remove(&heap,i);
+      }
+      if(e!=me) {
+	pe[e]=-1;
+	elen[e]=AMD_DEAD;
+	w[e]=0;
+      }
+    }
+    pe[me]=pme1;
+    len[me]=pfree-pme1;
+    elen[me]=AMD_ELEMENT;
+    /* |Le\Lme| for the other elements adjacent to Lme, in w[e]-wflg */
+    for(pme=pme1;pme<pme1+len[me];pme++) {
+      i=iw[pme];
+      if(!(eln=elen[i])) continue;
+      nvi=-nv[i];
+      wnvi=wflg-nvi;
+      for(p=pe[i];p<pe[i]+eln;p++) {
+	e=iw[p];
+	if((we=w[e])>=wflg) we-=nvi;
+	else if(we) we=degree[e]+wnvi;
+	w[e]=we;
+      }
+    }
+    /* Degree update.  Elements lying inside Lme are absorbed, variables
+     * adjacent to nothing but me go with the pivot and me is put at the
+     * head of the element list of the rest */
+    for(pme=pme1;pme<pme1+len[me];pme++) {
+      i=iw[pme];
+      p1=pe[i];
+      p2=p1+elen[i];
+      pn=p1;
+      deg=0;
+      h=0;
+      for(p=p1;p<p2;p++) {
+	e=iw[p];
+	if(!w[e]) continue;
+	if((dext=w[e]-wflg)>0) {
+	  deg+=dext;
+	  iw[pn++]=e;
+	  h+=(unsigned int)e;
+	} else {
+	  pe[e]=-1;
+	  elen[e]=AMD_DEAD;
+	  w[e]=0;
+	}
+      }
+      elen[i]=pn-p1+1;
+      p3=pn;
+      for(p=p2;p<p1+len[i];p++) {
+	j=iw[p];
+	if((nvj=nv[j])<=0) continue;
+	deg+=nvj;
+	iw[pn++]=j;
+	h+=(unsigned int)j;
+      }
+      if(elen[i]==1 && p3==pn) {
+	nvi=-nv[i];
+	degme-=nvi;
+	nvpiv+=nvi;
+	nel+=nvi;
+	nv[i]=0;
+	pe[i]=-1;
+	elen[i]=AMD_DEAD;
+	mnext[mtail[me]]=i;
+	mtail[me]=mtail[i];
+      } else {
+	if(deg<degree[i]) degree[i]=deg;
+	iw[pn]=iw[p3];
+	iw[p3]=iw[p1];
+	iw[p1]=me;
+	len[i]=pn-p1+1;
+	hkey[i]=(int)(h%(unsigned int)n);
+	hnext[i]=hhead[hkey[i]];
+	hhead[hkey[i]]=i;
+      }
+    }
+    degree[me]=degme;
+    wflg=next_flag(wflg,n+1,w,n);
+    /* Merge variables of Lme with the same lists into supervariables */
+    for(pme=pme1;pme<pme1+len[me];pme++) {
+      i=iw[pme];
+      if(nv[i]>=0 || hhead[hkey[i]]<0) continue;
+      k=hhead[hkey[i]];
+      hhead[hkey[i]]=-1;
+      for(i=k;i>=0;i=hnext[i]) {
+	ln=len[i];
+	eln=elen[i];
+	for(p=pe[i]+1;p<pe[i]+ln;p++) w[iw[p]]=wflg;
+	jlast=i;
+	for(j=hnext[i];j>=0;) {
+	  ok=(len[j]==ln && elen[j]==eln);
+	  for(p=pe[j]+1;ok && p<pe[j]+ln;p++) if(w[iw[p]]!=wflg) ok=0;
+	  if(ok) {
+	    nv[i]+=nv[j];
+	    nv[j]=0;
+	    pe[j]=-1;
+	    elen[j]=AMD_DEAD;
+	    mnext[mtail[i]]=j;
+	    mtail[i]=mtail[j];
+	    j=hnext[j];
+	    hnext[jlast]=j;
+	  } else {
+	    jlast=j;
+	    j=hnext[j];
+	  }
+	}
+	wflg=next_flag(wflg,1,w,n);
+      }
+    }
+    /* Finish the degrees of Lme, dropping the variables merged above */
+    for(p=pme=pme1;pme<pme1+len[me];pme++) {
+      i=iw[pme];
+      if((nvi=-nv[i])<=0) continue;
+      nv[i]=nvi;
+      deg=degree[i]+degme-nvi;
+      if(deg>n-nel-nvi) deg=n-nel-nvi;
+      degree[i]=deg;
+      iw[p++]=i;
+    }
+    nv[me]=nvpiv;
+    len[me]=p-pme1;
+    pfree=p;
+    /* and put them back on the heap */
+    for(pme=pme1;pme<pfree;pme++) {
+      i=iw[pme];
+      if(wt) {
+	if(stamp==INT_MAX) {
+	  for(k=0;k<n;k++) mk[k]=0;
+	  stamp=0;
+	}
+	score[i]=var_score(i,iw,pe,len,elen,nv,mnext,mk,lst,++stamp,wt,wt1,lsize+i);
+      } else score[i]=(double)degree[i];
+      heap_insert(&heap,i);
+    }
+    if(!len[me]) {
+      pe[me]=-1;
+      elen[me]=AMD_DEAD;
+      w[me]=0;
+    }
+    /* The pivot and everything eliminated with it */
+    for(i=me;i>=0;i=mnext[i]) {
+      if(group) group[ct]=(i==me);
+      order[ct++]=i;
+    }
+  }
+  free(iw);
+  free(score);
+  free(pe);
+  return order;
+}
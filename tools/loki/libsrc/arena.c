@@ -0,0 +1,264 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * arena.c:                                                                 *
+ *                                                                          *
+ * Region allocator.  Memory is handed out from large blocks by bumping a   *
+ * pointer and is only given back all at once, by arena_reset() (blocks    *
+ * are kept for reuse) or arena_free().  This replaces keeping lists of     *
+ * every allocation just so they can be freed at the end.                   *
+ *                                                                          *
+ * lk_arena() gives the process wide arena for a phase of the run (setup,   *
+ * per iteration scratch, output); these must only be used from one        *
+ * thread.  lk_thread_arena() gives a private arena of the calling thread,  *
+ * freed when the thread exits.                                             *
+ *                                                                          *
+ * Setting LOKI_ARENA_STATS in the environment prints allocation counts    *
+ * for every arena when lk_arena_free_all() is called.                      *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <stdio.h>
+#include <pthread.h>
+
+#include "lk_malloc.h"
+#include "arena.h"
+
+#define ARENA_HDR ((sizeof(struct arena_block)+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1))
+#define ARENA_ROUND(x) (((x)+ARENA_ALIGN-1)&~(size_t)(ARENA_ALIGN-1))
+#define BLOCK_DATA(b) ((char *)(b)+ARENA_HDR)
+
+static struct arena *arena_list;
+static pthread_mutex_t arena_list_lock=PTHREAD_MUTEX_INITIALIZER;
+static struct arena *phase_arena[N_ARENA_PHASES];
+static const char *phase_name[N_ARENA_PHASES]={"setup","iteration","output"};
+static pthread_key_t thread_key;
+static pthread_once_t thread_once=PTHREAD_ONCE_INIT;
+
+struct arena *arena_new(const char *name,size_t block_size)
+{
+  struct arena *a;
+
+  a=lk_calloc((size_t)1,sizeof(struct arena));
+  a->name=name;
+  a->block_size=block_size?ARENA_ROUND(block_size):ARENA_BLOCK_SIZE;
+  pthread_mutex_lock(&arena_list_lock);
+  a->next=arena_list;
+  arena_list=a;
+  pthread_mutex_unlock(&arena_list_lock);
+  return a;
+}
+
+static struct arena_block *new_block(struct arena *a,size_t size)
+{
+  struct arena_block *b;
+
+  a->stats.n_malloc++;
+  a->stats.reserved+=size;
+  b=lk_malloc(ARENA_HDR+size);
+  b->size=size;
+  b->pos=0;
+  return b;
+}
+
+void *arena_alloc(struct arena *a,size_t size)
+{
+  struct arena_block *b;
+  void *p;
+
+  size=size?ARENA_ROUND(size):ARENA_ALIGN;
+  b=a->cur;
+  if(!b || b->pos+size>b->size) {
+    if(size>(a->block_size>>2)) {
+      /* Large requests get a block of their own, kept behind the current one */
+      b=new_block(a,size);
+      if(a->cur) {
+	b->next=a->cur->next;
+	a->cur->next=b;
+      } else {
+	b->next=0;
+	a->cur=b;
+      }
+    } else {
+      if((b=a->spare)) a->spare=b->next;
+      else b=new_block(a,a->block_size);
+      b->next=a->cur;
+      a->cur=b;
+    }
+  }
+  p=BLOCK_DATA(b)+b->pos;
+  b->pos+=size;
+  a->last=p;
+  a->stats.n_alloc++;
+  a->stats.in_use+=size;
+  if(a->stats.in_use>a->stats.peak) a->stats.peak=a->stats.in_use;
+  return p;
+}
+
+void *arena_calloc(struct arena *a,size_t n,size_t size)
+{
+  void *p;
+
+  p=arena_alloc(a,n*size);
+  memset(p,0,n*size);
+  return p;
+}
+
+/* Resize p (old_size bytes, from a).  The last allocation is grown in place
+ * if it fits, anything else is copied and the old space is lost until reset */
+void *arena_realloc(struct arena *a,void *p,size_t old_size,size_t size)
+{
+  struct arena_block *b=a->cur;
+  size_t n,n1;
+  void *p1;
+
+  if(!p) return arena_alloc(a,size);
+  n=old_size?ARENA_ROUND(old_size):ARENA_ALIGN;
+  n1=size?ARENA_ROUND(size):ARENA_ALIGN;
+  if(p==a->last && b && (char *)p+n==BLOCK_DATA(b)+b->pos && b->pos-n+n1<=b->size) {
+    b->pos=b->pos-n+n1;
+    a->stats.in_use=a->stats.in_use-n+n1;
+    if(a->stats.in_use>a->stats.peak) a->stats.peak=a->stats.in_use;
+    return p;
+  }
+  p1=arena_alloc(a,size);
+  memcpy(p1,p,old_size<size?old_size:size);
+  return p1;
+}
+
+char *arena_strdup(struct arena *a,const char *s)
+{
+  size_t n;
+  char *p;
+
+  n=strlen(s)+1;
+  p=arena_alloc(a,n);
+  memcpy(p,s,n);
+  return p;
+}
+
+/* Release everything allocated from a.  Standard sized blocks are kept */
+void arena_reset(struct arena *a)
+{
+  struct arena_block *b,*b1;
+
+  for(b=a->cur;b;b=b1) {
+    b1=b->next;
+    if(b->size==a->block_size) {
+      b->pos=0;
+      b->next=a->spare;
+      a->spare=b;
+    } else {
+      a->stats.reserved-=b->size;
+      free(b);
+    }
+  }
+  a->cur=0;
+  a->last=0;
+  a->stats.in_use=0;
+  a->stats.n_reset++;
+}
+
+static void free_blocks(struct arena_block *b)
+{
+  struct arena_block *b1;
+
+  for(;b;b=b1) {
+    b1=b->next;
+    free(b);
+  }
+}
+
+void arena_free(struct arena *a)
+{
+  struct arena **ap;
+
+  if(!a) return;
+  pthread_mutex_lock(&arena_list_lock);
+  for(ap=&arena_list;*ap;ap=&(*ap)->next) if(*ap==a) {
+    *ap=a->next;
+    break;
+  }
+  pthread_mutex_unlock(&arena_list_lock);
+  free_blocks(a->cur);
+  free_blocks(a->spare);
+  free(a);
+}
+
+struct arena *lk_arena(int phase)
+{
+  if(!phase_arena[phase]) phase_arena[phase]=arena_new(phase_name[phase],phase==ARENA_SETUP?4*ARENA_BLOCK_SIZE:ARENA_BLOCK_SIZE);
+  return phase_arena[phase];
+}
+
+void lk_arena_reset(int phase)
+{
+  if(phase_arena[phase]) arena_reset(phase_arena[phase]);
+}
+
+static void free_thread_arenas(void *p)
+{
+  struct arena **ta=p;
+  int i;
+
+  for(i=0;i<N_ARENA_PHASES;i++) arena_free(ta[i]);
+  free(ta);
+}
+
+static void init_thread_key(void)
+{
+  (void)pthread_key_create(&thread_key,free_thread_arenas);
+}
+
+struct arena *lk_thread_arena(int phase)
+{
+  struct arena **ta;
+
+  (void)pthread_once(&thread_once,init_thread_key);
+  if(!(ta=pthread_getspecific(thread_key))) {
+    ta=lk_calloc((size_t)N_ARENA_PHASES,sizeof(struct arena *));
+    (void)pthread_setspecific(thread_key,ta);
+  }
+  if(!ta[phase]) ta[phase]=arena_new(phase_name[phase],0);
+  return ta[phase];
+}
+
+void arena_report(FILE *fptr)
+{
+  struct arena *a;
+
+  pthread_mutex_lock(&arena_list_lock);
+  (void)fprintf(fptr,"%-16s %12s %10s %8s %12s %12s\n","arena","allocations","mallocs","resets","peak bytes","reserved");
+  for(a=arena_list;a;a=a->next)
+    (void)fprintf(fptr,"%-16s %12lu %10lu %8lu %12lu %12lu\n",a->name?a->name:"",a->stats.n_alloc,a->stats.n_malloc,
+		  a->stats.n_reset,(unsigned long)a->stats.peak,(unsigned long)a->stats.reserved);
+  pthread_mutex_unlock(&arena_list_lock);
+}
+
+/* Free the phase arenas and the calling thread's arenas */
+void lk_arena_free_all(void)
+{
+  struct arena **ta;
+  int i;
+
+  if(getenv("LOKI_ARENA_STATS")) arena_report(stderr);
+  for(i=0;i<N_ARENA_PHASES;i++) {
+    arena_free(phase_arena[i]);
+    phase_arena[i]=0;
+  }
+  (void)pthread_once(&thread_once,init_thread_key);
+  if((ta=pthread_getspecific(thread_key))) {
+    (void)pthread_setspecific(thread_key,0);
+    free_thread_arenas(ta);
+  }
+}
@@ -0,0 +1,597 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * codec_stream.c:                                                          *
+ *                                                                          *
+ * In process gzip and bzip2 streams behind an ordinary FILE *, so          *
+ * compressed files are read and written without forking a filter program. *
+ *                                                                          *
+ * gzip output is written as BGZF: a series of gzip members holding up to   *
+ * 64K of input each, which any gzip reader accepts.  The members can be    *
+ * compressed in parallel by worker threads (set_codec_threads() or the     *
+ * LOKI_COMPRESS_THREADS environment variable).                             *
+ *                                                                          *
+ * When a codec is not available the old child process filters are used.   *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#define _GNU_SOURCE
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <stdio.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#if HAVE_ZLIB_H && HAVE_LIBZ
+#include <zlib.h>
+#define CODEC_GZIP 1
+#endif
+#if HAVE_BZLIB_H && HAVE_LIBBZ2
+#include <bzlib.h>
+#define CODEC_BZIP2 1
+#endif
+
+#include "utils.h"
+#include "libhdr.h"
+#include "lk_malloc.h"
+#include "loki_compress.h"
+
+#define CODEC_BUF_SIZE 65536
+#define BGZF_BLOCK 65280    /* Input per BGZF member, so the member fits in 64K */
+#define BGZF_MAX 65536
+#define BGZF_HDR 18
+#define BGZF_FTR 8
+
+#define SLOT_FREE 0
+#define SLOT_QUEUED 1
+#define SLOT_BUSY 2
+#define SLOT_DONE 3
+
+static int codec_threads;
+
+void set_codec_threads(int n)
+{
+  codec_threads=n>0?n:1;
+}
+
+static int get_codec_threads(void)
+{
+  char *p;
+
+  if(!codec_threads) {
+    codec_threads=1;
+    if((p=getenv("LOKI_COMPRESS_THREADS"))) set_codec_threads(atoi(p));
+  }
+  return codec_threads;
+}
+
+int codec_available(const int type)
+{
+  switch(type) {
+#ifdef HAVE_FOPENCOOKIE
+#ifdef CODEC_GZIP
+  case COMPRESS_GZIP:
+    return 1;
+#endif
+#ifdef CODEC_BZIP2
+  case COMPRESS_BZIP2:
+    return 1;
+#endif
+#endif
+  default:
+    return 0;
+  }
+}
+
+/* In process codec for a filter program, COMPRESS_NONE if there is none */
+int codec_type(const char *filterprog)
+{
+  int i,type=COMPRESS_NONE;
+  const char *p;
+  static const char *gz[]={"gzip","gunzip","pigz","bgzip",0};
+  static const char *bz[]={"bzip2","bunzip2","pbzip2","lbzip2",0};
+
+  if(!filterprog) return type;
+  if((p=strrchr(filterprog,'/'))) p++;
+  else p=filterprog;
+  for(i=0;gz[i];i++) if(!strcmp(p,gz[i])) type=COMPRESS_GZIP;
+  for(i=0;bz[i];i++) if(!strcmp(p,bz[i])) type=COMPRESS_BZIP2;
+  return codec_available(type)?type:COMPRESS_NONE;
+}
+
+#if defined(HAVE_FOPENCOOKIE) && (defined(CODEC_GZIP) || defined(CODEC_BZIP2))
+
+struct bgzf_slot {
+  char *in,*out;
+  size_t in_len,out_len;
+  int state;
+};
+
+struct codec {
+  FILE *fptr;
+  int type,read_flag,close_fptr;
+  int eof,err,in_member;
+  char *ibuf,*obuf;
+#ifdef CODEC_GZIP
+  z_stream zs;
+  /* BGZF output */
+  struct bgzf_slot *slot;
+  int n_slots,head,tail,n_threads,quit;
+  pthread_t *threads;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+#endif
+#ifdef CODEC_BZIP2
+  bz_stream bs;
+#endif
+};
+
+#ifdef CODEC_GZIP
+static void put_le(unsigned char *p,unsigned long x,int n)
+{
+  while(n--) {
+    *p++=(unsigned char)(x&0xff);
+    x>>=8;
+  }
+}
+
+/* Compress one BGZF member, returns its size or 0 on error */
+static size_t bgzf_compress(const char *in,size_t n,char *out)
+{
+  z_stream zs;
+  size_t clen;
+  static const unsigned char hdr[16]={0x1f,0x8b,8,4,0,0,0,0,0,0xff,6,0,'B','C',2,0};
+
+  memset(&zs,0,sizeof(z_stream));
+  if(deflateInit2(&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,-15,8,Z_DEFAULT_STRATEGY)!=Z_OK) return 0;
+  zs.next_in=(Bytef *)in;
+  zs.avail_in=(uInt)n;
+  zs.next_out=(Bytef *)out+BGZF_HDR;
+  zs.avail_out=BGZF_MAX-BGZF_HDR-BGZF_FTR;
+  if(deflate(&zs,Z_FINISH)!=Z_STREAM_END) {
+    (void)deflateEnd(&zs);
+    return 0;
+  }
+  clen=zs.total_out;
+  (void)deflateEnd(&zs);
+  memcpy(out,hdr,16);
+  put_le((unsigned char *)out+16,(unsigned long)(clen+BGZF_HDR+BGZF_FTR-1),2);
+  put_le((unsigned char *)out+BGZF_HDR+clen,crc32(crc32(0L,Z_NULL,0),(const Bytef *)in,(uInt)n),4);
+  put_le((unsigned char *)out+BGZF_HDR+clen+4,(unsigned long)n,4);
+  return clen+BGZF_HDR+BGZF_FTR;
+}
+
+static void *bgzf_worker(void *arg)
+{
+  struct codec *c=arg;
+  struct bgzf_slot *sl;
+  int i;
+
+  pthread_mutex_lock(&c->lock);
+  for(;;) {
+    sl=0;
+    for(i=0;i<c->n_slots;i++) if(c->slot[i].state==SLOT_QUEUED) {
+      sl=c->slot+i;
+      break;
+    }
+    if(!sl) {
+      if(c->quit) break;
+      pthread_cond_wait(&c->cond,&c->lock);
+      continue;
+    }
+    sl->state=SLOT_BUSY;
+    pthread_mutex_unlock(&c->lock);
+    sl->out_len=bgzf_compress(sl->in,sl->in_len,sl->out);
+    pthread_mutex_lock(&c->lock);
+    sl->state=SLOT_DONE;
+    pthread_cond_broadcast(&c->cond);
+  }
+  pthread_mutex_unlock(&c->lock);
+  return 0;
+}
+
+/* Write out finished members in order until slot k is free (k<0: all of them) */
+static int bgzf_drain(struct codec *c,int k)
+{
+  struct bgzf_slot *sl;
+  int st;
+
+  for(;;) {
+    sl=c->slot+c->tail;
+    if(c->n_threads) pthread_mutex_lock(&c->lock);
+    st=k>=0?c->slot[k].state:sl->state;
+    if(c->n_threads) {
+      if(st!=SLOT_FREE) while(sl->state!=SLOT_DONE) pthread_cond_wait(&c->cond,&c->lock);
+      pthread_mutex_unlock(&c->lock);
+    }
+    if(st==SLOT_FREE) break;
+    if(!sl->out_len || fwrite(sl->out,(size_t)1,sl->out_len,c->fptr)!=sl->out_len) c->err=1;
+    if(c->n_threads) pthread_mutex_lock(&c->lock);
+    sl->state=SLOT_FREE;
+    if(c->n_threads) pthread_mutex_unlock(&c->lock);
+    sl->in_len=0;
+    c->tail=(c->tail+1)%c->n_slots;
+  }
+  return c->err;
+}
+
+static void bgzf_submit(struct codec *c)
+{
+  struct bgzf_slot *sl=c->slot+c->head;
+
+  if(c->n_threads) {
+    pthread_mutex_lock(&c->lock);
+    sl->state=SLOT_QUEUED;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+  } else {
+    sl->out_len=bgzf_compress(sl->in,sl->in_len,sl->out);
+    sl->state=SLOT_DONE;
+  }
+  c->head=(c->head+1)%c->n_slots;
+  (void)bgzf_drain(c,c->head);
+}
+
+static int gz_write_init(struct codec *c)
+{
+  int i,nt;
+
+  nt=get_codec_threads();
+  c->n_slots=nt>1?2*nt:1;
+  c->slot=lk_calloc((size_t)c->n_slots,sizeof(struct bgzf_slot));
+  for(i=0;i<c->n_slots;i++) {
+    c->slot[i].in=lk_malloc((size_t)BGZF_BLOCK);
+    c->slot[i].out=lk_malloc((size_t)BGZF_MAX);
+  }
+  if(nt>1) {
+    pthread_mutex_init(&c->lock,0);
+    pthread_cond_init(&c->cond,0);
+    c->threads=lk_malloc(sizeof(pthread_t)*nt);
+    for(i=0;i<nt;i++) if(pthread_create(c->threads+i,0,bgzf_worker,c)) break;
+    c->n_threads=i;
+  }
+  return 0;
+}
+
+static ssize_t gz_write(struct codec *c,const char *buf,size_t size)
+{
+  struct bgzf_slot *sl;
+  size_t n,left=size;
+
+  while(left) {
+    sl=c->slot+c->head;
+    n=BGZF_BLOCK-sl->in_len;
+    if(n>left) n=left;
+    memcpy(sl->in+sl->in_len,buf,n);
+    sl->in_len+=n;
+    buf+=n;
+    left-=n;
+    if(sl->in_len==BGZF_BLOCK) bgzf_submit(c);
+    if(c->err) {
+      errno=EIO;
+      return -1;
+    }
+  }
+  return (ssize_t)size;
+}
+
+static int gz_write_close(struct codec *c)
+{
+  int i;
+  static const unsigned char eof_block[28]={0x1f,0x8b,8,4,0,0,0,0,0,0xff,6,0,'B','C',2,0,0x1b,0,3,0,0,0,0,0,0,0,0,0};
+
+  if(c->slot[c->head].in_len) bgzf_submit(c);
+  (void)bgzf_drain(c,-1);
+  if(fwrite(eof_block,(size_t)1,sizeof(eof_block),c->fptr)!=sizeof(eof_block)) c->err=1;
+  if(c->threads) {
+    pthread_mutex_lock(&c->lock);
+    c->quit=1;
+    pthread_cond_broadcast(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    for(i=0;i<c->n_threads;i++) (void)pthread_join(c->threads[i],0);
+    free(c->threads);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->lock);
+  }
+  for(i=0;i<c->n_slots;i++) {
+    free(c->slot[i].in);
+    free(c->slot[i].out);
+  }
+  free(c->slot);
+  return c->err;
+}
+
+/* Reads single and multi-member gzip files, including BGZF */
+static ssize_t gz_read(struct codec *c,char *buf,size_t size)
+{
+  z_stream *zs=&c->zs;
+  size_t n;
+  int ret;
+
+  zs->next_out=(Bytef *)buf;
+  zs->avail_out=(uInt)size;
+  while(zs->avail_out && !c->eof) {
+    if(!zs->avail_in) {
+      n=fread(c->ibuf,(size_t)1,(size_t)CODEC_BUF_SIZE,c->fptr);
+      if(!n) {
+	c->eof=1;
+	if(c->in_member || ferror(c->fptr)) c->err=1;
+	break;
+      }
+      zs->next_in=(Bytef *)c->ibuf;
+      zs->avail_in=(uInt)n;
+    }
+    c->in_member=1;
+    ret=inflate(zs,Z_NO_FLUSH);
+    if(ret==Z_STREAM_END) {
+      c->in_member=0;
+      (void)inflateReset(zs);
+    } else if(ret!=Z_OK) {
+      c->err=1;
+      break;
+    }
+  }
+  n=size-zs->avail_out;
+  if(!n && c->err) {
+    errno=EIO;
+    return -1;
+  }
+  return (ssize_t)n;
+}
+#endif
+
+#ifdef CODEC_BZIP2
+static ssize_t bz_write(struct codec *c,const char *buf,size_t size)
+{
+  bz_stream *bs=&c->bs;
+  size_t n;
+
+  bs->next_in=(char *)buf;
+  bs->avail_in=(unsigned int)size;
+  while(bs->avail_in) {
+    bs->next_out=c->obuf;
+    bs->avail_out=CODEC_BUF_SIZE;
+    if(BZ2_bzCompress(bs,BZ_RUN)!=BZ_RUN_OK) c->err=1;
+    n=CODEC_BUF_SIZE-bs->avail_out;
+    if(!c->err && n && fwrite(c->obuf,(size_t)1,n,c->fptr)!=n) c->err=1;
+    if(c->err) {
+      errno=EIO;
+      return -1;
+    }
+  }
+  return (ssize_t)size;
+}
+
+static int bz_write_close(struct codec *c)
+{
+  bz_stream *bs=&c->bs;
+  size_t n;
+  int ret;
+
+  bs->avail_in=0;
+  do {
+    bs->next_out=c->obuf;
+    bs->avail_out=CODEC_BUF_SIZE;
+    ret=BZ2_bzCompress(bs,BZ_FINISH);
+    if(ret!=BZ_FINISH_OK && ret!=BZ_STREAM_END) c->err=1;
+    n=CODEC_BUF_SIZE-bs->avail_out;
+    if(n && fwrite(c->obuf,(size_t)1,n,c->fptr)!=n) c->err=1;
+  } while(!c->err && ret!=BZ_STREAM_END);
+  (void)BZ2_bzCompressEnd(bs);
+  return c->err;
+}
+
+/* Reads single and concatenated bzip2 streams */
+static ssize_t bz_read(struct codec *c,char *buf,size_t size)
+{
+  bz_stream *bs=&c->bs;
+  size_t n;
+  int ret;
+
+  bs->next_out=buf;
+  bs->avail_out=(unsigned int)size;
+  while(bs->avail_out && !c->eof) {
+    if(!bs->avail_in) {
+      n=fread(c->ibuf,(size_t)1,(size_t)CODEC_BUF_SIZE,c->fptr);
+      if(!n) {
+	c->eof=1;
+	if(c->in_member || ferror(c->fptr)) c->err=1;
+	break;
+      }
+      bs->next_in=c->ibuf;
+      bs->avail_in=(unsigned int)n;
+    }
+    if(!c->in_member) {
+      if(BZ2_bzDecompressInit(bs,0,0)!=BZ_OK) {
+	c->err=1;
+	break;
+      }
+      c->in_member=1;
+    }
+    ret=BZ2_bzDecompress(bs);
+    if(ret==BZ_STREAM_END) {
+      c->in_member=0;
+      (void)BZ2_bzDecompressEnd(bs);
+    } else if(ret!=BZ_OK) {
+      c->err=1;
+      break;
+    }
+  }
+  n=size-bs->avail_out;
+  if(!n && c->err) {
+    errno=EIO;
+    return -1;
+  }
+  return (ssize_t)n;
+}
+#endif
+
+static ssize_t codec_read(void *cookie,char *buf,size_t size)
+{
+  struct codec *c=cookie;
+
+#ifdef CODEC_GZIP
+  if(c->type==COMPRESS_GZIP) return gz_read(c,buf,size);
+#endif
+#ifdef CODEC_BZIP2
+  if(c->type==COMPRESS_BZIP2) return bz_read(c,buf,size);
+#endif
+  errno=EINVAL;
+  return -1;
+}
+
+static ssize_t codec_write(void *cookie,const char *buf,size_t size)
+{
+  struct codec *c=cookie;
+
+#ifdef CODEC_GZIP
+  if(c->type==COMPRESS_GZIP) return gz_write(c,buf,size);
+#endif
+#ifdef CODEC_BZIP2
+  if(c->type==COMPRESS_BZIP2) return bz_write(c,buf,size);
+#endif
+  errno=EINVAL;
+  return -1;
+}
+
+static int codec_close(void *cookie)
+{
+  struct codec *c=cookie;
+  int err=0;
+
+  if(c->read_flag==READ) {
+#ifdef CODEC_GZIP
+    if(c->type==COMPRESS_GZIP) (void)inflateEnd(&c->zs);
+#endif
+#ifdef CODEC_BZIP2
+    if(c->type==COMPRESS_BZIP2 && c->in_member) (void)BZ2_bzDecompressEnd(&c->bs);
+#endif
+  } else {
+#ifdef CODEC_GZIP
+    if(c->type==COMPRESS_GZIP) err=gz_write_close(c);
+#endif
+#ifdef CODEC_BZIP2
+    if(c->type==COMPRESS_BZIP2) err=bz_write_close(c);
+#endif
+  }
+  if(c->close_fptr) {
+    if(fclose(c->fptr)) err=1;
+  } else if(c->read_flag!=READ && fflush(c->fptr)) err=1;
+  if(c->ibuf) free(c->ibuf);
+  if(c->obuf) free(c->obuf);
+  free(c);
+  return err?EOF:0;
+}
+
+/* Open fname (stdin/stdout if 0) for reading or writing through an in process codec */
+FILE *codec_open(const int read_flag,const char *fname,const int type)
+{
+  struct codec *c;
+  FILE *fptr,*fp;
+  cookie_io_functions_t io;
+  int err=0;
+
+  if(!codec_available(type)) {
+    errno=EINVAL;
+    return 0;
+  }
+  if(fname) {
+    if(!(fptr=fopen(fname,read_flag==READ?"r":"w"))) return 0;
+  } else fptr=read_flag==READ?stdin:stdout;
+  c=lk_calloc((size_t)1,sizeof(struct codec));
+  c->fptr=fptr;
+  c->close_fptr=fname?1:0;
+  c->type=type;
+  c->read_flag=read_flag;
+  if(read_flag==READ) c->ibuf=lk_malloc((size_t)CODEC_BUF_SIZE);
+#ifdef CODEC_GZIP
+  if(type==COMPRESS_GZIP) {
+    if(read_flag==READ) err=(inflateInit2(&c->zs,15+32)!=Z_OK);
+    else err=gz_write_init(c);
+  }
+#endif
+#ifdef CODEC_BZIP2
+  if(type==COMPRESS_BZIP2 && read_flag!=READ) {
+    c->obuf=lk_malloc((size_t)CODEC_BUF_SIZE);
+    err=(BZ2_bzCompressInit(&c->bs,9,0,0)!=BZ_OK);
+  }
+#endif
+  memset(&io,0,sizeof(io));
+  if(read_flag==READ) io.read=codec_read;
+  else io.write=codec_write;
+  io.close=codec_close;
+  if(err || !(fp=fopencookie(c,read_flag==READ?"r":"w",io))) {
+    if(c->close_fptr) (void)fclose(fptr);
+    if(c->ibuf) free(c->ibuf);
+    if(c->obuf) free(c->obuf);
+    free(c);
+    if(err) errno=ENOMEM;
+    return 0;
+  }
+  return fp;
+}
+
+#else
+
+FILE *codec_open(const int read_flag,const char *fname,const int type)
+{
+  (void)read_flag;
+  (void)fname;
+  (void)type;
+  errno=EINVAL;
+  return 0;
+}
+
+#endif
+
+static FILE *fd_stream(const int read_flag,int fd)
+{
+  FILE *fptr;
+
+  if(fd<0) return 0;
+  errno=0;
+  fptr=fdopen(fd,read_flag==READ?"r":"w");
+  if(fptr && errno && errno!=ESPIPE) {
+    (void)fclose(fptr);
+    fptr=0;
+  }
+  errno=0;
+  return fptr;
+}
+
+/* Open fname through filterprog, in process if filterprog is gzip or bzip2 */
+FILE *filter_open(const int read_flag,const char *fname,const char *filterprog)
+{
+  int type;
+
+  type=codec_type(filterprog);
+  if(type!=COMPRESS_NONE) return codec_open(read_flag,fname,type);
+  return fd_stream(read_flag,child_open(read_flag,fname,filterprog));
+}
+
+/* Open fname compressed with type, using the codec if there is one and
+ * otherwise the program found by init_compress() */
+FILE *compress_open(const int read_flag,const char *fname,const int type,const struct lk_compress *compress)
+{
+  char *prog;
+
+  if(codec_available(type)) return codec_open(read_flag,fname,type);
+  if(type<0 || type>=COMPRESS_NONE) return 0;
+  if(type==COMPRESS_ZIP) {
+    if(read_flag==READ) {
+      if(!(prog=compress->comp_path[type][1])) return 0;
+      return fd_stream(read_flag,child_open1(read_flag,fname,prog,0));
+    }
+    if(!(prog=compress->comp_path[type][0])) return 0;
+    return fd_stream(read_flag,child_open1(read_flag,fname,prog,"-"));
+  }
+  if(!(prog=compress->comp_path[type][0])) return 0;
+  return fd_stream(read_flag,child_open(read_flag,fname,prog));
+}
@@ -1,17 +1,24 @@
 #include <config.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "libhdr.h"
 #include "ranlib.h"
 #include "utils.h"
+#include "lk_malloc.h"
 
-#define N              624                 
+#define N              RNG_MT_N
 #define M              397                 
 #define umask          0x80000000U
 #define lmask          0x7FFFFFFFU
 #define mixBits(u,v)   (((u)&umask)|((v)&lmask))
-#define twist(u,v)     ((mixBits(u,v)>>1)^((v)&1U?aa:0U))
+#define twist(u,v,a)   ((mixBits(u,v)>>1)^((v)&1U?(a):0U))
 static unsigned int rgen[][3]={
 	{0x9908B0DFU,0x9D2C5680U,0xEFC60000U}, /* Original MT19937 param */
 	 {0x8c400000U,0xbb56ef00U,0xddd58000U}, /* Set of independent 2^19937 RNG parameters */
@@ -73,11 +80,26 @@ static unsigned int rgen[][3]={
 	 {0,0,0}
 };
 
-static unsigned int state[N+1],set;     
-static unsigned int *next,maskB,maskC,aa;
-static int left=-1,shift0,gen_idx=0;
-  
-int set_mt_idx(int idx)
+#define MT_BITS 19937       /* Degree of the characteristic polynomial */
+#define PW ((MT_BITS>>6)+1) /* 64 bit words for a polynomial of degree <= MT_BITS */
+
+struct rng_ctx lk_rng={.left=-1,.bet={-1.0E37,-1.0E37},.bin={-1.0E37,.nsave=-214748365},.poi={-1.0E37,-1.0E37}};
+
+/* Stream 0 is lk_rng, others come from rng_init_streams() or the seedfile */
+static struct rng_ctx **streams;
+static int n_streams=1;
+
+/* Jump polynomials x^(2^log2) mod the characteristic polynomial of a generator */
+struct jump_poly {
+	struct jump_poly *next;
+	int gen_idx,log2;
+	uint64_t *h;
+};
+
+static struct jump_poly *jump_list;
+static pthread_mutex_t jump_lock=PTHREAD_MUTEX_INITIALIZER;
+
+int set_mt_idx_r(struct rng_ctx *c,int idx)
 {
 	int i,err=-1;
 	
@@ -85,84 +107,482 @@ int set_mt_idx(int idx)
 		i=0;
 		while(rgen[i][0]) i++;
 		if(i>idx && rgen[idx][1]) {
-			shift0=idx?12:11;
-			aa=rgen[idx][0];
-			maskB=rgen[idx][1];
-			maskC=rgen[idx][2];
-			if(set && idx!=gen_idx) err=1;
+			c->shift0=idx?12:11;
+			c->aa=rgen[idx][0];
+			c->maskB=rgen[idx][1];
+			c->maskC=rgen[idx][2];
+			if(c->set && idx!=c->gen_idx) err=1;
 			else err=0;
-			gen_idx=idx;
+			c->gen_idx=idx;
+			c->out_ok=0;
 		}
 	}
-	set=1;
+	c->set=1;
 	return err;
 }
 
-void sgenrand(unsigned int seed)
+int set_mt_idx(int idx)
+{
+	return set_mt_idx_r(&lk_rng,idx);
+}
+
+void sgenrand_r(struct rng_ctx *c,unsigned int seed)
 { 
 	int j;
+	unsigned int *state=c->state;
 
-	if(!set) set_mt_idx(0);
+	if(!c->set) set_mt_idx_r(c,0);
 	state[0]=seed&0xffffffffU;
 	for(j=1;j<N;j++) {
 		state[j]=(1812433253U*(state[j-1]^(state[j-1]>>30))+j);
 		state[j]&=0xffffffffU;
 	}
-	left=0;
+	c->left=0;
+	c->out_ok=0;
+	ranlib_reset_r(c);
 }
 
-static void next_state(void)
+void sgenrand(unsigned int seed)
 {
-	unsigned int *p=state;
-	int j;
+	sgenrand_r(&lk_rng,seed);
+}
+
+/* Regenerate the state.  state[j] depends on state[j+1] and state[j+M]
+ * (or state[j+M-N], already regenerated), so 8 words can be done at a time
+ * except for the last which needs the new state[0] */
+static void next_state(struct rng_ctx *c)
+{
+	unsigned int *p=c->state,a=c->aa;
+	int j=0;
+#ifdef __AVX2__
+	const __m256i um=_mm256_set1_epi32((int)umask),lm=_mm256_set1_epi32((int)lmask);
+	const __m256i one=_mm256_set1_epi32(1),va=_mm256_set1_epi32((int)a);
+	__m256i u,v,y;
+	
+	for(;j+8<=N-M;j+=8) {
+		u=_mm256_loadu_si256((const __m256i *)(p+j));
+		v=_mm256_loadu_si256((const __m256i *)(p+j+1));
+		y=_mm256_srli_epi32(_mm256_or_si256(_mm256_and_si256(u,um),_mm256_and_si256(v,lm)),1);
+		y=_mm256_xor_si256(y,_mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(v,one),one),va));
+		y=_mm256_xor_si256(y,_mm256_loadu_si256((const __m256i *)(p+j+M)));
+		_mm256_storeu_si256((__m256i *)(p+j),y);
+	}
+#endif
+	for(;j<N-M;j++) p[j]=p[j+M]^twist(p[j],p[j+1],a);
+#ifdef __AVX2__
+	for(;j+8<=N-1;j+=8) {
+		u=_mm256_loadu_si256((const __m256i *)(p+j));
+		v=_mm256_loadu_si256((const __m256i *)(p+j+1));
+		y=_mm256_srli_epi32(_mm256_or_si256(_mm256_and_si256(u,um),_mm256_and_si256(v,lm)),1);
+		y=_mm256_xor_si256(y,_mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(v,one),one),va));
+		y=_mm256_xor_si256(y,_mm256_loadu_si256((const __m256i *)(p+j+M-N)));
+		_mm256_storeu_si256((__m256i *)(p+j),y);
+	}
+#endif
+	for(;j<N-1;j++) p[j]=p[j+M-N]^twist(p[j],p[j+1],a);
+	p[N-1]=p[M-1]^twist(p[N-1],p[0],a);
+	c->left=N;
+	c->out_ok=0;
+}
 
-	left=N-1;
-	next=state;
-	for(j=N-M+1;--j;p++) *p=p[M]^twist(p[0],p[1]);
-	for(j=M;--j;p++) *p=p[M-N]^twist(p[0],p[1]);
-	*p=p[M-N]^twist(p[0],state[0]);
+/* Temper the whole state into out[] */
+static void temper(struct rng_ctx *c)
+{
+	const unsigned int *s=c->state;
+	unsigned int y,*o=c->out,mB=c->maskB,mC=c->maskC;
+	int j=0,sh=c->shift0;
+#ifdef __AVX2__
+	const __m256i vb=_mm256_set1_epi32((int)mB),vc=_mm256_set1_epi32((int)mC);
+	const __m128i vsh=_mm_cvtsi32_si128(sh);
+	__m256i v;
+	
+	for(;j+8<=N;j+=8) {
+		v=_mm256_loadu_si256((const __m256i *)(s+j));
+		v=_mm256_xor_si256(v,_mm256_srl_epi32(v,vsh));
+		v=_mm256_xor_si256(v,_mm256_and_si256(_mm256_slli_epi32(v,7),vb));
+		v=_mm256_xor_si256(v,_mm256_and_si256(_mm256_slli_epi32(v,15),vc));
+		v=_mm256_xor_si256(v,_mm256_srli_epi32(v,18));
+		_mm256_storeu_si256((__m256i *)(o+j),v);
+	}
+#endif
+	for(;j<N;j++) {
+		y=s[j];
+		y^=(y>>sh);
+		y^=(y<<7)&mB;
+		y^=(y<<15)&mC;
+		o[j]=y^(y>>18);
+	}
+	c->out_ok=1;
 }
 
-unsigned int genint(void)
+static unsigned int mt_word(struct rng_ctx *c)
+{
+	if(c->left<=0) next_state(c);
+	if(!c->out_ok) temper(c);
+	return c->out[N-c->left--];
+}
+
+/* x[i]=(w[i]+off)*scale, exactly as the scalar conversion would give */
+static void to_double(const unsigned int *w,double *x,const int n,const double off,const double scale)
 {
-	unsigned int y;
+	int i=0;
+#ifdef __AVX2__
+	const __m128i sgn=_mm_set1_epi32((int)0x80000000U);
+	const __m256d two31=_mm256_set1_pd(2147483648.0),vo=_mm256_set1_pd(off),vs=_mm256_set1_pd(scale);
+	__m256d d;
 	
- 	if(--left<0) next_state();
-	y=*next++;
-	y^=(y>>shift0);
-	y^=(y<<7)&maskB;
-	y^=(y<<15)&maskC;
-	return (y^(y >> 18));
+	for(;i+4<=n;i+=4) {
+		d=_mm256_cvtepi32_pd(_mm_xor_si128(_mm_loadu_si128((const __m128i *)(w+i)),sgn));
+		d=_mm256_add_pd(_mm256_add_pd(d,two31),vo);
+		_mm256_storeu_pd(x+i,_mm256_mul_pd(d,vs));
+	}
+#endif
+	for(;i<n;i++) x[i]=((double)w[i]+off)*scale;
 }
 
-double genrand(void)
+/* Fill x with n draws, the same as n calls to genrand_r() or safe_genrand_r() */
+static void fill_block(struct rng_ctx *c,double *x,int n,const double off,const double scale)
 {
-	unsigned int y;
+	int k;
 	
- 	if(--left<0) next_state();
-	y=*next++;
-	y^=(y>>shift0);
-	y^=(y<<7)&maskB;
-	y^=(y<<15)&maskC;
-	return (y^(y >> 18))*(1.0/4294967295.0);
+	while(n>0) {
+		if(c->left<=0) next_state(c);
+		if(!c->out_ok) temper(c);
+		k=c->left<n?c->left:n;
+		to_double(c->out+N-c->left,x,k,off,scale);
+		c->left-=k;
+		x+=k;
+		n-=k;
+	}
+}
+
+unsigned int genint_r(struct rng_ctx *c)
+{
+	return mt_word(c);
+}
+
+double genrand_r(struct rng_ctx *c)
+{
+	return mt_word(c)*(1.0/4294967295.0);
+}
+
+double safe_genrand_r(struct rng_ctx *c)
+{
+	return ((double)mt_word(c)+.5)*(1.0/4294967296.0);
+}
+
+void genrand_block_r(struct rng_ctx *c,double *x,int n)
+{
+	fill_block(c,x,n,0.0,1.0/4294967295.0);
+}
+
+void safe_genrand_block_r(struct rng_ctx *c,double *x,int n)
+{
+	fill_block(c,x,n,.5,1.0/4294967296.0);
+}
+
+unsigned int genint(void)
+{
+	return mt_word(&lk_rng);
+}
+
+double genrand(void)
+{
+	return mt_word(&lk_rng)*(1.0/4294967295.0);
 }
 
 double safe_genrand(void)
 {
-	unsigned int y;
+	return ((double)mt_word(&lk_rng)+.5)*(1.0/4294967296.0);
+}
+
+void genrand_block(double *x,int n)
+{
+	genrand_block_r(&lk_rng,x,n);
+}
+
+void safe_genrand_block(double *x,int n)
+{
+	safe_genrand_block_r(&lk_rng,x,n);
+}
+
+/* Polynomials over GF(2) are arrays of 64 bit words, bit i of the array
+ * being the coefficient of x^i */
+static uint64_t get_bits(const uint64_t *p,const int pos)
+{
+	int q=pos>>6,r=pos&63;
+
+	return r?(p[q]>>r)|(p[q+1]<<(64-r)):p[q];
+}
+
+/* p^=q<<sh, where q has nw words */
+static void xor_shifted(uint64_t *p,const uint64_t *q,const int nw,const int sh)
+{
+	int i,o=sh>>6,r=sh&63;
 	
- 	if(--left<0) next_state();
-	y=*next++;
-	y^=(y>>shift0);
-	y^=(y<<7)&maskB;
-	y^=(y<<15)&maskC;
-	return ((double)(y^(y >> 18))+.5)*(1.0/4294967296.0);
+	if(r) for(i=0;i<nw;i++) {
+		p[o+i]^=q[i]<<r;
+		p[o+i+1]^=q[i]>>(64-r);
+	} else for(i=0;i<nw;i++) p[o+i]^=q[i];
+}
 
+static int parity64(uint64_t x)
+{
+	x^=x>>32;
+	x^=x>>16;
+	x^=x>>8;
+	x^=x>>4;
+	x^=x>>2;
+	x^=x>>1;
+	return (int)(x&1);
+}
+
+/* Minimal polynomial of the low bit of generator gen_idx started from seed,
+ * found by running Berlekamp-Massey over 2*MT_BITS output bits.  Returns the
+ * degree, with the connection polynomial in cp (4*PW words) */
+static int bit_poly(const int gen_idx,const unsigned int seed,uint64_t *cp)
+{
+	struct rng_ctx c;
+	uint64_t *r,*b,*t,d;
+	int i,w,L=0,m=1,ns=2*MT_BITS,nw=4*PW;
+	
+	memset(&c,0,sizeof(struct rng_ctx));
+	(void)set_mt_idx_r(&c,gen_idx);
+	sgenrand_r(&c,seed);
+	/* Output bits in reverse order, so s(i-j) for j=0,1... is a run of bits */
+	r=lk_calloc((size_t)(ns/64+PW+2),sizeof(uint64_t));
+	for(i=0;i<ns;i++) if(mt_word(&c)&1) r[(ns-1-i)>>6]|=(uint64_t)1<<((ns-1-i)&63);
+	b=lk_calloc((size_t)(2*nw),sizeof(uint64_t));
+	t=b+nw;
+	memset(cp,0,sizeof(uint64_t)*nw);
+	cp[0]=b[0]=1;
+	for(i=0;i<ns;i++) {
+		for(d=0,w=0;w<=(L>>6);w++) d^=cp[w]&get_bits(r,ns-1-i+64*w);
+		if(!parity64(d)) m++;
+		else if(2*L<=i) {
+			memcpy(t,cp,sizeof(uint64_t)*(PW+1));
+			xor_shifted(cp,b,PW+1,m);
+			L=i+1-L;
+			memcpy(b,t,sizeof(uint64_t)*(PW+1));
+			m=1;
+		} else {
+			xor_shifted(cp,b,PW+1,m);
+			m++;
+		}
+	}
+	free(r);
+	free(b);
+	return L;
+}
+
+/* Characteristic polynomial of generator gen_idx.  Some of the alternative
+ * generators do not have an irreducible polynomial, so the output of a
+ * particular seed can have a shorter minimal polynomial; in that case other
+ * seeds are tried until one of full degree (which must be the characteristic
+ * polynomial) is found */
+static uint64_t *char_poly(const int gen_idx)
+{
+	uint64_t *cp,*phi=0;
+	int j,k,L=0;
+	
+	cp=lk_malloc(sizeof(uint64_t)*4*PW);
+	for(k=0;k<16 && L!=MT_BITS;k++) L=bit_poly(gen_idx,4357U+(unsigned int)k*69069U,cp);
+	if(L==MT_BITS) {
+		/* Connection polynomial -> characteristic polynomial */
+		phi=lk_calloc((size_t)PW,sizeof(uint64_t));
+		for(j=0;j<=L;j++) if((cp[j>>6]>>(j&63))&1) phi[(L-j)>>6]|=(uint64_t)1<<((L-j)&63);
+	}
+	free(cp);
+	return phi;
+}
+
+static uint64_t spread(uint32_t x)
+{
+	uint64_t v=x;
+	
+	v=(v|(v<<16))&UINT64_C(0x0000FFFF0000FFFF);
+	v=(v|(v<<8))&UINT64_C(0x00FF00FF00FF00FF);
+	v=(v|(v<<4))&UINT64_C(0x0F0F0F0F0F0F0F0F);
+	v=(v|(v<<2))&UINT64_C(0x3333333333333333);
+	v=(v|(v<<1))&UINT64_C(0x5555555555555555);
+	return v;
+}
+
+/* p=p^2 mod phi, where sh+s*(PW+1) holds phi<<s and t has space for 2*PW words */
+static void sqr_mod(uint64_t *p,const uint64_t *sh,uint64_t *t)
+{
+	int i,k,e;
+	const uint64_t *q;
+	
+	for(i=0;i<PW;i++) {
+		t[2*i]=spread((uint32_t)p[i]);
+		t[2*i+1]=spread((uint32_t)(p[i]>>32));
+	}
+	for(k=2*(MT_BITS-1);k>=MT_BITS;k--) if((t[k>>6]>>(k&63))&1) {
+		e=k-MT_BITS;
+		q=sh+(e&63)*(PW+1);
+		t+=e>>6;
+		for(i=0;i<=PW;i++) t[i]^=q[i];
+		t-=e>>6;
+	}
+	memcpy(p,t,sizeof(uint64_t)*PW);
+}
+
+static const uint64_t *jump_poly(const int gen_idx,const int log2)
+{
+	struct jump_poly *jp;
+	uint64_t *phi,*sh,*t,*h;
+	int i;
+	
+	pthread_mutex_lock(&jump_lock);
+	for(jp=jump_list;jp;jp=jp->next) if(jp->gen_idx==gen_idx && jp->log2==log2) break;
+	if(!jp && (phi=char_poly(gen_idx))) {
+		sh=lk_calloc((size_t)(64*(PW+1)),sizeof(uint64_t));
+		for(i=0;i<64;i++) xor_shifted(sh+i*(PW+1),phi,PW,i);
+		t=lk_malloc(sizeof(uint64_t)*2*PW);
+		h=lk_calloc((size_t)PW,sizeof(uint64_t));
+		h[0]=2;
+		for(i=0;i<log2;i++) sqr_mod(h,sh,t);
+		free(t);
+		free(sh);
+		free(phi);
+		jp=lk_malloc(sizeof(struct jump_poly));
+		jp->gen_idx=gen_idx;
+		jp->log2=log2;
+		jp->h=h;
+		jp->next=jump_list;
+		jump_list=jp;
+	}
+	pthread_mutex_unlock(&jump_lock);
+	return jp?jp->h:0;
+}
+
+/* Advance c by 2^log2 draws.  The state is multiplied by the jump
+ * polynomial, evaluated by Horner's rule with one generator step per
+ * coefficient (Haramoto et al., INFORMS J. Comput. 20:385-390, 2008) */
+int rng_jump(struct rng_ctx *c,const int log2)
+{
+	const uint64_t *h;
+	unsigned int *r,*s,y,a;
+	int i,j,k,deg,ri=0;
+	
+	if(!c->set) set_mt_idx_r(c,0);
+	if(!(h=jump_poly(c->gen_idx,log2))) {
+		message(WARN_MSG,"rng_jump(): No jump polynomial for random number generator %d\n",c->gen_idx);
+		return -1;
+	}
+	for(deg=MT_BITS-1;deg>0 && !((h[deg>>6]>>(deg&63))&1);deg--);
+	/* r is a circular buffer of the last N words generated, oldest at r[ri];
+	 * c->state is the same with the oldest at state[0] */
+	r=lk_calloc((size_t)N,sizeof(unsigned int));
+	s=c->state;
+	a=c->aa;
+	for(k=deg;k>=0;k--) {
+		j=ri+1<N?ri+1:0;
+		i=ri+M<N?ri+M:ri+M-N;
+		y=mixBits(r[ri],r[j]);
+		r[ri]=r[i]^(y>>1)^(y&1U?a:0U);
+		ri=j;
+		if((h[k>>6]>>(k&63))&1) {
+			for(i=0;i<N-ri;i++) r[ri+i]^=s[i];
+			for(j=0;i<N;i++,j++) r[j]^=s[i];
+		}
+	}
+	for(i=0;i<N;i++) s[i]=r[(ri+i)%N];
+	c->out_ok=0;
+	free(r);
+	return 0;
+}
+
+static void add_stream(struct rng_ctx *c)
+{
+	if(streams) streams=lk_realloc(streams,sizeof(void *)*(n_streams+1));
+	else streams=lk_malloc(sizeof(void *)*(n_streams+1));
+	streams[0]=&lk_rng;
+	streams[n_streams++]=c;
+}
+
+/* Make sure there are at least n streams.  A new stream starts
+ * 2^RNG_STREAM_LOG2 draws on from the one before.  Must be called before
+ * the streams are handed out to other threads */
+int rng_init_streams(int n)
+{
+	struct rng_ctx *c;
+	
+	while(n_streams<n) {
+		c=lk_malloc(sizeof(struct rng_ctx));
+		*c=*rng_stream(n_streams-1);
+		if(rng_jump(c,RNG_STREAM_LOG2)) {
+			free(c);
+			return -1;
+		}
+		add_stream(c);
+	}
+	return 0;
+}
+
+/* Drop streams 1,2,... so that they are derived afresh from stream 0 the
+ * next time they are needed, e.g., after stream 0 has been moved on */
+void rng_drop_streams(void)
+{
+	while(n_streams>1) free(streams[--n_streams]);
+}
+
+int rng_n_streams(void)
+{
+	return n_streams;
+}
+
+struct rng_ctx *rng_stream(int k)
+{
+	if(k<0 || k>=n_streams) ABT_FUNC("Random number stream out of range\n");
+	return k?streams[k]:&lk_rng;
+}
+
+/* Read the rest of a stream's state after its "mt19937b_idx = n" line.
+ * Returns 1 for an unknown generator, -1 for a bad state */
+static int read_state(FILE *fptr,struct rng_ctx *c,const int left)
+{
+	int i,j;
+	
+	if(fscanf(fptr,"mt19937b_gen = %d\n",&i)!=1) i=0;
+	j=set_mt_idx_r(c,i);
+	if(j==-1) {
+		message(WARN_MSG,"getseed(): Bad random number generator (%d)\n",i);
+		set_mt_idx_r(c,0);
+		return 1;
+	}
+	if(j==1) message(DEBUG_MSG,"getseed(): Changing random number generator to %d\n",i);
+	if(left<0 || left>N) return -1;
+	c->out_ok=0;
+	for(i=0;i<N;i++) if(fscanf(fptr,"%u",c->state+i)!=1) return -1;
+	c->left=left;
+	return 0;
+}
+
+/* States of streams 1,2,... following that of stream 0 */
+static void read_streams(FILE *fptr)
+{
+	int k,left;
+	struct rng_ctx *c;
+	
+	rng_drop_streams();
+	while(fscanf(fptr," mt19937b_stream = %d",&k)==1 && k==n_streams) {
+		if(fscanf(fptr," mt19937b_idx = %d\n",&left)!=1) break;
+		c=lk_calloc((size_t)1,sizeof(struct rng_ctx));
+		ranlib_reset_r(c);
+		if(read_state(fptr,c,left)) {
+			free(c);
+			break;
+		}
+		add_stream(c);
+	}
+	if(n_streams>1) message(DEBUG_MSG,"getseed(): Read state for %d random number streams\n",n_streams);
 }
 
 int getseed(const char *fname)
 {
-	int flag=0,i,j,err=0;
+	int flag=0,err=0,left,k;
 	unsigned int sd;
 	char buf[256],*fname1;
 	FILE *fptr;
@@ -179,27 +599,17 @@ int getseed(const char *fname)
 	fptr=fopen(fname1,"r");
 	if(fptr)	{
 		if(fgets(buf,256,fptr))	{
-			free(fname1);
 			flag=sscanf(buf,"mt19937b_seed = %u\n",&sd);
-			if(flag!=1)	{
-				if(sscanf(buf,"mt19937b_idx = %d\n",&left)==1) {
-					if(fscanf(fptr,"mt19937b_gen = %d\n",&i)!=1) i=0;
-					j=set_mt_idx(i);
-					if(j==-1) {
-						message(WARN_MSG,"getseed(): Bad random number generator (%d)\n",i);
-						(void)fclose(fptr);
-						set_mt_idx(0);
-						return -1;
-					}
-					if(j==1) message(DEBUG_MSG,"getseed(): Changing random number generator to %d\n",i);
-					if(left>=0 && left<=N) {
-						for(i=0;i<N;i++) if(fscanf(fptr,"%u",state+i)!=1) break;
-						next=state+N-left;
-						if(i==N)	{
-							message(DEBUG_MSG,"getseed(): Using stored state for mt19937b generator\n");
-							return 0;
-						}
-					}
+			if(flag!=1 && sscanf(buf,"mt19937b_idx = %d\n",&left)==1) {
+				k=read_state(fptr,&lk_rng,left);
+				if(!k) {
+					message(DEBUG_MSG,"getseed(): Using stored state for mt19937b generator\n");
+					read_streams(fptr);
+				}
+				if(k>=0) {
+					(void)fclose(fptr);
+					free(fname1);
+					return -k;
 				}
 			}
 		}
@@ -220,33 +630,47 @@ int getseed(const char *fname)
 	return err;
 }
 
-int dumpseed(FILE *fptr,const int flag)
+int dumpseed_r(FILE *fptr,struct rng_ctx *c,const int flag)
 {
 	int i,err=0;
 	unsigned int sd;
 	
 	if(flag)	{
-		err=fprintf(fptr,"mt19937b_idx = %d\n",left);
-		if(err>0 && gen_idx) err=fprintf(fptr,"mt19937b_gen = %d\n",gen_idx);
+		err=fprintf(fptr,"mt19937b_idx = %d\n",c->left);
+		if(err>0 && c->gen_idx) err=fprintf(fptr,"mt19937b_gen = %d\n",c->gen_idx);
 		if(err>0) for(i=0;i<N;i++)	{
-			err=fprintf(fptr,"%u%c",state[i],(i+1)%16?' ':'\n');
+			err=fprintf(fptr,"%u%c",c->state[i],(i+1)%16?' ':'\n');
 			if(err<0) break;
 		}
 	} else {
-		sd=genint();
+		sd=genint_r(c);
 		err=fprintf(fptr,"mt19937b_seed = %u\n",sd);
 	}
 	return err;
 }
 
+/* With flag set the full state of every stream is written, otherwise
+ * just a seed for stream 0 (other streams will then be derived from it) */
+int dumpseed(FILE *fptr,const int flag)
+{
+	int k,err;
+	
+	err=dumpseed_r(fptr,&lk_rng,flag);
+	if(flag) for(k=1;err>0 && k<n_streams;k++) {
+		err=fprintf(fptr,"mt19937b_stream = %d\n",k);
+		if(err>0) err=dumpseed_r(fptr,streams[k],flag);
+	}
+	return err;
+}
+
 int bindumpseed(FILE *fptr)
 {
 	int i,err=0;
 	
-	if(gen_idx) {
-		if(fprintf(fptr,"%x,%x,%x\n",N,left,gen_idx)<0) err=1;
-	} else if(fprintf(fptr,"%x,%x\n",N,left)<0) err=1;
-	for(i=0;!err && i<N;i++) if(fprintf(fptr,"%x\n",state[i])<0) err=1;
+	if(lk_rng.gen_idx) {
+		if(fprintf(fptr,"%x,%x,%x\n",N,lk_rng.left,lk_rng.gen_idx)<0) err=1;
+	} else if(fprintf(fptr,"%x,%x\n",N,lk_rng.left)<0) err=1;
+	for(i=0;!err && i<N;i++) if(fprintf(fptr,"%x\n",lk_rng.state[i])<0) err=1;
 	return err;
 }
 
@@ -264,9 +688,9 @@ int binreadseed(FILE *fptr,char *s)
 		err=1;
 	}
 	if(i!=N) err=1;
-	if(!err) for(i=0;!err && i<N;i++) if(fscanf(fptr,"%x\n",state+i)!=1) err=1;
-	left=(int)j;
-	if(!err) next=state+N-left;
+	if(!err) for(i=0;!err && i<N;i++) if(fscanf(fptr,"%x\n",lk_rng.state+i)!=1) err=1;
+	lk_rng.left=(int)j;
+	lk_rng.out_ok=0;
 	return err;
 }
 
@@ -0,0 +1,227 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * hash_map.c:                                                              *
+ *                                                                          *
+ * Open addressing hash table with string or integer keys, using Bob       *
+ * Jenkins' hashlittle() <hash.c>.  Entries live in a single array with     *
+ * linear probing, and string keys are copied into large blocks owned by    *
+ * the table, so a lookup touches one or two cache lines rather than a      *
+ * path of tree nodes.  There is no deletion.                               *
+ *                                                                          *
+ * Entries are unordered; hmap_sorted() gives them in key order when that   *
+ * is needed.                                                               *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <ctype.h>
+
+#include "lk_malloc.h"
+#include "hash_map.h"
+#include "hash.h"
+
+#define HMAP_SEED 0x4c6f6b69
+#define HMAP_MIN_SIZE 16
+#define HMAP_KEY_BLOCK 65536
+#define HMAP_FOLD_BUF 256
+
+struct hash_map *hmap_new(const int flags,size_t size)
+{
+  struct hash_map *hm;
+  size_t sz=HMAP_MIN_SIZE;
+
+  /* Room for size entries without growing */
+  while(sz<size+(size>>1)) sz<<=1;
+  hm=lk_malloc(sizeof(struct hash_map));
+  hm->slot=lk_calloc(sz,sizeof(struct hmap_entry));
+  hm->size=sz;
+  hm->n=0;
+  hm->flags=flags;
+  hm->keys=0;
+  hm->key_pos=hm->key_size=0;
+  return hm;
+}
+
+static uint32_t hmap_hash(const struct hash_map *hm,const void *key,size_t *len)
+{
+  uint32_t h;
+
+  if(hm->flags&HMAP_INT) h=hashlittle(key,sizeof(long),HMAP_SEED);
+  else {
+    *len=strlen(key);
+    h=hashlittle(key,*len,HMAP_SEED);
+  }
+  return h?h:1;
+}
+
+/* Upper case copy of key for HMAP_NOCASE tables, in buf if it fits */
+static const char *fold_key(const char *key,char *buf)
+{
+  size_t i,len;
+  char *p;
+
+  len=strlen(key);
+  p=len<HMAP_FOLD_BUF?buf:lk_malloc(len+1);
+  for(i=0;i<=len;i++) p[i]=toupper((int)key[i]);
+  return p;
+}
+
+/* Slot holding key, or the empty slot where it would go */
+static struct hmap_entry *hmap_probe(const struct hash_map *hm,const void *key,const uint32_t h)
+{
+  size_t i,mask=hm->size-1;
+  struct hmap_entry *e;
+
+  for(i=h&mask;;i=(i+1)&mask) {
+    e=hm->slot+i;
+    if(!e->hash) break;
+    if(e->hash==h) {
+      if(hm->flags&HMAP_INT) {
+	if(e->key.value==*(const long *)key) break;
+      } else if(!strcmp(e->key.str,key)) break;
+    }
+  }
+  return e;
+}
+
+void *hmap_find(const struct hash_map *hm,const void *key)
+{
+  struct hmap_entry *e;
+  const char *k=key;
+  char buf[HMAP_FOLD_BUF];
+  size_t len;
+
+  if(hm->flags&HMAP_NOCASE) k=fold_key(key,buf);
+  e=hmap_probe(hm,k,hmap_hash(hm,k,&len));
+  if(k!=key && k!=buf) free((void *)k);
+  return e->hash?e->data:0;
+}
+
+static void hmap_grow(struct hash_map *hm)
+{
+  struct hmap_entry *old,*e;
+  size_t i,j,mask,old_size;
+
+  old=hm->slot;
+  old_size=hm->size;
+  hm->size<<=1;
+  mask=hm->size-1;
+  hm->slot=lk_calloc(hm->size,sizeof(struct hmap_entry));
+  for(i=0;i<old_size;i++) if(old[i].hash) {
+    for(j=old[i].hash&mask;hm->slot[j].hash;j=(j+1)&mask);
+    e=hm->slot+j;
+    *e=old[i];
+  }
+  free(old);
+}
+
+static char *store_key(struct hash_map *hm,const char *key,const size_t len)
+{
+  char *p;
+  size_t sz;
+
+  if(hm->key_pos+len+1>hm->key_size) {
+    sz=sizeof(char *)+len+1;
+    if(sz<HMAP_KEY_BLOCK) sz=HMAP_KEY_BLOCK;
+    p=lk_malloc(sz);
+    *(char **)p=hm->keys;
+    hm->keys=p;
+    hm->key_pos=sizeof(char *);
+    hm->key_size=sz;
+  }
+  p=hm->keys+hm->key_pos;
+  memcpy(p,key,len+1);
+  hm->key_pos+=len+1;
+  return p;
+}
+
+/* Find or add the entry for key.  *found is set if the entry already existed;
+ * a new entry has data==0.  The entry pointer is valid until the next insertion */
+struct hmap_entry *hmap_insert(struct hash_map *hm,const void *key,int *found)
+{
+  struct hmap_entry *e;
+  const char *k=key;
+  char buf[HMAP_FOLD_BUF];
+  size_t len=0;
+  uint32_t h;
+
+  if(hm->flags&HMAP_NOCASE) k=fold_key(key,buf);
+  h=hmap_hash(hm,k,&len);
+  e=hmap_probe(hm,k,h);
+  if(found) *found=e->hash?1:0;
+  if(!e->hash) {
+    if(3*(hm->n+1)>2*hm->size) {
+      hmap_grow(hm);
+      e=hmap_probe(hm,k,h);
+    }
+    e->hash=h;
+    e->data=0;
+    if(hm->flags&HMAP_INT) e->key.value=*(const long *)key;
+    else e->key.str=store_key(hm,k,len);
+    hm->n++;
+  }
+  if(k!=key && k!=buf) free((void *)k);
+  return e;
+}
+
+static int cmp_str_entry(const void *s1,const void *s2)
+{
+  return strcmp((*(struct hmap_entry * const *)s1)->key.str,(*(struct hmap_entry * const *)s2)->key.str);
+}
+
+static int cmp_int_entry(const void *s1,const void *s2)
+{
+  long a,b;
+
+  a=(*(struct hmap_entry * const *)s1)->key.value;
+  b=(*(struct hmap_entry * const *)s2)->key.value;
+  return a<b?-1:(a>b?1:0);
+}
+
+/* Array of the hm->n entries in key order, to be freed by the caller.
+ * The pointers are valid until the next insertion */
+struct hmap_entry **hmap_sorted(const struct hash_map *hm)
+{
+  struct hmap_entry **ent;
+  size_t i,j;
+
+  ent=lk_malloc(sizeof(struct hmap_entry *)*(hm->n?hm->n:1));
+  for(i=j=0;i<hm->size;i++) if(hm->slot[i].hash) ent[j++]=hm->slot+i;
+  if(j>1) qsort(ent,j,sizeof(struct hmap_entry *),(hm->flags&HMAP_INT)?cmp_int_entry:cmp_str_entry);
+  return ent;
+}
+
+/* Call func for every entry, in no particular order */
+void hmap_traverse(const struct hash_map *hm,void (*func)(struct hmap_entry *,void *),void *arg)
+{
+  size_t i;
+
+  for(i=0;i<hm->size;i++) if(hm->slot[i].hash) func(hm->slot+i,arg);
+}
+
+void hmap_free(struct hash_map *hm,void (*free_data)(void *))
+{
+  size_t i;
+  char *p,*p1;
+
+  if(!hm) return;
+  if(free_data) for(i=0;i<hm->size;i++) if(hm->slot[i].hash && hm->slot[i].data) free_data(hm->slot[i].data);
+  p=hm->keys;
+  while(p) {
+    p1=*(char **)p;
+    free(p);
+    p=p1;
+  }
+  free(hm->slot);
+  free(hm);
+}
@@ -210,13 +210,10 @@ FILE *_open_readfile(const char *fname,int *flag,const struct lk_compress *compr
   if(guess<COMPRESS_NONE) {
     message(DEBUG_MSG,"File appears to have been compressed using %s\n",prog[guess]);
     filter=compress->comp_path[guess][guess==COMPRESS_ZIP?1:0];
-    if(filter) {
-      *flag=1;
-      if(guess==COMPRESS_ZIP) i=child_open1(READ,fname,filter,0);
-      else i=child_open1(READ,fname,filter,"-d");
-      if(!(fptr=fdopen(i,"r"))) ABT_FUNC("Couldn't fdopen() stream");
-      if(errno && errno!=ESPIPE) ABT_FUNC("Unknown IO error\n");
-      errno=0;
+    if(codec_available(guess) || filter) {
+      /* Only the external filters leave a child process to be reaped */
+      *flag=!codec_available(guess);
+      if(!(fptr=compress_open(READ,fname,guess,compress))) ABT_FUNC("Couldn't open compressed stream");
     } else {
       if(chk_flag) abt(__FILE__,__LINE__,"%s(): File '%s' appears to have been compressed using %s, which is not in the current $PATH\n",__func__,fname,prog[guess]);
       else {
@@ -0,0 +1,274 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * line_reader.c:                                                           *
+ *                                                                          *
+ * Line reader for large text inputs.  Lines are returned as spans into     *
+ * the reader's window without copying:                                     *
+ *                                                                          *
+ *   Regular files are mapped into memory.                                  *
+ *   Pipes are read in LR_BUF_SIZE chunks by a background thread, which     *
+ *   fills one chunk while the caller parses the other.                     *
+ *   LR_SYNC readers go through getdelim() and never read past the line     *
+ *   returned, so the FILE can be mixed with other stdio calls.             *
+ *                                                                          *
+ * Only lines running over the end of a window are copied.  The returned    *
+ * span is valid until the next call on the reader.                         *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <stdio.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef _POSIX_MAPPED_FILES
+#include <sys/mman.h>
+#endif
+
+#include "lk_malloc.h"
+#include "line_reader.h"
+
+static void spill_add(struct line_reader *lr,char *p,size_t n)
+{
+  if(lr->spill_len+n>=lr->spill_size) {
+    lr->spill_size=(lr->spill_len+n+1)<<1;
+    lr->spill=lr->spill?lk_realloc(lr->spill,lr->spill_size):lk_malloc(lr->spill_size);
+  }
+  memcpy(lr->spill+lr->spill_len,p,n);
+  lr->spill_len+=n;
+  lr->spill[lr->spill_len]=0;
+}
+
+static void *lr_read_ahead(void *arg)
+{
+  struct line_reader *lr=arg;
+  struct lr_chunk *ch;
+  size_t n;
+  int i=0,quit;
+
+  for(;;) {
+    ch=lr->chunk+i;
+    pthread_mutex_lock(&lr->lock);
+    while(ch->full && !lr->quit) pthread_cond_wait(&lr->cond,&lr->lock);
+    quit=lr->quit;
+    pthread_mutex_unlock(&lr->lock);
+    if(quit) break;
+    n=fread(ch->buf,1,LR_BUF_SIZE,lr->fptr);
+    pthread_mutex_lock(&lr->lock);
+    ch->n=n;
+    ch->eof=(n<LR_BUF_SIZE);
+    ch->full=1;
+    pthread_cond_broadcast(&lr->cond);
+    pthread_mutex_unlock(&lr->lock);
+    if(n<LR_BUF_SIZE) break;
+    i^=1;
+  }
+  return 0;
+}
+
+/* Move to the next window of input, returns 0 at the end of the input */
+static int lr_refill(struct line_reader *lr,int c)
+{
+  struct lr_chunk *ch;
+  ssize_t n;
+
+  if(lr->eof) return 0;
+  if(lr->mode==LR_MODE_SYNC) {
+    n=getdelim(&lr->lbuf,&lr->lsize,c<0?'\n':c,lr->fptr);
+    if(n<=0) {
+      lr->eof=1;
+      lr->ptr=lr->end=lr->lbuf;
+      return 0;
+    }
+    lr->ptr=lr->lbuf;
+    lr->end=lr->lbuf+n;
+  } else {
+    pthread_mutex_lock(&lr->lock);
+    if(lr->cur>=0) {
+      lr->chunk[lr->cur].full=0;
+      pthread_cond_broadcast(&lr->cond);
+    }
+    lr->cur=(lr->cur+1)&1;
+    ch=lr->chunk+lr->cur;
+    while(!ch->full) pthread_cond_wait(&lr->cond,&lr->lock);
+    pthread_mutex_unlock(&lr->lock);
+    lr->ptr=ch->buf;
+    lr->end=ch->buf+ch->n;
+    lr->eof=ch->eof;
+  }
+  return 1;
+}
+
+static char *find_eol(char *p,char *e)
+{
+  char *q,*r;
+
+  q=memchr(p,'\n',(size_t)(e-p));
+  r=memchr(p,'\r',(size_t)((q?q:e)-p));
+  return r?r:q;
+}
+
+/* c<0: lines end in \n, \r\n or \r; otherwise in c */
+static char *lr_scan(struct line_reader *lr,size_t *len,int c)
+{
+  char *p,*q,*line;
+  size_t n;
+
+  lr->spill_len=0;
+  lr->term=0;
+  if(lr->skip_lf) {
+    lr->skip_lf=0;
+    if(lr->ptr==lr->end) (void)lr_refill(lr,c);
+    if(lr->ptr<lr->end && *lr->ptr=='\n') lr->ptr++;
+  }
+  for(;;) {
+    p=lr->ptr;
+    n=(size_t)(lr->end-p);
+    q=n?(c<0?find_eol(p,lr->end):memchr(p,c,n)):0;
+    if(q) {
+      n=(size_t)(q-p);
+      lr->ptr=q+1;
+      lr->term=c<0?'\n':c;
+      if(c<0 && *q=='\r') {
+	if(lr->ptr<lr->end) {
+	  if(*lr->ptr=='\n') lr->ptr++;
+	} else lr->skip_lf=1;
+      }
+      if(lr->spill_len) {
+	spill_add(lr,p,n);
+	line=lr->spill;
+	n=lr->spill_len;
+      } else {
+	line=p;
+	if(lr->flags&LR_CSTR) *q=0;
+      }
+      break;
+    }
+    if(lr->eof) {
+      /* Unterminated last line */
+      lr->ptr=lr->end;
+      if(lr->spill_len || (n && lr->mode==LR_MODE_MMAP && (lr->flags&LR_CSTR))) {
+	spill_add(lr,p,n);
+	line=lr->spill;
+	n=lr->spill_len;
+      } else if(n) {
+	line=p;
+	if(lr->flags&LR_CSTR) *lr->end=0;
+      } else line=0;
+      break;
+    }
+    if(n) spill_add(lr,p,n);
+    lr->ptr=lr->end;
+    (void)lr_refill(lr,c);
+  }
+  if(len) *len=line?n:0;
+  return line;
+}
+
+/* Next line without its terminator (\n, \r\n or \r), 0 at the end of the input */
+char *lr_getline(struct line_reader *lr,size_t *len)
+{
+  return lr_scan(lr,len,-1);
+}
+
+/* Next record terminated by c, without the terminator, 0 at the end of the input */
+char *lr_getdelim(struct line_reader *lr,size_t *len,int c)
+{
+  return lr_scan(lr,len,c);
+}
+
+struct line_reader *lr_open(FILE *fptr,int flags)
+{
+  struct line_reader *lr;
+  int i;
+#ifdef _POSIX_MAPPED_FILES
+  struct stat st;
+  off_t off;
+  void *map;
+#endif
+
+  lr=lk_calloc((size_t)1,sizeof(struct line_reader));
+  lr->fptr=fptr;
+  lr->flags=flags;
+  lr->cur=-1;
+  lr->mode=LR_MODE_SYNC;
+  if(flags&LR_SYNC) return lr;
+#ifdef _POSIX_MAPPED_FILES
+  if(!fstat(fileno(fptr),&st) && S_ISREG(st.st_mode) && (off=ftello(fptr))>=0) {
+    if(off>=st.st_size) {
+      lr->mode=LR_MODE_MMAP;
+      lr->eof=1;
+      return lr;
+    }
+    map=mmap(0,(size_t)st.st_size,PROT_READ|((flags&LR_CSTR)?PROT_WRITE:0),MAP_PRIVATE,fileno(fptr),0);
+    if(map!=MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+      (void)madvise(map,(size_t)st.st_size,MADV_SEQUENTIAL);
+#endif
+      lr->mode=LR_MODE_MMAP;
+      lr->map=map;
+      lr->map_size=(size_t)st.st_size;
+      lr->ptr=lr->map+off;
+      lr->end=lr->map+lr->map_size;
+      lr->eof=1;
+      return lr;
+    }
+  }
+#endif
+  for(i=0;i<2;i++) lr->chunk[i].buf=lk_malloc((size_t)LR_BUF_SIZE+1);
+  pthread_mutex_init(&lr->lock,0);
+  pthread_cond_init(&lr->cond,0);
+  if(pthread_create(&lr->thread,0,lr_read_ahead,lr)) {
+    /* No thread, read in line by line */
+    pthread_cond_destroy(&lr->cond);
+    pthread_mutex_destroy(&lr->lock);
+    for(i=0;i<2;i++) free(lr->chunk[i].buf);
+    lr->chunk[0].buf=lr->chunk[1].buf=0;
+  } else lr->mode=LR_MODE_STREAM;
+  return lr;
+}
+
+/* Close the reader, leaving the FILE open.  A mapped FILE is positioned after
+ * the last line returned, a piped FILE will have been read ahead */
+void lr_close(struct line_reader *lr)
+{
+  int i;
+
+  if(!lr) return;
+  switch(lr->mode) {
+  case LR_MODE_MMAP:
+#ifdef _POSIX_MAPPED_FILES
+    if(lr->map) {
+      (void)fseeko(lr->fptr,(off_t)(lr->ptr-lr->map),SEEK_SET);
+      (void)munmap(lr->map,lr->map_size);
+    }
+#endif
+    break;
+  case LR_MODE_STREAM:
+    pthread_mutex_lock(&lr->lock);
+    lr->quit=1;
+    pthread_cond_broadcast(&lr->cond);
+    pthread_mutex_unlock(&lr->lock);
+    (void)pthread_join(lr->thread,0);
+    pthread_cond_destroy(&lr->cond);
+    pthread_mutex_destroy(&lr->lock);
+    for(i=0;i<2;i++) free(lr->chunk[i].buf);
+    break;
+  default:
+    if(lr->lbuf) free(lr->lbuf);
+  }
+  if(lr->spill) free(lr->spill);
+  free(lr);
+}
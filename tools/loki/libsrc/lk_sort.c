@@ -0,0 +1,352 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * lk_sort.c:                                                               *
+ *                                                                          *
+ * Sorting without a comparison function.  Keys (doubles or ints) are      *
+ * mapped to unsigned 64 bit integers that sort in the same order, and      *
+ * these are put in order by an LSD radix sort, 11 bits a pass.  Passes     *
+ * where every key has the same digit are skipped, so keys with a narrow    *
+ * range need fewer passes.  All sorts are stable.                          *
+ *                                                                          *
+ * Large arrays are split between threads, each radix sorting its part,    *
+ * and the sorted parts are then merged in pairs.  The number of threads    *
+ * comes from set_sort_threads() or LOKI_SORT_THREADS in the environment,   *
+ * and defaults to the number of processors.                                *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "lk_malloc.h"
+#include "lk_sort.h"
+
+#define RADIX_BITS 11
+#define RADIX_SIZE (1<<RADIX_BITS)
+#define RADIX_PASSES ((64+RADIX_BITS-1)/RADIX_BITS)
+#define DIGIT(k,p) ((size_t)((k)>>((p)*RADIX_BITS))&(RADIX_SIZE-1))
+#define SIGN_BIT UINT64_C(0x8000000000000000)
+
+/* One part of a threaded sort or merge.  idx (and ti) are 0 for plain keys */
+struct sort_part {
+  uint64_t *key,*tk;
+  size_t *idx,*ti;
+  size_t n,n1;
+};
+
+static int sort_threads;
+
+void set_sort_threads(int n)
+{
+  sort_threads=n>0?n:1;
+}
+
+static int get_sort_threads(void)
+{
+  char *p;
+  long n=1;
+
+  if(!sort_threads) {
+#ifdef _SC_NPROCESSORS_ONLN
+    n=sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    set_sort_threads((int)n);
+    if((p=getenv("LOKI_SORT_THREADS"))) set_sort_threads(atoi(p));
+  }
+  return sort_threads;
+}
+
+static uint64_t double_key(const double x,const int flag)
+{
+  uint64_t k;
+
+  memcpy(&k,&x,sizeof(uint64_t));
+  k=(k&SIGN_BIT)?~k:k|SIGN_BIT;
+  return (flag&LK_SORT_DESCEND)?~k:k;
+}
+
+static double key_double(uint64_t k)
+{
+  double x;
+
+  k=(k&SIGN_BIT)?k&~SIGN_BIT:~k;
+  memcpy(&x,&k,sizeof(double));
+  return x;
+}
+
+static void insertion_sort(uint64_t *key,size_t *idx,const size_t n)
+{
+  size_t i,j,ix=0;
+  uint64_t k;
+
+  for(i=1;i<n;i++) {
+    k=key[i];
+    if(idx) ix=idx[i];
+    for(j=i;j>0 && key[j-1]>k;j--) {
+      key[j]=key[j-1];
+      if(idx) idx[j]=idx[j-1];
+    }
+    key[j]=k;
+    if(idx) idx[j]=ix;
+  }
+}
+
+/* LSD radix sort of key[] (and idx[] with it), with tk[] and ti[] as scratch */
+static void radix_sort(uint64_t *key,size_t *idx,uint64_t *tk,size_t *ti,const size_t n)
+{
+  size_t *cnt,*ct,*i1=idx,*i2=ti,*it,i,s,c;
+  uint64_t *k1=key,*k2=tk,*kt;
+  int p;
+
+  if(n<=LK_SORT_SMALL) {
+    insertion_sort(key,idx,n);
+    return;
+  }
+  /* Digit counts do not depend on the order, so are done once for all passes */
+  cnt=lk_calloc((size_t)(RADIX_SIZE*RADIX_PASSES),sizeof(size_t));
+  for(i=0;i<n;i++) for(p=0;p<RADIX_PASSES;p++) cnt[p*RADIX_SIZE+DIGIT(key[i],p)]++;
+  for(p=0;p<RADIX_PASSES;p++) {
+    ct=cnt+p*RADIX_SIZE;
+    if(ct[DIGIT(k1[0],p)]==n) continue;
+    for(s=i=0;i<RADIX_SIZE;i++) {
+      c=ct[i];
+      ct[i]=s;
+      s+=c;
+    }
+    if(i1) for(i=0;i<n;i++) {
+      c=ct[DIGIT(k1[i],p)]++;
+      k2[c]=k1[i];
+      i2[c]=i1[i];
+    } else for(i=0;i<n;i++) k2[ct[DIGIT(k1[i],p)]++]=k1[i];
+    kt=k1;
+    k1=k2;
+    k2=kt;
+    it=i1;
+    i1=i2;
+    i2=it;
+  }
+  if(k1!=key) {
+    memcpy(key,k1,sizeof(uint64_t)*n);
+    if(idx) memcpy(idx,i1,sizeof(size_t)*n);
+  }
+  free(cnt);
+}
+
+static void *sort_thread(void *arg)
+{
+  struct sort_part *sp=arg;
+
+  radix_sort(sp->key,sp->idx,sp->tk,sp->ti,sp->n);
+  return 0;
+}
+
+/* Merge the sorted runs key[0..n1-1] and key[n1..n-1] into tk[] */
+static void *merge_thread(void *arg)
+{
+  struct sort_part *sp=arg;
+  const uint64_t *key=sp->key;
+  const size_t *idx=sp->idx;
+  size_t i=0,j=sp->n1,k=0,n=sp->n;
+
+  while(i<sp->n1 && j<n) {
+    if(key[j]<key[i]) {
+      if(idx) sp->ti[k]=idx[j];
+      sp->tk[k++]=key[j++];
+    } else {
+      if(idx) sp->ti[k]=idx[i];
+      sp->tk[k++]=key[i++];
+    }
+  }
+  if(i<sp->n1) {
+    memcpy(sp->tk+k,key+i,sizeof(uint64_t)*(sp->n1-i));
+    if(idx) memcpy(sp->ti+k,idx+i,sizeof(size_t)*(sp->n1-i));
+  } else if(j<n) {
+    memcpy(sp->tk+k,key+j,sizeof(uint64_t)*(n-j));
+    if(idx) memcpy(sp->ti+k,idx+j,sizeof(size_t)*(n-j));
+  }
+  return 0;
+}
+
+/* Run func on each of the n parts, the last in the calling thread */
+static void run_parts(void *(*func)(void *),struct sort_part *sp,const int n)
+{
+  pthread_t *th;
+  int i,*ok;
+
+  th=lk_malloc(sizeof(pthread_t)*n);
+  ok=lk_calloc((size_t)n,sizeof(int));
+  for(i=0;i<n-1;i++) {
+    if(!pthread_create(th+i,0,func,sp+i)) ok[i]=1;
+    else (void)func(sp+i);
+  }
+  (void)func(sp+n-1);
+  for(i=0;i<n-1;i++) if(ok[i]) (void)pthread_join(th[i],0);
+  free(ok);
+  free(th);
+}
+
+static void par_sort(uint64_t *key,size_t *idx,uint64_t *tk,size_t *ti,const size_t n,int nt)
+{
+  struct sort_part *sp;
+  size_t *b;
+  uint64_t *k1=key,*k2=tk,*kt;
+  size_t *i1=idx,*i2=ti,*it;
+  int i,j;
+
+  sp=lk_malloc(sizeof(struct sort_part)*nt);
+  b=lk_malloc(sizeof(size_t)*(nt+1));
+  for(i=0;i<=nt;i++) b[i]=(size_t)((double)n*(double)i/(double)nt);
+  b[nt]=n;
+  for(i=0;i<nt;i++) {
+    sp[i].key=key+b[i];
+    sp[i].tk=tk+b[i];
+    sp[i].idx=idx?idx+b[i]:0;
+    sp[i].ti=ti?ti+b[i]:0;
+    sp[i].n=b[i+1]-b[i];
+  }
+  run_parts(sort_thread,sp,nt);
+  /* Merge pairs of runs until one is left */
+  while(nt>1) {
+    for(i=j=0;i+1<nt;i+=2,j++) {
+      sp[j].key=k1+b[i];
+      sp[j].tk=k2+b[i];
+      sp[j].idx=i1?i1+b[i]:0;
+      sp[j].ti=i2?i2+b[i]:0;
+      sp[j].n1=b[i+1]-b[i];
+      sp[j].n=b[i+2]-b[i];
+    }
+    if(i<nt) {
+      memcpy(k2+b[i],k1+b[i],sizeof(uint64_t)*(n-b[i]));
+      if(i1) memcpy(i2+b[i],i1+b[i],sizeof(size_t)*(n-b[i]));
+    }
+    run_parts(merge_thread,sp,j);
+    for(i=0;i<nt;i+=2) b[i>>1]=b[i];
+    nt=(nt+1)>>1;
+    b[nt]=n;
+    kt=k1;
+    k1=k2;
+    k2=kt;
+    it=i1;
+    i1=i2;
+    i2=it;
+  }
+  if(k1!=key) {
+    memcpy(key,k1,sizeof(uint64_t)*n);
+    if(idx) memcpy(idx,i1,sizeof(size_t)*n);
+  }
+  free(b);
+  free(sp);
+}
+
+/* Sort key[] ascending, carrying idx[] (if not 0) with it */
+static void sort_keys(uint64_t *key,size_t *idx,const size_t n)
+{
+  uint64_t *tk;
+  size_t *ti=0;
+  int nt;
+
+  if(n<=LK_SORT_SMALL) {
+    insertion_sort(key,idx,n);
+    return;
+  }
+  tk=lk_malloc(sizeof(uint64_t)*n);
+  if(idx) ti=lk_malloc(sizeof(size_t)*n);
+  nt=get_sort_threads();
+  if((size_t)nt>n/LK_SORT_PAR_MIN) nt=(int)(n/LK_SORT_PAR_MIN);
+  if(nt<2) radix_sort(key,idx,tk,ti,n);
+  else par_sort(key,idx,tk,ti,n,nt);
+  if(ti) free(ti);
+  free(tk);
+}
+
+/* Key for sorting by value, in the same order as a comparison sort would
+ * give: -0.0 and 0.0 must compare equal to keep the sort stable */
+static uint64_t value_key(double z,const int flag)
+{
+  if(z==0.0) z=0.0;
+  return double_key(z,flag);
+}
+
+void lk_sort_doubles(double *x,size_t n)
+{
+  uint64_t *k;
+  size_t i;
+
+  if(n<2) return;
+  k=lk_malloc(sizeof(uint64_t)*n);
+  for(i=0;i<n;i++) k[i]=double_key(x[i],0);
+  sort_keys(k,0,n);
+  for(i=0;i<n;i++) x[i]=key_double(k[i]);
+  free(k);
+}
+
+void lk_sort_ints(int *x,size_t n)
+{
+  uint64_t *k;
+  size_t i;
+
+  if(n<2) return;
+  k=lk_malloc(sizeof(uint64_t)*n);
+  for(i=0;i<n;i++) k[i]=(uint64_t)((int64_t)x[i]+INT64_C(2147483648));
+  sort_keys(k,0,n);
+  for(i=0;i<n;i++) x[i]=(int)((int64_t)k[i]-INT64_C(2147483648));
+  free(k);
+}
+
+/* Sort the indices in idx[] by key[idx[i]] */
+void lk_sort_index(int *idx,size_t n,const double *key,const int flag)
+{
+  uint64_t *k;
+  size_t i,*p;
+  int *t;
+
+  if(n<2) return;
+  t=lk_malloc(sizeof(int)*n);
+  for(i=0;i<n;i++) t[i]=idx[i];
+  k=lk_malloc(sizeof(uint64_t)*n);
+  p=lk_malloc(sizeof(size_t)*n);
+  for(i=0;i<n;i++) {
+    k[i]=value_key(key[t[i]],flag);
+    p[i]=i;
+  }
+  sort_keys(k,p,n);
+  for(i=0;i<n;i++) idx[i]=t[p[i]];
+  free(p);
+  free(k);
+  free(t);
+}
+
+/* Sort n records of the given size in base[] by key[i], the key of record i */
+void lk_sort_by_key(void *base,size_t n,size_t size,const double *key,const int flag)
+{
+  uint64_t *k;
+  size_t i,*p;
+  char *t;
+
+  if(n<2) return;
+  k=lk_malloc(sizeof(uint64_t)*n);
+  p=lk_malloc(sizeof(size_t)*n);
+  for(i=0;i<n;i++) {
+    k[i]=value_key(key[i],flag);
+    p[i]=i;
+  }
+  sort_keys(k,p,n);
+  free(k);
+  t=lk_malloc(n*size);
+  for(i=0;i<n;i++) memcpy(t+i*size,(char *)base+p[i]*size,size);
+  memcpy(base,t,n*size);
+  free(t);
+  free(p);
+}
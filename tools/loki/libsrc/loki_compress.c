@@ -114,7 +114,7 @@ struct lk_compress *init_compress(void)
 				lkc->comp_path[COMPRESS_ZIP][0]=0;
 			}
 		}
-		for(i=0;i<COMPRESS_NONE;i++) if(lkc->comp_path[i][0]) break;
+		for(i=0;i<COMPRESS_NONE;i++) if(lkc->comp_path[i][0] || codec_available(i)) break;
 		lkc->default_compress=i;
 	
 		if(atexit(free_compress)) ABT_FUNC("Unable to register exit function free_compress()\n");
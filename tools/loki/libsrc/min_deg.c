@@ -11,6 +11,9 @@
  * Produce a min-degree ordering for factoring of a sparse matrix           *
  * components on a marker by marker basis.                                  *
  *                                                                          *
+ * Graphs of amd_min_size nodes or more are passed to amd_order() (amd.c),  *
+ * as the elimination graph built here gets too slow to update.             *
+ *                                                                          *
  * Copyright (C) Simon C. Heath 1997, 2000, 2002                            *
  * This is free software.  You can distribute it and/or modify it           *
  * under the terms of the Modified BSD license, see the file COPYING        *
@@ -29,14 +32,26 @@
 #include "utils.h"
 #include "loki_struct.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "min_deg.h"
 
 #define BSIZE 1024
 
 static struct mat_elem *free_node_list,**mat;
-static struct remember *MinDegBlock,*FirstRemBlock;
+static struct arena *md_arena;
 static double *score;
 static int *degree,*fill_in;
+static int amd_min_size=AMD_MIN_SIZE;
+
+void set_amd_min_size(int n)
+{
+  amd_min_size=n;
+}
+
+int get_amd_min_size(void)
+{
+  return amd_min_size;
+}
 
 static int calc_degree(int i,int *inv,int *flag,int *nn,struct deg_list *dlist,int fg)
 {
@@ -222,8 +237,7 @@ static struct mat_elem *alloc_new_nodes(int n)
   int i;
 	
   assert(n);
-  p=lk_malloc(sizeof(struct mat_elem)*n);
-  MinDegBlock=AddRemem(p,MinDegBlock);
+  p=arena_alloc(md_arena,sizeof(struct mat_elem)*n);
   /* Link blocks together */
   for(i=0;i<n-1;i++) p[i].next=p+i+1;
   p[n-1].next=0;
@@ -265,17 +279,15 @@ int *min_deg(int n,int *mm,int *order,int *group,int fg)
   struct mat_elem *p;
 	
   if(n<1 || !mm) {
-    if(FirstRemBlock) {
-      FreeRemem(FirstRemBlock);
-      FirstRemBlock=0;
+    if(md_arena) {
+      arena_free(md_arena);
+      md_arena=0;
     }
     return 0;
   }
-  if(!FirstRemBlock) {
-    FirstRemBlock=lk_malloc(sizeof(struct remember));
-    MinDegBlock=FirstRemBlock;
-    MinDegBlock->pos=0;
-    MinDegBlock->next=0;
+  if(n>=amd_min_size) return amd_order(n,mm,order,group,0,0,0);
+  if(!md_arena) {
+    md_arena=arena_new("min_deg",0);
     free_node_list=0;
   }
   mat=lk_malloc(sizeof(void *)*n);
@@ -526,18 +538,16 @@ int *greedy(int n,int *mm,int *order,int *group,double *wt,struct pair_wt *wt1,i
   double z;
 	
   if(n<1 || !mm) {
-    if(FirstRemBlock) {
-      FreeRemem(FirstRemBlock);
-      FirstRemBlock=0;
+    if(md_arena) {
+      arena_free(md_arena);
+      md_arena=0;
     }
     return 0;
   }
   *cost=0;
-  if(!FirstRemBlock) {
-    FirstRemBlock=lk_malloc(sizeof(struct remember));
-    MinDegBlock=FirstRemBlock;
-    MinDegBlock->pos=0;
-    MinDegBlock->next=0;
+  if(n>=amd_min_size) return amd_order(n,mm,order,group,wt,wt1,cost);
+  if(!md_arena) {
+    md_arena=arena_new("min_deg",0);
     free_node_list=0;
   }
   mat=lk_malloc(sizeof(void *)*n);
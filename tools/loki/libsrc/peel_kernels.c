@@ -0,0 +1,181 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * peel_kernels.c:                                                          *
+ *                                                                          *
+ * Inner loops of the nuclear family peeling operation.  The parental       *
+ * genotype combinations are held in struct of arrays form (one array for   *
+ * each of the four parental genes and one for the probabilities), and      *
+ * each offspring multiplies every combination by the probability of its    *
+ * genotype, summed over the four ways it can be transmitted.  Offspring    *
+ * probabilities are looked up in a genotype table indexed by               *
+ * (paternal allele << n_bits) | maternal allele.                           *
+ *                                                                          *
+ * With AVX2 (or AVX-512) enabled at compile time the lookups are done      *
+ * with gathers, 4 (or 8) combinations at a time, and the remainder with    *
+ * the scalar code.  Each lane does the same operations in the same order   *
+ * as the scalar code, so the results do not depend on the path taken.      *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+#include "peel_kernels.h"
+
+/* A fused multiply-add would round differently from the separate multiply
+ * and add, and the compiler might fuse the vector and scalar code
+ * differently, so keep them apart.  With SSE arithmetic doubles are held
+ * at their own precision, so -ffloat-store would only slow the loops down
+ * (it applies to the vector variables too) */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#ifdef __SSE2_MATH__
+#pragma GCC optimize ("no-float-store")
+#endif
+#endif
+
+/* p[i]*=t[0]*q[a|c]+t[1]*q[b|c]+t[2]*q[a|d]+t[3]*q[b|d] for i<n, where
+ * a=pg0[i]<<n_bits, b=pg1[i]<<n_bits, c=mg0[i] and d=mg1[i].  t[] holds
+ * the transmission probabilities in X_MM_PM, X_MM_PP, X_MP_PM, X_MP_PP
+ * order */
+void pk_trans_combine(double *p,const int *pg0,const int *pg1,const int *mg0,const int *mg1,
+		      const double *q,const double *t,const int n_bits,const int n)
+{
+  int i=0,a,b;
+  double z,t0=t[0],t1=t[1],t2=t[2],t3=t[3];
+#ifdef __AVX512F__
+  const __m128i sh=_mm_cvtsi32_si128(n_bits);
+  const __m512d w0=_mm512_set1_pd(t0),w1=_mm512_set1_pd(t1),w2=_mm512_set1_pd(t2),w3=_mm512_set1_pd(t3);
+  __m256i va,vb,vc,vd;
+  __m512d s;
+
+  for(;i+8<=n;i+=8) {
+    va=_mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(pg0+i)),sh);
+    vb=_mm256_sll_epi32(_mm256_loadu_si256((const __m256i *)(pg1+i)),sh);
+    vc=_mm256_loadu_si256((const __m256i *)(mg0+i));
+    vd=_mm256_loadu_si256((const __m256i *)(mg1+i));
+    s=_mm512_mul_pd(w0,_mm512_i32gather_pd(_mm256_or_si256(va,vc),q,8));
+    s=_mm512_add_pd(s,_mm512_mul_pd(w1,_mm512_i32gather_pd(_mm256_or_si256(vb,vc),q,8)));
+    s=_mm512_add_pd(s,_mm512_mul_pd(w2,_mm512_i32gather_pd(_mm256_or_si256(va,vd),q,8)));
+    s=_mm512_add_pd(s,_mm512_mul_pd(w3,_mm512_i32gather_pd(_mm256_or_si256(vb,vd),q,8)));
+    _mm512_storeu_pd(p+i,_mm512_mul_pd(_mm512_loadu_pd(p+i),s));
+  }
+#endif
+#ifdef __AVX2__
+  {
+    const __m128i sh4=_mm_cvtsi32_si128(n_bits);
+    const __m256d u0=_mm256_set1_pd(t0),u1=_mm256_set1_pd(t1),u2=_mm256_set1_pd(t2),u3=_mm256_set1_pd(t3);
+    __m128i xa,xb,xc,xd;
+    __m256d s4;
+
+    for(;i+4<=n;i+=4) {
+      xa=_mm_sll_epi32(_mm_loadu_si128((const __m128i *)(pg0+i)),sh4);
+      xb=_mm_sll_epi32(_mm_loadu_si128((const __m128i *)(pg1+i)),sh4);
+      xc=_mm_loadu_si128((const __m128i *)(mg0+i));
+      xd=_mm_loadu_si128((const __m128i *)(mg1+i));
+      s4=_mm256_mul_pd(u0,_mm256_i32gather_pd(q,_mm_or_si128(xa,xc),8));
+      s4=_mm256_add_pd(s4,_mm256_mul_pd(u1,_mm256_i32gather_pd(q,_mm_or_si128(xb,xc),8)));
+      s4=_mm256_add_pd(s4,_mm256_mul_pd(u2,_mm256_i32gather_pd(q,_mm_or_si128(xa,xd),8)));
+      s4=_mm256_add_pd(s4,_mm256_mul_pd(u3,_mm256_i32gather_pd(q,_mm_or_si128(xb,xd),8)));
+      _mm256_storeu_pd(p+i,_mm256_mul_pd(_mm256_loadu_pd(p+i),s4));
+    }
+  }
+#endif
+  for(;i<n;i++) {
+    a=pg0[i]<<n_bits;
+    b=pg1[i]<<n_bits;
+    z=t0*q[a|mg0[i]]+t1*q[b|mg0[i]]+t2*q[a|mg1[i]]+t3*q[b|mg1[i]];
+    p[i]*=z;
+  }
+}
+
+/* As pk_trans_combine(), but with the paternal genes first mapped through
+ * m1[] (which gives them already shifted) and the maternal genes through
+ * m2[].  Where the two mapped paternal genes are the same the transmissions
+ * from the sire are merged using tb[], and where the maternal genes are the
+ * same those from the dam are merged using ta[].
+ *
+ * The vector code always sums four terms, with zero weights for the terms
+ * that are merged away.  As the table entries are not negative, adding the
+ * zero terms leaves the sums unchanged */
+void pk_trans_combine_map(double *p,const int *pg0,const int *pg1,const int *mg0,const int *mg1,const double *q,const double *t,
+			  const double *ta,const double *tb,const int *m1,const int *m2,const int n)
+{
+  int i=0,a,b,c,d;
+  double z;
+#ifdef __AVX512F__
+  const __m512d t0=_mm512_set1_pd(t[0]),t1=_mm512_set1_pd(t[1]),t2=_mm512_set1_pd(t[2]),t3=_mm512_set1_pd(t[3]);
+  const __m512d ta0=_mm512_set1_pd(ta[0]),ta1=_mm512_set1_pd(ta[1]),tb0=_mm512_set1_pd(tb[0]),tb1=_mm512_set1_pd(tb[1]);
+  const __m512d one=_mm512_set1_pd(1.0),zero=_mm512_setzero_pd();
+  __m256i va,vb,vc,vd;
+  __m512d s,c0,c1,c2,c3;
+  __mmask8 ab,cd;
+
+  for(;i+8<=n;i+=8) {
+    va=_mm256_i32gather_epi32(m1,_mm256_loadu_si256((const __m256i *)(pg0+i)),4);
+    vb=_mm256_i32gather_epi32(m1,_mm256_loadu_si256((const __m256i *)(pg1+i)),4);
+    vc=_mm256_i32gather_epi32(m2,_mm256_loadu_si256((const __m256i *)(mg0+i)),4);
+    vd=_mm256_i32gather_epi32(m2,_mm256_loadu_si256((const __m256i *)(mg1+i)),4);
+    ab=_mm512_cmpeq_epi64_mask(_mm512_cvtepi32_epi64(va),_mm512_cvtepi32_epi64(vb));
+    cd=_mm512_cmpeq_epi64_mask(_mm512_cvtepi32_epi64(vc),_mm512_cvtepi32_epi64(vd));
+    c0=_mm512_mask_blend_pd(ab,_mm512_mask_blend_pd(cd,t0,ta0),_mm512_mask_blend_pd(cd,tb0,one));
+    c1=_mm512_mask_blend_pd(ab,_mm512_mask_blend_pd(cd,t1,ta1),zero);
+    c2=_mm512_mask_blend_pd(cd,_mm512_mask_blend_pd(ab,t2,tb1),zero);
+    c3=_mm512_mask_blend_pd(ab|cd,t3,zero);
+    s=_mm512_mul_pd(c0,_mm512_i32gather_pd(_mm256_or_si256(va,vc),q,8));
+    s=_mm512_add_pd(s,_mm512_mul_pd(c1,_mm512_i32gather_pd(_mm256_or_si256(vb,vc),q,8)));
+    s=_mm512_add_pd(s,_mm512_mul_pd(c2,_mm512_i32gather_pd(_mm256_or_si256(va,vd),q,8)));
+    s=_mm512_add_pd(s,_mm512_mul_pd(c3,_mm512_i32gather_pd(_mm256_or_si256(vb,vd),q,8)));
+    _mm512_storeu_pd(p+i,_mm512_mul_pd(_mm512_loadu_pd(p+i),s));
+  }
+#endif
+#ifdef __AVX2__
+  {
+    const __m256d u0=_mm256_set1_pd(t[0]),u1=_mm256_set1_pd(t[1]),u2=_mm256_set1_pd(t[2]),u3=_mm256_set1_pd(t[3]);
+    const __m256d ua0=_mm256_set1_pd(ta[0]),ua1=_mm256_set1_pd(ta[1]),ub0=_mm256_set1_pd(tb[0]),ub1=_mm256_set1_pd(tb[1]);
+    const __m256d one4=_mm256_set1_pd(1.0),zero4=_mm256_setzero_pd();
+    __m128i xa,xb,xc,xd;
+    __m256d s4,e0,e1,e2,e3,xab,xcd;
+
+    for(;i+4<=n;i+=4) {
+      xa=_mm_i32gather_epi32(m1,_mm_loadu_si128((const __m128i *)(pg0+i)),4);
+      xb=_mm_i32gather_epi32(m1,_mm_loadu_si128((const __m128i *)(pg1+i)),4);
+      xc=_mm_i32gather_epi32(m2,_mm_loadu_si128((const __m128i *)(mg0+i)),4);
+      xd=_mm_i32gather_epi32(m2,_mm_loadu_si128((const __m128i *)(mg1+i)),4);
+      xab=_mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_cmpeq_epi32(xa,xb)));
+      xcd=_mm256_castsi256_pd(_mm256_cvtepi32_epi64(_mm_cmpeq_epi32(xc,xd)));
+      e0=_mm256_blendv_pd(_mm256_blendv_pd(u0,ua0,xcd),_mm256_blendv_pd(ub0,one4,xcd),xab);
+      e1=_mm256_blendv_pd(_mm256_blendv_pd(u1,ua1,xcd),zero4,xab);
+      e2=_mm256_blendv_pd(_mm256_blendv_pd(u2,ub1,xab),zero4,xcd);
+      e3=_mm256_blendv_pd(u3,zero4,_mm256_or_pd(xab,xcd));
+      s4=_mm256_mul_pd(e0,_mm256_i32gather_pd(q,_mm_or_si128(xa,xc),8));
+      s4=_mm256_add_pd(s4,_mm256_mul_pd(e1,_mm256_i32gather_pd(q,_mm_or_si128(xb,xc),8)));
+      s4=_mm256_add_pd(s4,_mm256_mul_pd(e2,_mm256_i32gather_pd(q,_mm_or_si128(xa,xd),8)));
+      s4=_mm256_add_pd(s4,_mm256_mul_pd(e3,_mm256_i32gather_pd(q,_mm_or_si128(xb,xd),8)));
+      _mm256_storeu_pd(p+i,_mm256_mul_pd(_mm256_loadu_pd(p+i),s4));
+    }
+  }
+#endif
+  for(;i<n;i++) {
+    a=m1[pg0[i]];
+    b=m1[pg1[i]];
+    c=m2[mg0[i]];
+    d=m2[mg1[i]];
+    if(a!=b) {
+      if(c!=d) z=t[0]*q[a|c]+t[1]*q[b|c]+t[2]*q[a|d]+t[3]*q[b|d];
+      else z=ta[0]*q[a|c]+ta[1]*q[b|c];
+    } else if(c!=d) z=tb[0]*q[a|c]+tb[1]*q[a|d];
+    else z=q[a|c];
+    p[i]*=z;
+  }
+}
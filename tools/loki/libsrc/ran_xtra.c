@@ -59,18 +59,18 @@ double ppnd(double p,int *fault)
 #undef D2   
 #undef SPLIT 
 
-double trunc_normal(const double a,const double b,const int flag,int *err)
+double trunc_normal_r(struct rng_ctx *rng,const double a,const double b,const int flag,int *err)
 {
 	double u,t,t1,p;
 	
-	u=(double)ranf();
+	u=(double)ranf_r(rng);
 	t=flag==1?0.0:.5*(1.0+erf(a/sqrt(2.0)));
 	t1=flag==2?1.0:.5*(1.0+erf(b/sqrt(2.0)));
 	p=ppnd(t+u*(t1-t),err);
 	return p;
 }
 
-void dirichlet(const int n,const double *ct,double *fq)
+void dirichlet_r(struct rng_ctx *rng,const int n,const double *ct,double *fq)
 {
 	int i;
 	double z=1.0,z1=0.0;
@@ -78,9 +78,18 @@ void dirichlet(const int n,const double *ct,double *fq)
 	for(i=0;i<n;i++) z1+=ct[i];
 	for(i=0;i<n-1;i++) {
 		z1-=ct[i];
-		fq[i]=z*genbet(ct[i],z1);
+		fq[i]=z*genbet_r(rng,ct[i],z1);
 		z-=fq[i];
 	}
 	fq[i]=z;
 }
 
+double trunc_normal(const double a,const double b,const int flag,int *err)
+{
+	return trunc_normal_r(&lk_rng,a,b,flag,err);
+}
+
+void dirichlet(const int n,const double *ct,double *fq)
+{
+	dirichlet_r(&lk_rng,n,ct,fq);
+}
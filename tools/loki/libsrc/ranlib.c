@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
 
@@ -29,7 +30,7 @@ static double fsign( const double num, const double sign)
 	return ((sign>DBL_EPSILON && num<DBL_EPSILON)||(sign<DBL_EPSILON && num>DBL_EPSILON))?-num:num;
 }
 
-double genbet(const double aa,const double bb)
+double genbet_r(struct rng_ctx *rng,const double aa,const double bb)
 /**********************************************************************
      double genbet(double aa,double bb)
                GeNerate BETa random deviate
@@ -50,24 +51,23 @@ double genbet(const double aa,const double bb)
 **********************************************************************
 */
 {
+struct genbet_cache *cc=&rng->bet;
 /* JJV changed expmax (log(1.0E38)==87.49823), and added minlog */
 #define expmax 87.49823
 #define infnty 1.0E38
 #define minlog 1.0E-37
-static double olda = -1.0E37;
-static double oldb = -1.0E37;
-static double gbet,a,alpha,b,beta,delta,gamm,k1,k2,r,s,t,u1,u2,v,w,y,z;
-static int qsame;
+double gbet,r,s,t,u1,u2,v,w,y,z;
+int qsame;
 
-    qsame = fabs(olda-aa)<DBL_EPSILON && fabs(oldb-bb)<DBL_EPSILON;
+    qsame = fabs(cc->olda-aa)<DBL_EPSILON && fabs(cc->oldb-bb)<DBL_EPSILON;
     if(qsame) goto S20;
     if(!(aa < minlog || bb < minlog)) goto S10;
     (void)fputs(" AA or BB < 1.0E-37 in GENBET - Abort!\n",stderr);
     (void)fprintf(stderr," AA: %16.6E BB %16.6E\n",aa,bb);
     exit(EXIT_FAILURE);
 S10:
-    olda = aa;
-    oldb = bb;
+    cc->olda = aa;
+    cc->oldb = bb;
 S20:
     if(!(min(aa,bb) > 1.0)) goto S100;
 /*
@@ -75,19 +75,19 @@ S20:
      Initialize
 */
     if(qsame) goto S30;
-    a = min(aa,bb);
-    b = max(aa,bb);
-    alpha = a+b;
-    beta = sqrt((alpha-2.0)/(2.0*a*b-alpha));
-    gamm = a+1.0/beta;
+    cc->a = min(aa,bb);
+    cc->b = max(aa,bb);
+    cc->alpha = cc->a+cc->b;
+    cc->beta = sqrt((cc->alpha-2.0)/(2.0*cc->a*cc->b-cc->alpha));
+    cc->gamm = cc->a+1.0/cc->beta;
 S30:
 S40:
-    u1 = safe_ranf();
+    u1 = safe_ranf_r(rng);
 /*
      Step 1
 */
-    u2 = safe_ranf();
-    v = beta*log(u1/(1.0-u1));
+    u2 = safe_ranf_r(rng);
+    v = cc->beta*log(u1/(1.0-u1));
 /* JJV altered this */
     if(v > expmax) goto S55;
 /*
@@ -95,15 +95,15 @@ S40:
  * JJV S50 _was_ w = a*exp(v); also note here a > 1.0
  */
     w = exp(v);
-    if(w > infnty/a) goto S55;
-    w *= a;
+    if(w > infnty/cc->a) goto S55;
+    w *= cc->a;
     goto S60;
 S55:
     w = infnty;
 S60:
     z = pow(u1,2.0)*u2;
-    r = gamm*v-1.3862944;
-    s = a+r-w;
+    r = cc->gamm*v-1.3862944;
+    s = cc->a+r-w;
 /*
      Step 2
 */
@@ -122,17 +122,17 @@ S60:
  *    JJV the algorithm rejects the trial and starts over
  *    JJV May not need this here since alpha > 2.0
  */
-    if(alpha/(b+w) < minlog) goto S40;
-    if(r+alpha*log(alpha/(b+w)) < t) goto S40;
+    if(cc->alpha/(cc->b+w) < minlog) goto S40;
+    if(r+cc->alpha*log(cc->alpha/(cc->b+w)) < t) goto S40;
 S70:
 /*
      Step 5
 */
-    if(!(aa == a)) goto S80;
-    gbet = w/(b+w);
+    if(!(aa == cc->a)) goto S80;
+    gbet = w/(cc->b+w);
     goto S90;
 S80:
-    gbet = b/(b+w);
+    gbet = cc->b/(cc->b+w);
 S90:
     goto S230;
 S100:
@@ -141,27 +141,27 @@ S100:
      Initialize
 */
     if(qsame) goto S110;
-    a = max(aa,bb);
-    b = min(aa,bb);
-    alpha = a+b;
-    beta = 1.0/b;
-    delta = 1.0+a-b;
-    k1 = delta*(1.38889E-2+4.16667E-2*b)/(a*beta-0.777778);
-    k2 = 0.25+(0.5+0.25/delta)*b;
+    cc->a = max(aa,bb);
+    cc->b = min(aa,bb);
+    cc->alpha = cc->a+cc->b;
+    cc->beta = 1.0/cc->b;
+    cc->delta = 1.0+cc->a-cc->b;
+    cc->k1 = cc->delta*(1.38889E-2+4.16667E-2*cc->b)/(cc->a*cc->beta-0.777778);
+    cc->k2 = 0.25+(0.5+0.25/cc->delta)*cc->b;
 S110:
 S120:
-    u1 = safe_ranf();
+    u1 = safe_ranf_r(rng);
 /*
      Step 1
 */
-    u2 = safe_ranf();
+    u2 = safe_ranf_r(rng);
     if(u1 >= 0.5) goto S130;
 /*
      Step 2
 */
     y = u1*u2;
     z = u1*y;
-    if(0.25*u2+z-y >= k1) goto S120;
+    if(0.25*u2+z-y >= cc->k1) goto S120;
     goto S170;
 S130:
 /*
@@ -169,18 +169,18 @@ S130:
 */
     z = pow(u1,2.0)*u2;
     if(!(z <= 0.25)) goto S160;
-    v = beta*log(u1/(1.0-u1));
+    v = cc->beta*log(u1/(1.0-u1));
 /*
  *    JJV instead of checking v > expmax at top, I will check
  *    JJV if a < 1, then check the appropriate values
  */
-    if(a > 1.0) goto S135;
+    if(cc->a > 1.0) goto S135;
 /*   JJV a < 1 so it can help out if exp(v) would overflow */
     if(v > expmax) goto S132;
-    w = a*exp(v);
+    w = cc->a*exp(v);
     goto S200;
 S132:
-    w = v + log(a);
+    w = v + log(cc->a);
     if(w > expmax) goto S140;
     w = exp(w);
     goto S200;
@@ -188,8 +188,8 @@ S135:
 /*   JJV in this case a > 1 */
     if(v > expmax) goto S140;
     w = exp(v);
-    if(w > infnty/a) goto S140;
-    w *= a;
+    if(w > infnty/cc->a) goto S140;
+    w *= cc->a;
     goto S200;
 S140:
     w = infnty;
@@ -205,21 +205,21 @@ S140:
  *    goto S200;
  */
 S160:
-    if(z >= k2) goto S120;
+    if(z >= cc->k2) goto S120;
 S170:
 /*
      Step 4
      Step 5
 */
-    v = beta*log(u1/(1.0-u1));
+    v = cc->beta*log(u1/(1.0-u1));
 /*   JJV same kind of checking as above */
-    if(a > 1.0) goto S175;
+    if(cc->a > 1.0) goto S175;
 /* JJV a < 1 so it can help out if exp(v) would overflow */
     if(v > expmax) goto S172;
-    w = a*exp(v);
+    w = cc->a*exp(v);
     goto S190;
 S172:
-    w = v + log(a);
+    w = v + log(cc->a);
     if(w > expmax) goto S180;
     w = exp(w);
     goto S190;
@@ -227,8 +227,8 @@ S175:
 /* JJV in this case a > 1.0 */
     if(v > expmax) goto S180;
     w = exp(v);
-    if(w > infnty/a) goto S180;
-    w *= a;
+    if(w > infnty/cc->a) goto S180;
+    w *= cc->a;
     goto S190;
 S180:
     w = infnty;
@@ -245,17 +245,17 @@ S190:
  * JJV here we also check to see if log overlows; if so, we treat it
  * JJV as -INF, which means condition is true, i.e. restart
  */
-    if(alpha/(b+w) < minlog) goto S120;
-    if(alpha*(log(alpha/(b+w))+v)-1.3862944 < log(z)) goto S120;
+    if(cc->alpha/(cc->b+w) < minlog) goto S120;
+    if(cc->alpha*(log(cc->alpha/(cc->b+w))+v)-1.3862944 < log(z)) goto S120;
 S200:
 /*
      Step 6
 */
-    if(!(a == aa)) goto S210;
-    gbet = w/(b+w);
+    if(!(cc->a == aa)) goto S210;
+    gbet = w/(cc->b+w);
     goto S220;
 S210:
-    gbet = b/(b+w);
+    gbet = cc->b/(cc->b+w);
 S230:
 S220:
     return gbet;
@@ -263,7 +263,7 @@ S220:
 #undef infnty
 #undef minlog
 }
-double genchi(const double df)
+double genchi_r(struct rng_ctx *rng,const double df)
 /**********************************************************************
      double genchi(double df)
                 Generate random value of CHIsquare variable
@@ -279,7 +279,7 @@ double genchi(const double df)
 **********************************************************************
 */
 {
-static double gchi;
+double gchi;
 
     if(!(df <= 0.0)) goto S10;
     (void)fputs(" DF <= 0 in GENCHI - ABORT\n",stderr);
@@ -290,11 +290,11 @@ S10:
  * JJV changed the code to call SGAMMA directly
  *    genchi = 2.0*gengam(1.0,df/2.0); <- OLD
  */
-    gchi = 2.0*sgamma(df/2.0);
+    gchi = 2.0*sgamma_r(rng,df/2.0);
     return gchi;
 }
 
-double genexp(double const av)
+double genexp_r(struct rng_ctx *rng,double const av)
 /*
 **********************************************************************
      double genexp(double av)
@@ -317,7 +317,7 @@ double genexp(double const av)
 **********************************************************************
 */
 {
-static double gexp;
+double gexp;
 
 /* JJV added check that av >= 0 */
     if(av >= 0.0) goto S10;
@@ -325,10 +325,10 @@ static double gexp;
     (void)fprintf(stderr," Value of AV: %16.6E\n",av);
     exit(EXIT_FAILURE);
 S10:
-    gexp = sexpo()*av;
+    gexp = sexpo_r(rng)*av;
     return gexp;
 }
-double genf(const double dfn,const double dfd)
+double genf_r(struct rng_ctx *rng,const double dfn,const double dfd)
 /*
 **********************************************************************
      double genf(double dfn,double dfd)
@@ -347,7 +347,7 @@ double genf(const double dfn,const double dfd)
 **********************************************************************
 */
 {
-static double gf,xden,xnum;
+double gf,xden,xnum;
 
     if(!(dfn <= 0.0 || dfd <= 0.0)) goto S10;
     (void)fputs(" Degrees of freedom nonpositive in GENF - abort!\n",stderr);
@@ -361,8 +361,8 @@ S10:
  *   xnum = genchi(dfn)/dfn; <- OLD
  *   xden = genchi(dfd)/dfd; <- OLD
  */
-    xnum = 2.0*sgamma(dfn/2.0)/dfn;
-    xden = 2.0*sgamma(dfd/2.0)/dfd;
+    xnum = 2.0*sgamma_r(rng,dfn/2.0)/dfn;
+    xden = 2.0*sgamma_r(rng,dfd/2.0)/dfd;
 /*
  * JJV changed constant to prevent underflow at compile time.
  *   if(!(xden <= 9.999999999998E-39*xnum)) goto S20;
@@ -384,7 +384,7 @@ S20:
 S30:
     return gf;
 }
-double gengam(const double a,const double r)
+double gengam_r(struct rng_ctx *rng,const double a,const double r)
 /*
 **********************************************************************
      double gengam(double a,double r)
@@ -418,19 +418,19 @@ double gengam(const double a,const double r)
 **********************************************************************
 */
 {
-static double ggam;
+double ggam;
 /* JJV added argument checker */
     if(a > 0.0 && r > 0.0) goto S10;
     (void)fputs(" A or R nonpositive in GENGAM - abort!\n",stderr);
     (void)fprintf(stderr," A value: %16.6E R value: %16.6E\n",a,r);
     exit(EXIT_FAILURE);
 S10:
-    ggam = sgamma(r);
+    ggam = sgamma_r(rng,r);
     ggam /= a;
     return ggam;
 }
 
-void genmul(const int n,const double *p,const int ncat,int *ix)
+void genmul_r(struct rng_ctx *rng,const int n,const double *p,const int ncat,int *ix)
 /*
 **********************************************************************
  
@@ -458,8 +458,8 @@ void genmul(const int n,const double *p,const int ncat,int *ix)
 **********************************************************************
 */
 {
-static double prob,ptot,sum;
-static int i,icat,ntot;
+double prob,ptot,sum;
+int i,icat,ntot;
     if(n < 0) ftnstop("N < 0 in GENMUL");
     if(ncat <= 1) ftnstop("NCAT <= 1 in GENMUL");
     ptot = 0.0F;
@@ -480,7 +480,7 @@ static int i,icat,ntot;
 */
     for(icat=0; icat<ncat-1; icat++) {
         prob = *(p+icat)/sum;
-        *(ix+icat) = ignbin(ntot,prob);
+        *(ix+icat) = ignbin_r(rng,ntot,prob);
         ntot -= *(ix+icat);
 	if(ntot <= 0) return;
         sum -= *(p+icat);
@@ -492,7 +492,7 @@ static int i,icat,ntot;
     return;
 }
 
-double gennch(const double df,const double xnonc)
+double gennch_r(struct rng_ctx *rng,const double df,const double xnonc)
 /*
 **********************************************************************
      double gennch(double df,double xnonc)
@@ -513,7 +513,7 @@ double gennch(const double df,const double xnonc)
 **********************************************************************
 */
 {
-static double g;
+double g;
 
     if(!(df < 1.0 || xnonc < 0.0)) goto S10;
     (void)fputs("DF < 1 or XNONC < 0 in GENNCH - ABORT\n",stderr);
@@ -526,19 +526,19 @@ S10:
  * JJV case df == 1.0
  * gennch = pow(gennor(sqrt(xnonc),1.0),2.0); <- OLD
  */
-    g = pow(snorm()+sqrt(xnonc),2.0);
+    g = pow(snorm_r(rng)+sqrt(xnonc),2.0);
     goto S30;
 S20:
 /*
  * JJV case df > 1.0
  * gennch = genchi(df-1.0)+pow(gennor(sqrt(xnonc),1.0),2.0); <- OLD
  */
-    g = 2.0*sgamma((df-1.0)/2.0)+pow(snorm()+sqrt(xnonc),2.0);
+    g = 2.0*sgamma_r(rng,(df-1.0)/2.0)+pow(snorm_r(rng)+sqrt(xnonc),2.0);
 S30:
     return g;
 }
 
-double gennf(const double dfn,const double dfd,const double xnonc)
+double gennf_r(struct rng_ctx *rng,const double dfn,const double dfd,const double xnonc)
 /*
 **********************************************************************
      double gennf(double dfn,double dfd,double xnonc)
@@ -561,8 +561,8 @@ double gennf(const double dfn,const double dfd,const double xnonc)
 **********************************************************************
 */
 {
-static double gnf,xden,xnum;
-static int qcond;
+double gnf,xden,xnum;
+int qcond;
 
     /* JJV changed qcond, error message to allow dfn == 1.0 */
     qcond = dfn < 1.0 || dfd <= 0.0 || xnonc < 0.0;
@@ -583,13 +583,13 @@ S10:
  */
     if(dfn >= 1.000001) goto S20;
 /* JJV case dfn == 1.0, dfn is counted as exactly 1.0 */
-    xnum = pow(snorm()+sqrt(xnonc),2.0);
+    xnum = pow(snorm_r(rng)+sqrt(xnonc),2.0);
     goto S30;
 S20:
 /* JJV case df > 1.0 */
-    xnum = (2.0*sgamma((dfn-1.0)/2.0)+pow(snorm()+sqrt(xnonc),2.0))/dfn;
+    xnum = (2.0*sgamma_r(rng,(dfn-1.0)/2.0)+pow(snorm_r(rng)+sqrt(xnonc),2.0))/dfn;
 S30:
-    xden = 2.0*sgamma(dfd/2.0)/dfd;
+    xden = 2.0*sgamma_r(rng,dfd/2.0)/dfd;
 /*
  * JJV changed constant to prevent underflow at compile time.
  *   if(!(xden <= 9.999999999998E-39*xnum)) goto S40;
@@ -611,7 +611,7 @@ S40:
 S50:
     return gnf;
 }
-double gennor(const double av,const double sd)
+double gennor_r(struct rng_ctx *rng,const double av,const double sd)
 /*
 **********************************************************************
      double gennor(double av,double sd)
@@ -640,9 +640,9 @@ double gennor(const double av,const double sd)
     (void)fprintf(stderr," Value of SD: %16.6E\n",sd);
     exit(EXIT_FAILURE);
 S10:
-    return sd*snorm()+av;
+    return sd*snorm_r(rng)+av;
 }
-void genprm(int *iarray,const int larray)
+void genprm_r(struct rng_ctx *rng,int *iarray,const int larray)
 /*
 **********************************************************************
     void genprm(int *iarray,int larray)
@@ -654,16 +654,16 @@ void genprm(int *iarray,const int larray)
 **********************************************************************
 */
 {
-static int i,itmp,iwhich,D1,D2;
+int i,itmp,iwhich,D1,D2;
 
     for(i=1,D1=1,D2=(larray-i+D1)/D1; D2>0; D2--,i+=D1) {
-        iwhich = ignuin(i,larray);
+        iwhich = ignuin_r(rng,i,larray);
         itmp = *(iarray+iwhich-1);
         *(iarray+iwhich-1) = *(iarray+i-1);
         *(iarray+i-1) = itmp;
     }
 }
-double genunf(const double low,const double high)
+double genunf_r(struct rng_ctx *rng,const double low,const double high)
 /*
 **********************************************************************
      double genunf(double low,double high)
@@ -681,10 +681,10 @@ double genunf(const double low,const double high)
     (void)fputs("Abort\n",stderr);
     exit(EXIT_FAILURE);
 S10:
-    return low+(high-low)*safe_ranf();
+    return low+(high-low)*safe_ranf_r(rng);
 }
 
-int ignbin(const int n,const double pp)
+int ignbin_r(struct rng_ctx *rng,const int n,const double pp)
 /*
 **********************************************************************
      int ignbin(int n,double pp)
@@ -792,16 +792,14 @@ int ignbin(const int n,const double pp)
 *****DETERMINE APPROPRIATE ALGORITHM AND WHETHER SETUP IS NECESSARY
 */
 {
+struct ignbin_cache *cc=&rng->bin;
 /* JJV changed initial values to ridiculous values */
-static double psave = -1.0E37;
-static int nsave = -214748365;
-static int i,ix,ix1,k,m,mp,T1;
-static double al,alv,amaxp,c,f,f1,f2,ffm,fm,g,p,p1,p2,p3,p4,q,qn,r,u,v,w,w2,x,x1,
-    x2,xl,xll,xlr,xm,xnp,xnpq,xr,ynorm,z,z2;
+int i,ix,ix1,k,mp,T1;
+double al,alv,amaxp,f,f1,f2,u,v,w,w2,x,x1,x2,ynorm,z,z2;
 
-    if(pp != psave) goto S10;
-    if(n != nsave) goto S20;
-    if(xnp < 30.0) goto S150;
+    if(pp != cc->psave) goto S10;
+    if(n != cc->nsave) goto S20;
+    if(cc->xnp < 30.0) goto S150;
     goto S30;
 S10:
 /*
@@ -810,52 +808,52 @@ JJV added checks to ensure 0.0 <= PP <= 1.0
 */
     if(pp < 0.0F) ftnstop("PP < 0.0 in IGNBIN");
     if(pp > 1.0F) ftnstop("PP > 1.0 in IGNBIN");
-    psave = pp;
-    p = min(psave,1.0-psave);
-    q = 1.0-p;
+    cc->psave = pp;
+    cc->p = min(cc->psave,1.0-cc->psave);
+    cc->q = 1.0-cc->p;
 S20:
 /*
 JJV added check to ensure N >= 0
 */
     if(n < 0L) ftnstop("N < 0 in IGNBIN");
-    xnp = n*p;
-    nsave = n;
-    if(xnp < 30.0) goto S140;
-    ffm = xnp+p;
-    m = (int)ffm;
-    fm = (double)m;
-    xnpq = xnp*q;
-    p1 = (int) (2.195*sqrt(xnpq)-4.6*q)+0.5;
-    xm = fm+0.5;
-    xl = xm-p1;
-    xr = xm+p1;
-    c = 0.134+20.5/(15.3+fm);
-    al = (ffm-xl)/(ffm-xl*p);
-    xll = al*(1.0+0.5*al);
-    al = (xr-ffm)/(xr*q);
-    xlr = al*(1.0+0.5*al);
-    p2 = p1*(1.0+c+c);
-    p3 = p2+c/xll;
-    p4 = p3+c/xlr;
+    cc->xnp = n*cc->p;
+    cc->nsave = n;
+    if(cc->xnp < 30.0) goto S140;
+    cc->ffm = cc->xnp+cc->p;
+    cc->m = (int)cc->ffm;
+    cc->fm = (double)cc->m;
+    cc->xnpq = cc->xnp*cc->q;
+    cc->p1 = (int) (2.195*sqrt(cc->xnpq)-4.6*cc->q)+0.5;
+    cc->xm = cc->fm+0.5;
+    cc->xl = cc->xm-cc->p1;
+    cc->xr = cc->xm+cc->p1;
+    cc->c = 0.134+20.5/(15.3+cc->fm);
+    al = (cc->ffm-cc->xl)/(cc->ffm-cc->xl*cc->p);
+    cc->xll = al*(1.0+0.5*al);
+    al = (cc->xr-cc->ffm)/(cc->xr*cc->q);
+    cc->xlr = al*(1.0+0.5*al);
+    cc->p2 = cc->p1*(1.0+cc->c+cc->c);
+    cc->p3 = cc->p2+cc->c/cc->xll;
+    cc->p4 = cc->p3+cc->c/cc->xlr;
 S30:
 /*
 *****GENERATE VARIATE
 */
-    u = safe_ranf()*p4;
-    v = safe_ranf();
+    u = safe_ranf_r(rng)*cc->p4;
+    v = safe_ranf_r(rng);
 /*
      TRIANGULAR REGION
 */
-    if(u > p1) goto S40;
-    ix = (int)(xm-p1*v+u);
+    if(u > cc->p1) goto S40;
+    ix = (int)(cc->xm-cc->p1*v+u);
     goto S170;
 S40:
 /*
      PARALLELOGRAM REGION
 */
-    if(u > p2) goto S50;
-    x = xl+(u-p1)/c;
-    v = v*c+1.0-ABS(xm-x)/p1;
+    if(u > cc->p2) goto S50;
+    x = cc->xl+(u-cc->p1)/cc->c;
+    v = v*cc->c+1.0-ABS(cc->xm-x)/cc->p1;
     if(v > 1.0 || v <= 0.0) goto S30;
     ix = (int)x;
     goto S70;
@@ -863,41 +861,41 @@ S50:
 /*
      LEFT TAIL
 */
-    if(u > p3) goto S60;
-    ix = (int)(xl+log(v)/xll);
+    if(u > cc->p3) goto S60;
+    ix = (int)(cc->xl+log(v)/cc->xll);
     if(ix < 0) goto S30;
-    v *= ((u-p2)*xll);
+    v *= ((u-cc->p2)*cc->xll);
     goto S70;
 S60:
 /*
      RIGHT TAIL
 */
-    ix = (int)(xr-log(v)/xlr);
+    ix = (int)(cc->xr-log(v)/cc->xlr);
     if(ix > n) goto S30;
-    v *= ((u-p3)*xlr);
+    v *= ((u-cc->p3)*cc->xlr);
 S70:
 /*
 *****DETERMINE APPROPRIATE WAY TO PERFORM ACCEPT/REJECT TEST
 */
-    k = ABS(ix-m);
-    if(k > 20 && k < xnpq/2-1) goto S130;
+    k = ABS(ix-cc->m);
+    if(k > 20 && k < cc->xnpq/2-1) goto S130;
 /*
      EXPLICIT EVALUATION
 */
     f = 1.0;
-    r = p/q;
-    g = (n+1)*r;
-    T1 = m-ix;
+    cc->r = cc->p/cc->q;
+    cc->g = (n+1)*cc->r;
+    T1 = cc->m-ix;
     if(T1 < 0) goto S80;
     else if(T1 == 0) goto S120;
     else  goto S100;
 S80:
-    mp = m+1;
-    for(i=mp; i<=ix; i++) f *= (g/i-r);
+    mp = cc->m+1;
+    for(i=mp; i<=ix; i++) f *= (cc->g/i-cc->r);
     goto S120;
 S100:
     ix1 = ix+1;
-    for(i=ix1; i<=m; i++) f /= (g/i-r);
+    for(i=ix1; i<=cc->m; i++) f /= (cc->g/i-cc->r);
 S120:
     if(v <= f) goto S170;
     goto S30;
@@ -905,8 +903,8 @@ S130:
 /*
      SQUEEZING USING UPPER AND LOWER BOUNDS ON ALOG(F(X))
 */
-    amaxp = k/xnpq*((k*(k/3.0+0.625)+0.1666666666666)/xnpq+0.5);
-    ynorm = -(k*k/(2.0*xnpq));
+    amaxp = k/cc->xnpq*((k*(k/3.0+0.625)+0.1666666666666)/cc->xnpq+0.5);
+    ynorm = -(k*k/(2.0*cc->xnpq));
     alv = log(v);
     if(alv < ynorm-amaxp) goto S170;
     if(alv > ynorm+amaxp) goto S30;
@@ -915,14 +913,14 @@ S130:
      THE FINAL ACCEPTANCE/REJECTION TEST
 */
     x1 = ix+1.0;
-    f1 = fm+1.0;
-    z = n+1.0-fm;
+    f1 = cc->fm+1.0;
+    z = n+1.0-cc->fm;
     w = n-ix+1.0;
     z2 = z*z;
     x2 = x1*x1;
     f2 = f1*f1;
     w2 = w*w;
-    if(alv <= xm*log(f1/x1)+(n-m+0.5)*log(z/w)+(ix-m)*log(w*p/(x1*q))+(13860.0-
+    if(alv <= cc->xm*log(f1/x1)+(n-cc->m+0.5)*log(z/w)+(ix-cc->m)*log(w*cc->p/(x1*cc->q))+(13860.0-
       (462.0-(132.0-(99.0-140.0/f2)/f2)/f2)/f2)/f1/166320.0+(13860.0-(462.0-
       (132.0-(99.0-140.0/z2)/z2)/z2)/z2)/z/166320.0+(13860.0-(462.0-(132.0-
       (99.0-140.0/x2)/x2)/x2)/x2)/x1/166320.0+(13860.0-(462.0-(132.0-(99.0
@@ -932,25 +930,25 @@ S140:
 /*
      INVERSE CDF LOGIC FOR MEAN LESS THAN 30
 */
-    qn = pow(q,(double)n);
-    r = p/q;
-    g = r*(n+1);
+    cc->qn = pow(cc->q,(double)n);
+    cc->r = cc->p/cc->q;
+    cc->g = cc->r*(n+1);
 S150:
     ix = 0;
-    f = qn;
-    u = safe_ranf();
+    f = cc->qn;
+    u = safe_ranf_r(rng);
 S160:
     if(u < f) goto S170;
     if(ix > 110) goto S150;
     u -= f;
     ix += 1;
-    f *= (g/ix-r);
+    f *= (cc->g/ix-cc->r);
     goto S160;
 S170:
-    if(psave > 0.5) ix = n-ix;
+    if(cc->psave > 0.5) ix = n-ix;
     return ix;
 }
-int ignnbn(const int n,const double p)
+int ignnbn_r(struct rng_ctx *rng,const int n,const double p)
 /*
 **********************************************************************
  
@@ -975,7 +973,7 @@ int ignnbn(const int n,const double p)
 **********************************************************************
 */
 {
-static double y,a,r;
+double y,a,r;
 /*
      ..
      .. Executable Statements ..
@@ -997,13 +995,13 @@ static double y,a,r;
  * JJV changed this to call SGAMMA directly
  *  y = gengam(a,r); <- OLD
  */
-    y = sgamma(r)/a;
+    y = sgamma_r(rng,r)/a;
 /*
      Generate a random Poisson(y) variable
 */
-    return ignpoi(y);
+    return ignpoi_r(rng,y);
 }
-int ignpoi(const double mu)
+int ignpoi_r(struct rng_ctx *rng,const double mu)
 /*
 **********************************************************************
      int ignpoi(double mu)
@@ -1055,6 +1053,7 @@ int ignpoi(const double mu)
      SEPARATION OF CASES A AND B
 */
 {
+struct ignpoi_cache *cc=&rng->poi;
 static double a0 = -0.5;
 static double a1 = 0.3333333;
 static double a2 = -0.2500068;
@@ -1064,49 +1063,46 @@ static double a5 = 0.1421878;
 static double a6 = -0.1384794;
 static double a7 = 0.125006;
 /* JJV changed the initial values of MUPREV and MUOLD */
-static double muold = -1.0E37;
-static double muprev = -1.0E37;
 static double fact[10] = {
     1.0,1.0,2.0,6.0,24.0,120.0,720.0,5040.0,40320.0,362880.0
 };
 /* JJV added ll to the list, for Case A */
- static int ipoi,j,k,kflag,l,ll,m;
-static double b1,b2,c,c0,c1,c2,c3,d,del,difmuk,e,fk,fx,fy,g,omega,p,p0,px,py,q,s,
-    t,u,v,x,xx,pp[35];
+ int ipoi=0,j,k,kflag;
+double del,difmuk=0.0,e,fk=0.0,fx,fy,g,px,py,t,u,v,x,xx;
 
-    if(mu == muprev) goto S10;
+    if(mu == cc->muprev) goto S10;
     if(mu < 10.0) goto S120;
 /*
      C A S E  A. (RECALCULATION OF S,D,LL IF MU HAS CHANGED)
      JJV changed l in Case A to ll
 */
-    muprev = mu;
-    s = sqrt(mu);
-    d = 6.0*mu*mu;
+    cc->muprev = mu;
+    cc->s = sqrt(mu);
+    cc->d = 6.0*mu*mu;
 /*
              THE POISSON PROBABILITIES PK EXCEED THE DISCRETE NORMAL
              PROBABILITIES FK WHENEVER K >= M(MU). LL=IFIX(MU-1.1484)
              IS AN UPPER BOUND TO M(MU) FOR ALL MU >= 10 .
 */
-    ll = (int) (mu-1.1484);
+    cc->ll = (int) (mu-1.1484);
 S10:
 /*
      STEP N. NORMAL SAMPLE - SNORM(IR) FOR STANDARD NORMAL DEVIATE
 */
-    g = mu+s*snorm();
+    g = mu+cc->s*snorm_r(rng);
     if(g < 0.0) goto S20;
     ipoi = (int) (g);
 /*
      STEP I. IMMEDIATE ACCEPTANCE IF IGNPOI IS LARGE ENOUGH
 */
-    if(ipoi >= ll) return ipoi;
+    if(ipoi >= cc->ll) return ipoi;
 /*
      STEP S. SQUEEZE ACCEPTANCE - SUNIF(IR) FOR (0,1)-SAMPLE U
 */
     fk = (double)ipoi;
     difmuk = mu-fk;
-    u = safe_ranf();
-    if(d*u >= difmuk*difmuk*difmuk) return ipoi;
+    u = safe_ranf_r(rng);
+    if(cc->d*u >= difmuk*difmuk*difmuk) return ipoi;
 S20:
 /*
      STEP P. PREPARATIONS FOR STEPS Q AND H.
@@ -1116,16 +1112,16 @@ S20:
              APPROXIMATIONS TO THE DISCRETE NORMAL PROBABILITIES FK.
              C=.1069/MU GUARANTEES MAJORIZATION BY THE 'HAT'-FUNCTION.
 */
-    if(mu == muold) goto S30;
-    muold = mu;
-    omega = 0.3989423/s;
-    b1 = 4.166667E-2/mu;
-    b2 = 0.3*b1*b1;
-    c3 = 0.1428571*b1*b2;
-    c2 = b2-15.0*c3;
-    c1 = b1-6.0*b2+45.0*c3;
-    c0 = 1.0-b1+3.0*b2-15.0*c3;
-    c = 0.1069/mu;
+    if(mu == cc->muold) goto S30;
+    cc->muold = mu;
+    cc->omega = 0.3989423/cc->s;
+    cc->b1 = 4.166667E-2/mu;
+    cc->b2 = 0.3*cc->b1*cc->b1;
+    cc->c3 = 0.1428571*cc->b1*cc->b2;
+    cc->c2 = cc->b2-15.0*cc->c3;
+    cc->c1 = cc->b1-6.0*cc->b2+45.0*cc->c3;
+    cc->c0 = 1.0-cc->b1+3.0*cc->b2-15.0*cc->c3;
+    cc->c = 0.1069/mu;
 S30:
     if(g < 0.0) goto S50;
 /*
@@ -1144,12 +1140,12 @@ S50:
              DEVIATE E AND SAMPLE T FROM THE LAPLACE 'HAT'
              (IF T <= -.6744 THEN PK < FK FOR ALL MU >= 10.)
 */
-    e = sexpo();
-    u = safe_ranf();
+    e = sexpo_r(rng);
+    u = safe_ranf_r(rng);
     u += (u-1.0);
     t = 1.8+fsign(e,u);
     if(t <= -0.6744) goto S50;
-    ipoi = (int) (mu+s*t);
+    ipoi = (int) (mu+cc->s*t);
     fk = (double)ipoi;
     difmuk = mu-fk;
 /*
@@ -1161,7 +1157,7 @@ S60:
 /*
      STEP H. HAT ACCEPTANCE (E IS REPEATED ON REJECTION)
 */
-    if(c*fabs(u) > py*exp(px+e)-fy*exp(fx+e)) goto S50;
+    if(cc->c*fabs(u) > py*exp(px+e)-fy*exp(fx+e)) goto S50;
     return ipoi;
 S70:
 /*
@@ -1189,10 +1185,10 @@ S90:
 S100:
     py = 0.3989423/sqrt(fk);
 S110:
-    x = (0.5-difmuk)/s;
+    x = (0.5-difmuk)/cc->s;
     xx = x*x;
     fx = -0.5*xx;
-    fy = omega*(((c3*xx+c2)*xx+c1)*xx+c0);
+    fy = cc->omega*(((cc->c3*xx+cc->c2)*xx+cc->c1)*xx+cc->c0);
     if(kflag <= 0) goto S40;
     goto S60;
 S120:
@@ -1200,58 +1196,58 @@ S120:
      C A S E  B. (START NEW TABLE AND CALCULATE P0 IF NECESSARY)
      JJV changed MUPREV assignment to initial value
 */
-    muprev = -1.0E37;
-    if(mu == muold) goto S130;
+    cc->muprev = -1.0E37;
+    if(mu == cc->muold) goto S130;
 /* JJV added argument checker here */
     if(mu >= 0.0) goto S125;
     (void)fprintf(stderr,"MU < 0 in IGNPOI: MU %16.6E\n",mu);
     (void)fputs("Abort\n",stderr);
     exit(EXIT_FAILURE);
 S125:
-    muold = mu;
-    m = max(1,(int) (mu));
-    l = 0;
-    p = exp(-mu);
-    q = p0 = p;
+    cc->muold = mu;
+    cc->m = max(1,(int) (mu));
+    cc->l = 0;
+    cc->p = exp(-mu);
+    cc->q = cc->p0 = cc->p;
 S130:
 /*
      STEP U. UNIFORM SAMPLE FOR INVERSION METHOD
 */
-    u = safe_ranf();
+    u = safe_ranf_r(rng);
     ipoi = 0;
-    if(u <= p0) return ipoi;
+    if(u <= cc->p0) return ipoi;
 /*
      STEP T. TABLE COMPARISON UNTIL THE END PP(L) OF THE
              PP-TABLE OF CUMULATIVE POISSON PROBABILITIES
              (0.458=PP(9) FOR MU=10)
 */
-    if(l == 0) goto S150;
+    if(cc->l == 0) goto S150;
     j = 1;
-    if(u > 0.458) j = min(l,m);
-    for(k=j; k<=l; k++) {
-        if(u <= *(pp+k-1)) goto S180;
+    if(u > 0.458) j = min(cc->l,cc->m);
+    for(k=j; k<=cc->l; k++) {
+        if(u <= *(cc->pp+k-1)) goto S180;
     }
-    if(l == 35) goto S130;
+    if(cc->l == 35) goto S130;
 S150:
 /*
      STEP C. CREATION OF NEW POISSON PROBABILITIES P
              AND THEIR CUMULATIVES Q=PP(K)
 */
-    l += 1;
-    for(k=l; k<=35; k++) {
-        p = p*mu/(double)k;
-        q += p;
-        *(pp+k-1) = q;
-        if(u <= q) goto S170;
+    cc->l += 1;
+    for(k=cc->l; k<=35; k++) {
+        cc->p = cc->p*mu/(double)k;
+        cc->q += cc->p;
+        *(cc->pp+k-1) = cc->q;
+        if(u <= cc->q) goto S170;
     }
-    l = 35;
+    cc->l = 35;
     goto S130;
 S170:
-    l = k;
+    cc->l = k;
 S180:
     return k;
 }
-int ignuin(const int low,const int high)
+int ignuin_r(struct rng_ctx *rng,const int low,const int high)
 /*
 **********************************************************************
      int ignuin(int low,int high)
@@ -1269,7 +1265,7 @@ int ignuin(const int low,const int high)
      MAXNUM is 1 less than maximum generable value
 */
 {
-static int ranp1;
+int ranp1;
 	
     if(!(low > high)) goto S10;
     (void)fputs(" low > high in ignuin - ABORT\n",stderr);
@@ -1281,7 +1277,8 @@ S10:
     return low;
 
 S30:
-    return low+(int)(safe_ranf()*(double)(ranp1+1));
+    ranp1 = high-low;
+    return low+(int)(safe_ranf_r(rng)*(double)(ranp1+1));
 }
 
 int mltmod(const int a,const int s,const int m)
@@ -1302,7 +1299,7 @@ int mltmod(const int a,const int s,const int m)
 #define h2 15
 #define h (1<<h2)
 	
-static int a0,a1,k,p,q,qh,rh;
+int a0,a1,k,p,q,qh,rh;
 /*
      H2 = ((b-2)/2) where b = 32 because we are using a 32 bit
       machine. On a different machine recompute H
@@ -1380,7 +1377,7 @@ S140:
 #undef h
 }
 
-double sexpo(void) /*@*/
+double sexpo_r(struct rng_ctx *rng)
 /*
 **********************************************************************
                                                                       
@@ -1413,12 +1410,12 @@ static double q[8] = {
     0.6931472,0.9333737,0.9888778,0.9984959,0.9998293,0.9999833,0.9999986,
     .9999999
 };
-static int i;
-static double a,u,ustar,umin;
+int i;
+double a,u,ustar,umin;
 static double *q1 = q;
 S21:
     a = 0.0;
-    u = safe_ranf();
+    u = safe_ranf_r(rng);
     goto S30;
 S20:
     a += *q1;
@@ -1436,17 +1433,17 @@ S30:
 S60:
 	 if(u>q[7]) goto S21;
     i = 1;
-    ustar = safe_ranf();
+    ustar = safe_ranf_r(rng);
     umin = ustar;
 S70:
-    ustar = safe_ranf();
+    ustar = safe_ranf_r(rng);
     if(ustar < umin) umin = ustar;
     i += 1;
     if(u > *(q+i-1)) goto S70;
     return a+umin**q1;
 }
 
-double sgamma(const double a)
+double sgamma_r(struct rng_ctx *rng,const double a)
 /*
 **********************************************************************
                                                                       
@@ -1499,6 +1496,7 @@ double sgamma(const double a)
      SQRT32 IS THE SQUAREROOT OF 32 = 5.656854249492380
 */
 {
+struct sgamma_cache *cc=&rng->gam;
 static double q1 = 4.166669E-2;
 static double q2 = 2.083148E-2;
 static double q3 = 8.01191E-3;
@@ -1518,42 +1516,40 @@ static double e2 = 0.4999897;
 static double e3 = 0.166829;
 static double e4 = 4.07753E-2;
 static double e5 = 1.0293E-2;
-static double aa = 0.0;
-static double aaa = 0.0;
 static double sqrt32 = 5.656854;
 /* JJV added b0 to fix rare and subtle bug */
- static double sgam,s2,s,d,t,x,u,r,q0,b,b0,si,c,v,q,e,w,p;
-    if(a == aa) goto S10;
+ double sgam,t,x,u,r,b0,v,q,e,w,p;
+    if(a == cc->aa) goto S10;
     if(a < 1.0) goto S120;
 /*
      STEP  1:  RECALCULATIONS OF S2,S,D IF A HAS CHANGED
 */
-    aa = a;
-    s2 = a-0.5;
-    s = sqrt(s2);
-    d = sqrt32-12.0*s;
+    cc->aa = a;
+    cc->s2 = a-0.5;
+    cc->s = sqrt(cc->s2);
+    cc->d = sqrt32-12.0*cc->s;
 S10:
 /*
      STEP  2:  T=STANDARD NORMAL DEVIATE,
                X=(S,1/2)-NORMAL DEVIATE.
                IMMEDIATE ACCEPTANCE (I)
 */
-    t = snorm();
-    x = s+0.5*t;
+    t = snorm_r(rng);
+    x = cc->s+0.5*t;
     sgam = x*x;
     if(t >= 0.0) return sgam;
 /*
      STEP  3:  U= 0,1 -UNIFORM SAMPLE. SQUEEZE ACCEPTANCE (S)
 */
-    u = safe_ranf();
-    if(d*u <= t*t*t) return sgam;
+    u = safe_ranf_r(rng);
+    if(cc->d*u <= t*t*t) return sgam;
 /*
      STEP  4:  RECALCULATIONS OF Q0,B,SI,C IF NECESSARY
 */
-    if(a == aaa) goto S40;
-    aaa = a;
+    if(a == cc->aaa) goto S40;
+    cc->aaa = a;
     r = 1.0/ a;
-    q0 = ((((((q7*r+q6)*r+q5)*r+q4)*r+q3)*r+q2)*r+q1)*r;
+    cc->q0 = ((((((q7*r+q6)*r+q5)*r+q4)*r+q3)*r+q2)*r+q1)*r;
 /*
                APPROXIMATION DEPENDING ON SIZE OF PARAMETER A
                THE CONSTANTS IN THE EXPRESSIONS FOR B, SI AND
@@ -1564,25 +1560,25 @@ S10:
 /*
                CASE 3:  A .GT. 13.022
 */
-    b = 1.77;
-    si = 0.75;
-    c = 0.1515/s;
+    cc->b = 1.77;
+    cc->si = 0.75;
+    cc->c = 0.1515/cc->s;
     goto S40;
 S20:
 /*
                CASE 2:  3.686 .LT. A .LE. 13.022
 */
-    b = 1.654+7.6E-3*s2;
-    si = 1.68/s+0.275;
-    c = 6.2E-2/s+2.4E-2;
+    cc->b = 1.654+7.6E-3*cc->s2;
+    cc->si = 1.68/cc->s+0.275;
+    cc->c = 6.2E-2/cc->s+2.4E-2;
     goto S40;
 S30:
 /*
                CASE 1:  A .LE. 3.686
 */
-    b = 0.463+s+0.178*s2;
-    si = 1.235;
-    c = 0.195/s-7.9E-2+1.6E-1*s;
+    cc->b = 0.463+cc->s+0.178*cc->s2;
+    cc->si = 1.235;
+    cc->c = 0.195/cc->s-7.9E-2+1.6E-1*cc->s;
 S40:
 /*
      STEP  5:  NO QUOTIENT TEST IF X NOT POSITIVE
@@ -1591,12 +1587,12 @@ S40:
 /*
      STEP  6:  CALCULATION OF V AND QUOTIENT Q
 */
-    v = t/(s+s);
+    v = t/(cc->s+cc->s);
     if(fabs(v) <= 0.25) goto S50;
-    q = q0-s*t+0.25*t*t+(s2+s2)*log(1.0+v);
+    q = cc->q0-cc->s*t+0.25*t*t+(cc->s2+cc->s2)*log(1.0+v);
     goto S60;
 S50:
-    q = q0+0.5*t*t*((((((a7*v+a6)*v+a5)*v+a4)*v+a3)*v+a2)*v+a1)*v;
+    q = cc->q0+0.5*t*t*((((((a7*v+a6)*v+a5)*v+a4)*v+a3)*v+a2)*v+a1)*v;
 S60:
 /*
      STEP  7:  QUOTIENT ACCEPTANCE (Q)
@@ -1608,10 +1604,10 @@ S70:
                U= 0,1 -UNIFORM DEVIATE
                T=(B,SI)-DOUBLE EXPONENTIAL (LAPLACE) SAMPLE
 */
-    e = sexpo();
-    u = safe_ranf();
+    e = sexpo_r(rng);
+    u = safe_ranf_r(rng);
     u += (u-1.0);
-    t = b+fsign(si*e,u);
+    t = cc->b+fsign(cc->si*e,u);
 /*
      STEP  9:  REJECTION IF T .LT. TAU(1) = -.71874483771719
 */
@@ -1619,12 +1615,12 @@ S70:
 /*
      STEP 10:  CALCULATION OF V AND QUOTIENT Q
 */
-    v = t/(s+s);
+    v = t/(cc->s+cc->s);
     if(fabs(v) <= 0.25) goto S80;
-    q = q0-s*t+0.25*t*t+(s2+s2)*log(1.0+v);
+    q = cc->q0-cc->s*t+0.25*t*t+(cc->s2+cc->s2)*log(1.0+v);
     goto S90;
 S80:
-    q = q0+0.5*t*t*((((((a7*v+a6)*v+a5)*v+a4)*v+a3)*v+a2)*v+a1)*v;
+    q = cc->q0+0.5*t*t*((((((a7*v+a6)*v+a5)*v+a4)*v+a3)*v+a2)*v+a1)*v;
 S90:
 /*
      STEP 11:  HAT ACCEPTANCE (H) (IF Q NOT POSITIVE GO TO STEP 8)
@@ -1642,7 +1638,7 @@ S90:
  * JJV exponentiated (87.49823 = log(1.0E38))
  */
     if((q+e-0.5*t*t) > 87.49823) goto S115;
-    if(c*fabs(u) > exp(q+e-0.5*t*t)) goto S70;
+    if(cc->c*fabs(u) > exp(q+e-0.5*t*t)) goto S70;
     goto S115;
 S95:
     w = exp(q)-1.0;
@@ -1653,9 +1649,9 @@ S110:
 /*
                IF T IS REJECTED, SAMPLE AGAIN AT STEP 8
 */
-    if(c*fabs(u) > w*exp(e-0.5*t*t)) goto S70;
+    if(cc->c*fabs(u) > w*exp(e-0.5*t*t)) goto S70;
 S115:
-    x = s+0.5*t;
+    x = cc->s+0.5*t;
     return x*x;
 S120:
 /*
@@ -1673,17 +1669,17 @@ S120:
 */
     b0 = 1.0+0.3678794*a;
 S130:
-    p = b0*safe_ranf();
+    p = b0*safe_ranf_r(rng);
     if(p >= 1.0) goto S140;
     sgam = exp(log(p)/ a);
-    if(sexpo() < sgam) goto S130;
+    if(sexpo_r(rng) < sgam) goto S130;
     return sgam;
 S140:
     sgam = -log((b0-p)/ a);
-    if(sexpo() < (1.0-a)*log(sgam)) goto S130;
+    if(sexpo_r(rng) < (1.0-a)*log(sgam)) goto S130;
     return sgam;
 }
-double snorm(void)
+double snorm_r(struct rng_ctx *rng)
 /*
 **********************************************************************
                                                                       
@@ -1739,9 +1735,9 @@ static double h[31] = {
     5.654656E-2,5.95313E-2,6.308489E-2,6.737503E-2,7.264544E-2,7.926471E-2,
     8.781922E-2,9.930398E-2,0.11556,0.1404344,0.1836142,0.2790016,0.7010474
 };
-static int i;
-static double sn,u,s,ustar,aa,w,y,tt;
-    u = safe_ranf();
+int i;
+double sn,u,s,ustar,aa,w,y,tt;
+    u = safe_ranf_r(rng);
     s = 0.0;
     if(u > 0.5) s = 1.0;
     u += (u-s);
@@ -1762,18 +1758,18 @@ S40:
 /*
                                 CENTER CONTINUED
 */
-    u = safe_ranf();
+    u = safe_ranf_r(rng);
     w = u*(*(a+i)-aa);
     tt = (0.5*w+aa)*w;
     goto S80;
 S70:
     tt = u;
-    ustar = safe_ranf();
+    ustar = safe_ranf_r(rng);
 S80:
     if(ustar > tt) goto S50;
-    u = safe_ranf();
+    u = safe_ranf_r(rng);
     if(ustar >= u) goto S70;
-    ustar = safe_ranf();
+    ustar = safe_ranf_r(rng);
     goto S40;
 S100:
 /*
@@ -1796,11 +1792,11 @@ S140:
 S150:
     tt = u;
 S160:
-    ustar = safe_ranf();
+    ustar = safe_ranf_r(rng);
     if(ustar <= tt) {
-		 u = safe_ranf();
+		 u = safe_ranf_r(rng);
 		 if(ustar >= u) goto S150;
-		 u = safe_ranf();
+		 u = safe_ranf_r(rng);
 		 goto S140;
 	 }
 S50:
@@ -1812,3 +1808,119 @@ S50:
     if(s == 1.0) sn = -y;
     return sn;
 }
+
+/* Forget the setup kept between calls by the generators above */
+void ranlib_reset_r(struct rng_ctx *rng)
+{
+	memset(&rng->gam,0,sizeof(struct sgamma_cache));
+	memset(&rng->bin,0,sizeof(struct ignbin_cache));
+	memset(&rng->poi,0,sizeof(struct ignpoi_cache));
+	rng->bet.olda=rng->bet.oldb=-1.0E37;
+	rng->bin.psave=-1.0E37;
+	rng->bin.nsave=-214748365;
+	rng->poi.muold=rng->poi.muprev=-1.0E37;
+}
+
+/* n standard normal deviates, the same as n calls to snorm_r().  snorm_r()
+ * uses a variable number of uniforms per deviate, so this is not a fixed
+ * stride over a block of uniforms; the gain is in keeping the loop tight */
+void snorm_block_r(struct rng_ctx *rng,double *x,int n)
+{
+	while(n-->0) *(x++)=snorm_r(rng);
+}
+
+/* Versions drawing from the default stream, lk_rng */
+double genbet(const double aa,const double bb)
+{
+	return genbet_r(&lk_rng,aa,bb);
+}
+
+double genchi(const double df)
+{
+	return genchi_r(&lk_rng,df);
+}
+
+double genexp(double const av)
+{
+	return genexp_r(&lk_rng,av);
+}
+
+double genf(const double dfn,const double dfd)
+{
+	return genf_r(&lk_rng,dfn,dfd);
+}
+
+double gengam(const double a,const double r)
+{
+	return gengam_r(&lk_rng,a,r);
+}
+
+void genmul(const int n,const double *p,const int ncat,int *ix)
+{
+	genmul_r(&lk_rng,n,p,ncat,ix);
+}
+
+double gennch(const double df,const double xnonc)
+{
+	return gennch_r(&lk_rng,df,xnonc);
+}
+
+double gennf(const double dfn,const double dfd,const double xnonc)
+{
+	return gennf_r(&lk_rng,dfn,dfd,xnonc);
+}
+
+double gennor(const double av,const double sd)
+{
+	return gennor_r(&lk_rng,av,sd);
+}
+
+void genprm(int *iarray,const int larray)
+{
+	genprm_r(&lk_rng,iarray,larray);
+}
+
+double genunf(const double low,const double high)
+{
+	return genunf_r(&lk_rng,low,high);
+}
+
+int ignbin(const int n,const double pp)
+{
+	return ignbin_r(&lk_rng,n,pp);
+}
+
+int ignnbn(const int n,const double p)
+{
+	return ignnbn_r(&lk_rng,n,p);
+}
+
+int ignpoi(const double mu)
+{
+	return ignpoi_r(&lk_rng,mu);
+}
+
+int ignuin(const int low,const int high)
+{
+	return ignuin_r(&lk_rng,low,high);
+}
+
+double sexpo(void)
+{
+	return sexpo_r(&lk_rng);
+}
+
+double sgamma(const double a)
+{
+	return sgamma_r(&lk_rng,a);
+}
+
+double snorm(void)
+{
+	return snorm_r(&lk_rng);
+}
+
+void snorm_block(double *x,int n)
+{
+	snorm_block_r(&lk_rng,x,n);
+}
@@ -0,0 +1,239 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * rf_store.c:                                                              *
+ *                                                                          *
+ * Accumulates the terms of an R-Function while it is being assembled by a  *
+ * peeling operation.  Terms are stored contiguously in the order they are  *
+ * first seen, with a map from index to term: a plain array when the index  *
+ * has at most RFS_DENSE_BITS bits, otherwise an open addressing hash with  *
+ * linear probing.  The map is reset between functions by bumping a stamp   *
+ * rather than clearing it.                                                 *
+ *                                                                          *
+ * rfs_sort() puts the terms in index order (the order the output function  *
+ * is stored in) with a radix sort and forms their cumulative sums, so that *
+ * rfs_sample() can draw a term with a binary search.  Each term is summed  *
+ * in the order its contributions arrive and the cumulative sums are taken  *
+ * in index order, so the results are the same as from walking a tree.      *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "rf_store.h"
+
+#define RFS_MIN_TERMS 1024
+
+/* Make the map 1<<bits slots, all empty */
+static void map_reset(struct rf_store *s,const int bits)
+{
+  int sz=1<<bits;
+
+  if(sz>s->map_cap) {
+    if(s->slot) {
+      free(s->slot);
+      free(s->stamp);
+    }
+    s->slot=lk_malloc(sizeof(int)*sz);
+    s->stamp=lk_calloc((size_t)sz,sizeof(unsigned int));
+    s->map_cap=sz;
+    s->gen=0;
+  }
+  s->map_bits=bits;
+  if(!++s->gen) {
+    memset(s->stamp,0,sizeof(unsigned int)*s->map_cap);
+    s->gen=1;
+  }
+}
+
+static unsigned int rfs_hash(const lk_ulong a,const int bits)
+{
+  uint32_t h;
+
+  h=(uint32_t)(a^(a>>(LK_LONG_BIT/2)));
+  h*=0x9e3779b1U;
+  return (unsigned int)(h>>(32-bits));
+}
+
+static void rehash(struct rf_store *s,const int bits)
+{
+  int i;
+  unsigned int h,mask;
+
+  map_reset(s,bits);
+  s->hash_bits=bits;
+  mask=(1U<<bits)-1;
+  for(i=0;i<s->n;i++) {
+    for(h=rfs_hash(s->idx[i],bits);s->stamp[h]==s->gen;h=(h+1)&mask);
+    s->stamp[h]=s->gen;
+    s->slot[h]=i;
+  }
+}
+
+/* Start a new function with indices of the given number of bits.  The
+ * store must be zeroed before first use */
+void rfs_init(struct rf_store *s,const int bits)
+{
+  if(!s->size) {
+    s->size=RFS_MIN_TERMS;
+    s->idx=lk_malloc(sizeof(lk_ulong)*s->size*2);
+    s->idx1=s->idx+s->size;
+    s->p=lk_malloc(sizeof(double)*s->size*2);
+    s->p1=s->p+s->size;
+  }
+  s->bits=bits;
+  s->n=0;
+  s->dense=(bits<=RFS_DENSE_BITS);
+  map_reset(s,s->dense?bits:(s->hash_bits?s->hash_bits:RFS_MIN_BITS));
+}
+
+static void grow_terms(struct rf_store *s)
+{
+  lk_ulong *ti;
+  double *tp;
+
+  ti=lk_malloc(sizeof(lk_ulong)*s->size*4);
+  tp=lk_malloc(sizeof(double)*s->size*4);
+  memcpy(ti,s->idx,sizeof(lk_ulong)*s->n);
+  memcpy(tp,s->p,sizeof(double)*s->n);
+  free(s->idx<s->idx1?s->idx:s->idx1);
+  free(s->p<s->p1?s->p:s->p1);
+  s->size*=2;
+  s->idx=ti;
+  s->idx1=ti+s->size;
+  s->p=tp;
+  s->p1=tp+s->size;
+}
+
+/* Add p to the term with index a */
+void rfs_add(struct rf_store *s,const lk_ulong a,const double p)
+{
+  int k;
+  unsigned int h,mask;
+
+  if(s->dense) {
+    h=(unsigned int)a;
+    if(s->stamp[h]==s->gen) {
+      s->p[s->slot[h]]+=p;
+      return;
+    }
+  } else {
+    mask=(1U<<s->map_bits)-1;
+    for(h=rfs_hash(a,s->map_bits);s->stamp[h]==s->gen;h=(h+1)&mask) {
+      k=s->slot[h];
+      if(s->idx[k]==a) {
+	s->p[k]+=p;
+	return;
+      }
+    }
+  }
+  if(s->n==s->size) grow_terms(s);
+  k=s->n++;
+  s->idx[k]=a;
+  s->p[k]=p;
+  s->stamp[h]=s->gen;
+  s->slot[h]=k;
+  if(!s->dense && 2*s->n>(1<<s->map_bits)) rehash(s,s->map_bits+1);
+}
+
+static void swap_terms(struct rf_store *s)
+{
+  lk_ulong *ti;
+  double *tp;
+
+  ti=s->idx;
+  s->idx=s->idx1;
+  s->idx1=ti;
+  tp=s->p;
+  s->p=s->p1;
+  s->p1=tp;
+}
+
+/* Put the terms in index order and form their cumulative sums in p1[].
+ * No more terms can be added until the next rfs_init() */
+void rfs_sort(struct rf_store *s)
+{
+  int i,j,k,sh,n=s->n,cnt[256];
+  lk_ulong a,or_idx=0,and_idx=~(lk_ulong)0;
+  double z;
+
+  if(s->dense && 4*n>=(1<<s->map_bits)) {
+    /* Most of the map is in use, so just read it off */
+    for(i=j=0;j<(1<<s->map_bits);j++) if(s->stamp[j]==s->gen) {
+	k=s->slot[j];
+	s->idx1[i]=s->idx[k];
+	s->p1[i++]=s->p[k];
+      }
+    swap_terms(s);
+  } else {
+    for(i=0;i<n;i++) {
+      or_idx|=s->idx[i];
+      and_idx&=s->idx[i];
+    }
+    for(sh=0;sh<s->bits;sh+=8) {
+      /* Skip digits that are the same for every term */
+      if(!(((or_idx^and_idx)>>sh)&0xff)) continue;
+      memset(cnt,0,sizeof(cnt));
+      for(i=0;i<n;i++) cnt[(s->idx[i]>>sh)&0xff]++;
+      for(j=i=0;i<256;i++) {
+	k=cnt[i];
+	cnt[i]=j;
+	j+=k;
+      }
+      for(i=0;i<n;i++) {
+	a=s->idx[i];
+	k=cnt[(a>>sh)&0xff]++;
+	s->idx1[k]=a;
+	s->p1[k]=s->p[i];
+      }
+      swap_terms(s);
+    }
+  }
+  for(z=0.0,i=0;i<n;i++) {
+    z+=s->p[i];
+    s->p1[i]=z;
+  }
+}
+
+/* Find the first term (in index order) where the cumulative sum reaches z.
+ * Returns 0 if z is beyond the total */
+int rfs_sample(const struct rf_store *s,const double z,lk_ulong *a)
+{
+  int lo=0,hi=s->n-1,m;
+
+  if(hi<0 || s->p1[hi]<z) return 0;
+  while(lo<hi) {
+    m=(lo+hi)>>1;
+    if(s->p1[m]>=z) hi=m;
+    else lo=m+1;
+  }
+  *a=s->idx[lo];
+  return 1;
+}
+
+void rfs_free(struct rf_store *s)
+{
+  if(s->size) {
+    free(s->idx<s->idx1?s->idx:s->idx1);
+    free(s->p<s->p1?s->p:s->p1);
+  }
+  if(s->slot) {
+    free(s->slot);
+    free(s->stamp);
+  }
+  memset(s,0,sizeof(struct rf_store));
+}
@@ -0,0 +1,125 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * seg_kernels.c:                                                           *
+ *                                                                          *
+ * Forward filter / backward sampler for the segregation indicators of     *
+ * meioses along an ordered list of loci.  A meiosis is a Markov chain over *
+ * the loci with known indicators at some of them, and different meioses   *
+ * are independent given those, so they are handled in batches held in     *
+ * struct of arrays form: the forward step runs across the batch one locus  *
+ * at a time, with the same operations in the same order for each lane as  *
+ * for a single meiosis.  The backward step draws random numbers, so is     *
+ * done one lane at a time in whatever order the caller wants them drawn.  *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+
+#include "lk_malloc.h"
+#include "ranlib.h"
+#include "seg_kernels.h"
+
+/* Keep the results independent of how the compiler vectorizes the loops
+ * (see peel_kernels.c) */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#ifdef __SSE2_MATH__
+#pragma GCC optimize ("no-float-store")
+#endif
+#endif
+
+/* Space for batches of up to n_lanes meioses over up to n_loci loci */
+void sk_alloc(struct seg_work *w,const int n_loci,const int n_lanes)
+{
+  size_t sz;
+
+  sz=(size_t)n_loci*n_lanes;
+  w->p[0]=lk_malloc((2*sizeof(double)+sizeof(int))*sz);
+  w->p[1]=w->p[0]+sz;
+  w->s=(int *)(w->p[1]+sz);
+  w->n_loci=n_loci;
+  w->n_lanes=n_lanes;
+}
+
+void sk_free(struct seg_work *w)
+{
+  if(w->p[0]) free(w->p[0]);
+  w->p[0]=w->p[1]=0;
+  w->s=0;
+  w->n_loci=w->n_lanes=0;
+}
+
+/* Forward probabilities over the first n loci for lanes lo..hi-1, which
+ * share the recombination fractions r[k] between loci k and k+1 */
+void sk_forward(struct seg_work *w,const int n,const int lo,const int hi,const double *r)
+{
+  int b,k,s,*sk;
+  const int nl=w->n_lanes;
+  double *p0,*p1,*q0,*q1,x0,x1,z,rk;
+
+  p0=w->p[0];
+  p1=w->p[1];
+  sk=w->s;
+  for(b=lo;b<hi;b++) {
+    s=sk[b];
+    p0[b]=s<0?.5:(double)(s==0);
+    p1[b]=s<0?.5:(double)(s==1);
+  }
+  /* Both branches are evaluated so that the loop can be vectorized */
+  for(k=1;k<n;k++) {
+    q0=p0;
+    q1=p1;
+    p0+=nl;
+    p1+=nl;
+    sk+=nl;
+    rk=r[k-1];
+    for(b=lo;b<hi;b++) {
+      s=sk[b];
+      x0=.5*(q0[b]*(1.0-rk)+q1[b]*rk);
+      x1=.5*(q1[b]*(1.0-rk)+q0[b]*rk);
+      z=x0+x1;
+      x0/=z;
+      x1/=z;
+      p0[b]=s<0?x0:(double)(s==0);
+      p1[b]=s<0?x1:(double)(s==1);
+    }
+  }
+}
+
+/* Sample the unknown indicators of lane b, last locus first, given the
+ * forward probabilities from sk_forward() */
+void sk_backward(struct seg_work *w,const int n,const int b,const double *r,struct rng_ctx *rng)
+{
+  int k,s,s1,*sk;
+  const int nl=w->n_lanes;
+  double pp[2],z,*p[2];
+
+  k=n-1;
+  sk=w->s+b;
+  p[0]=w->p[0]+b;
+  p[1]=w->p[1]+b;
+  s=sk[k*nl];
+  if(s<0) {
+    s=(ranf_r(rng)<p[0][k*nl])?0:1;
+    sk[k*nl]=s;
+  }
+  for(k--;k>=0;k--) {
+    s1=sk[k*nl];
+    if(s1<0) {
+      pp[s]=p[s][k*nl]*(1.0-r[k]);
+      pp[s^1]=p[s^1][k*nl]*r[k];
+      z=pp[0]+pp[1];
+      s1=(z*ranf_r(rng)<pp[0])?0:1;
+      sk[k*nl]=s1;
+    }
+    s=s1;
+  }
+}
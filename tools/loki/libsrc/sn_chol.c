@@ -0,0 +1,534 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * sn_chol.c:                                                               *
+ *                                                                          *
+ * Supernodal LDL' factorization of sparse symmetric matrices whose         *
+ * pattern stays the same while the values change.  sn_analyse() takes the  *
+ * pattern with the columns in elimination order, postorders the            *
+ * elimination tree (which does not change the fill) and finds the          *
+ * supernodes, their row structures and which supernodes update which, so   *
+ * that each numerical factorization only has to fill in the values         *
+ * (sn_entry()) and call sn_factor().  Supernodes are factorized left       *
+ * looking: all updates from a descendant are applied as one dense block    *
+ * operation, then the diagonal block and the rows below it are done in     *
+ * place.  Supernodes in different subtrees do not depend on each other,    *
+ * so these can be shared out between threads; each supernode is always     *
+ * done the same way, so the results do not depend on the thread count.     *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+#include "lk_malloc.h"
+#include "sn_chol.h"
+
+/* -ffloat-store only slows the loops down with SSE arithmetic (see
+ * peel_kernels.c) */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__SSE2_MATH__)
+#pragma GCC optimize ("no-float-store")
+#endif
+
+#define SN_BLK 4 /* Target columns updated together */
+
+struct sn_shared {
+  struct sn_chol *s;
+  double tol;
+  int next,fail,*pending;
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+};
+
+/* Workspace for factor_sn() */
+struct sn_work {
+  int *map,*rel;
+  double *w;
+};
+
+struct sn_worker {
+  struct sn_shared *sh;
+  struct sn_work wk;
+};
+
+/* Strictly lower triangle of the pattern by rows (rp, ri), with the
+ * columns renumbered by map if given.  Entries above the diagonal are
+ * taken as their transposes */
+static void lower_rows(const int n,const int *col_ptr,const int *row_idx,const int *map,int *rp,int **ri)
+{
+  int i,j,k,r,c,*pos;
+
+  for(i=0;i<=n;i++) rp[i]=0;
+  for(j=0;j<n;j++) for(k=col_ptr[j];k<col_ptr[j+1];k++) if((i=row_idx[k])!=j) {
+    r=map?map[i]:i;
+    c=map?map[j]:j;
+    rp[(r>c?r:c)+1]++;
+  }
+  for(i=0;i<n;i++) rp[i+1]+=rp[i];
+  *ri=lk_malloc(sizeof(int)*(rp[n]?rp[n]:1));
+  pos=lk_malloc(sizeof(int)*(n?n:1));
+  memcpy(pos,rp,sizeof(int)*n);
+  for(j=0;j<n;j++) for(k=col_ptr[j];k<col_ptr[j+1];k++) if((i=row_idx[k])!=j) {
+    r=map?map[i]:i;
+    c=map?map[j]:j;
+    if(r>c) (*ri)[pos[r]++]=c;
+    else (*ri)[pos[c]++]=r;
+  }
+  free(pos);
+}
+
+/* Elimination tree (Liu's algorithm with path compression) */
+static void etree(const int n,const int *rp,const int *ri,int *parent,int *anc)
+{
+  int i,k,r,nx;
+
+  for(r=0;r<n;r++) {
+    parent[r]=anc[r]=-1;
+    for(k=rp[r];k<rp[r+1];k++) for(i=ri[k];i>=0 && i<r;i=nx) {
+      nx=anc[i];
+      anc[i]=r;
+      if(nx<0) parent[i]=r;
+    }
+  }
+}
+
+/* Analyse the pattern of an n x n symmetric matrix given by columns
+ * (col_ptr, row_idx; either or both triangles, diagonal optional) with
+ * the columns in elimination order.  On return perm[k] is the column of
+ * the input that has become column k of the factorization */
+struct sn_chol *sn_analyse(const int n,const int *col_ptr,const int *row_idx,int *perm)
+{
+  int i,j,k,r,c,f,J,K,top,nr,nc,*rp,*ri,*parent,*anc,*head,*next,*ipost,*cc,*pos,*ht,*cnt;
+  size_t sz;
+  struct sn_chol *s;
+
+  s=lk_calloc((size_t)1,sizeof(struct sn_chol));
+  s->n=n;
+  if(n<1) return s;
+  rp=lk_malloc(sizeof(int)*(n+1));
+  parent=lk_malloc(sizeof(int)*n*6);
+  anc=parent+n;
+  head=anc+n;
+  next=head+n;
+  ipost=next+n;
+  cc=ipost+n;
+  /* Postorder the elimination tree, visiting children in column order */
+  lower_rows(n,col_ptr,row_idx,0,rp,&ri);
+  etree(n,rp,ri,parent,anc);
+  free(ri);
+  for(j=0;j<n;j++) head[j]=-1;
+  for(j=n-1;j>=0;j--) if((i=parent[j])>=0) {
+    next[j]=head[i];
+    head[i]=j;
+  }
+  for(k=j=0;j<n;j++) if(parent[j]<0) {
+    anc[top=0]=j;
+    while(top>=0) {
+      i=anc[top];
+      if((c=head[i])>=0) {
+	head[i]=next[c];
+	anc[++top]=c;
+      } else {
+	top--;
+	perm[k++]=i;
+      }
+    }
+  }
+  for(k=0;k<n;k++) ipost[perm[k]]=k;
+  for(j=0;j<n;j++) next[ipost[j]]=parent[j]<0?-1:ipost[parent[j]];
+  memcpy(parent,next,sizeof(int)*n);
+  lower_rows(n,col_ptr,row_idx,ipost,rp,&ri);
+  /* Column counts of L from the row subtrees */
+  for(j=0;j<n;j++) cc[j]=0;
+  for(r=0;r<n;r++) {
+    head[r]=r;
+    for(k=rp[r];k<rp[r+1];k++) for(i=ri[k];head[i]!=r;i=parent[i]) {
+      cc[i]++;
+      head[i]=r;
+    }
+  }
+  /* Supernodes: runs of columns each the parent of the one before with
+   * the same structure below the diagonal */
+  s->col_sn=lk_malloc(sizeof(int)*n);
+  for(J=-1,j=0;j<n;j++) {
+    if(!j || parent[j-1]!=j || cc[j-1]!=cc[j]+1) J++;
+    s->col_sn[j]=J;
+  }
+  s->n_sn=J+1;
+  s->sn_start=lk_malloc(sizeof(int)*(s->n_sn+1)*5);
+  s->sn_parent=s->sn_start+s->n_sn+1;
+  s->row_ptr=s->sn_parent+s->n_sn+1;
+  s->upd_ptr=s->row_ptr+s->n_sn+1;
+  s->sched=s->upd_ptr+s->n_sn+1;
+  s->x_ptr=lk_malloc(sizeof(size_t)*(s->n_sn+1));
+  for(j=n-1;j>=0;j--) s->sn_start[s->col_sn[j]]=j;
+  s->sn_start[s->n_sn]=n;
+  s->row_ptr[0]=0;
+  s->x_ptr[0]=0;
+  for(J=0;J<s->n_sn;J++) {
+    f=s->sn_start[J];
+    nc=s->sn_start[J+1]-f;
+    nr=cc[f]+1;
+    s->row_ptr[J+1]=s->row_ptr[J]+nr;
+    s->x_ptr[J+1]=s->x_ptr[J]+(size_t)nr*nc;
+    j=parent[f+nc-1];
+    s->sn_parent[J]=j<0?-1:s->col_sn[j];
+  }
+  /* Row structures, taken from the first column of each supernode */
+  s->rows=lk_malloc(sizeof(int)*(s->row_ptr[s->n_sn]?s->row_ptr[s->n_sn]:1));
+  pos=lk_malloc(sizeof(int)*(s->n_sn+1));
+  for(J=0;J<s->n_sn;J++) {
+    k=s->row_ptr[J];
+    for(j=s->sn_start[J];j<s->sn_start[J+1];j++) s->rows[k++]=j;
+    pos[J]=k;
+  }
+  for(r=0;r<n;r++) {
+    head[r]=r;
+    for(k=rp[r];k<rp[r+1];k++) for(i=ri[k];head[i]!=r;i=parent[i]) {
+      head[i]=r;
+      J=s->col_sn[i];
+      if(i==s->sn_start[J] && r>=s->sn_start[J+1]) s->rows[pos[J]++]=r;
+    }
+  }
+  free(ri);
+  /* For each supernode, the supernodes below it with rows in its columns */
+  cnt=pos;
+  for(J=0;J<=s->n_sn;J++) cnt[J]=0;
+  for(K=0;K<s->n_sn;K++) {
+    nc=s->sn_start[K+1]-s->sn_start[K];
+    for(k=s->row_ptr[K]+nc;k<s->row_ptr[K+1];) {
+      J=s->col_sn[s->rows[k]];
+      cnt[J+1]++;
+      while(k<s->row_ptr[K+1] && s->rows[k]<s->sn_start[J+1]) k++;
+    }
+  }
+  s->upd_ptr[0]=0;
+  for(J=0;J<s->n_sn;J++) s->upd_ptr[J+1]=s->upd_ptr[J]+cnt[J+1];
+  s->upd=lk_malloc(sizeof(int)*2*(s->upd_ptr[s->n_sn]?s->upd_ptr[s->n_sn]:1));
+  for(J=0;J<s->n_sn;J++) cnt[J]=s->upd_ptr[J];
+  for(K=0;K<s->n_sn;K++) {
+    nc=s->sn_start[K+1]-s->sn_start[K];
+    for(k=s->row_ptr[K]+nc;k<s->row_ptr[K+1];) {
+      J=s->col_sn[s->rows[k]];
+      s->upd[2*cnt[J]]=K;
+      s->upd[2*cnt[J]+1]=k-s->row_ptr[K];
+      cnt[J]++;
+      while(k<s->row_ptr[K+1] && s->rows[k]<s->sn_start[J+1]) k++;
+    }
+  }
+  /* Schedule for threads: leaves first, then by height, so every
+   * supernode comes after its descendants */
+  ht=head;
+  for(J=0;J<s->n_sn;J++) ht[J]=0;
+  for(J=0;J<s->n_sn;J++) if((K=s->sn_parent[J])>=0 && ht[K]<ht[J]+1) ht[K]=ht[J]+1;
+  for(J=0;J<=s->n_sn;J++) cnt[J]=0;
+  for(J=0;J<s->n_sn;J++) cnt[ht[J]+1]++;
+  for(J=0;J<s->n_sn;J++) cnt[J+1]+=cnt[J];
+  for(J=0;J<s->n_sn;J++) s->sched[cnt[ht[J]]++]=J;
+  free(pos);
+  free(parent);
+  free(rp);
+  sz=s->x_ptr[s->n_sn];
+  s->x=lk_malloc(sizeof(double)*(sz?sz:1));
+  return s;
+}
+
+void sn_free(struct sn_chol *s)
+{
+  if(!s) return;
+  if(s->sn_start) free(s->sn_start);
+  if(s->col_sn) free(s->col_sn);
+  if(s->rows) free(s->rows);
+  if(s->upd) free(s->upd);
+  if(s->x_ptr) free(s->x_ptr);
+  if(s->x) free(s->x);
+  free(s);
+}
+
+void sn_zero(struct sn_chol *s)
+{
+  if(s->n_sn) memset(s->x,0,sizeof(double)*s->x_ptr[s->n_sn]);
+}
+
+/* Where element (i,j) of the matrix (numbered as in the factorization) is
+ * stored, or 0 if it is not in the pattern */
+double *sn_entry(const struct sn_chol *s,const int i,const int j)
+{
+  int r,c,J,lo,hi,mid;
+
+  r=i>j?i:j;
+  c=i>j?j:i;
+  J=s->col_sn[c];
+  lo=s->row_ptr[J]+c-s->sn_start[J];
+  hi=s->row_ptr[J+1]-1;
+  while(lo<=hi) {
+    mid=(lo+hi)>>1;
+    if(s->rows[mid]<r) lo=mid+1;
+    else if(s->rows[mid]>r) hi=mid-1;
+    else return s->x+s->x_ptr[J]+(size_t)(c-s->sn_start[J])*(s->row_ptr[J+1]-s->row_ptr[J])+mid-s->row_ptr[J];
+  }
+  return 0;
+}
+
+/* cols[j][rel[a]] -= sum_t src[t*ld+a]*w[t*SN_BLK+j] for the SN_BLK target
+ * columns, rows a0<=a<n and source columns t<nt (rel 0 for no mapping) */
+static void upd_blk(double **cols,const int *rel,const double *src,const int ld,const int nt,const double *w,const int a0,const int n)
+{
+  int a,r,t;
+  double s,w0,w1,w2,w3,*c0,*c1,*c2,*c3;
+
+  c0=cols[0];
+  c1=cols[1];
+  c2=cols[2];
+  c3=cols[3];
+  for(t=0;t<nt;t++,src+=ld,w+=SN_BLK) {
+    w0=w[0];
+    w1=w[1];
+    w2=w[2];
+    w3=w[3];
+    if(w0==0.0 && w1==0.0 && w2==0.0 && w3==0.0) continue;
+    if(rel) for(a=a0;a<n;a++) {
+      r=rel[a];
+      s=src[a];
+      c0[r]-=s*w0;
+      c1[r]-=s*w1;
+      c2[r]-=s*w2;
+      c3[r]-=s*w3;
+    } else for(a=a0;a<n;a++) {
+      s=src[a];
+      c0[a]-=s*w0;
+      c1[a]-=s*w1;
+      c2[a]-=s*w2;
+      c3[a]-=s*w3;
+    }
+  }
+}
+
+/* Weights for upd_blk(): w[t*SN_BLK+j]=L(b+j,t)*D(t) for the nb (up to
+ * SN_BLK) rows from b of nt columns of a supernode with nr rows, and the
+ * target columns (extra ones being given weight 0) */
+static void blk_weights(double *w,double **cols,const double *X,const int nr,const int nt,const int b,const int nb)
+{
+  int j,t;
+  const double *src;
+
+  for(t=0;t<nt;t++) {
+    src=X+(size_t)t*nr;
+    for(j=0;j<SN_BLK;j++) w[t*SN_BLK+j]=j<nb?src[b+j]*src[t]:0.0;
+  }
+  for(j=nb;j<SN_BLK;j++) cols[j]=cols[0];
+}
+
+/* Factorize supernode J, applying the updates from the supernodes below
+ * it first.  Target columns are done SN_BLK at a time, so each column of
+ * the source is read once for every SN_BLK targets.  (Rows above the
+ * diagonal of the targets are updated along with the others, but the
+ * space there is not used.)  Returns the first column with a negative
+ * pivot or -1 */
+static int factor_sn(struct sn_chol *s,const int J,struct sn_work *wk,const double tol)
+{
+  int a,b,c,c2,j,u,K,f,l,nc,nr,nb,p,q,nrk,nck;
+  const int *rw;
+  double d,z,*X,*col,*col2,*cols[SN_BLK];
+  const double *XK;
+
+  f=s->sn_start[J];
+  l=s->sn_start[J+1];
+  nc=l-f;
+  nr=s->row_ptr[J+1]-s->row_ptr[J];
+  X=s->x+s->x_ptr[J];
+  rw=s->rows+s->row_ptr[J];
+  for(a=0;a<nr;a++) wk->map[rw[a]]=a;
+  for(u=s->upd_ptr[J];u<s->upd_ptr[J+1];u++) {
+    K=s->upd[2*u];
+    p=s->upd[2*u+1];
+    nck=s->sn_start[K+1]-s->sn_start[K];
+    nrk=s->row_ptr[K+1]-s->row_ptr[K];
+    XK=s->x+s->x_ptr[K];
+    rw=s->rows+s->row_ptr[K];
+    for(q=p;q<nrk && rw[q]<l;q++);
+    for(a=p;a<nrk;a++) wk->rel[a]=wk->map[rw[a]];
+    /* X(rows p.., columns p..q-1) -= L_K D_K L_K' */
+    for(b=p;b<q;b+=SN_BLK) {
+      nb=q-b<SN_BLK?q-b:SN_BLK;
+      for(j=0;j<nb;j++) cols[j]=X+(size_t)(rw[b+j]-f)*nr;
+      blk_weights(wk->w,cols,XK,nrk,nck,b,nb);
+      upd_blk(cols,wk->rel,XK,nrk,nck,wk->w,b,nrk);
+    }
+  }
+  /* Diagonal block and the rows below it, SN_BLK columns at a time, each
+   * group being updated from the columns before it then factorized */
+  for(b=0;b<nc;b+=SN_BLK) {
+    nb=nc-b<SN_BLK?nc-b:SN_BLK;
+    if(b) {
+      for(j=0;j<nb;j++) cols[j]=X+(size_t)(b+j)*nr;
+      blk_weights(wk->w,cols,X,nr,b,b,nb);
+      upd_blk(cols,0,X,nr,b,wk->w,b,nr);
+    }
+    for(c=b;c<b+nb;c++) {
+      col=X+(size_t)c*nr;
+      d=col[c];
+      if(fabs(d)<tol) {
+	for(a=c;a<nr;a++) col[a]=0.0;
+	continue;
+      }
+      if(d<DBL_EPSILON) return f+c;
+      z=1.0/d;
+      for(a=c+1;a<nr;a++) col[a]*=z;
+      for(c2=c+1;c2<b+nb;c2++) {
+	col2=X+(size_t)c2*nr;
+	z=col[c2]*d;
+	if(z==0.0) continue;
+	for(a=c2;a<nr;a++) col2[a]-=col[a]*z;
+      }
+    }
+  }
+  return -1;
+}
+
+static void alloc_work(struct sn_work *wk,const int n)
+{
+  wk->map=lk_malloc(sizeof(int)*2*(n?n:1));
+  wk->rel=wk->map+n;
+  wk->w=lk_malloc(sizeof(double)*SN_BLK*(n?n:1));
+}
+
+static void free_work(struct sn_work *wk)
+{
+  free(wk->map);
+  free(wk->w);
+}
+
+static void *sn_thread(void *arg)
+{
+  int J,P,k;
+  struct sn_worker *w;
+  struct sn_shared *sh;
+
+  w=arg;
+  sh=w->sh;
+  for(;;) {
+    (void)pthread_mutex_lock(&sh->lock);
+    if(sh->next>=sh->s->n_sn || sh->fail>=0) {
+      (void)pthread_mutex_unlock(&sh->lock);
+      break;
+    }
+    J=sh->s->sched[sh->next++];
+    while(sh->pending[J] && sh->fail<0) (void)pthread_cond_wait(&sh->done,&sh->lock);
+    k=sh->fail;
+    (void)pthread_mutex_unlock(&sh->lock);
+    if(k>=0) break;
+    k=factor_sn(sh->s,J,&w->wk,sh->tol);
+    (void)pthread_mutex_lock(&sh->lock);
+    if(k>=0 && (sh->fail<0 || k<sh->fail)) sh->fail=k;
+    if(((P=sh->s->sn_parent[J])>=0 && !--sh->pending[P]) || k>=0) (void)pthread_cond_broadcast(&sh->done);
+    (void)pthread_mutex_unlock(&sh->lock);
+  }
+  return 0;
+}
+
+/* Numerical factorization of the values set up in s->x, using up to
+ * n_threads threads.  Pivots less than tol in size are taken as zero,
+ * and their columns of L are cleared.  Returns the first column found
+ * with a negative pivot (the matrix is not positive semi-definite), or -1 */
+int sn_factor(struct sn_chol *s,const double tol,const int n_threads)
+{
+  int i,J,K,nt,*started;
+  pthread_t *th;
+  struct sn_shared sh;
+  struct sn_worker *w;
+  struct sn_work wk;
+
+  nt=s->n_sn<SN_PAR_MIN?1:n_threads;
+  if(nt<=1) {
+    alloc_work(&wk,s->n);
+    for(i=-1,J=0;i<0 && J<s->n_sn;J++) i=factor_sn(s,J,&wk,tol);
+    free_work(&wk);
+    return i;
+  }
+  sh.s=s;
+  sh.tol=tol;
+  sh.next=0;
+  sh.fail=-1;
+  sh.pending=lk_calloc((size_t)s->n_sn,sizeof(int));
+  for(J=0;J<s->n_sn;J++) if((K=s->sn_parent[J])>=0) sh.pending[K]++;
+  (void)pthread_mutex_init(&sh.lock,0);
+  (void)pthread_cond_init(&sh.done,0);
+  w=lk_malloc(sizeof(struct sn_worker)*nt);
+  th=lk_malloc(sizeof(pthread_t)*nt);
+  started=lk_calloc((size_t)nt,sizeof(int));
+  for(i=0;i<nt;i++) {
+    w[i].sh=&sh;
+    alloc_work(&w[i].wk,s->n);
+  }
+  for(i=1;i<nt;i++) if(!pthread_create(th+i,0,sn_thread,w+i)) started[i]=1;
+  (void)sn_thread(w);
+  for(i=1;i<nt;i++) if(started[i]) (void)pthread_join(th[i],0);
+  (void)pthread_cond_destroy(&sh.done);
+  (void)pthread_mutex_destroy(&sh.lock);
+  for(i=0;i<nt;i++) free_work(&w[i].wk);
+  free(started);
+  free(th);
+  free(w);
+  free(sh.pending);
+  return sh.fail;
+}
+
+/* Solve L X = B in place for nrhs right hand sides, the columns of B being
+ * ldb apart */
+void sn_lsolve(const struct sn_chol *s,double *b,const int nrhs,const int ldb)
+{
+  int a,c,v,J,f,nc,nr;
+  const int *rw;
+  double z,*bv;
+  const double *col;
+
+  for(J=0;J<s->n_sn;J++) {
+    f=s->sn_start[J];
+    nc=s->sn_start[J+1]-f;
+    nr=s->row_ptr[J+1]-s->row_ptr[J];
+    rw=s->rows+s->row_ptr[J];
+    for(c=0;c<nc;c++) {
+      col=s->x+s->x_ptr[J]+(size_t)c*nr;
+      for(v=0;v<nrhs;v++) {
+	bv=b+(size_t)v*ldb;
+	z=bv[f+c];
+	if(z==0.0) continue;
+	for(a=c+1;a<nr;a++) bv[rw[a]]-=col[a]*z;
+      }
+    }
+  }
+}
+
+/* Solve L' x = b in place */
+void sn_ltsolve(const struct sn_chol *s,double *b)
+{
+  int a,c,J,f,nc,nr;
+  const int *rw;
+  double z;
+  const double *col;
+
+  for(J=s->n_sn-1;J>=0;J--) {
+    f=s->sn_start[J];
+    nc=s->sn_start[J+1]-f;
+    nr=s->row_ptr[J+1]-s->row_ptr[J];
+    rw=s->rows+s->row_ptr[J];
+    for(c=nc-1;c>=0;c--) {
+      col=s->x+s->x_ptr[J]+(size_t)c*nr;
+      z=b[f+c];
+      for(a=c+1;a<nr;a++) z-=col[a]*b[rw[a]];
+      b[f+c]=z;
+    }
+  }
+}
@@ -30,18 +30,20 @@
 #define string_srep srep
 #define _fget_bptr struct f_buffer **
 
-#define __FG_BUF_SIZE 4096
 #define __FG_STR_SIZE 256
 
+/* fget_string() state: a line reader in LR_SYNC mode, so callers can go on
+ * reading the FILE directly between lines */
 struct f_buffer {
-  size_t ptr,ptr1,size;
-  char buf[__FG_BUF_SIZE];
+  FILE *fptr;
+  struct line_reader *lr;
 };
 
 
 #include "config.h"
 #include "lk_malloc.h"
 #include "string_utils.h"
+#include "line_reader.h"
 
 #define SBUF(s) (s)->srep->buf
 
@@ -55,85 +57,275 @@ struct srep {
   size_t slen;
   size_t rfc;
   char *buf;
+  struct str_pool *pool;     /* pool the srep came from */
+  struct str_pool *buf_pool; /* pool the buffer came from if buf_class>=0 */
+  int buf_class;             /* slab size class of buf, -1 if malloced */
 };
 
-static pthread_mutex_t free_string_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t free_srep_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * string and srep structures and small string buffers come from per thread
+ * pools, so the parse path does not take a lock on every allocation and free.
+ *
+ * Each pool has a free list per object type, filled from 64K slabs.  Objects
+ * freed by the thread owning the pool go straight back on its free lists.
+ * Objects freed by another thread are pushed on a lock free return stack of
+ * the owning pool, which the owner takes over in one go when its own free
+ * list runs dry.  Pools of exited threads are kept and handed to the next
+ * new thread.
+ */
+#define STR_SLAB_SIZE 65536
+#define STR_N_CLASSES 6    /* Small buffers of 8,16,...,256 bytes */
+#define STR_MAX_SMALL 256
+#define FL_STRING 0
+#define FL_SREP 1
+#define FL_BUF 2
+#define N_FREE_LISTS (FL_BUF+STR_N_CLASSES)
+
+struct free_node {
+  struct free_node *next;
+};
 
-static string *free_string_list;
-static struct srep *free_srep_list;
+struct str_slab {
+  struct str_slab *next;
+  double align;
+};
 
-static struct srep *new_srep(void)
+struct str_pool {
+  struct free_node *free[N_FREE_LISTS];
+  struct free_node *remote[N_FREE_LISTS];
+  struct str_slab *slabs;
+  char *slab_ptr;
+  size_t slab_left;
+  long live;                 /* objects handed out and not given back */
+  struct str_pool *next;     /* orphan list */
+  struct str_pool *all_next; /* list of all pools */
+};
+
+static pthread_key_t pool_key;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct str_pool *all_pools,*orphan_pools;
+
+static const size_t fl_size[N_FREE_LISTS]={sizeof(string),sizeof(struct srep),8,16,32,64,128,256};
+
+static void orphan_pool(void *p)
 {
-  struct srep *sr;
+  struct str_pool *pool=p;
 	
-  pthread_mutex_lock(&free_srep_mutex);
-  if((sr=free_srep_list)) {
-    free_srep_list=sr->next;
-    pthread_mutex_unlock(&free_srep_mutex);
-  } else {
-    pthread_mutex_unlock(&free_srep_mutex);
-    sr=lk_malloc(sizeof(struct srep));
+  pthread_mutex_lock(&pool_mutex);
+  pool->next=orphan_pools;
+  orphan_pools=pool;
+  pthread_mutex_unlock(&pool_mutex);
+}
+
+static void init_pool_key(void)
+{
+  (void)pthread_key_create(&pool_key,orphan_pool);
+}
+
+static struct str_pool *get_pool(void)
+{
+  struct str_pool *pool;
+	
+  (void)pthread_once(&pool_once,init_pool_key);
+  if(!(pool=pthread_getspecific(pool_key))) {
+    pthread_mutex_lock(&pool_mutex);
+    if((pool=orphan_pools)) orphan_pools=pool->next;
+    else {
+      pool=lk_calloc((size_t)1,sizeof(struct str_pool));
+      pool->all_next=all_pools;
+      all_pools=pool;
+    }
+    pool->next=0;
+    pthread_mutex_unlock(&pool_mutex);
+    (void)pthread_setspecific(pool_key,pool);
   }
-  if(sr) {
-    sr->slen=0;
-    sr->buf=0;
-    sr->next=0;
-    sr->rfc=0;
+  return pool;
+}
+
+static int buf_class(size_t sz)
+{
+  int i=0;
+  size_t k=8;
+	
+  while(k<sz) {
+    k<<=1;
+    i++;
+  }
+  return i;
+}
+
+static void *slab_alloc(struct str_pool *pool,size_t sz)
+{
+  void *p;
+  struct str_slab *sl;
+	
+  if(pool->slab_left<sz) {
+    sl=lk_malloc(STR_SLAB_SIZE);
+    sl->next=pool->slabs;
+    pool->slabs=sl;
+    pool->slab_ptr=(char *)&sl->align;
+    pool->slab_left=STR_SLAB_SIZE-((char *)&sl->align-(char *)sl);
+  }
+  p=pool->slab_ptr;
+  pool->slab_ptr+=sz;
+  pool->slab_left-=sz;
+  return p;
+}
+
+static void *pool_get(struct str_pool *pool,int fl)
+{
+  struct free_node *p;
+  long n;
+	
+  if(!(p=pool->free[fl])) {
+    /* Take over objects other threads have given back */
+    if(__atomic_load_n(&pool->remote[fl],__ATOMIC_ACQUIRE)) {
+      p=__atomic_exchange_n(&pool->remote[fl],(struct free_node *)0,__ATOMIC_ACQUIRE);
+      for(n=0;p;n++) {
+	struct free_node *p1=p->next;
+	p->next=pool->free[fl];
+	pool->free[fl]=p;
+	p=p1;
+      }
+      pool->live-=n;
+      p=pool->free[fl];
+    }
+    if(!p) {
+      pool->live++;
+      return slab_alloc(pool,(fl_size[fl]+sizeof(double)-1)&~(sizeof(double)-1));
+    }
+  }
+  pool->free[fl]=p->next;
+  pool->live++;
+  return p;
+}
+
+static void pool_put(struct str_pool *owner,int fl,void *v)
+{
+  struct free_node *p=v,*head;
+	
+  if(owner==pthread_getspecific(pool_key)) {
+    p->next=owner->free[fl];
+    owner->free[fl]=p;
+    owner->live--;
+  } else {
+    head=__atomic_load_n(&owner->remote[fl],__ATOMIC_RELAXED);
+    do p->next=head;
+    while(!__atomic_compare_exchange_n(&owner->remote[fl],&head,p,0,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
   }
+}
+
+static struct srep *new_srep(void)
+{
+  struct str_pool *pool;
+  struct srep *sr;
+	
+  pool=get_pool();
+  sr=pool_get(pool,FL_SREP);
+  sr->slen=0;
+  sr->buf=0;
+  sr->next=0;
+  sr->rfc=0;
+  sr->pool=pool;
+  sr->buf_pool=0;
+  sr->buf_class=-1;
   return sr;
 }
 
 static string *new_string(void)
 {
+  struct str_pool *pool;
   string *s;
 	
-  pthread_mutex_lock(&free_string_mutex);
-  if((s=free_string_list)) {
-    free_string_list=s->next;
-    pthread_mutex_unlock(&free_string_mutex);
-  } else {
-    pthread_mutex_unlock(&free_string_mutex);
-    s=lk_malloc(sizeof(string));
-  }
+  pool=get_pool();
+  s=pool_get(pool,FL_STRING);
   s->next=0;
   s->len=0;
+  s->pool=pool;
   return s;
 }
 
-static char *alloc_sbuf(struct srep *sr,size_t sz)
+/* Buffers of up to STR_MAX_SMALL bytes come from the pool, larger ones from malloc */
+static char *get_sbuf(struct srep *sr,size_t ln)
 {
-  size_t ln;
+  struct str_pool *pool;
 	
-  ln=sz+1;
-  sr->slen=ln;
-  sr->rfc=1;
-  sr->buf=lk_malloc(ln);
+  if(ln<=STR_MAX_SMALL) {
+    pool=get_pool();
+    sr->buf_class=buf_class(ln);
+    sr->buf_pool=pool;
+    sr->buf=pool_get(pool,FL_BUF+sr->buf_class);
+    sr->slen=(size_t)8<<sr->buf_class;
+  } else {
+    sr->buf_class=-1;
+    sr->buf_pool=0;
+    sr->buf=lk_malloc(ln);
+    sr->slen=ln;
+  }
   return sr->buf;
 }
 
+static void put_sbuf(struct srep *sr)
+{
+  if(sr->buf) {
+    if(sr->buf_class>=0) pool_put(sr->buf_pool,FL_BUF+sr->buf_class,sr->buf);
+    else free(sr->buf);
+    sr->buf=0;
+  }
+  sr->buf_class=-1;
+  sr->slen=0;
+}
+
+static char *alloc_sbuf(struct srep *sr,size_t sz)
+{
+  sr->rfc=1;
+  return get_sbuf(sr,sz+1);
+}
+
 static char *realloc_sbuf(struct srep *sr,size_t sz)
 {
-  size_t ln;
+  size_t ln,olen;
+  struct str_pool *opool;
+  int ocls;
+  char *p;
 	
   ln=sz+1;
-  sr->buf=lk_realloc(sr->buf,ln);
-  sr->slen=ln;
+  if(sr->buf_class<0) {
+    sr->buf=lk_realloc(sr->buf,ln);
+    sr->slen=ln;
+  } else if(ln>sr->slen) {
+    p=sr->buf;
+    opool=sr->buf_pool;
+    ocls=sr->buf_class;
+    olen=sr->slen;
+    (void)get_sbuf(sr,ln);
+    memcpy(sr->buf,p,olen);
+    pool_put(opool,FL_BUF+ocls,p);
+  }
   return sr->buf;
 }
 
+/* Move a pool buffer to malloced memory, for callers that will free() it */
+static void malloc_sbuf(struct srep *sr)
+{
+  char *p;
+	
+  if(sr->buf && sr->buf_class>=0) {
+    p=lk_malloc(sr->slen);
+    memcpy(p,sr->buf,sr->slen);
+    pool_put(sr->buf_pool,FL_BUF+sr->buf_class,sr->buf);
+    sr->buf=p;
+    sr->buf_class=-1;
+    sr->buf_pool=0;
+  }
+}
+
 static void free_sbuf(struct srep *sr)
 {
   if(!(--(sr->rfc))) {
-    if(sr->buf) {
-      free(sr->buf);
-      sr->buf=0;
-    }
-    sr->slen=0;
-    pthread_mutex_lock(&free_srep_mutex);
-    sr->next=free_srep_list;
-    free_srep_list=sr;
-    pthread_mutex_unlock(&free_srep_mutex);
+    put_sbuf(sr);
+    pool_put(sr->pool,FL_SREP,sr);
   }
 }
 
@@ -142,23 +334,39 @@ void free_string(string *s)
   if(s) {
     free_sbuf(s->srep);
     s->srep=0;
-    pthread_mutex_lock(&free_string_mutex);
-    s->next=free_string_list;
-    free_string_list=s;
-    pthread_mutex_unlock(&free_string_mutex);
+    pool_put(s->pool,FL_STRING,s);
   }
 }
 
+/* Give the slabs of the calling thread's pool back to the system if none of
+ * its objects are in use any more */
 void free_string_lib(void)
 {
-  pthread_mutex_lock(&free_string_mutex);
-  free_list(free_string_list,0);
-  free_string_list=0;
-  pthread_mutex_unlock(&free_string_mutex);
-  pthread_mutex_lock(&free_srep_mutex);
-  free_list(free_srep_list,0);
-  free_srep_list=0;
-  pthread_mutex_lock(&free_srep_mutex);
+  struct str_pool *pool;
+  struct str_slab *sl,*sl1;
+  int fl;
+	
+  pool=get_pool();
+  for(fl=0;fl<N_FREE_LISTS;fl++) {
+    pool->free[fl]=0;
+    if(__atomic_load_n(&pool->remote[fl],__ATOMIC_ACQUIRE)) {
+      struct free_node *p=__atomic_exchange_n(&pool->remote[fl],(struct free_node *)0,__ATOMIC_ACQUIRE);
+      while(p) {
+	pool->live--;
+	p=p->next;
+      }
+    }
+  }
+  if(pool->live) return;
+  sl=pool->slabs;
+  while(sl) {
+    sl1=sl->next;
+    free(sl);
+    sl=sl1;
+  }
+  pool->slabs=0;
+  pool->slab_ptr=0;
+  pool->slab_left=0;
 }
 
 static struct srep *clean_copy(struct srep *sr)
@@ -195,12 +403,12 @@ void trim_comment(string *s,int c)
 void *get_fget_buffer(struct f_buffer **buffer,size_t *sz)
 {
   void *p;
-  struct f_buffer *buf;
+  struct line_reader *lr;
 	
-  buf=*buffer;
-  if(buf->ptr>buf->ptr1) {
-    p=buf->buf+buf->ptr1;
-    *sz=buf->ptr-buf->ptr1;
+  lr=*buffer?(*buffer)->lr:0;
+  if(lr && lr->ptr<lr->end) {
+    p=lr->ptr;
+    *sz=(size_t)(lr->end-lr->ptr);
   } else {
     p=0;
     *sz=0;
@@ -208,146 +416,71 @@ void *get_fget_buffer(struct f_buffer **buffer,size_t *sz)
   return p;    			 
 }
 
-string *fget_string(FILE *fptr,string *s,struct f_buffer **buffer)
+void free_fget_buffer(struct f_buffer **buffer)
 {
-  size_t i;
-  int fg;
-  struct srep *sr;
-  struct f_buffer *buf;
-  char *p;
-	
-  buf=*buffer;
-  if(!buf) {
-    buf=lk_malloc(sizeof(struct f_buffer));
-    buf->ptr=buf->ptr1=0;
-    buf->size=__FG_BUF_SIZE;
-    *buffer=buf;
-  }
-  if(!s) {
-    s=new_string();
-    s->srep=sr=new_srep();
-    sr->buf=lk_malloc((size_t)__FG_STR_SIZE);
-    sr->slen=__FG_STR_SIZE;
-  } else {
-    sr=s->srep;
-    if(sr->rfc>1) {
-      sr->rfc--;
-      s->srep=sr=new_srep();
-      sr->slen=__FG_STR_SIZE;
-      sr->buf=lk_malloc((size_t)__FG_STR_SIZE);
-    }
-    s->len=0;
-  }
-  sr->buf[0]=0;
-  assert(buf->ptr>=buf->ptr1 && buf->ptr<=buf->size);
-  p=buf->buf;
-  if(buf->ptr==buf->ptr1) {
-    buf->ptr1=0;
-    /*    n=fread(p,1,buf->size,fptr);
-    buf->ptr=n;
-    if(!n) {
-      s->len=0;
-      return s;
-      } */
-    char *p1=fgets(p,buf->size,fptr);
-    if(!p1) {
-      s->len=0;
-      return s;
-    }
-    buf->ptr=strlen(p1);
+  if(*buffer) {
+    lr_close((*buffer)->lr);
+    free(*buffer);
+    *buffer=0;
   }
-  do {
-    for(i=buf->ptr1;i<buf->ptr;i++) if(p[i]=='\n' || p[i]=='\r') break;
-    if(i<buf->ptr) {
-      fg=0;
-      if(p[i]=='\r') {
-	if(i+1==buf->ptr) fg=-1;
-	else {
-	  if(p[i+1]=='\n') fg=1;
-	  p[i]='\n';
-	}
-      }
-      if(fg>=0) {
-	addl_cstring_to_string(s,p+buf->ptr1,i-buf->ptr1+1);
-	buf->ptr1=i+1+fg;
-	break;
-      } else {
-	if(i-buf->ptr1) addl_cstring_to_string(s,p+buf->ptr1,i-buf->ptr1);
-	p[0]='\r';
-	buf->ptr1=0;
-	/*	n=fread(p+1,1,buf->size-1,fptr);
-		buf->ptr=n+1; */
-	char *p1=fgets(p+1,buf->size-1,fptr);
-	
-	buf->ptr=1+(p1?strlen(p1):0);
-      }
-    } else {
-      addl_cstring_to_string(s,p+buf->ptr1,i-buf->ptr1);
-      buf->ptr1=0;
-      /*      n=fread(p,1,buf->size,fptr); */
-      char *p1=fgets(p,buf->size,fptr);
-      buf->ptr=p1?strlen(p1):0;
-    }
-  } while(buf->ptr>buf->ptr1);
-  return s;
 }
 
-string *fget_string_gen(FILE *fptr,string *s,struct f_buffer **buffer,int c)
+/* Compatibility wrapper round the line reader: the line (c<0) or record
+ * (terminated by c) is copied into s, including its terminator */
+static string *lk_fget_string(FILE *fptr,string *s,struct f_buffer **buffer,int c)
 {
-  size_t i,n;
   struct srep *sr;
   struct f_buffer *buf;
   char *p;
+  size_t n;
 	
   buf=*buffer;
   if(!buf) {
     buf=lk_malloc(sizeof(struct f_buffer));
-    buf->ptr=buf->ptr1=0;
-    buf->size=__FG_BUF_SIZE;
+    buf->fptr=0;
+    buf->lr=0;
     *buffer=buf;
   }
+  if(buf->fptr!=fptr || !buf->lr) {
+    lr_close(buf->lr);
+    buf->lr=lr_open(fptr,LR_SYNC);
+    buf->fptr=fptr;
+  }
   if(!s) {
     s=new_string();
     s->srep=sr=new_srep();
-    sr->buf=lk_malloc((size_t)__FG_STR_SIZE);
-    sr->slen=__FG_STR_SIZE;
+    (void)alloc_sbuf(sr,__FG_STR_SIZE-1);
   } else {
     sr=s->srep;
     if(sr->rfc>1) {
       sr->rfc--;
       s->srep=sr=new_srep();
-      sr->slen=__FG_STR_SIZE;
-      sr->buf=lk_malloc((size_t)__FG_STR_SIZE);
+      (void)alloc_sbuf(sr,__FG_STR_SIZE-1);
     }
     s->len=0;
   }
   sr->buf[0]=0;
-  assert(buf->ptr>=buf->ptr1 && buf->ptr<=buf->size);
-  p=buf->buf;
-  if(buf->ptr==buf->ptr1) {
-    buf->ptr1=0;
-    n=fread(p,1,buf->size,fptr);
-    buf->ptr=n;
-    if(!n) {
-      s->len=0;
-      return s;
-    }
+  p=c<0?lr_getline(buf->lr,&n):lr_getdelim(buf->lr,&n,c);
+  if(p) {
+    if(sr->slen<n+2) (void)realloc_sbuf(sr,n+1);
+    memcpy(sr->buf,p,n);
+    if(buf->lr->term) sr->buf[n++]=(char)buf->lr->term;
+    sr->buf[n]=0;
+    s->len=n;
   }
-  do {
-    for(i=buf->ptr1;i<buf->ptr;i++) if(p[i]==c) break;
-    if(i<buf->ptr) {
-      addl_cstring_to_string(s,p+buf->ptr1,i-buf->ptr1+1);
-      buf->ptr1=i+1;
-      break;
-    }
-    addl_cstring_to_string(s,p+buf->ptr1,i-buf->ptr1);
-    buf->ptr1=0;
-    n=fread(p,1,buf->size,fptr);
-    buf->ptr=n;
-  } while(buf->ptr>buf->ptr1);
   return s;
 }
 
+string *fget_string(FILE *fptr,string *s,struct f_buffer **buffer)
+{
+  return lk_fget_string(fptr,s,buffer,-1);
+}
+
+string *fget_string_gen(FILE *fptr,string *s,struct f_buffer **buffer,int c)
+{
+  return lk_fget_string(fptr,s,buffer,c);
+}
+
 void set_strcmpfunc(int (*f)(const char *,const char *))
 {
   strcmpfunc=f;
@@ -433,6 +566,7 @@ char *copy_cstring(string *s)
   char *p=0;
 	
   if(s) {
+    malloc_sbuf(s->srep);
     p=s->srep->buf;
     s->srep->rfc++;
   }
@@ -450,6 +584,7 @@ char *extract_cstring(string *s)
       p=lk_malloc((size_t)s->len+1);
       strncpy(p,sr->buf,s->len+1);
     } else {
+      malloc_sbuf(sr);
       p=sr->buf;
       sr->buf=0;
     }
@@ -43,6 +43,11 @@
 #include <sys/systeminfo.h>
 #endif
 #include <assert.h>
+#include <locale.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "ranlib.h"
 #include "lk_malloc.h"
@@ -346,7 +351,7 @@ double strtodnum(const char *s,double low,double high,char **errstr)
 	errno=0;
 	if(low>high) er=1;
 	else {
-		x=strtod(s,&s1);
+		x=lk_strtod(s,&s1);
 		if(errno==EINVAL) er=3;
 		else if(errno==ERANGE) er=2;
 		else if(*s1 || s==s1) er=3;
@@ -371,7 +376,7 @@ long strtolnum(const char *s,long low,long high,char **errstr)
 	errno=0;
 	if(low>high) er=1;
 	else {
-		x=strtol(s,&s1,10);
+		x=lk_strtol(s,&s1);
 		if(errno==EINVAL) er=3;
 		else if(errno==ERANGE) er=2;
 		else if(*s1 || s==s1) er=3;
@@ -509,72 +514,253 @@ tokens *copy_ntokens(tokens *tok,int n)
   return tok1;
 }
 
+/* White space as isspace() sees it for the bytes that can appear in a
+ * data file.  The C library puts no byte above 0x7f in the space class
+ * for single byte locales, and in UTF-8 such bytes are never whole
+ * characters, so the table is the same whatever the locale */
+#define is_wspace(c) ((c)==' ' || ((unsigned char)(c)-9u)<5u)
+
+/* Bit i of the mask is set if byte i of the 16 byte block at p is a
+ * delimiter - white space if ch is 0, otherwise ch itself */
+static unsigned int delim_mask(const char *p,const int ch)
+{
+#ifdef __SSE2__
+  __m128i x,m;
+
+  x=_mm_loadu_si128((const __m128i *)p);
+  if(ch) m=_mm_cmpeq_epi8(x,_mm_set1_epi8((char)ch));
+  else {
+    /* Subtracting 9-128 turns the unsigned test x-9<5 for 9-13 into
+     * a signed comparison */
+    m=_mm_cmplt_epi8(_mm_sub_epi8(x,_mm_set1_epi8(9-128)),_mm_set1_epi8(5-128));
+    m=_mm_or_si128(m,_mm_cmpeq_epi8(x,_mm_set1_epi8(' ')));
+  }
+  return (unsigned int)_mm_movemask_epi8(m);
+#else
+  int i;
+  unsigned int m=0;
+
+  for(i=0;i<16;i++) if(ch?p[i]==(char)ch:is_wspace(p[i])) m|=1u<<i;
+  return m;
+#endif
+}
+
+static int first_bit(unsigned int m)
+{
+#ifdef __GNUC__
+  return __builtin_ctz(m);
+#else
+  int i=0;
+
+  while(!(m&1u)) {
+    m>>=1;
+    i++;
+  }
+  return i;
+#endif
+}
+
+struct span_buf {
+  struct tok_span *sp;
+  int size;
+};
+
+/* Records token n, as a span in b or, if b is null, as a pointer in tok
+ * with the token terminated in place */
+static void add_token(struct span_buf *b,tokens *tok,const char *s,const int start,const int len,const int n)
+{
+  if(b) {
+    if(n==b->size) {
+      b->size=b->size?b->size<<1:16;
+      b->sp=b->sp?lk_realloc(b->sp,sizeof(struct tok_span)*b->size):lk_malloc(sizeof(struct tok_span)*b->size);
+    }
+    b->sp[n].start=start;
+    b->sp[n].len=len;
+  } else {
+    if(n==tok->size) {
+      tok->size<<=1;
+      tok->toks=lk_realloc(tok->toks,sizeof(void *)*tok->size);
+    }
+    tok->toks[n]=(char *)s+start;
+    ((char *)s)[start+len]=0;
+  }
+}
+
+/* Splits s as tokenize() does.  The string is classified 16 bytes at a
+ * time, the last partial block byte by byte, so nothing is read past
+ * the terminating NUL.  Splitting on white space, each set bit of e
+ * marks where a token starts or ends */
+static int scan_core(const char *s,const int ch,struct span_buf *b,tokens *tok)
+{
+  size_t i,len,k,st=0;
+  unsigned int m,e,bits,prev=1;
+  int pos,n=0,j,x;
+
+  len=strlen(s);
+  for(i=0;i<len;i+=16) {
+    k=len-i;
+    if(k>=16) {
+      m=delim_mask(s+i,ch);
+      bits=0xffffu;
+    } else {
+      for(m=0,j=0;j<(int)k;j++) if(ch?s[i+j]==(char)ch:is_wspace(s[i+j])) m|=1u<<j;
+      bits=(1u<<k)-1u;
+    }
+    if(!ch) {
+      e=(m^((m<<1)|prev))&bits;
+      prev=(m>>(k>=16?15:k-1))&1u;
+      for(;e;e&=e-1u) {
+	pos=first_bit(e);
+	if((m>>pos)&1u) add_token(b,tok,s,(int)st,(int)(i+pos-st),n++);
+	else st=i+pos;
+      }
+    } else {
+      for(m&=bits;m;m&=m-1u) {
+	/* Trim the white space round each field, as qstrip() does */
+	pos=first_bit(m);
+	x=(int)(i+pos);
+	while((int)st<x && is_wspace(s[st])) st++;
+	while(x>(int)st && is_wspace(s[x-1])) x--;
+	add_token(b,tok,s,(int)st,x-(int)st,n++);
+	st=i+pos+1;
+      }
+    }
+  }
+  if(!ch) {
+    if(!prev) add_token(b,tok,s,(int)st,(int)(len-st),n++);
+  } else if(st<len) {
+    x=(int)len;
+    while((int)st<x && is_wspace(s[st])) st++;
+    while(x>(int)st && is_wspace(s[x-1])) x--;
+    add_token(b,tok,s,(int)st,x-(int)st,n++);
+  }
+  return n;
+}
+
+/* Finds the tokens of s as tokenize() would, but leaves s alone and
+ * stores the offset and length of each in *spans, which is grown as
+ * needed (*size is its allocated length).  Returns the number of tokens */
+int scan_tokens(const char *s,const int ch,struct tok_span **spans,int *size)
+{
+  int n=0;
+  struct span_buf b;
+	
+  if(s) {
+    b.sp=*spans;
+    b.size=*size;
+    n=scan_core(s,ch,&b,0);
+    *spans=b.sp;
+    *size=b.size;
+    if(n==1 && !b.sp[0].len) n--;
+  }
+  return n;
+}
+
+/* The tokens are left where they are in s, each terminated by
+ * overwriting the delimiter (or the space) following it */
 tokens *tokenize(char *s,const int ch,tokens *tok)
 {
   int n_toks=0;
-  char **p=0,*p1;
 	
   if(!tok) {
     tok=lk_malloc(sizeof(tokens));
     tok->size=16;
-    if(tok) {
-      if(!(tok->toks=lk_malloc(sizeof(void *)*tok->size))) {
-	free(tok);
-	tok=0;
+    tok->toks=lk_malloc(sizeof(void *)*tok->size);
+  }
+  if(s) {
+    n_toks=scan_core(s,ch,0,tok);
+    if(n_toks==1 && !*tok->toks[0]) n_toks--;
+  }
+  tok->n_tok=n_toks;
+  return tok;
+}
+
+/* Exact powers of ten for lk_strtod() */
+static const double pow10_tab[23]={
+  1.0e0,1.0e1,1.0e2,1.0e3,1.0e4,1.0e5,1.0e6,1.0e7,1.0e8,1.0e9,1.0e10,1.0e11,
+  1.0e12,1.0e13,1.0e14,1.0e15,1.0e16,1.0e17,1.0e18,1.0e19,1.0e20,1.0e21,1.0e22
+};
+
+/* Can c continue a number as the C library reads it?  If so the fast
+ * parsers hand the string over to strtod()/strtol() */
+#define num_cont(c) (isalnum((unsigned char)(c)) || (c)=='.' || (c)==',' || ((unsigned char)(c))>0x7f)
+
+/* strtol(s,endptr,10) for the common case of a plain decimal integer.
+ * Anything else, including overflow, is passed to strtol() so the
+ * result, errno and *endptr are always as strtol() would give */
+long lk_strtol(const char *s,char **endptr)
+{
+  const char *p=s,*q;
+  unsigned long x=0;
+  int neg=0;
+
+  while(is_wspace(*p)) p++;
+  if(*p=='-' || *p=='+') neg=(*p++=='-');
+  while(*p=='0' && (unsigned char)(p[1]-'0')<10u) p++;
+  q=p;
+  while((unsigned char)(*p-'0')<10u) x=x*10+(unsigned long)(*p++-'0');
+  /* Up to 18 (or 9) digits can not overflow a long */
+  if(p==q || p-q>(LONG_MAX>2147483647L?18:9) || num_cont(*p)) return strtol(s,endptr,10);
+  if(endptr) *endptr=(char *)p;
+  return neg?-(long)x:(long)x;
+}
+
+/* strtod() for the common case of a decimal number with at most 19
+ * significant digits and a small exponent.  If the digits fit in 53 bits
+ * and the power of ten is exact, one multiplication or division gives
+ * the correctly rounded result that strtod() would.  Everything else
+ * (long mantissas, large exponents, hex, inf and nan, a radix other
+ * than '.' in the current locale) is passed to strtod().  Rounding to
+ * extended precision would spoil this, hence the FLT_EVAL_METHOD test */
+double lk_strtod(const char *s,char **endptr)
+{
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD==0
+  const char *p=s,*q;
+  uint64_t m=0;
+  int neg=0,nd=0,dig=0,dot=0,e=0,ex=0,eneg=0;
+  struct lconv *lc;
+  double x;
+
+  while(is_wspace(*p)) p++;
+  if(*p=='-' || *p=='+') neg=(*p++=='-');
+  for(;;p++) {
+    if((unsigned char)(*p-'0')<10u) {
+      dig=1;
+      if(m || *p!='0') {
+	if(++nd>19) return strtod(s,endptr);
+	m=m*10+(uint64_t)(*p-'0');
       }
-    }
+      if(dot) e--;
+    } else if(*p=='.' && !dot) dot=1;
+    else break;
   }
-  if(tok) {
-    p=tok->toks;
-    if((p1=s)) {
-      if(!ch) { /* Split on white space */
-	for(;;) {
-	  while(*s && isspace((int)*s)) s++;
-	  if(!*s) break;
-	  if(n_toks==tok->size) {
-	    tok->size<<=1;
-	    if(!(p=lk_realloc(p,sizeof(void *)*tok->size))) {
-	      free_tokens(tok);
-	      tok=0;
-	      break;
-	    }
-	    tok->toks=p;
-	  }
-	  p[n_toks++]=p1;
-	  while(*s && !isspace((int)*s)) {
-	    *p1++=*s++;
-	  }
-	  if(*s) s++;
-	  *p1++=0;
-	}
-      } else { /* Split on token */
-	for(;;) {
-	  if(!*s) break;
-	  if(n_toks==tok->size) {
-	    tok->size<<=1;
-	    if(!(p=lk_realloc(p,sizeof(void *)*tok->size))) {
-	      free_tokens(tok);
-	      tok=0;
-	      break;
-	    }
-	    tok->toks=p;
-	  }
-	  p[n_toks++]=p1;
-	  while(*s && *s!=ch) {
- 	    *p1++=*s++;
-	  }
-	  if(*s) s++;
-	  *p1++=0;
-	  qstrip(p[n_toks-1]);
-	}
+  if(!dig) return strtod(s,endptr);
+  if(dot) {
+    lc=localeconv();
+    if(lc->decimal_point[0]!='.' || lc->decimal_point[1]) return strtod(s,endptr);
+  }
+  if(*p=='e' || *p=='E') {
+    q=p+1;
+    if(*q=='-' || *q=='+') eneg=(*q++=='-');
+    if((unsigned char)(*q-'0')<10u) {
+      while((unsigned char)(*q-'0')<10u) {
+	if(ex<10000) ex=ex*10+(*q-'0');
+	q++;
       }
+      e+=eneg?-ex:ex;
+      p=q;
     }
   }
-  if(tok) {
-    if(n_toks==1 && !*p[0]) n_toks--;
-    tok->n_tok=n_toks;
-  }
-  return tok;
+  if(!m) e=0;
+  if(num_cont(*p) || m>((uint64_t)1<<53) || e<-22 || e>22) return strtod(s,endptr);
+  x=(double)m;
+  if(e<0) x/=pow10_tab[-e];
+  else if(e) x*=pow10_tab[e];
+  if(endptr) *endptr=(char *)p;
+  return neg?-x:x;
+#else
+  return strtod(s,endptr);
+#endif
 }
 
 #ifdef HAVE_REGCOMP	
@@ -24,6 +24,7 @@
 #include "utils.h"
 #include "loki.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "loki_utils.h"
 
 void init_traitlocus(struct loki *loki,int i)
@@ -185,8 +186,7 @@ void AllocEffects(struct loki *loki)
 			if(!(type&ST_TRAITLOCUS)) k+=model->term[i].df;
 		}
 		if(!k) continue;
-		if(!(tp=malloc(sizeof(double)*k))) ABT_FUNC(MMsg);
-		loki->sys.RemBlock=AddRemem(tp,loki->sys.RemBlock);
+		tp=arena_alloc(lk_arena(ARENA_SETUP),sizeof(double)*k);
 		for(i=0;i<k;i++) tp[i]=0.0;
 		for(i=0;i<model->n_terms;i++) if(!(model->term[i].vars[0].type&ST_TRAITLOCUS)) {
 			model->term[i].eff=tp;
@@ -204,8 +204,7 @@ void AllocEffects(struct loki *loki)
 		if(loki->params.est_aff_freq) {
 			for(j=i=0;i<loki->markers->n_markers;i++) j+=loki->markers->marker[i].locus.n_alleles;
 			if(j) {
-				if(!(tp=malloc(sizeof(double)*j*2))) ABT_FUNC(MMsg);
-				loki->sys.RemBlock=AddRemem(tp,loki->sys.RemBlock);
+				tp=arena_alloc(lk_arena(ARENA_SETUP),sizeof(double)*j*2);
 				for(i=0;i<j*2;i++) tp[i]=0.0;
 				for(i=0;i<loki->markers->n_markers;i++) {
 					n_all=loki->markers->marker[i].locus.n_alleles;
@@ -10,7 +10,11 @@
  *                                                                          *
  * Calculate Inverse of NRM matrix using algorithm of Quaas (1976)          *
  *                                                                          *
- * June 2003 (SCH) - Moved from prep to loki                                * 
+ * June 2003 (SCH) - Moved from prep to loki                                *
+ *                                                                          *
+ * Only the descendants of each individual are visited when the inbreeding  *
+ * terms are accumulated, and the pedigree components are done in parallel  *
+ * on the peeling threads (see loki_peel.c).                                *
  *                                                                          *
  * Copyright (C) Simon C. Heath 1997, 2000, 2002, 2003                      *
  * This is free software.  You can distribute it and/or modify it           *
@@ -25,19 +29,49 @@
 #endif
 #include <math.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "utils.h"
 #include "libhdr.h"
 #include "loki.h"
 #include "loki_utils.h"
+#include "loki_peel.h"
 #include "sparse.h"
 
+/* -ffloat-store only slows the loops down with SSE arithmetic (see
+ * peel_kernels.c) */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__SSE2_MATH__)
+#pragma GCC optimize ("no-float-store")
+#endif
+
+/* A column of the factor is built from the descendants of its individual
+ * when there are at most 1/2^NRM_DESC_SHIFT as many as later members of
+ * the component, and by scanning all later members otherwise */
+#define NRM_DESC_SHIFT 6
+
+/* Scratch space for one component, sized for the largest */
+struct nrm_work {
+	int *sire_list,*dam_list;
+	int *kid_ptr,*kids;     /* Offspring of each individual */
+	int *mate_ptr,*mates;   /* Offspring by their higher numbered parent */
+	int *mate_pos,*mark,*spos,*desc;
+	double *u,*v;
+};
+
+/* Components are handed out largest first from a shared counter */
+struct nrm_queue {
+	pthread_mutex_t lock;
+	int *order,next,n;
+	struct loki *loki;
+	int *comp_start;
+};
+
 static struct loki *lk;
 
 static void free_nrm(void)
 {
 	int i;
-	
+
 	if(lk && lk->models->AIMatrix) {
 		for(i=0;i<lk->pedigree->n_comp;i++) {
 			if(lk->models->AIMatrix[i]) free(lk->models->AIMatrix[i]);
@@ -46,174 +80,322 @@ static void free_nrm(void)
 	}
 }
 
-/* Calculate inverse of NRM (G) matrix using Quaas/Henderson method 
- * See Numerical Recipes in C 2nd edition pps. 78-79 for a description 
- * of the sparse matrix storage. Note the matrix is half stored.
- * 
- * The strategy is to build up the matrix directly, which means knowing
- * what non-zero diagonal elements will be present.  This is relatively
- * simple for the inverse NRM matrix as it has a very simple structure */
-void Calculate_NRM(struct loki *loki)
+static void alloc_work(struct nrm_work *w,const int n)
 {
-	int id,i,j,k,k1,idd,ids,idd1,ids1,cs,nz=0,comp,max_comp=0;
-	int *sire_list,*dam_list,*temp,*spouses=0,n_comp;
-	double d,*v,*u,xx,d2,d4,Detl,TDetl;
-	struct SparseMatRec *AIM=0;
-	struct Id_Record *id_array;
-	
-	message(INFO_MSG,"Calculating NRM matrix for polygenic effect\n");
-	lk=loki;
-	/* Find maximum component size */
-	n_comp=loki->pedigree->n_comp;
-	for(i=0;i<n_comp;i++) if(loki->pedigree->comp_size[i]>max_comp) max_comp=loki->pedigree->comp_size[i];
-	if(!(sire_list=calloc((size_t)(loki->pedigree->ped_size+max_comp),sizeof(int)))) ABT_FUNC(MMsg);
-	dam_list=sire_list+max_comp;
-	if(!(u=malloc(max_comp*2*sizeof(double)))) ABT_FUNC(MMsg);
-	v=u+max_comp;
-	TDetl=0.0;
-	if(!(loki->models->AIMatrix=malloc(sizeof(void *)*n_comp))) ABT_FUNC(MMsg);
-	id_array=loki->pedigree->id_array;
-	/* Do this one component at a time */
-	for(id=comp=0;comp<n_comp;comp++) {
-		cs=loki->pedigree->comp_size[comp];
-		/* Calculate storage requirements */
-		if(!(temp=calloc((size_t)cs+1,sizeof(int)))) ABT_FUNC(MMsg);
-		/* Count non-zero (off diagonal) elements in matrix */
-		for(j=k=0;j<cs;j++) {
-			ids=id_array[id+j].sire;
-			idd=id_array[id+j].dam;
-			if(ids) ids-=id;
-			if(idd) idd-=id;
-			sire_list[j]=ids;
-			dam_list[j]=idd;
-			if(ids!=idd) {
-				k++;
-				if(ids>idd) temp[ids-1]++;
-				else temp[idd-1]++;
+	if(!(w->sire_list=malloc(sizeof(int)*(11*n+2)))) ABT_FUNC(MMsg);
+	w->dam_list=w->sire_list+n;
+	w->kid_ptr=w->dam_list+n;
+	w->kids=w->kid_ptr+n+1;
+	w->mate_ptr=w->kids+2*n;
+	w->mates=w->mate_ptr+n+1;
+	w->mate_pos=w->mates+n;
+	w->mark=w->mate_pos+n;
+	w->spos=w->mark+n;
+	w->desc=w->spos+n;
+	if(!(w->u=malloc(sizeof(double)*2*n))) ABT_FUNC(MMsg);
+	w->v=w->u+n;
+}
+
+static void free_work(struct nrm_work *w)
+{
+	free(w->sire_list);
+	free(w->u);
+}
+
+static int cmp_int(const void *s1,const void *s2)
+{
+	return *(const int *)s1-*(const int *)s2;
+}
+
+static const int *sort_size;
+
+/* Largest components first, ties in their original order */
+static int cmp_comp(const void *s1,const void *s2)
+{
+	int i,j;
+
+	i=*(const int *)s1;
+	j=*(const int *)s2;
+	if(sort_size[i]!=sort_size[j]) return sort_size[j]-sort_size[i];
+	return i-j;
+}
+
+/* Lists (in CSR form) the offspring of each member of a component, and
+ * the offspring again grouped by their higher numbered parent, both in
+ * increasing order.  The offspring of j are kids[kid_ptr[j]..kid_ptr[j+1]-1] */
+static void list_offspring(struct nrm_work *w,const int cs)
+{
+	int j,ids,idd;
+
+	for(j=0;j<=cs;j++) w->kid_ptr[j]=w->mate_ptr[j]=0;
+	for(j=0;j<cs;j++) {
+		ids=w->sire_list[j];
+		idd=w->dam_list[j];
+		if(ids) w->kid_ptr[ids-1]++;
+		if(idd && idd!=ids) w->kid_ptr[idd-1]++;
+		if(ids!=idd) w->mate_ptr[(ids>idd?ids:idd)-1]++;
+	}
+	for(j=1;j<=cs;j++) {
+		w->kid_ptr[j]+=w->kid_ptr[j-1];
+		w->mate_ptr[j]+=w->mate_ptr[j-1];
+	}
+	for(j=cs-1;j>=0;j--) {
+		ids=w->sire_list[j];
+		idd=w->dam_list[j];
+		if(ids) w->kids[--w->kid_ptr[ids-1]]=j;
+		if(idd && idd!=ids) w->kids[--w->kid_ptr[idd-1]]=j;
+		if(ids!=idd) w->mates[--w->mate_ptr[(ids>idd?ids:idd)-1]]=j;
+	}
+}
+
+/* Set up the half stored inverse NRM for one component.  Row j holds the
+ * parents of j followed by the other parents of the offspring for which j
+ * is the higher numbered parent, in the order the offspring come.  The
+ * position of the (sire,dam) entry of each offspring is kept in mate_pos,
+ * pointing at the parent entry if one parent is the parent of the other */
+static struct SparseMatRec *nrm_structure(struct nrm_work *w,const int cs)
+{
+	int j,k,k1,ids,idd,nz,np,p,q;
+	struct SparseMatRec *AIM;
+
+	list_offspring(w,cs);
+	for(j=0;j<cs;j++) w->mark[j]=0;
+	for(nz=j=0;j<cs;j++) {
+		ids=w->sire_list[j];
+		idd=w->dam_list[j];
+		if(ids && ids!=(j+1)) nz++;
+		if(idd && idd!=ids && idd!=(j+1)) nz++;
+		for(k=w->mate_ptr[j];k<w->mate_ptr[j+1];k++) {
+			k1=w->mates[k];
+			q=w->sire_list[k1]+w->dam_list[k1]-(j+1);
+			if(q && w->mark[q-1]!=j+1) {
+				w->mark[q-1]=j+1;
+				nz++;
 			}
 		}
-		nz=0;
-		spouses=0;
-		if(k) {
-			if(!(spouses=calloc((size_t)k,sizeof(int)))) ABT_FUNC(MMsg);
-			for(j=k=0;j<cs;j++)	{
-				k1=k;
-				k+=temp[j];
-				temp[j]=k1;
-				ids=sire_list[j];
-				idd=dam_list[j];
-				if(ids && ids!=(j+1)) nz++;
-				if(idd && idd!=ids && idd!=(j+1)) nz++;
-				if(ids!=idd) {
-					if(ids>idd)	{
-						for(k1=temp[ids-1];k1<temp[ids];k1++) {
-							if(spouses[k1]==idd) break;
-							if(!spouses[k1]) {
-								spouses[k1]=idd;
-								nz++;
-								break;
-							}
-						}
-					} else {
-						for(k1=temp[idd-1];k1<temp[idd];k1++) {
-							if(spouses[k1]==ids) break;
-							if(!spouses[k1]) {
-								spouses[k1]=ids;
-								nz++;
-								break;
-							}
-						}
-					}
-				}
-			}
+	}
+	if(!(AIM=malloc((nz+1+cs)*sizeof(struct SparseMatRec)))) ABT_FUNC(MMsg);
+	for(j=0;j<cs;j++) w->mark[j]=0;
+	nz=cs+1;
+	for(j=0;j<cs;j++) {
+		w->u[j]=0.0;
+		AIM[j].val=0.0;
+		AIM[j].x=nz;
+		ids=w->sire_list[j];
+		idd=w->dam_list[j];
+		if(ids && ids!=(j+1)) {
+			AIM[nz].x=ids-1;
+			AIM[nz++].val=0.0;
 		}
-		if(!(AIM=malloc((nz+1+cs)*sizeof(struct SparseMatRec)))) ABT_FUNC(MMsg);
-		/* Set up coordinates for non-zero elements */
-		nz=cs+1;
-		for(j=0;j<cs;j++) {
-			u[j]=0.0;
-			AIM[j].val=0.0;
-			AIM[j].x=nz;
-			ids=sire_list[j];
-			idd=dam_list[j];
-			if(ids && ids!=(j+1)) {
-				AIM[nz].x=ids-1;
-				AIM[nz++].val=0.0;
-			}
-			if(idd && idd!=ids && idd!=(j+1)) {
-				AIM[nz].x=idd-1;
-				AIM[nz++].val=0.0;
-			}
-			if(!spouses) continue;
-			for(k=temp[j];k<temp[j+1];k++) {
-				if(!spouses[k]) break;
-				AIM[nz].x=spouses[k]-1;
+		if(idd && idd!=ids && idd!=(j+1)) {
+			AIM[nz].x=idd-1;
+			AIM[nz++].val=0.0;
+		}
+		np=nz;
+		for(k=w->mate_ptr[j];k<w->mate_ptr[j+1];k++) {
+			k1=w->mates[k];
+			q=w->sire_list[k1]+w->dam_list[k1]-(j+1);
+			w->mate_pos[k1]=-1;
+			if(!q) continue;
+			if(w->mark[q-1]!=j+1) {
+				w->mark[q-1]=j+1;
+				w->spos[q-1]=nz;
+				AIM[nz].x=q-1;
 				AIM[nz++].val=0.0;
 			}
+			/* The parent entry if q is a parent of j (as the entries were
+			 * once found by searching the row) */
+			for(p=AIM[j].x;p<np && AIM[p].x!=q-1;p++);
+			w->mate_pos[k1]=p<np?p:w->spos[q-1];
 		}
-		AIM[cs].x=nz;
-		if(spouses) free(spouses);
-		Detl=0.0;
-		for(i=0;i<cs;i++) {
-			xx=0.0;
-			ids=sire_list[i]-1;
-			idd=dam_list[i]-1;
-			if(ids>=0) xx=u[ids];
-			if(idd>=0) xx+=u[idd];
-			xx=1.0-.25*xx;
-			d=1.0/xx;
-			u[i]+=xx;
-			xx=sqrt(xx);
-			v[i]=xx;
-			Detl+=log(xx);
-			for(k=i+1;k<cs;k++) {
-				xx=0.0;
-				ids1=sire_list[k]-1;
-				idd1=dam_list[k]-1;
-				if(ids1>=i) xx=v[ids1];
-				if(idd1>=i) xx+=v[idd1];
-				if(xx>0.0) {
-					xx=.5*xx;
-					u[k]+=xx*xx;
+	}
+	AIM[cs].x=nz;
+	return AIM;
+}
+
+/* Entry k of column i of the factor of the NRM, from the entries of the
+ * parents of k (zero unless they are i or descendants of i) */
+static void nrm_entry(struct nrm_work *w,const int i,const int k)
+{
+	int ids1,idd1;
+	double xx,*v;
+
+	v=w->v;
+	xx=0.0;
+	ids1=w->sire_list[k]-1;
+	idd1=w->dam_list[k]-1;
+	if(ids1>=i) xx=v[ids1];
+	if(idd1>=i) xx+=v[idd1];
+	if(xx>0.0) {
+		xx=.5*xx;
+		w->u[k]+=xx*xx;
+	}
+	v[k]=xx;
+}
+
+/* Calculate the inverse NRM for one component.  The factor of the NRM is
+ * built a column at a time as before.  The only non-zero entries in a
+ * column are for the descendants of the column's individual, so if there
+ * are not too many of these only they are visited, in increasing order so
+ * the sums are formed exactly as when all later members of the component
+ * are scanned.  Otherwise the later members are scanned as before */
+static struct SparseMatRec *nrm_component(struct nrm_work *w,const int cs)
+{
+	int i,j,k,n,ids,idd,max_desc,dirty=0,*sire_list,*dam_list;
+	double d,xx,d2,d4,Detl,*u,*v;
+	struct SparseMatRec *AIM;
+
+	AIM=nrm_structure(w,cs);
+	sire_list=w->sire_list;
+	dam_list=w->dam_list;
+	u=w->u;
+	v=w->v;
+	for(j=0;j<cs;j++) {
+		v[j]=0.0;
+		w->mark[j]=0;
+	}
+	Detl=0.0;
+	for(i=0;i<cs;i++) {
+		xx=0.0;
+		ids=sire_list[i]-1;
+		idd=dam_list[i]-1;
+		if(ids>=0) xx=u[ids];
+		if(idd>=0) xx+=u[idd];
+		xx=1.0-.25*xx;
+		d=1.0/xx;
+		u[i]+=xx;
+		xx=sqrt(xx);
+		v[i]=xx;
+		Detl+=log(xx);
+		/* Collect the descendants of i (after i itself) */
+		max_desc=1+((cs-i)>>NRM_DESC_SHIFT);
+		n=0;
+		w->desc[n++]=i;
+		for(k=0;k<n && n<=max_desc;k++) {
+			for(j=w->kid_ptr[w->desc[k]];j<w->kid_ptr[w->desc[k]+1];j++) {
+				if(w->mark[w->kids[j]]!=i+1) {
+					w->mark[w->kids[j]]=i+1;
+					w->desc[n++]=w->kids[j];
 				}
-				v[k]=xx;
 			}
-			AIM[i].val+=d;
-			d2= -.5*d;
-			d4=.25*d;
-			j=AIM[i].x;
+		}
+		if(n<=max_desc) {
+			/* v is left set by a scan of the later members */
+			if(dirty) for(k=i+1;k<cs;k++) v[k]=0.0;
+			dirty=0;
+			if(n>2) gnu_qsort(w->desc+1,(size_t)(n-1),sizeof(int),cmp_int);
+			for(j=1;j<n;j++) nrm_entry(w,i,w->desc[j]);
+			for(j=1;j<n;j++) v[w->desc[j]]=0.0;
+		} else {
+			for(k=i+1;k<cs;k++) nrm_entry(w,i,k);
+			dirty=1;
+		}
+		AIM[i].val+=d;
+		d2= -.5*d;
+		d4=.25*d;
+		j=AIM[i].x;
+		if(ids>=0) {
+			AIM[j++].val+=d2;
+			AIM[ids].val+=d4;
+		}
+		if(idd>=0) {
+			AIM[j++].val+=d2;
+			AIM[idd].val+=d4;
 			if(ids>=0) {
-				AIM[j++].val+=d2;
-				AIM[ids].val+=d4;
-			}
-			if(idd>=0) {
-				AIM[j++].val+=d2;
-				AIM[idd].val+=d4;
-				if(ids>=0) {
-					if(ids==idd) AIM[ids].val+=d4;
-					else if(ids>idd) {
-						for(j=AIM[ids].x;j<AIM[ids+1].x;j++) if(AIM[j].x==idd) {
-							AIM[j].val+=d4;
-							break;
-						}
-					} else {
-						for(j=AIM[idd].x;j<AIM[idd+1].x;j++) if(AIM[j].x==ids) {
-							AIM[j].val+=d4;
-							break;
-						}
-					}
-				}
+				if(ids==idd) AIM[ids].val+=d4;
+				else if(w->mate_pos[i]>=0) AIM[w->mate_pos[i]].val+=d4;
 			}
 		}
-		Detl+=Detl;
-		TDetl+=Detl;
-		AIM[cs].val=Detl;
-		loki->models->AIMatrix[comp]=AIM;
-		message(DEBUG_MSG," Component %d, non-zero off-diagonals = %d, L(Det) NRM Matrix = %g\n",comp+1,nz-1-cs,Detl);
-		free(temp);
-		id+=cs;
 	}
-	free(sire_list);
-	free(u);
+	Detl+=Detl;
+	AIM[cs].val=Detl;
+	return AIM;
+}
+
+static void *nrm_worker(void *arg)
+{
+	int i,j,comp,cs,id,ids,idd;
+	struct nrm_queue *q;
+	struct nrm_work w;
+	struct Id_Record *id_array;
+
+	q=arg;
+	id_array=q->loki->pedigree->id_array;
+	alloc_work(&w,q->loki->pedigree->comp_size[q->order[0]]);
+	for(;;) {
+		pthread_mutex_lock(&q->lock);
+		i=q->next++;
+		pthread_mutex_unlock(&q->lock);
+		if(i>=q->n) break;
+		comp=q->order[i];
+		cs=q->loki->pedigree->comp_size[comp];
+		id=q->comp_start[comp];
+		for(j=0;j<cs;j++) {
+			ids=id_array[id+j].sire;
+			idd=id_array[id+j].dam;
+			if(ids) ids-=id;
+			if(idd) idd-=id;
+			w.sire_list[j]=ids;
+			w.dam_list[j]=idd;
+		}
+		q->loki->models->AIMatrix[comp]=nrm_component(&w,cs);
+	}
+	free_work(&w);
+	return 0;
+}
+
+/* Calculate inverse of NRM (G) matrix using Quaas/Henderson method
+ * See Numerical Recipes in C 2nd edition pps. 78-79 for a description
+ * of the sparse matrix storage. Note the matrix is half stored.
+ *
+ * The strategy is to build up the matrix directly, which means knowing
+ * what non-zero diagonal elements will be present.  This is relatively
+ * simple for the inverse NRM matrix as it has a very simple structure.
+ *
+ * The components are independent, so with more than one peeling thread
+ * they are shared out between the threads.  Nothing random is involved
+ * and each component is calculated in the same way, so the result does
+ * not depend on the number of threads */
+void Calculate_NRM(struct loki *loki)
+{
+	int i,n_comp,nt,*started,*comp_size;
+	double Detl;
+	pthread_t *threads;
+	struct nrm_queue q;
+	struct SparseMatRec *AIM;
+
+	message(INFO_MSG,"Calculating NRM matrix for polygenic effect\n");
+	lk=loki;
+	n_comp=loki->pedigree->n_comp;
+	comp_size=loki->pedigree->comp_size;
+	if(!(loki->models->AIMatrix=malloc(sizeof(void *)*n_comp))) ABT_FUNC(MMsg);
+	if(!(q.order=malloc(sizeof(int)*(2*n_comp+1)))) ABT_FUNC(MMsg);
+	q.comp_start=q.order+n_comp;
+	for(i=0;i<n_comp;i++) q.order[i]=i;
+	sort_size=comp_size;
+	gnu_qsort(q.order,(size_t)n_comp,sizeof(int),cmp_comp);
+	for(q.comp_start[0]=i=0;i<n_comp;i++) q.comp_start[i+1]=q.comp_start[i]+comp_size[i];
+	q.next=0;
+	q.n=n_comp;
+	q.loki=loki;
+	nt=get_peel_threads();
+	if(nt>n_comp) nt=n_comp;
+	pthread_mutex_init(&q.lock,0);
+	if(nt>1) {
+		if(!(threads=malloc(sizeof(pthread_t)*nt))) ABT_FUNC(MMsg);
+		if(!(started=calloc((size_t)nt,sizeof(int)))) ABT_FUNC(MMsg);
+		for(i=1;i<nt;i++) if(!pthread_create(threads+i,0,nrm_worker,&q)) started[i]=1;
+		(void)nrm_worker(&q);
+		for(i=1;i<nt;i++) if(started[i]) (void)pthread_join(threads[i],0);
+		free(started);
+		free(threads);
+	} else if(n_comp) (void)nrm_worker(&q);
+	pthread_mutex_destroy(&q.lock);
+	for(i=0;i<n_comp;i++) {
+		AIM=loki->models->AIMatrix[i];
+		Detl=AIM[comp_size[i]].val;
+		message(DEBUG_MSG," Component %d, non-zero off-diagonals = %d, L(Det) NRM Matrix = %g\n",i+1,AIM[comp_size[i]].x-1-comp_size[i],Detl);
+	}
+	free(q.order);
 	if(atexit(free_nrm)) message(WARN_MSG,"Unable to register exit function free_nrm()\n");
 }
@@ -32,6 +32,7 @@
 #include "gen_pen.h"
 #include "handle_res.h"
 #include "lk_malloc.h"
+#include "arena.h"
 
 static struct gp_rfnode **rflist,*free_rfn_list;
 static struct gp_rfunc_ptr **rfuncs,*free_rfp_list;
@@ -40,97 +41,29 @@ static struct gp_rfunc *free_rf_list[MAX_GP_RF_GENES],**autozyg_list;
 static struct deg_list *deglist,**first;
 static int *gp_inv,*gp_inv1,*gp_flag,*pflag,*rf_idx,
 **fact,*ofact,rf_idx_n,*rfxn,**rfx,
-*cnv_gene,gp_xx_size,mem_list_size,mem_list_ptr;
+*cnv_gene,gp_xx_size;
 static double *gp_tmp_p,*gp_z,*gp_xx;
-static void **mem_list;
-
-static void *realloc_and_remember(void *p,size_t size)
-{
-	int i;
-	
-	for(i=0;i<mem_list_ptr;i++) if(mem_list[i]==p) break;
-	if(i<mem_list_ptr) {
-		p=lk_realloc(p,size);
-		mem_list[i]=p;
-	} else p=0;
-	return p;
-}
-
-static void *malloc_and_remember(size_t size)
-{
-	void *p;
-	
-	if(mem_list_ptr==mem_list_size) {
-		if(mem_list_size) {
-			mem_list_size*=1.5;
-			mem_list=lk_realloc(mem_list,sizeof(void *)*mem_list_size);
-		} else {
-			mem_list_size=16;
-			mem_list=lk_malloc(sizeof(void *)*mem_list_size);
-		}
-	}
-	p=lk_malloc(size);
-	mem_list[mem_list_ptr++]=p;
-	return p;
-}
-
-static void free_rfunc(struct gp_rfunc *rf)
-{
-#ifdef TRACE_PEEL
-	if(CHK_PEEL(TRACE_LEVEL_3)) (void)printf("In free_rfunc(%p)\n",(void *)rf);
-#endif
-	free(rf->inv);
-	free(rf->p);
-	free(rf); 
-}
+/* Everything allocated here (work arrays, rfunctions, peel ops and list nodes)
+ * comes from gp_arena and is only released, in one go, by free_gen_pen() */
+static struct arena *gp_arena;
 
 void free_gen_pen(void) 
 {
 	int i;
-	struct gp_rfunc_ptr *rfp,*rfp1;
-	struct gp_rfnode *rfn,*rfn1;
-	struct gp_rfunc *rf,*rf1;
-	struct gp_peel_op *ops,*ops1;
 	
 #ifdef TRACE_PEEL
 	if(CHK_PEEL(TRACE_LEVEL_1)) (void)printf("In free_gen_pen()\n");
 #endif
-	rfp=free_rfp_list;
-	while(rfp) {
-		rfp1=rfp->next;
-		free(rfp);
-		rfp=rfp1;
-	}
+	arena_free(gp_arena);
+	gp_arena=0;
 	free_rfp_list=0;
-	rfn=free_rfn_list;
-	while(rfn) {
-		rfn1=rfn->next;
-		free(rfn);
-		rfn=rfn1;
-	}
 	free_rfn_list=0;
-	if(mem_list) {
-		for(i=0;i<mem_list_ptr;i++) if(mem_list[i]) free(mem_list[i]);
-		free(mem_list);
-		mem_list=0;
-		mem_list_size=mem_list_ptr=0;
-	}
+	rf_idx=0;
 	rf_idx_n=0;
+	gp_xx=0;
+	gp_xx_size=0;
 	for(i=0;i<MAX_GP_RF_GENES;i++) {
-		rf=free_rf_list[i];
-		while(rf) {
-			rf1=rf->next;
-			free_rfunc(rf);
-			rf=rf1;
-		}
 		free_rf_list[i]=0;
-		ops=free_ops_list[i];
-		while(ops) {
-			ops1=ops->next;
-			free(ops->inv);
-			free(ops);
-			ops=ops1;
-		}
 		free_ops_list[i]=0;
 	}
 }
@@ -140,15 +73,16 @@ void alloc_gen_pen(int ngenes)
 	int i,n_all;
 	
 	prt_peel_trace(TRACE_LEVEL_1,"In alloc_gen_pen(%d)\n",ngenes);
-	rflist=malloc_and_remember(sizeof(void *)*ngenes);
-	autozyg_list=malloc_and_remember(sizeof(void *)*ngenes);
-	rfuncs=malloc_and_remember(sizeof(void *)*ngenes);
-	first=malloc_and_remember(sizeof(void *)*ngenes);
-	fact=malloc_and_remember(sizeof(void *)*2*ngenes);
+	if(!gp_arena) gp_arena=arena_new("gen_pen",0);
+	rflist=arena_alloc(gp_arena,sizeof(void *)*ngenes);
+	autozyg_list=arena_alloc(gp_arena,sizeof(void *)*ngenes);
+	rfuncs=arena_alloc(gp_arena,sizeof(void *)*ngenes);
+	first=arena_alloc(gp_arena,sizeof(void *)*ngenes);
+	fact=arena_alloc(gp_arena,sizeof(void *)*2*ngenes);
 	rfx=fact+ngenes;
-	deglist=malloc_and_remember(sizeof(struct deg_list)*ngenes);
+	deglist=arena_alloc(gp_arena,sizeof(struct deg_list)*ngenes);
 	for(i=0;i<ngenes;i++) deglist[i].gene=i;
-	gp_inv=malloc_and_remember(sizeof(int)*7*ngenes);
+	gp_inv=arena_alloc(gp_arena,sizeof(int)*7*ngenes);
 	gp_inv1=gp_inv+ngenes;
 	gp_flag=gp_inv1+ngenes;
 	pflag=gp_flag+ngenes;
@@ -156,10 +90,10 @@ void alloc_gen_pen(int ngenes)
 	rfxn=ofact+ngenes;
 	cnv_gene=rfxn+ngenes;
 	n_all=2;
-	gp_tmp_p=malloc_and_remember(sizeof(double)*(ngenes+n_all*n_all));
+	gp_tmp_p=arena_alloc(gp_arena,sizeof(double)*(ngenes+n_all*n_all));
 	gp_z=gp_tmp_p+n_all*n_all;
 	gp_xx_size=8;
-	gp_xx=malloc_and_remember(sizeof(double)*gp_xx_size);
+	gp_xx=arena_alloc(gp_arena,sizeof(double)*gp_xx_size);
 }
 
 static struct gp_rfunc *get_new_rfunc(int n,int n_all)
@@ -167,12 +101,12 @@ static struct gp_rfunc *get_new_rfunc(int n,int n_all)
 	int nc;
 	struct gp_rfunc *rf;
 	
-	rf=lk_malloc(sizeof(struct gp_rfunc));
+	rf=arena_alloc(gp_arena,sizeof(struct gp_rfunc));
 	rf->n_inv=n;
 	nc=(int)(.5+exp(log((double)n_all)*(double)n));
 	rf->nc=nc;
-	rf->p=lk_malloc(sizeof(double)*nc);
-	rf->inv=lk_malloc(sizeof(int)*n);
+	rf->p=arena_alloc(gp_arena,sizeof(double)*nc);
+	rf->inv=arena_alloc(gp_arena,sizeof(int)*n);
 	prt_peel_trace(TRACE_LEVEL_3,"In get_new_rfunc(%d,%d): allocating new rfunc %p\n",n,n_all,(void *)rf);
 	return rf;
 }
@@ -187,9 +121,9 @@ static struct gp_peel_op *get_new_peel_op(int n)
 		free_ops_list[n-1]=ops->next;
 		prt_peel_trace(TRACE_LEVEL_3,"In get_new_peel_op(%d): getting peel_op %p from free list\n",n,(void *)ops);
 	} else {
-		ops=lk_malloc(sizeof(struct gp_peel_op));
+		ops=arena_alloc(gp_arena,sizeof(struct gp_peel_op));
 		ops->n_inv=n;
-		ops->inv=lk_malloc(sizeof(int)*n*2);
+		ops->inv=arena_alloc(gp_arena,sizeof(int)*n*2);
 		ops->pflag=ops->inv+n;
 		prt_peel_trace(TRACE_LEVEL_3,"In get_new_peel_op(%d): allocating new peel_op %p\n",n,(void *)ops);
 	}
@@ -210,7 +144,7 @@ static struct gp_rfnode *find_rfnode(int x,int y)
 	}
 	if(!p || p->y!=y) {
 		if((p=free_rfn_list)) free_rfn_list=p->next;
-		else p=lk_malloc(sizeof(struct gp_rfnode));
+		else p=arena_alloc(gp_arena,sizeof(struct gp_rfnode));
 		p->next=*pp;
 		p->y=y;
 		p->rf=0;
@@ -612,7 +546,7 @@ double gen_pen(struct Locus *locus,int c,int *err,int flag,const struct loki *lo
 					rf->flag=0;
 					rf->inv[0]=a1;
 					if((rfp=free_rfp_list)) free_rfp_list=rfp->next;
-					else rfp=lk_malloc(sizeof(struct gp_rfunc_ptr));
+					else rfp=arena_alloc(gp_arena,sizeof(struct gp_rfunc_ptr));
 					rfp->next=rfuncs[a1];
 					rfp->rf=rf;
 					rfuncs[a1]=rfp;
@@ -638,19 +572,19 @@ double gen_pen(struct Locus *locus,int c,int *err,int flag,const struct loki *lo
 					rf->inv[1]=a2;
 					rfnode->rf=rf;
 					if((rfp=free_rfp_list)) free_rfp_list=rfp->next;
-					else rfp=lk_malloc(sizeof(struct gp_rfunc_ptr));
+					else rfp=arena_alloc(gp_arena,sizeof(struct gp_rfunc_ptr));
 					rfp->next=rfuncs[a1];
 					rfp->rf=rf;
 					rfuncs[a1]=rfp;
 					/* Add in reference to symmetrical node */
 					if((rfp=free_rfp_list)) free_rfp_list=rfp->next;
-					else rfp=lk_malloc(sizeof(struct gp_rfunc_ptr));
+					else rfp=arena_alloc(gp_arena,sizeof(struct gp_rfunc_ptr));
 					rfp->next=rfuncs[a2];
 					rfp->rf=rf;
 					rfuncs[a2]=rfp;
 					rfnodep=rflist+a2;
 					if((rfnode=free_rfn_list)) free_rfn_list=rfnode->next;
-					else rfnode=lk_malloc(sizeof(struct gp_rfnode));
+					else rfnode=arena_alloc(gp_arena,sizeof(struct gp_rfnode));
 					while((rfnode1=*rfnodep)) {
 						if(rfnode1->y<a1) {
 							rfnode->next=rfnode1;
@@ -910,7 +844,7 @@ double gen_pen(struct Locus *locus,int c,int *err,int flag,const struct loki *lo
 					k1=gp_inv1[i];
 					rf->inv[j++]=k1;
 					if((rfp1=free_rfp_list)) free_rfp_list=rfp1->next;
-					else rfp1=lk_malloc(sizeof(struct gp_rfunc_ptr));
+					else rfp1=arena_alloc(gp_arena,sizeof(struct gp_rfunc_ptr));
 					rfp1->next=rfuncs[k1];
 					rfp1->rf=rf;
 					rfuncs[k1]=rfp1;
@@ -939,9 +873,8 @@ double gen_pen(struct Locus *locus,int c,int *err,int flag,const struct loki *lo
 		}
 		/* Check we have enough space for rfunction indices */
 		if(n_rf>rf_idx_n) {
+			rf_idx=arena_realloc(gp_arena,rf_idx,sizeof(int)*(rf_idx_n+2*rf_idx_n*ngenes),sizeof(int)*(n_rf+2*n_rf*ngenes));
 			rf_idx_n=n_rf;
-			if(rf_idx) rf_idx=realloc_and_remember(rf_idx,sizeof(int)*(rf_idx_n+2*rf_idx_n*ngenes));
-			else rf_idx=malloc_and_remember(sizeof(int)*(rf_idx_n+2*rf_idx_n*ngenes));
 			fact[0]=rf_idx+rf_idx_n;
 			rfx[0]=fact[0]+rf_idx_n*ngenes;
 			for(k1=1;k1<ngenes;k1++) {
@@ -1258,9 +1191,8 @@ double gen_pen(struct Locus *locus,int c,int *err,int flag,const struct loki *lo
 			/* Set up temporary storage */
 			nc=(int)(.5+exp(log((double)n_all)*(double)n_peel));
 			if(nc>gp_xx_size) {
-				if(gp_xx) {
-					gp_xx=realloc_and_remember(gp_xx,sizeof(double)*nc);
-				} else gp_xx=malloc_and_remember(sizeof(double)*nc);
+				/* Contents are cleared below, so no need to copy */
+				gp_xx=arena_alloc(gp_arena,sizeof(double)*nc);
 				gp_xx_size=nc;
 			}
 			xx=gp_xx;
@@ -26,21 +26,27 @@
 #include "utils.h"
 #include "loki.h"
 #include "ranlib.h"
+#include "arena.h"
 #include "loki_peel.h"
 #include "genedrop.h"
 
 void genedrop(int locus,const struct loki *loki)
 {
-	int i,ped_size,**seg;
+	int i,k,n,ped_size,**seg;
+	double *u;
 	struct Id_Record *id_array;
 	
 	id_array=loki->pedigree->id_array;
 	ped_size=loki->pedigree->ped_size;
 	seg=loki->markers->marker[locus].locus.seg;
-	for(i=0;i<ped_size;i++) {
-		if(id_array[i].sire) seg[X_PAT][i]=ranf()<.5?0:1;
+	/* One uniform per known parent, drawn in a single block */
+	for(i=n=0;i<ped_size;i++) n+=(id_array[i].sire?1:0)+(id_array[i].dam?1:0);
+	u=arena_alloc(lk_arena(ARENA_ITER),sizeof(double)*n);
+	ranf_block(u,n);
+	for(i=k=0;i<ped_size;i++) {
+		if(id_array[i].sire) seg[X_PAT][i]=u[k++]<.5?0:1;
 		else seg[X_PAT][i]= -1;
-		if(id_array[i].dam) seg[X_MAT][i]=ranf()<.5?0:1;
+		if(id_array[i].dam) seg[X_MAT][i]=u[k++]<.5?0:1;
 		else seg[X_MAT][i]= -1;
 	}
 }
@@ -48,7 +54,7 @@ void genedrop(int locus,const struct loki *loki)
 void drop_genotypes(int locus,const struct loki *loki)
 {
 	int i,j,n_all,ids,idd,ped_size;
-	double *freq,*cm,z;
+	double *freq,*cm,*u,z;
 	
 	struct Id_Record *id_array;
 	
@@ -57,23 +63,25 @@ void drop_genotypes(int locus,const struct loki *loki)
 	if(n_all<1) return;
 	id_array=loki->pedigree->id_array;
 	ped_size=loki->pedigree->ped_size;
-	if(!(cm=malloc(sizeof(double)*n_all))) ABT_FUNC(MMsg);
+	/* cm[] followed by two uniforms for each individual */
+	if(!(cm=malloc(sizeof(double)*(n_all+2*ped_size)))) ABT_FUNC(MMsg);
+	u=cm+n_all;
+	ranf_block(u,2*ped_size);
 	cm[0]=freq[0];
 	for(i=1;i<n_all;i++) cm[i]=cm[i-1]+freq[i];
 	for(i=0;i<ped_size;i++)	{
-		if((ids=id_array[i].sire)) id_array[i].allele[X_PAT]=id_array[ids-1].allele[ranf()<.5?0:1];
+		if((ids=id_array[i].sire)) id_array[i].allele[X_PAT]=id_array[ids-1].allele[*(u++)<.5?0:1];
 		else {
-			z=ranf();
+			z=*(u++);
 			for(j=0;j<n_all;j++) if(z<=cm[j]) break;
 			id_array[i].allele[X_PAT]=j+1;
 		}
-		if((idd=id_array[i].dam)) id_array[i].allele[X_MAT]=id_array[idd-1].allele[ranf()<.5?0:1];
+		if((idd=id_array[i].dam)) id_array[i].allele[X_MAT]=id_array[idd-1].allele[*(u++)<.5?0:1];
 		else {
-			z=ranf();
+			z=*(u++);
 			for(j=0;j<n_all;j++) if(z<=cm[j]) break;
 			id_array[i].allele[X_MAT]=j+1;
 		}
 	}
 	free(cm);
 }
-
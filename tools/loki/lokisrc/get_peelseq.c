@@ -159,7 +159,8 @@ static int *min_degree(int *g_perm,int *trans,int k2,int *inv,int size,const int
 	order=lk_malloc(sizeof(int)*size*2);
 	order_bk=lk_malloc(sizeof(int)*size*2);
 	group=order+size;
-	for(i=0;i<4;i++) {
+	/* Large graphs go to amd_order(), which has just the one ordering */
+	for(i=0;i<(size<get_amd_min_size()?4:1);i++) {
 		mat=assemble_matrix(size,inv,g_perm,trans,k2,linktype,id_array);
 		assert(mat);
 		greedy(size,mat,order,group,wt,wt1,i,&cost);
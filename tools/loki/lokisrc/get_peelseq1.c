@@ -173,7 +173,8 @@ static int *min_degree(int *g_perm,int *trans,int k2,int *inv,int size,const int
 	if(!(order=malloc(sizeof(int)*size*2))) ABT_FUNC(MMsg);
 	if(!(order_bk=malloc(sizeof(int)*size*2))) ABT_FUNC(MMsg);
 	group=order+size;
-	for(i=0;i<4;i++) {
+	/* Large graphs go to amd_order(), which has just the one ordering */
+	for(i=0;i<(size<get_amd_min_size()?4:1);i++) {
 		mat=assemble_matrix(size,inv,g_perm,trans,k2,linktype,id_array);
 		if(!mat) ABT_FUNC("Internal error - assemble_matrix() returned a zero pointer\n");
 		greedy(size,mat,order,group,wt,wt1,i,&cost);
@@ -65,7 +65,7 @@ double Calc_Res_Ratio(double v1,double v2,struct loki *loki)
 	get_res_param(&nn,&s,loki);
 	l1=-.5*(nn*log(2.0*M_PI*v1)+s/v1);
 	l1-=(-.5*(nn*log(2.0*M_PI*v2)+s/v2));
-	return l1;
+	return loki->models->temper*l1;
 }
 
 static double Calc_vprob(double v,double s,double x)
@@ -79,19 +79,23 @@ double Calc_Resprop(struct loki *loki)
 	double s,v;
 
 	get_res_param(&v,&s,loki);
-	v+=RES_PRIOR_V0;
+	v=v*loki->models->temper+RES_PRIOR_V0;
+	s*=loki->models->temper;
 	s+=RES_PRIOR_V0*RES_PRIOR_S0;
 	s/=v;
 	return Calc_vprob(v,s,loki->models->residual_var[0]);
 }
 
-/* Sample residual variance */
+/* Sample residual variance.  In a heated chain the likelihood is raised
+ * to the power temper, which scales both the sum of squares and the
+ * number of observations */
 double Sample_ResVar(struct loki *loki)
 {
 	double s,nn,y,v2;
 
 	get_res_param(&nn,&s,loki);
-	nn+=RES_PRIOR_V0;
+	nn=nn*loki->models->temper+RES_PRIOR_V0;
+	s*=loki->models->temper;
 	s+=RES_PRIOR_V0*RES_PRIOR_S0;
 	y=loki->models->residual_var[0];
 	loki->models->residual_var[0]=s/(sgamma(nn*0.5)*2.0);
@@ -107,7 +111,8 @@ double Calc_Var_Prior(double v,const struct loki *loki)
 	return loki->sys.res_prior_konst-log(v)*(.5*RES_PRIOR_V0+1.0)-RES_PRIOR_S0*RES_PRIOR_V0/(2.0*v);
 }
 
-double Calc_ResLike(struct loki *loki)
+/* Log likelihood of the residuals without any heating */
+double Res_LogLike(struct loki *loki)
 {
 	double s,nn;
 
@@ -115,6 +120,11 @@ double Calc_ResLike(struct loki *loki)
 	return -.5*(nn*log(2.0*M_PI*loki->models->residual_var[0])+s/loki->models->residual_var[0]);
 }
 
+double Calc_ResLike(struct loki *loki)
+{
+	return loki->models->temper*Res_LogLike(loki);
+}
+
 double Calc_CensResLike(struct loki *loki)
 {
 	int i,j,type,idx;
@@ -8,6 +8,7 @@ extern double Calc_Res_Ratio(double,double,struct loki *);
 extern double Calc_Resprop(struct loki *);
 extern double Calc_CensResLike(struct loki *);
 extern double Calc_ResLike(struct loki *);
+extern double Res_LogLike(struct loki *);
 extern double Sample_ResVar(struct loki *);
 extern double Calc_Var_Prior(double,const struct loki *);
 extern double Recalc_Res(int,struct loki *);
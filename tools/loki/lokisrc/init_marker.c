@@ -32,6 +32,7 @@
 #include "loki_peel.h"
 #include "loki_utils.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "locus.h"
 
 static char *sexstr[2]={"female","male"};
@@ -207,8 +208,7 @@ static void init_marker_freq(struct Marker *mark,struct loki *loki)
   for(k=grp=0;grp<n_gen;grp++) if(mark->count_flag[grp]) k++;
   if(k) {
     mark->counts=lk_malloc(sizeof(void *)*n_gen);
-    tp=lk_malloc(sizeof(double)*k*n_all);
-    loki->sys.RemBlock=AddRemem(tp,loki->sys.RemBlock);
+    tp=arena_alloc(lk_arena(ARENA_SETUP),sizeof(double)*k*n_all);
     for(grp=0;grp<n_gen;grp++) {
       if(mark->count_flag[grp]) {
 	mark->counts[grp]=tp;
@@ -23,29 +23,145 @@
 
 #include "utils.h"
 #include "lk_malloc.h"
+#include "hash_map.h"
 #include "loki.h"
 #include "loki_utils.h"
 #include "kinship.h"
 
-/* Simple kinship coefficient */
+/* Kinship coefficients already calculated, keyed on the pair of ids.
+ * The table maps a pair to (1 + the position of its value in kin_val).
+ * It belongs to the id_array it was filled from, and is not thread safe */
+static struct hash_map *kin_map;
+static const struct Id_Record *kin_ids;
+static double *kin_val;
+static int *kin_stack;
+static size_t kin_n,kin_size,kin_stack_size;
+static int kin_exit;
+
+static void free_kin_table(void)
+{
+  if(kin_map) hmap_free(kin_map,0);
+  if(kin_val) free(kin_val);
+  if(kin_stack) free(kin_stack);
+  kin_map=0;
+  kin_ids=0;
+  kin_val=0;
+  kin_stack=0;
+  kin_n=kin_size=kin_stack_size=0;
+}
+
+/* Pairs are stored as a>=b */
+static long kin_key(const int a,const int b)
+{
+  return (long)a*(a-1)/2+b;
+}
+
+/* Kinship of a and b (a>=b) if it is known without recursion, in which
+ * case 1 is returned */
+static int kin_lookup(const int a,const int b,double *z)
+{
+  long key;
+  void *p;
+
+  if(!(a&&b) || (a!=b && !kin_ids[a-1].sire)) {
+    *z=0.0;
+    return 1;
+  }
+  key=kin_key(a,b);
+  if((p=hmap_find(kin_map,&key))) {
+    *z=kin_val[(size_t)p-1];
+    return 1;
+  }
+  return 0;
+}
+
+static void kin_push(const int a,const int b,size_t *sp)
+{
+  if(*sp+2>kin_stack_size) {
+    if(kin_stack_size) {
+      kin_stack_size<<=1;
+      kin_stack=lk_realloc(kin_stack,sizeof(int)*kin_stack_size);
+    } else {
+      kin_stack_size=256;
+      kin_stack=lk_malloc(sizeof(int)*kin_stack_size);
+    }
+  }
+  kin_stack[(*sp)++]=a>b?a:b;
+  kin_stack[(*sp)++]=a>b?b:a;
+}
+
+/* Simple kinship coefficient.  The coefficient for a pair is the average
+ * of the coefficients of the lower numbered member with the parents of the
+ * higher numbered member (with the special case of a==b).  Instead of
+ * recursing, the pairs still needed are kept on a stack, and every
+ * coefficient worked out is remembered for later calls */
 double kinship(const int a, const int b,const struct Id_Record *id_array)
 {
+  int i,j,ids,idd,k;
+  size_t sp=0;
+  long key;
+  double z,z1;
+  struct hmap_entry *e;
+
   if(!(a&&b)) return 0.0;
-  if (a==b) return 0.5+0.5*kinship(id_array[a-1].sire,id_array[a-1].dam,id_array);
-  if(!id_array[a-1].sire) {
-    if(b<a) return 0.0;
-    if(!id_array[b-1].sire) return 0.0;
-    return (kinship(a,id_array[b-1].sire,id_array)+kinship(a,id_array[b-1].dam,id_array))*0.5;
+  if(id_array!=kin_ids) {
+    if(!kin_exit) {
+      kin_exit=1;
+      if(atexit(free_kin_table)) message(WARN_MSG,"Unable to register exit function free_kin_table()\n");
+    }
+    free_kin_table();
+    kin_map=hmap_new(HMAP_INT,0);
+    kin_ids=id_array;
   }
-  if(!id_array[b-1].sire) {
-    if(a<b) return 0.0;
-    return (kinship(b,id_array[a-1].sire,id_array)+kinship(b,id_array[a-1].dam,id_array))*0.5;
+  if(kin_lookup(a>b?a:b,a>b?b:a,&z)) return z;
+  kin_push(a,b,&sp);
+  while(sp) {
+    i=kin_stack[sp-2];
+    j=kin_stack[sp-1];
+    if(kin_lookup(i,j,&z)) {
+      sp-=2;
+      continue;
+    }
+    ids=id_array[i-1].sire;
+    idd=id_array[i-1].dam;
+    k=0;
+    if(i==j) {
+      if(!kin_lookup(ids>idd?ids:idd,ids>idd?idd:ids,&z1)) k=1;
+      else z=0.5+0.5*z1;
+    } else {
+      if(!kin_lookup(ids>j?ids:j,ids>j?j:ids,&z)) {
+	kin_push(j,ids,&sp);
+	k=1;
+      }
+      if(!kin_lookup(idd>j?idd:j,idd>j?j:idd,&z1)) {
+	kin_push(j,idd,&sp);
+	k=1;
+      }
+      if(!k) z=(z+z1)*0.5;
+    }
+    if(k) {
+      if(i==j) kin_push(ids,idd,&sp);
+      continue;
+    }
+    if(kin_n==kin_size) {
+      if(kin_size) {
+	kin_size<<=1;
+	kin_val=lk_realloc(kin_val,sizeof(double)*kin_size);
+      } else {
+	kin_size=1024;
+	kin_val=lk_malloc(sizeof(double)*kin_size);
+      }
+    }
+    kin_val[kin_n++]=z;
+    key=kin_key(i,j);
+    e=hmap_insert(kin_map,&key,0);
+    e->data=(void *)kin_n;
+    sp-=2;
   }
-  if(a<b) return (kinship(a,id_array[b-1].sire,id_array)+kinship(a,id_array[b-1].dam,id_array))*0.5;
-  return (kinship(b,id_array[a-1].sire,id_array)+kinship(b,id_array[a-1].dam,id_array))*0.5;
+  (void)kin_lookup(a>b?a:b,a>b?b:a,&z);
+  return z;
 }
 
-static struct kin **kin;
 static struct Id_Record *id_array;
 static int ped_size;
 
@@ -235,7 +351,6 @@ double calc_gen(int n,int *g,int *b,int xfl)
 void calc_kin(int *inbr,struct loki *loki)
 {
   int i,id,id1,j,k,cs,comp,xx[4],xx1[4],k1,k2,n_comp,*comp_size;
-  struct kin *kk1;
   double w[9],z;
   int states[][4]={{0,0,0,0},{0,0,1,1},{0,0,0,1},{0,0,1,2},
 		   {0,1,0,0},{0,1,2,2},{0,1,0,1},{0,1,0,2},{0,1,2,3}};
@@ -248,17 +363,6 @@ void calc_kin(int *inbr,struct loki *loki)
   n_comp=loki->pedigree->n_comp;
   comp_size=loki->pedigree->comp_size;
   fptr=fopen("loki_ibs.kin","w");
-  kin=lk_malloc(sizeof(void *)*n_comp);
-  for(j=i=0;i<n_comp;i++) {
-    cs=comp_size[i];
-    j+=cs*(cs+1)/2;
-  }
-  kin[0]=lk_malloc(sizeof(struct kin)*j);
-  for(i=1;i<n_comp;i++) {
-    cs=comp_size[i-1];
-    j=cs*(cs+1)/2;
-    kin[i]=kin[i-1]+j;
-  }
   for(i=comp=0;comp<n_comp;comp++) {
     cs=comp_size[comp];
     for(j=1;j<cs;j++) {
@@ -291,10 +395,6 @@ void calc_kin(int *inbr,struct loki *loki)
 	w[6]=4.0*w[6];
 	w[7]=4.0*w[7];
 	w[8]=4.0*w[8];
-	kk1=kin[comp]+j*(j-1)/2+k;
-	for(k1=0;k1<9;k1++) {
-	  kk1->p[k1]=w[k1];
-	}
 	if(fptr) {
 	  print_orig_id(fptr,id+1);
 	  (void)fputc(' ',fptr);
@@ -306,7 +406,5 @@ void calc_kin(int *inbr,struct loki *loki)
     }
     i+=cs;
   }
-  free(kin[0]);
-  free(kin);
   if(fptr) fclose(fptr);
 }
@@ -0,0 +1,194 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * locus_index.c:                                                           *
+ *                                                                          *
+ * Keeps the loci of each linkage group in map order.  The markers do not   *
+ * move during sampling, so they are sorted once; the linked trait loci are *
+ * merged in again only when one of them has been born, died, or changed   *
+ * position or linkage group since the last request.  Recombination        *
+ * fractions between pairs of markers are also kept (within a memory limit) *
+ * so that each is only calculated once.                                    *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <math.h>
+#include <stdio.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "loki.h"
+#include "loki_utils.h"
+#include "locus_index.h"
+
+/* Limit on the number of stored recombination fractions */
+#define LI_RECOM_MAX (1<<22)
+
+struct li_group {
+	struct Locus **mk; /* Markers in map order */
+	struct Locus **list; /* Markers and linked trait loci in map order */
+	double *recom; /* Marker pairs (j,k), j<k, at k*(k-1)/2+j, per sex; <0 if not yet set */
+	double *tl_pos; /* Positions of the trait loci in list, by trait locus */
+	char *tl_in; /* Which trait loci are in list */
+	int n_mk,n,n_tl,built,recom_set;
+};
+
+static const struct loki *lki;
+static struct li_group *grp;
+static int n_grp,*mk_rank;
+static size_t recom_used;
+
+static void free_index(void)
+{
+	int i;
+
+	for(i=0;i<n_grp;i++) {
+		if(grp[i].mk) free(grp[i].mk);
+		if(grp[i].recom) free(grp[i].recom);
+		if(grp[i].tl_pos) free(grp[i].tl_pos);
+	}
+	if(grp) free(grp);
+	if(mk_rank) free(mk_rank);
+	grp=0;
+	mk_rank=0;
+	n_grp=0;
+	recom_used=0;
+}
+
+void locus_index_alloc(const struct loki *loki)
+{
+	lki=loki;
+	n_grp=loki->markers->n_links;
+	if(n_grp) grp=lk_calloc((size_t)n_grp,sizeof(struct li_group));
+	if(loki->markers->n_markers) mk_rank=lk_malloc(sizeof(int)*loki->markers->n_markers);
+	if(atexit(free_index)) message(WARN_MSG,"Unable to register exit function free_index()\n");
+}
+
+/* The index is built on first use, after the marker positions have been
+ * read in (or restored from a dump file) */
+static void build_markers(const int link,struct li_group *g)
+{
+	int i,mt;
+
+	mt=lki->params.max_tloci;
+	i=lki->markers->linkage[link].n_markers;
+	g->mk=lk_malloc(sizeof(void *)*(2*i+mt));
+	g->list=g->mk+i;
+	if(mt) {
+		g->tl_pos=lk_malloc((sizeof(double)+1)*mt);
+		g->tl_in=(char *)(g->tl_pos+mt);
+	}
+	/* Exactly as the loci were put in order before */
+	get_locuslist(g->mk,link,&g->n_mk,1);
+	gnu_qsort(g->mk,(size_t)g->n_mk,sizeof(void *),cmp_loci);
+	for(i=0;i<g->n_mk;i++) mk_rank[g->mk[i]->index]=i;
+	g->n=-1;
+	g->built=1;
+}
+
+/* Merge the linked trait loci into the list of markers if they have changed */
+static void update_list(const int link,struct li_group *g)
+{
+	int i,j,k,n_tl,*tl,t;
+	double x;
+	const struct Locus *loc;
+
+	n_tl=lki->params.n_tloci;
+	loc=lki->models->tlocus;
+	k=(g->n<0 || n_tl!=g->n_tl);
+	for(i=0;!k && i<n_tl;i++,loc++) {
+		j=((loc->flag&TL_LINKED) && loc->link_group==link);
+		if(j!=g->tl_in[i] || (j && loc->pos[0]!=g->tl_pos[i])) k=1;
+	}
+	if(!k) return;
+	/* Put the linked trait loci in order (there will be few of them).  A trait
+	 * locus goes after any marker or trait locus at the same position */
+	tl=lk_malloc(sizeof(int)*(n_tl+1));
+	loc=lki->models->tlocus;
+	for(i=k=0;i<n_tl;i++) {
+		j=((loc[i].flag&TL_LINKED) && loc[i].link_group==link);
+		g->tl_in[i]=(char)j;
+		if(!j) continue;
+		x=g->tl_pos[i]=loc[i].pos[0];
+		for(j=k++;j>0 && loc[tl[j-1]].pos[0]>x;j--) tl[j]=tl[j-1];
+		tl[j]=i;
+	}
+	for(i=j=t=0;t<k;t++) {
+		x=loc[tl[t]].pos[0];
+		while(i<g->n_mk && g->mk[i]->pos[0]<=x) g->list[j++]=g->mk[i++];
+		g->list[j++]=(struct Locus *)(loc+tl[t]);
+	}
+	while(i<g->n_mk) g->list[j++]=g->mk[i++];
+	g->n=j;
+	g->n_tl=n_tl;
+	free(tl);
+}
+
+/* Copy the loci in linkage group link, in map order, to list.  If flag is
+ * set only the markers are given.  Returns the number of loci in count */
+void get_sorted_loci(struct Locus **list,const int link,int *count,const int flag)
+{
+	struct li_group *g;
+
+	g=grp+link;
+	if(!g->built) build_markers(link,g);
+	if(flag) {
+		memcpy(list,g->mk,sizeof(void *)*g->n_mk);
+		*count=g->n_mk;
+	} else {
+		update_list(link,g);
+		memcpy(list,g->list,sizeof(void *)*g->n);
+		*count=g->n;
+	}
+}
+
+/* Recombination fractions (female and male) between loci l1 and l2 where
+ * l1 is to the left of l2 */
+void locus_recom(const struct Locus *l1,const struct Locus *l2,double *r)
+{
+	int i,j,k,sx,nsx;
+	size_t sz,l;
+	double *p;
+	struct li_group *g;
+
+	nsx=1+lki->markers->sex_map;
+	if((l1->type&ST_MARKER) && (l2->type&ST_MARKER) && l1->link_group==l2->link_group) {
+		g=grp+l1->link_group;
+		if(!g->built) build_markers(l1->link_group,g);
+		if(!g->recom_set) {
+			g->recom_set=-1;
+			sz=(size_t)g->n_mk*(g->n_mk-1)/2*nsx;
+			if(sz && recom_used+sz<=LI_RECOM_MAX) {
+				g->recom=lk_malloc(sizeof(double)*sz);
+				for(l=0;l<sz;l++) g->recom[l]=-1.0;
+				recom_used+=sz;
+				g->recom_set=1;
+			}
+		}
+		if(g->recom_set>0) {
+			j=mk_rank[l1->index];
+			k=mk_rank[l2->index];
+			if(j>k) {
+				i=j;
+				j=k;
+				k=i;
+			}
+			p=g->recom+nsx*(k*(k-1)/2+j);
+			if(p[0]<0.0) for(sx=0;sx<nsx;sx++) p[sx]=.5*(1.0-exp(-0.02*(g->mk[k]->pos[sx]-g->mk[j]->pos[sx])));
+			r[0]=p[0];
+			r[1]=p[nsx-1];
+			return;
+		}
+	}
+	for(sx=0;sx<2;sx++) r[sx]=.5*(1.0-exp(-0.02*(l2->pos[sx]-l1->pos[sx])));
+}
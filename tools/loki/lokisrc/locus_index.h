@@ -0,0 +1,8 @@
+#ifndef _LOCUS_INDEX_H_
+#define _LOCUS_INDEX_H_
+
+void locus_index_alloc(const struct loki *);
+void get_sorted_loci(struct Locus **,const int,int *,const int);
+void locus_recom(const struct Locus *,const struct Locus *,double *);
+
+#endif
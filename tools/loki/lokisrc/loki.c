@@ -35,6 +35,7 @@
 #include "ranlib.h"
 #include "utils.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "libhdr.h"
 #include "string_utils.h"
 #include "loki.h"
@@ -49,6 +50,8 @@
 #include "pseudo_chrom.h"
 #include "ibs_check.h"
 #include "recomb.h"
+#include "loki_chains.h"
+#include "locus_index.h"
 
 static struct loki loki;
 static int no_report=0;
@@ -81,7 +84,7 @@ void FreeStuff(void)
 		else (void)writeseed("seedfile",1);
 	}
 	for(i=0;i<LK_NUM_NAMES;i++) if(loki.names[i]) free(loki.names[i]);
-	FreeRemem(loki.sys.FirstRemBlock);
+	lk_arena_free_all();
 	free(loki.data);
 	free(loki.models);
 	free(loki.markers);
@@ -99,12 +102,12 @@ static void ignore_handler(int i)
 int main(int argc,char *argv[])
 {
 	FILE *fptr;
-	int i=0,c,j,read_dump_flag=0,append_output_flag=0,no_pfile=0;
+	int i=0,c,j,read_dump_flag=0,append_output_flag=0,no_pfile=0,n_chains=1,seed_file=0,swap_n=1;
 	static int ibscheck,no_unrel,recomb_chk;
 	struct sigaction s_action;
-	char *tfile=0,*fname;
+	char *tfile=0,*fname,*end;
 	struct itimerval itimerval;
-	double sec,frac;
+	double sec,frac,heat=0.0;
 	
 	struct option longopts[]={
 	{"ibs_check",no_argument,&ibscheck,1},
@@ -112,6 +115,9 @@ int main(int argc,char *argv[])
 	{"no_between",no_argument,&no_unrel,1},
 	{"nobetween",no_argument,&no_unrel,1},
 	{"recomb_check",no_argument,&recomb_chk,1},
+	{"chains",required_argument,0,'C'},
+	{"heat",required_argument,0,'H'},
+	{"swap",required_argument,0,'S'},
 	{0,0,0,0}
 	};
 	
@@ -163,6 +169,27 @@ int main(int argc,char *argv[])
 			case 'e':
 				loki.params.error_correct_type=1;
 				break;
+			case 'C':
+				n_chains=atoi(optarg);
+				if(n_chains<1) {
+					fprintf(stderr,"Bad number of chains '%s'\n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'H':
+				heat=strtod(optarg,&end);
+				if(*end || heat<0.0) {
+					fprintf(stderr,"Bad heating '%s'\n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
+			case 'S':
+				swap_n=atoi(optarg);
+				if(swap_n<1) {
+					fprintf(stderr,"Bad swap interval '%s'\n",optarg);
+					exit(EXIT_FAILURE);
+				}
+				break;
 			case 'V':
 				(void)printf("%s\n",LOKI_NAME);
 				return 0;
@@ -177,12 +204,6 @@ int main(int argc,char *argv[])
 	
 	/* Turn off some output routines if not writing to a terminal */
 	if(!isatty(STDOUT_FILENO)) loki.params.verbose_level|=NON_INTERACTIVE;
-	/* Allocate memory handlers (for memory that is difficult to explicitly free) */
-	if(!(loki.sys.FirstRemBlock=malloc(sizeof(struct remember)))) ABT_FUNC(MMsg);
-	loki.sys.RemBlock=loki.sys.FirstRemBlock;
-	loki.sys.RemBlock->pos=0;
-	loki.sys.RemBlock->next=0;
-	
 	/* Ignore SIGPIPE signals while reading input files (otherwise get problems if reading through filter) */
 	s_action.sa_handler=ignore_handler;
 	s_action.sa_flags=0;
@@ -197,6 +218,7 @@ int main(int argc,char *argv[])
 	
 	/* Allocate parameter storage structures */
 	if(!(loki.models=calloc((size_t)1,sizeof(struct lk_model)))) ABT_FUNC(MMsg);
+	loki.models->temper=1.0;
 	if(!(loki.markers=calloc((size_t)1,sizeof(struct lk_markers)))) ABT_FUNC(MMsg);
 	loki.markers->marker=0;
 	loki.markers->linkage=0;
@@ -252,6 +274,7 @@ int main(int argc,char *argv[])
 	
 	/* Initialize RNG */
 	if(!(loki.params.ranseed_set&2))	{
+		seed_file=1;
 		if(!loki.names[LK_SEEDFILE]) {
 			if(getseed("seedfile")) init_ranf(135421);
 		} else if(getseed(loki.names[LK_SEEDFILE])) init_ranf(135421);
@@ -296,11 +319,15 @@ int main(int argc,char *argv[])
 	}
 	Get_Peel_Seq(&loki);
 	if(!no_pfile) {
+		/* With several chains, this process just waits for them */
+		set_chain_heating(heat,swap_n);
+		if(n_chains>1 && run_chains(n_chains,seed_file,&j,&loki)<0) return j?EXIT_FAILURE:0;
 		AllocEffects(&loki);
 		InitValues(&loki);
 		peel_alloc(&loki);
 		/* Allocate space for trait loci */
 		TL_Alloc(&loki);
+		locus_index_alloc(&loki);
 		/* Sample */	
 		SampleLoop(read_dump_flag,append_output_flag,&loki);
 	}
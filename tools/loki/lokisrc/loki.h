@@ -238,6 +238,7 @@ struct lk_model {
   unsigned long *rand_flag;
   struct Variable **rand_list;
   double res_nu; /* Student t parameter */
+  double temper; /* Power the trait likelihood is raised to (below 1 in heated chains) */
   double **c_var;
   double tloci_mean;
   double *residual_var;
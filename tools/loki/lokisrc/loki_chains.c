@@ -0,0 +1,673 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * loki_chains.c:                                                           *
+ *                                                                          *
+ * Runs several chains from one invocation.  The setup that does not change *
+ * during sampling (reading the data, genotype elimination, the peeling     *
+ * sequence) is done once, and then one process is forked per chain, so the *
+ * chains share the setup memory until they write to it.  Each chain keeps  *
+ * its output files in its own directory and has its own random number      *
+ * stream.  When all the chains have finished their output files are read   *
+ * back to give the potential scale reduction factor (R-hat) of Gelman and  *
+ * Rubin (Statist. Sci. 7:457-472, 1992) for each fixed output column.      *
+ *                                                                          *
+ * For a quantitative trait the chains can instead be heated and coupled    *
+ * (Geyer, 1991).  The chains then only swap temperatures, through pipes to *
+ * the parent, and the samples from the cold chain are merged at the end.   *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef USE_DMALLOC
+#include <dmalloc.h>
+#endif
+#include <stdio.h>
+#include <ctype.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "ranlib.h"
+#include "libhdr.h"
+#include "loki.h"
+#include "handle_res.h"
+#include "loki_chains.h"
+
+static pid_t *chain_pid;
+static int n_chain_pid;
+static double chain_heat;
+static int swap_every=1;
+static int mc3_in=-1,mc3_out=-1; /* Pipes from and to the parent in a heated chain */
+
+struct mc3_msg {
+	int lp;
+	double h;
+};
+
+struct mc3_stats {
+	int *level_try,*level_acc; /* Swaps between temperature levels i and i+1 */
+	int *chain_try,*chain_acc;
+};
+
+/* Name used by chain k for a file: chain<k+1> is put in front of the last
+ * component of the path.  If dir is set, the chain directory is returned
+ * instead (and created if need be) */
+static char *chain_name(const char *name,const int k,const int dir)
+{
+	const char *p;
+	char *s;
+	size_t l;
+
+	p=strrchr(name,'/');
+	l=p?(size_t)(p-name+1):0;
+	s=lk_malloc(strlen(name)+24);
+	(void)memcpy(s,name,l);
+	(void)sprintf(s+l,"chain%d",k+1);
+	if(dir) {
+		if(mkdir(s,0755) && errno!=EEXIST) abt(__FILE__,__LINE__,"%s(): Couldn't create directory '%s': %s\n",__func__,s,strerror(errno));
+	} else {
+		(void)strcat(s,"/");
+		(void)strcat(s,name+l);
+	}
+	return s;
+}
+
+/* Set up the process for chain k */
+static void start_chain(const int k,const int seed_file,struct loki *loki)
+{
+	/* Output files named in the parameter file (the log and seed files
+	 * are looked up in the output directory, so are not in the list) */
+	static int files[]={LK_PHENFILE,LK_DUMPFILE,LK_OUTPUTFILE,LK_FREQFILE,LK_HAPLOFILE,
+		LK_POLYFILE,LK_POSFILE,LK_IBDFILE,LK_IBDDIR};
+	int i,j;
+	char *s,*s1;
+	struct rng_ctx rng;
+
+	/* Fix the name of the main output file here so that the parent
+	 * can find it afterwards */
+	if(!loki->names[LK_OUTPUTFILE]) loki->names[LK_OUTPUTFILE]=make_file_name(".out");
+	for(i=0;i<(int)(sizeof(files)/sizeof(int));i++) if((s=loki->names[files[i]])) {
+		free(chain_name(s,k,1));
+		loki->names[files[i]]=chain_name(s,k,0);
+		free(s);
+	}
+	/* Other files go to the chain directory in the output directory */
+	s=add_file_dir(".");
+	s1=chain_name(s,k,1);
+	if((j=set_file_dir(s1))) abt(__FILE__,__LINE__,"%s(): Couldn't use '%s' for chain %d: %s\n",__func__,s1,k+1,j==UTL_BAD_STAT?strerror(errno):utl_error(j));
+	free(s1);
+	free(s);
+	/* Carry on from the chain's own seedfile if there is one, otherwise
+	 * start k jumps on from the stream of a single run */
+	s1=loki->names[LK_SEEDFILE]?loki->names[LK_SEEDFILE]:"seedfile";
+	s=add_file_dir(s1);
+	i=seed_file && !access(s,R_OK);
+	free(s);
+	rng=lk_rng;
+	if(!i || getseed(s1)) {
+		lk_rng=rng;
+		for(i=0;i<k;i++) if(rng_jump(&lk_rng,RNG_CHAIN_LOG2)) ABT_FUNC("Couldn't set up random number stream\n");
+		rng_drop_streams();
+	}
+	/* Only the first chain reports progress */
+	if(k) loki->params.verbose_level=OUTPUT_QUIET|(loki->params.verbose_level&NON_INTERACTIVE);
+}
+
+static char *get_line(FILE *fptr,char **buf,size_t *size)
+{
+	size_t l=0;
+
+	if(!*buf) {
+		*size=1024;
+		*buf=lk_malloc(*size);
+	}
+	while(fgets(*buf+l,(int)(*size-l),fptr)) {
+		l+=strlen(*buf+l);
+		if((*buf)[l-1]=='\n') break;
+		*size<<=1;
+		*buf=lk_realloc(*buf,*size);
+	}
+	return l?*buf:0;
+}
+
+/* Read the first nc columns of a line of an output file.  Returns 0 if
+ * it is not a sample line or is too short */
+static int scan_row(const char *s,double *x,const int nc)
+{
+	int i;
+	char *p;
+
+	if(!isdigit((int)*s)) return 0;
+	for(i=0;i<nc;i++) {
+		x[i]=lk_strtod(s,&p);
+		if(p==s) return 0;
+		s=p;
+	}
+	return 1;
+}
+
+/* Column names from the "Output columns:" list of an output file header.
+ * Returns the number of fixed output columns */
+static int read_header(FILE *fptr,char ***col,int *n_col,char **buf,size_t *size)
+{
+	int i,k,n=0,nfix=0,in_cols=0;
+	char *s,**c=0;
+
+	while((s=get_line(fptr,buf,size)) && !isdigit((int)*s)) {
+		k=0;
+		if(!strncmp(s,"Output columns:",15)) in_cols=1;
+		else if(in_cols && sscanf(s," %d:%n",&i,&k)==1 && k && i==n+1) {
+			s+=k;
+			while(*s==' ') s++;
+			s[strcspn(s,"\n")]=0;
+			c=c?lk_realloc(c,sizeof(char *)*(n+1)):lk_malloc(sizeof(char *));
+			c[n++]=strdup(s);
+		} else (void)sscanf(s,"No. fixed output columns: %d",&nfix);
+	}
+	*col=c;
+	*n_col=n;
+	return nfix?nfix:n;
+}
+
+/* Gelman and Rubin's R-hat for each fixed output column (apart from the
+ * iteration count), using the second half of the shortest chain and the
+ * same number of samples from the end of each of the others */
+static void write_rhat(const int n,char **fname,struct loki *loki)
+{
+	int i,j,k,nc,n_col,nr,*rows;
+	char *name,**col,*buf=0,*rmax_col=0;
+	size_t size=0;
+	double *x,*mean,*m2,d,w,b,z,r,rmax=0.0;
+	FILE *fptr;
+
+	if(!(fptr=fopen(fname[0],"r"))) {
+		message(WARN_MSG,"Couldn't open '%s' to compare chains\n",fname[0]);
+		return;
+	}
+	nc=read_header(fptr,&col,&n_col,&buf,&size);
+	(void)fclose(fptr);
+	rows=lk_calloc((size_t)n,sizeof(int));
+	x=lk_malloc(sizeof(double)*(nc+1)*(2*n+1));
+	mean=x+nc;
+	m2=mean+nc*n;
+	for(k=0;k<n;k++) {
+		if((fptr=fopen(fname[k],"r"))) {
+			while(get_line(fptr,&buf,&size)) if(scan_row(buf,x,nc)) rows[k]++;
+			(void)fclose(fptr);
+		} else message(WARN_MSG,"Couldn't open '%s' to compare chains\n",fname[k]);
+	}
+	for(nr=rows[0],k=1;k<n;k++) if(rows[k]<nr) nr=rows[k];
+	nr>>=1;
+	if(nc<2 || nr<2) message(WARN_MSG,"Not enough samples to compare chains\n");
+	else {
+		for(i=0;i<nc*n;i++) mean[i]=m2[i]=0.0;
+		for(k=0;k<n;k++) {
+			fptr=fopen(fname[k],"r");
+			i=nr-rows[k];
+			while(get_line(fptr,&buf,&size)) if(scan_row(buf,x,nc) && ++i>0) {
+				for(j=0;j<nc;j++) {
+					d=x[j]-mean[k*nc+j];
+					mean[k*nc+j]+=d/(double)i;
+					m2[k*nc+j]+=d*(x[j]-mean[k*nc+j]);
+				}
+			}
+			(void)fclose(fptr);
+		}
+		name=make_file_name(".rhat");
+		if(!(fptr=fopen(name,"w"))) abt(__FILE__,__LINE__,"%s(): File Error.  Couldn't open '%s' for output\n",__func__,name);
+		(void)fprintf(fptr,"Potential scale reduction factors (R-hat) from %d chains\n",n);
+		(void)fprintf(fptr,"Using the last %d samples of each chain\n\n",nr);
+		for(j=1;j<nc;j++) {
+			for(z=w=0.0,k=0;k<n;k++) {
+				z+=mean[k*nc+j];
+				w+=m2[k*nc+j];
+			}
+			z/=(double)n;
+			w/=(double)(n*(nr-1));
+			for(b=0.0,k=0;k<n;k++) {
+				d=mean[k*nc+j]-z;
+				b+=d*d;
+			}
+			b*=(double)nr/(double)(n-1);
+			(void)fprintf(fptr,"  %d: %s  ",j+1,j<n_col?col[j]:"");
+			if(w>0.0) {
+				r=sqrt(((double)(nr-1)*w+b)/((double)nr*w));
+				(void)fprintf(fptr,"%.4f\n",r);
+				if(r>rmax) {
+					rmax=r;
+					rmax_col=j<n_col?col[j]:0;
+				}
+			} else (void)fputs("-\n",fptr);
+		}
+		(void)fclose(fptr);
+		if((loki->params.verbose_level&VERBOSE_LEVELS_MASK)<OUTPUT_QUIET) {
+			(void)printf("Largest R-hat from %d chains: %.4f",n,rmax);
+			if(rmax_col) (void)printf(" (%s)",rmax_col);
+			(void)printf(", see %s\n",name);
+		}
+		free(name);
+	}
+	for(j=0;j<n_col;j++) free(col[j]);
+	if(col) free(col);
+	free(x);
+	free(rows);
+	if(buf) free(buf);
+}
+
+static void pass_signal(int i)
+{
+	int k;
+
+	for(k=0;k<n_chain_pid;k++) (void)kill(chain_pid[k],i);
+}
+
+/* Couple the chains by heating.  Chain k is run with the trait
+ * likelihood raised to the power 1/(1+k*heat), and every swap_n iterations
+ * the parent proposes swapping the temperatures of two chains on
+ * neighbouring levels.  heat=0 gives independent chains */
+void set_chain_heating(const double heat,const int swap_n)
+{
+	chain_heat=heat;
+	swap_every=swap_n>0?swap_n:1;
+}
+
+/* Only a single normal trait can be heated, as every update that uses
+ * the trait likelihood has to take account of the temperature */
+static int can_heat(const struct loki *loki)
+{
+	const struct lk_model *m=loki->models;
+
+	return m->models && m->n_models==1 && !m->models[0].polygenic_flag && !m->n_random &&
+		!m->censored_flag && !m->use_student_t && !(loki->params.analysis&(IBD_ANALYSIS|ESTIMATE_IBD));
+}
+
+static int read_full(const int fd,void *p,const size_t sz)
+{
+	ssize_t k;
+	size_t l=0;
+
+	while(l<sz) {
+		k=read(fd,(char *)p+l,sz-l);
+		if(k<0 && errno==EINTR) continue;
+		if(k<=0) return -1;
+		l+=(size_t)k;
+	}
+	return 0;
+}
+
+static int write_full(const int fd,const void *p,const size_t sz)
+{
+	ssize_t k;
+	size_t l=0;
+
+	while(l<sz) {
+		k=write(fd,(const char *)p+l,sz-l);
+		if(k<0 && errno==EINTR) continue;
+		if(k<=0) return -1;
+		l+=(size_t)k;
+	}
+	return 0;
+}
+
+/* Called by each chain at the end of every iteration.  When the chains
+ * are heated, every swap_every iterations a chain sends the parent the
+ * log likelihood of the trait at its current state (without heating) and
+ * gets back the temperature to carry on at */
+void chain_exchange(const int lp,struct loki *loki)
+{
+	struct mc3_msg m;
+	double t;
+
+	if(mc3_out<0 || lp%swap_every) return;
+	m.lp=lp;
+	m.h=Res_LogLike(loki);
+	if(write_full(mc3_out,&m,sizeof(m)) || read_full(mc3_in,&t,sizeof(t))) {
+		/* The parent has stopped coupling the chains */
+		(void)close(mc3_in);
+		(void)close(mc3_out);
+		mc3_in=mc3_out=-1;
+		return;
+	}
+	loki->models->temper=t;
+}
+
+/* Serve the swap proposals of the heated chains until they have all
+ * finished.  Swaps stop (but the chains are still answered) as soon as
+ * one chain has finished or the chains are out of step */
+static void couple_chains(const int n,int *fd_in,int *fd_out,struct mc3_stats *st)
+{
+	int i,k,a,b,lp=0,n_open,coupled=1,*level,*at_level;
+	double z,*beta;
+	struct mc3_msg *msg;
+
+	msg=lk_malloc(sizeof(struct mc3_msg)*n);
+	beta=lk_malloc(sizeof(double)*n);
+	level=lk_malloc(sizeof(int)*2*n);
+	at_level=level+n;
+	for(k=0;k<n;k++) {
+		beta[k]=1.0/(1.0+(double)k*chain_heat);
+		level[k]=at_level[k]=k;
+	}
+	for(;;) {
+		for(n_open=k=0;k<n;k++) if(fd_in[k]>=0) {
+			if(read_full(fd_in[k],msg+k,sizeof(struct mc3_msg))) {
+				(void)close(fd_in[k]);
+				(void)close(fd_out[k]);
+				fd_in[k]=fd_out[k]=-1;
+				coupled=0;
+			} else if(!n_open++) lp=msg[k].lp;
+			else if(coupled && msg[k].lp!=lp) {
+				message(WARN_MSG,"Chains out of step (iteration %d and %d): no more swaps\n",lp,msg[k].lp);
+				coupled=0;
+			}
+		}
+		if(!n_open) break;
+		if(coupled) {
+			i=(int)(safe_ranf()*(double)(n-1));
+			a=at_level[i];
+			b=at_level[i+1];
+			st->level_try[i]++;
+			st->chain_try[a]++;
+			st->chain_try[b]++;
+			z=(beta[i]-beta[i+1])*(msg[b].h-msg[a].h);
+			if(z>=0.0 || ranf()<exp(z)) {
+				at_level[i]=b;
+				at_level[i+1]=a;
+				level[a]=i+1;
+				level[b]=i;
+				st->level_acc[i]++;
+				st->chain_acc[a]++;
+				st->chain_acc[b]++;
+			}
+		}
+		for(k=0;k<n;k++) if(fd_out[k]>=0) {
+			if(write_full(fd_out[k],beta+level[k],sizeof(double))) {
+				(void)close(fd_in[k]);
+				(void)close(fd_out[k]);
+				fd_in[k]=fd_out[k]=-1;
+				coupled=0;
+			}
+		}
+	}
+	free(level);
+	free(beta);
+	free(msg);
+}
+
+/* Put the samples from the cold chain back together in the usual output
+ * file: each iteration was written by whichever chain was at temperature 1
+ * at the time.  Returns the number of samples */
+static int merge_cold(const int n,char **fname,const char *out)
+{
+	int k,k1,ns=0,*lp;
+	char **buf;
+	size_t *size;
+	FILE **fin,*fout;
+
+	if(!(fout=fopen(out,"w"))) abt(__FILE__,__LINE__,"%s(): File Error.  Couldn't open '%s' for output\n",__func__,out);
+	fin=lk_malloc(sizeof(FILE *)*n);
+	buf=lk_calloc((size_t)n,sizeof(char *));
+	size=lk_calloc((size_t)n,sizeof(size_t));
+	lp=lk_malloc(sizeof(int)*n);
+	for(k=0;k<n;k++) {
+		lp[k]=-1;
+		if(!(fin[k]=fopen(fname[k],"r"))) {
+			message(WARN_MSG,"Couldn't open '%s' to merge output\n",fname[k]);
+			continue;
+		}
+		/* The header is taken from the first chain */
+		while(get_line(fin[k],buf+k,size+k)) {
+			if(isdigit((int)*buf[k])) {
+				lp[k]=atoi(buf[k]);
+				break;
+			}
+			if(!k) (void)fputs(buf[k],fout);
+		}
+	}
+	for(;;) {
+		for(k1=-1,k=0;k<n;k++) if(lp[k]>=0 && (k1<0 || lp[k]<lp[k1])) k1=k;
+		if(k1<0) break;
+		(void)fputs(buf[k1],fout);
+		ns++;
+		lp[k1]=-1;
+		while(get_line(fin[k1],buf+k1,size+k1)) if(isdigit((int)*buf[k1])) {
+			lp[k1]=atoi(buf[k1]);
+			break;
+		}
+	}
+	(void)fclose(fout);
+	for(k=0;k<n;k++) {
+		if(fin[k]) (void)fclose(fin[k]);
+		if(buf[k]) free(buf[k]);
+	}
+	free(lp);
+	free(size);
+	free(buf);
+	free(fin);
+	return ns;
+}
+
+/* Swap acceptance rates, and the effective sample size (by batch means)
+ * of each fixed output column from the cold chain */
+static void write_mc3(const int n,const char *out,const double secs,const struct mc3_stats *st,struct loki *loki)
+{
+	int i,j,k,nc,n_col,ns=0,n_batch,bs;
+	char *name,**col,*buf=0;
+	size_t size=0;
+	double *x,z,m,v,vb,ess,ess_min=-1.0;
+	FILE *fptr,*fin;
+
+	name=make_file_name(".mc3");
+	if(!(fptr=fopen(name,"w"))) abt(__FILE__,__LINE__,"%s(): File Error.  Couldn't open '%s' for output\n",__func__,name);
+	(void)fprintf(fptr,"Metropolis coupled chains: %d, heating %g, swaps every %d iterations\n",n,chain_heat,swap_every);
+	(void)fprintf(fptr,"Run time %.1f s\n\nSwap acceptance between temperature levels:\n",secs);
+	for(i=0;i<n-1;i++) {
+		(void)fprintf(fptr,"  %g <-> %g: %d of %d",1.0/(1.0+(double)i*chain_heat),1.0/(1.0+(double)(i+1)*chain_heat),st->level_acc[i],st->level_try[i]);
+		if(st->level_try[i]) (void)fprintf(fptr," (%.3f)",(double)st->level_acc[i]/(double)st->level_try[i]);
+		(void)fputc('\n',fptr);
+	}
+	(void)fputs("\nSwap acceptance by chain:\n",fptr);
+	for(k=0;k<n;k++) {
+		(void)fprintf(fptr,"  chain%d: %d of %d",k+1,st->chain_acc[k],st->chain_try[k]);
+		if(st->chain_try[k]) (void)fprintf(fptr," (%.3f)",(double)st->chain_acc[k]/(double)st->chain_try[k]);
+		(void)fputc('\n',fptr);
+	}
+	x=0;
+	col=0;
+	n_col=nc=0;
+	if((fin=fopen(out,"r"))) {
+		nc=read_header(fin,&col,&n_col,&buf,&size);
+		rewind(fin);
+		k=1024;
+		x=lk_malloc(sizeof(double)*(nc+1)*k);
+		while(get_line(fin,&buf,&size)) if(scan_row(buf,x+ns*nc,nc) && ++ns==k) {
+			k<<=1;
+			x=lk_realloc(x,sizeof(double)*(nc+1)*k);
+		}
+		(void)fclose(fin);
+	}
+	n_batch=(int)sqrt((double)ns);
+	if(nc<2 || n_batch<2) (void)fputs("\nNot enough samples from the cold chain for effective sample sizes\n",fptr);
+	else {
+		bs=ns/n_batch;
+		(void)fprintf(fptr,"\nEffective sample sizes from %d samples of the cold chain (%d batches of %d):\n",ns,n_batch,bs);
+		for(j=1;j<nc;j++) {
+			for(m=0.0,i=0;i<ns;i++) m+=x[i*nc+j];
+			m/=(double)ns;
+			for(v=0.0,i=0;i<ns;i++) {
+				z=x[i*nc+j]-m;
+				v+=z*z;
+			}
+			v/=(double)(ns-1);
+			/* Batch means from the last n_batch*bs samples */
+			for(vb=0.0,k=0;k<n_batch;k++) {
+				for(z=0.0,i=ns-(k+1)*bs;i<ns-k*bs;i++) z+=x[i*nc+j];
+				z=z/(double)bs-m;
+				vb+=z*z;
+			}
+			vb*=(double)bs/(double)(n_batch-1);
+			(void)fprintf(fptr,"  %d: %s  ",j+1,j<n_col?col[j]:"");
+			if(vb>0.0) {
+				ess=(double)ns*v/vb;
+				(void)fprintf(fptr,"%.1f (%.3g per second)\n",ess,secs>0.0?ess/secs:0.0);
+				if(ess_min<0.0 || ess<ess_min) ess_min=ess;
+			} else (void)fputs("-\n",fptr);
+		}
+	}
+	(void)fclose(fptr);
+	if((loki->params.verbose_level&VERBOSE_LEVELS_MASK)<OUTPUT_QUIET) {
+		(void)printf("Cold chain: %d samples",ns);
+		if(ess_min>=0.0) (void)printf(", smallest effective sample size %.1f (%.3g per second)",ess_min,secs>0.0?ess_min/secs:0.0);
+		(void)printf(", see %s\n",name);
+	}
+	free(name);
+	for(j=0;j<n_col;j++) free(col[j]);
+	if(col) free(col);
+	if(x) free(x);
+	if(buf) free(buf);
+}
+
+/* Run n chains on from the current state, each in its own process.  Chain k
+ * (counting from 0) writes its output files to a directory chain<k+1> next
+ * to where they would otherwise go, and its random number stream starts
+ * k*2^RNG_CHAIN_LOG2 draws on from that of a single run, unless seed_file
+ * is set and the chain has a seedfile of its own from an earlier run.
+ * Returns k in the process running chain k.  The parent waits for the
+ * chains to finish (coupling them if they are heated), compares them and
+ * returns -1, setting *err if any chain could not be started or did not
+ * finish normally */
+int run_chains(const int n,const int seed_file,int *err,struct loki *loki)
+{
+	int i,k,st,*fd=0,sigs[]={SIGINT,SIGHUP,SIGQUIT,SIGALRM,SIGVTALRM,SIGPROF,SIGPIPE};
+	pid_t pid;
+	char *name,**fname;
+	struct itimerval it;
+	struct sigaction s_action;
+	struct timeval t0,t1;
+	struct mc3_stats mc3;
+
+	*err=0;
+	(void)memset(&mc3,0,sizeof(mc3));
+	if(chain_heat>0.0) {
+		if(!can_heat(loki)) abt(__FILE__,__LINE__,"%s(): Heated chains are only possible for a single normal trait without censoring, student t or random effects\n",__func__);
+		/* Pipes to (fd[4k],fd[4k+1]) and from (fd[4k+2],fd[4k+3]) each chain */
+		fd=lk_malloc(sizeof(int)*4*n);
+		for(k=0;k<n;k++) {
+			if(pipe(fd+4*k) || pipe(fd+4*k+2)) abt(__FILE__,__LINE__,"%s(): Couldn't create pipe: %s\n",__func__,strerror(errno));
+		}
+	}
+	/* Timers are not inherited, so pass on what is left */
+	if(loki->params.limit_time>0.0) (void)getitimer(loki->params.limit_timer_type,&it);
+	chain_pid=lk_malloc(sizeof(pid_t)*n);
+	(void)fflush(stdout);
+	(void)fflush(stderr);
+	(void)gettimeofday(&t0,0);
+	for(k=0;k<n;k++) {
+		pid=fork();
+		if(!pid) {
+			free(chain_pid);
+			chain_pid=0;
+			n_chain_pid=0;
+			if(fd) {
+				for(i=0;i<4*n;i++) if(i!=4*k && i!=4*k+3) (void)close(fd[i]);
+				mc3_in=fd[4*k];
+				mc3_out=fd[4*k+3];
+				free(fd);
+				/* Carry on alone if the parent goes away */
+				(void)signal(SIGPIPE,SIG_IGN);
+				loki->models->temper=1.0/(1.0+(double)k*chain_heat);
+			}
+			if(loki->params.limit_time>0.0) (void)setitimer(loki->params.limit_timer_type,&it,0);
+			start_chain(k,seed_file,loki);
+			return k;
+		}
+		if(pid<0) {
+			message(ERROR_MSG,"Couldn't start chain %d: %s\n",k+1,strerror(errno));
+			*err=1;
+			break;
+		}
+		chain_pid[n_chain_pid++]=pid;
+	}
+	if(loki->params.limit_time>0.0) {
+		(void)memset(&it,0,sizeof(it));
+		(void)setitimer(loki->params.limit_timer_type,&it,0);
+	}
+	/* The chains handle signals from the terminal themselves, and any
+	 * SIGTERM sent to this process is passed on to them */
+	s_action.sa_handler=SIG_IGN;
+	s_action.sa_flags=0;
+	(void)sigemptyset(&s_action.sa_mask);
+	for(i=0;i<(int)(sizeof(sigs)/sizeof(int));i++) (void)sigaction(sigs[i],&s_action,0L);
+	s_action.sa_handler=pass_signal;
+	(void)sigaction(SIGTERM,&s_action,0L);
+	if(*err) pass_signal(SIGTERM);
+	if(fd) {
+		/* Keep our ends: fd[4k+1] to write to chain k, fd[4k+2] to read from it */
+		for(k=0;k<n;k++) {
+			(void)close(fd[4*k]);
+			(void)close(fd[4*k+3]);
+		}
+		for(k=0;k<n;k++) {
+			fd[k]=fd[4*k+2];
+			fd[n+k]=fd[4*k+1];
+		}
+		mc3.level_try=lk_calloc((size_t)(4*n),sizeof(int));
+		mc3.level_acc=mc3.level_try+n;
+		mc3.chain_try=mc3.level_acc+n;
+		mc3.chain_acc=mc3.chain_try+n;
+		/* Swap decisions use a stream of their own, after those of the chains */
+		for(k=0;k<n;k++) if(rng_jump(&lk_rng,RNG_CHAIN_LOG2)) ABT_FUNC("Couldn't set up random number stream\n");
+		couple_chains(n,fd,fd+n,&mc3);
+	}
+	for(k=0;k<n_chain_pid;k++) {
+		while(waitpid(chain_pid[k],&st,0)<0) {
+			if(errno!=EINTR) {
+				st=-1;
+				break;
+			}
+		}
+		if(st) {
+			if(st>0 && WIFEXITED(st)) message(WARN_MSG,"Chain %d finished with exit status %d\n",k+1,WEXITSTATUS(st));
+			else message(WARN_MSG,"Chain %d did not finish normally\n",k+1);
+			*err=1;
+		}
+	}
+	(void)gettimeofday(&t1,0);
+	k=n_chain_pid;
+	n_chain_pid=0;
+	free(chain_pid);
+	chain_pid=0;
+	if(k==n) {
+		name=loki->names[LK_OUTPUTFILE]?strdup(loki->names[LK_OUTPUTFILE]):make_file_name(".out");
+		fname=lk_malloc(sizeof(char *)*n);
+		for(k=0;k<n;k++) fname[k]=chain_name(name,k,0);
+		if(fd) {
+			(void)merge_cold(n,fname,name);
+			write_mc3(n,name,(double)(t1.tv_sec-t0.tv_sec)+1.0e-6*(double)(t1.tv_usec-t0.tv_usec),&mc3,loki);
+		} else write_rhat(n,fname,loki);
+		for(k=0;k<n;k++) free(fname[k]);
+		free(fname);
+		free(name);
+	}
+	if(fd) {
+		free(mc3.level_try);
+		free(fd);
+	}
+	return -1;
+}
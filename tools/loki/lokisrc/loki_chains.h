@@ -0,0 +1,8 @@
+#ifndef _LOKI_CHAINS_H_
+#define _LOKI_CHAINS_H_
+
+int run_chains(const int,const int,int *,struct loki *);
+void set_chain_heating(const double,const int);
+void chain_exchange(const int,struct loki *);
+
+#endif
@@ -30,32 +30,35 @@
 #define DBL_MAX MAXDOUBLE
 #endif
 
-#define IDX_PART_BIT 8
-#define IDX_PART (1<<IDX_PART_BIT)
-#define HASHTABLE_SIZE 2056
 
 #include "ranlib.h"
 #include "utils.h"
 #include "loki.h"
 #include "loki_peel.h"
+#include "lk_malloc.h"
+#include "rf_store.h"
+
+/* Scratch space for the complex peeling operations.  Each peeling thread
+ * has its own, hanging off its workspace */
+struct complex_mem {
+	double **freq,**pen,*out_p;
+	int max_fnd,max_all,out_p_size;
+	int *mem,mem_size,max_pen,max_pen1;
+	int *trans,**trans_p,trans_size,trans_p_size;
+	size_t hb_size; /* Size of next R-Function memory block */
+	struct rf_store rfs; /* Terms of the output R-Function */
+};
 
-static double **complex_freq,**complex_pen,*complex_out_p;
-static int max_fnd,max_all,out_p_size,n_bits1;
-static int n_terms,hash_mode,*complex_mem,max_pen,max_pen1;
-static int *complex_trans,**complex_trans_p,complex_trans_size,complex_trans_p_size;
-static size_t hb_size=2048;
-static struct bin_node *hashtable[HASHTABLE_SIZE];
-static struct hash_block *first_hash_block,*hash_block;
 /* Given index x (from R-Function), returns corresponding n allele types in gt */
-static void get_gts(lk_ulong x,const int n,int *gt)
+static void get_gts(lk_ulong x,const int n,int *gt,const int n_bits)
 {
 	int i=0;
 	lk_ulong a;
 	
-	a=(1<<(n_bits1))-1;
+	a=(1<<(n_bits))-1;
 	while(x)	{
 		gt[i++]=1+(int)(x&a);
-		x>>=n_bits1;
+		x>>=n_bits;
 	}
 	for(;i<n;i++) gt[i]=1;
 }
@@ -100,35 +103,6 @@ lk_ulong get_index1(int n,int *gt,const int n_bits)
 	return x;
 }
 
-/* Returns storage for storing a new non-zero element.  Elements are allocated
- * in blocks of size hb_size */
-static struct bin_node *get_new_element(const lk_ulong idx,const double p)
-{
-	struct bin_node *element;
-	struct hash_data *hd;
-	
-	while(hash_block->ptr>=hash_block->size) {
-		if(!hash_block->next) {
-			if(!(hash_block->next=malloc(sizeof(struct hash_block)))) ABT_FUNC(MMsg);
-			hash_block=hash_block->next;
-			hash_block->next=0;
-			if(!(hash_block->elements=malloc(sizeof(struct bin_node)*hb_size))) ABT_FUNC(MMsg);
-			if(!(hash_block->hd=malloc(sizeof(struct hash_data)*hb_size))) ABT_FUNC(MMsg);
-			hash_block->size=hb_size;
-		} else hash_block=hash_block->next;
-		hash_block->ptr=0;
-	}
-	hd=hash_block->hd+hash_block->ptr;
-	element=hash_block->elements+hash_block->ptr++;
-	element->left=element->right=0;
-	element->balance=0;
-	hd->index=idx;
-	hd->p=p;
-	element->data=hd;
-	n_terms++;
-	return element;
-}
-
 struct peel_mem_block *get_new_memblock(size_t size,int flag)
 {
 	struct peel_mem_block *p;
@@ -148,6 +122,7 @@ void get_rf_memory(struct R_Func *rf,size_t size,int flag,struct loki *loki)
 {
 	size_t i;
 	struct peel_mem_block *p,*p1;
+	struct complex_mem *cm=loki->peel->workspace.cm;
 	
 	p1=loki->peel->mem_block[flag];
 	i=p1->size-p1->ptr;
@@ -158,8 +133,8 @@ void get_rf_memory(struct R_Func *rf,size_t size,int flag,struct loki *loki)
 			p=p->next;
 		}
 		if(!(p->next)) {
-			hb_size*=1.2;
-			i=(size>hb_size)?size:hb_size;
+			cm->hb_size*=1.2;
+			i=(size>cm->hb_size)?size:cm->hb_size;
 			p=get_new_memblock(i,flag);
 		} else {
 			p1=p->next;
@@ -180,134 +155,37 @@ void get_rf_memory(struct R_Func *rf,size_t size,int flag,struct loki *loki)
 	loki->peel->mem_block[flag]=p1;
 }
 
-/* Insert element with index idx into the binary tree hanging off *node */
-static struct bin_node *insert_node(struct bin_node *node,const lk_ulong idx,const double p,int *bal)
-{
-	int bb;
-	lk_ulong idx1;
-	struct hash_data *hd;
-	
-	hd=node->data;
-	idx1=hd->index;
-	if(idx!=idx1) {
-		bb=node->balance;
-		if(idx<idx1) {
-			if(node->left) node->left=insert_node(node->left,idx,p,bal);
-			else {
-				node->left=get_new_element(idx,p);
-				*bal=0;
-			}
-			if(!(*bal)) {
-				switch(bb) {
-					case -1:
-						node=rotate_left(node);
-						*bal=1;
-						break;
-					case 0:
-						node->balance=-1;
-						break;
-					case 1:
-						node->balance=0;
-						*bal=1;
-				}
-			}
-		} else {
-			if(node->right) node->right=insert_node(node->right,idx,p,bal);
-			else {
-				node->right=get_new_element(idx,p);
-				*bal=0;
-			}
-			if(!(*bal)) {
-				switch(bb) {
-					case -1:
-						node->balance=0;
-						*bal=1;
-						break;
-					case 0:
-						node->balance=1;
-						break;
-					case 1:
-						node=rotate_right(node);
-						*bal=1;
-				}
-			}			
-		}
-	} else {
-		*bal=1;
-		hd->p+=p;
-	}
-	return node;
-}
-
-/* Recursive routine for getting all elements from binary tree hanging off *node and storing
- * the values and indices from them in *tp and *tl */
-static void get_nodes(struct bin_node *node,double *tp,lk_ulong *tl,int *j)
+struct complex_mem *alloc_complex_mem(void)
 {
-	struct hash_data *hd;
+	struct complex_mem *cm;
 	
-	if(node->left)	get_nodes(node->left,tp,tl,j);
-	hd=node->data;
-	tp[*j]=hd->p;
-	tl[(*j)++]=hd->index;
-	if(node->right) get_nodes(node->right,tp,tl,j);
+	cm=lk_calloc((size_t)1,sizeof(struct complex_mem));
+	cm->hb_size=2048;
+	return cm;
 }
 
-/* Similar to get_nodes, but stops when the cumulative probability >= z.  Allows sampling
- * from distribution */
-static int sample_comb(struct bin_node *node,const double z,double *p,lk_ulong *idx)
+void free_complex_mem(struct complex_mem *cm)
 {
-	struct hash_data *hd;
-	
-	if(node->left) if(sample_comb(node->left,z,p,idx)) return 1;
-	hd=node->data;
-	if(hd->p>0.0) {
-		*p+=hd->p;
-		if(*p>=z) {
-			*idx=hd->index;
-			return 1;
-		}
+	if(!cm) return;
+	if(cm->mem) free(cm->mem);
+	if(cm->out_p) free(cm->out_p);
+	if(cm->freq) {
+		if(cm->freq[0]) free(cm->freq[0]);
+		free(cm->freq);
 	}
-	if(node->right) if(sample_comb(node->right,z,p,idx)) return 1;
-	return 0;
-}
-
-/* Clean up memory used */
-static void free_hash_blocks(void)
-{
-	struct hash_block *hb1;
-	
-	hash_block=first_hash_block;
-	while(hash_block) {
-		if(hash_block->elements) free(hash_block->elements);
-		if(hash_block->hd) free(hash_block->hd);
-		hb1=hash_block->next;
-		free(hash_block);
-		hash_block=hb1;
+	if(cm->pen) {
+		if(cm->pen[0]) free(cm->pen[0]);
+		free(cm->pen);
 	}
-	first_hash_block=0;
+	if(cm->trans) free(cm->trans);
+	if(cm->trans_p) free(cm->trans_p);
+	rfs_free(&cm->rfs);
+	free(cm);
 }
 
-void free_complex_mem(void)
-{
-	if(complex_mem) free(complex_mem);
-	if(complex_out_p) free(complex_out_p);
-	if(complex_freq) {
-		if(complex_freq[0]) free(complex_freq[0]);
-		free(complex_freq);
-	}
-	if(complex_pen) {
-		if(complex_pen[0]) free(complex_pen[0]);
-		free(complex_pen);
-	}
-	if(complex_trans) free(complex_trans);
-	if(complex_trans_p) free(complex_trans_p);
-	free_hash_blocks();
-}
-
-static void setup_complex_peel(const struct Complex_Element *element, const int sampling,int *temp[],int *n_other,int *n_jnt,int *n_trans,struct Id_Record *id_array)
+static void setup_complex_peel(struct complex_mem *cm,const struct Complex_Element *element, const int sampling,int *temp[],int *n_other,int *n_jnt,int *n_trans,struct Id_Record *id_array)
 {
 	int i,j,k,k1,n_peel,n_inv,n_rf,*inv,*flags;
-	static int complex_mem_size;
 	
 	n_inv=element->n_involved;
 	n_peel=element->n_peel;
@@ -315,17 +193,17 @@ static void setup_complex_peel(const struct Complex_Element *element, const int
 	inv=element->involved;
 	flags=element->flags;
 	i=12*n_inv+n_rf;
-	if(!complex_mem) {
-		complex_mem_size=i;
-		if(!(complex_mem=calloc((size_t)i,sizeof(int)))) ABT_FUNC(MMsg);
+	if(!cm->mem) {
+		cm->mem_size=i;
+		if(!(cm->mem=calloc((size_t)i,sizeof(int)))) ABT_FUNC(MMsg);
 	} else {
-		if(i>complex_mem_size) {
-			complex_mem_size=i;
-			if(!(complex_mem=realloc(complex_mem,i*sizeof(int)))) ABT_FUNC(MMsg);
+		if(i>cm->mem_size) {
+			cm->mem_size=i;
+			if(!(cm->mem=realloc(cm->mem,i*sizeof(int)))) ABT_FUNC(MMsg);
 		}
-		(void)memset(complex_mem,0,i*sizeof(int));
+		(void)memset(cm->mem,0,i*sizeof(int));
 	}
-	temp[0]=complex_mem;
+	temp[0]=cm->mem;
 	for(i=1;i<13;i++) temp[i]=temp[i-1]+n_inv;
 	/* 'other' alleles are alleles not in R-Functions and not already sampled
 	 * (if on reverse sampling pass) */
@@ -383,16 +261,15 @@ static void setup_complex_peel(const struct Complex_Element *element, const int
  * nuclear family based peeling operation) */
 double loki_complex_peelop(const struct Complex_Element *element,const int locus,const int s_flag,pen_func pen,const int n_all,struct R_Func *rf,double **freq,struct loki *loki)
 {
-	int i,j,k,k1,k2,k3,k4,n_out,n_peel,n_inv,*inv,n_rf,n_ind,n_other,ef,ef1,sampling=0,idx_shift=0,rf_flag;
-	int *gt_store,*gt_store1,*other_ptr,*other_list,*rf_ptr,*jnt_list,ht_size,n_trans,*trans_idx,*flags;
+	int i,j,k,k1,k2,k3,k4,n_out,n_peel,n_inv,*inv,n_rf,n_ind,n_other,ef,ef1,sampling=0,rf_flag;
+	int *gt_store,*gt_store1,*other_ptr,*other_list,*rf_ptr,*jnt_list,n_trans,*trans_idx,*flags;
 	int *off_index[2],*fnd_list,n_fnd=0,all,*pen_list,n_pen,*temp_p[13],n_jnt,*jnt_idx,linktype,n_idx,*nbts;
-	int *id_list;
+	int *id_list,n_bits1;
 	double *tp,prob=0.0,z,p1,Konst=0.0;
 	lk_ulong a,b,m,*tl,**a_set,msk[LK_LONG_BIT];
-	struct bin_node *elem;
-	struct hash_data *hd;
 	struct Id_Record *id_array;
 	struct Marker *mark;
+	struct complex_mem *cm=loki->peel->workspace.cm;
 	int **trans,**trans1;
 	
 	n_bits1=num_bits(n_all);
@@ -408,22 +285,6 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 	flags=element->flags;
 	n_out=element->n_out;
 	n_rf=element->n_rfuncs; /* No. input R-Functions */
-	/* Allocate first hash_block, if not already done so */
-	if(!first_hash_block) {
-		if(!(first_hash_block=malloc(sizeof(struct hash_block)))) ABT_FUNC(MMsg);
-		if(!(first_hash_block->elements=malloc(sizeof(struct bin_node)*hb_size))) ABT_FUNC(MMsg);
-		if(!(first_hash_block->hd=malloc(sizeof(struct hash_data)*hb_size))) ABT_FUNC(MMsg);
-		first_hash_block->next=0;
-		first_hash_block->size=hb_size;
-	}
-	/* Reset pointers to all hash_blocks */
-	hash_block=first_hash_block;
-	while(hash_block) {
-		hash_block->ptr=0;
-		hash_block=hash_block->next;
-	}
-	hash_block=first_hash_block;
-	n_terms=0; /* No. non-zero terms in output R-Function */
 	/* if s_flag is non-zero then we are doing a sampling run */
 	/* if s_flag&OP_SAMPLING then we are on the reverse (sampling) phase */
 	/* In any case, if !n_out and s_flag then we can sample */
@@ -431,7 +292,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 		if(s_flag&OP_SAMPLING) sampling=1;
 		else if(!n_out) sampling=1;
 	}
-	setup_complex_peel(element,sampling,temp_p,&n_other,&n_jnt,&n_trans,id_array);
+	setup_complex_peel(cm,element,sampling,temp_p,&n_other,&n_jnt,&n_trans,id_array);
 	gt_store=temp_p[0];
 	other_list=temp_p[1];
 	other_ptr=temp_p[2];
@@ -446,25 +307,25 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 	nbts=temp_p[11];
 	rf_ptr=temp_p[12];
 	for(i=0;i<(int)LK_LONG_BIT;i++) msk[i]=(1L<<i)-1L;
-	if(!complex_trans_p) {
-		complex_trans_p_size=n_inv;
-		if(!(complex_trans_p=malloc(sizeof(void *)*complex_trans_p_size*2))) ABT_FUNC(MMsg);
-		complex_trans_size=n_inv*n_all;
-		if(!(complex_trans=malloc(sizeof(int)*complex_trans_size*2))) ABT_FUNC(MMsg);
+	if(!cm->trans_p) {
+		cm->trans_p_size=n_inv;
+		if(!(cm->trans_p=malloc(sizeof(void *)*cm->trans_p_size*2))) ABT_FUNC(MMsg);
+		cm->trans_size=n_inv*n_all;
+		if(!(cm->trans=malloc(sizeof(int)*cm->trans_size*2))) ABT_FUNC(MMsg);
 	} else {
-		if(n_inv>complex_trans_p_size) {
-			complex_trans_p_size=n_inv;
-			if(!(complex_trans_p=realloc(complex_trans_p,sizeof(void *)*complex_trans_p_size*2))) ABT_FUNC(MMsg);
+		if(n_inv>cm->trans_p_size) {
+			cm->trans_p_size=n_inv;
+			if(!(cm->trans_p=realloc(cm->trans_p,sizeof(void *)*cm->trans_p_size*2))) ABT_FUNC(MMsg);
 		}
 		k=n_all*n_inv;
-		if(k>complex_trans_size) {
-			complex_trans_size=k;
-			if(!(complex_trans=realloc(complex_trans,sizeof(int)*complex_trans_size*2))) ABT_FUNC(MMsg);
+		if(k>cm->trans_size) {
+			cm->trans_size=k;
+			if(!(cm->trans=realloc(cm->trans,sizeof(int)*cm->trans_size*2))) ABT_FUNC(MMsg);
 		}
 	}
-	trans=complex_trans_p;
+	trans=cm->trans_p;
 	trans1=trans+n_inv;
-	trans[0]=complex_trans;
+	trans[0]=cm->trans;
 	for(i=1;i<n_inv*2;i++) trans[i]=trans[i-1]+n_all;
 	/* See how many bits / node we need */
 	for(i=0;i<n_inv;i++) {
@@ -504,13 +365,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 		(void)fprintf(stderr,"\nToo many individuals in output R-Function for marker %s when %s\nn_peel = %d, n_all = %d, n_bits1 = %d, required size = %d, LONG_BIT = %d\n",loki->markers->marker[locus].name,sampling?"sampling":"peeling",n_peel,n_all,n_bits1,k,(int)LK_LONG_BIT);
 		ABT_FUNC(AbMsg);
 	}
-	hash_mode=(log(2.0)*k<log((double)HASHTABLE_SIZE));
-	if(hash_mode) ht_size=(1<<k);
-	else {
-		ht_size=IDX_PART;
-		idx_shift=k-IDX_PART_BIT;
-	}
-	for(i=0;i<ht_size;i++) hashtable[i]=0;
+	rfs_init(&cm->rfs,k);
 	/* Compute masks - used for finding mutually 
 	 * consistent terms from multiple input R-Functions */
 	if(n_rf) {
@@ -549,24 +404,24 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 	for(k=0;k<n_inv;k++) if(flags[k]&HAP_FND) n_fnd++;
 	/* Get frequency info. for founder alleles (tricky because of recoding) */
 	if(n_fnd) {
-		if(!complex_freq) {
-			if(!(complex_freq=malloc(sizeof(void *)*n_fnd))) ABT_FUNC(MMsg);
-			max_all=n_all*n_fnd;
-			if(!(complex_freq[0]=malloc(sizeof(double)*max_all))) ABT_FUNC(MMsg);
-			max_fnd=n_fnd;
+		if(!cm->freq) {
+			if(!(cm->freq=malloc(sizeof(void *)*n_fnd))) ABT_FUNC(MMsg);
+			cm->max_all=n_all*n_fnd;
+			if(!(cm->freq[0]=malloc(sizeof(double)*cm->max_all))) ABT_FUNC(MMsg);
+			cm->max_fnd=n_fnd;
 		} else {
-			if(n_fnd>max_fnd) {
-				max_fnd=n_fnd;
-				tp=complex_freq[0];
-				if(!(complex_freq=realloc(complex_freq,sizeof(void *)*n_fnd))) ABT_FUNC(MMsg);
-				complex_freq[0]=tp;
+			if(n_fnd>cm->max_fnd) {
+				cm->max_fnd=n_fnd;
+				tp=cm->freq[0];
+				if(!(cm->freq=realloc(cm->freq,sizeof(void *)*n_fnd))) ABT_FUNC(MMsg);
+				cm->freq[0]=tp;
 			}
-			if(n_fnd*n_all>max_all) {
-				max_all=n_all*n_fnd;
-				if(!(complex_freq[0]=realloc(complex_freq[0],sizeof(double)*max_all))) ABT_FUNC(MMsg);
+			if(n_fnd*n_all>cm->max_all) {
+				cm->max_all=n_all*n_fnd;
+				if(!(cm->freq[0]=realloc(cm->freq[0],sizeof(double)*cm->max_all))) ABT_FUNC(MMsg);
 			}
 		}
-		for(i=1;i<n_fnd;i++) complex_freq[i]=complex_freq[i-1]+n_all;
+		for(i=1;i<n_fnd;i++) cm->freq[i]=cm->freq[i-1]+n_all;
 		n_fnd=0;
 		for(k=0;k<n_inv;k++) if(flags[k]&HAP_FND) {
 			j=abs(inv[k])-1;
@@ -576,10 +431,10 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 #endif
 			k2=n_all-1;
 			a=mark->req_set[inv[k]<0?X_PAT:X_MAT][j];
-			complex_freq[n_fnd][k2]=0.0;
+			cm->freq[n_fnd][k2]=0.0;
 			for(k1=0;k1<n_all;k1++) {
-				if(a&(1<<k1)) complex_freq[n_fnd][k2]+=freq[k3][k1];
-				else complex_freq[n_fnd][k1]=freq[k3][k1];
+				if(a&(1<<k1)) cm->freq[n_fnd][k2]+=freq[k3][k1];
+				else cm->freq[n_fnd][k1]=freq[k3][k1];
 			}
 			fnd_list[n_fnd++]=k;
 		}
@@ -596,28 +451,28 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 		}
 		/* Pre-calculate penetrances */
 		if(n_pen) {
-			if(!complex_pen) {
-				if(!(complex_pen=malloc(sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
-				max_pen1=n_pen*n_idx;
-				if(!(complex_pen[0]=malloc(sizeof(double)*max_pen1))) ABT_FUNC(MMsg);
-				max_pen=n_pen;
+			if(!cm->pen) {
+				if(!(cm->pen=malloc(sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
+				cm->max_pen1=n_pen*n_idx;
+				if(!(cm->pen[0]=malloc(sizeof(double)*cm->max_pen1))) ABT_FUNC(MMsg);
+				cm->max_pen=n_pen;
 			} else {
-				if(n_pen>max_pen)	{
-					max_pen=n_pen;
-					if(!(complex_pen=realloc(complex_pen,sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
+				if(n_pen>cm->max_pen)	{
+					cm->max_pen=n_pen;
+					if(!(cm->pen=realloc(cm->pen,sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
 				}
-				if(n_pen*n_idx>max_pen1) {
-					max_pen1=n_pen*n_idx;
-					if(!(complex_pen[0]=realloc(complex_pen[0],sizeof(double)*max_pen1))) ABT_FUNC(MMsg);
+				if(n_pen*n_idx>cm->max_pen1) {
+					cm->max_pen1=n_pen*n_idx;
+					if(!(cm->pen[0]=realloc(cm->pen[0],sizeof(double)*cm->max_pen1))) ABT_FUNC(MMsg);
 				}
 			}
-			for(k1=0;k1<n_pen*n_idx;k1++) complex_pen[0][k1]=1.0;
-			for(k1=1;k1<n_pen;k1++) complex_pen[k1]=complex_pen[k1-1]+n_idx;
+			for(k1=0;k1<n_pen*n_idx;k1++) cm->pen[0][k1]=1.0;
+			for(k1=1;k1<n_pen;k1++) cm->pen[k1]=cm->pen[k1-1]+n_idx;
 			for(k=0;k<n_pen;k++)	{
-				pen(complex_pen[k],pen_list[k],&mark->locus,n_all,n_bits1,loki);
+				pen(cm->pen[k],pen_list[k],&mark->locus,n_all,n_bits1,loki);
 				z=0.0;
-				for(k1=0;k1<n_idx;k1++) z+=complex_pen[k][k1];
-				for(k1=0;k1<n_idx;k1++) complex_pen[k][k1]/=z;
+				for(k1=0;k1<n_idx;k1++) z+=cm->pen[k][k1];
+				for(k1=0;k1<n_idx;k1++) cm->pen[k][k1]/=z;
 				Konst+=log(z);
 			}
 		}
@@ -697,7 +552,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 						gt_store[k1]=1+trans1[k1][0];
 					}
 				} else {
-					get_gts(rf[j].index[rf_ptr[i]],n_ind,gt_store1);
+					get_gts(rf[j].index[rf_ptr[i]],n_ind,gt_store1,n_bits1);
 					for(k=0;k<n_ind;k++)	{
 						k1=id_list[k];
 						gt_store[k1]=gt_store1[k];
@@ -801,7 +656,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 #endif
 						for(k1=0;k1<n_fnd;k1++) { /* Add founder frequencies */
 							k=fnd_list[k1];
-							p1*=complex_freq[k1][gt_store[k]-1];
+							p1*=cm->freq[k1][gt_store[k]-1];
 						}
 #ifdef DEBUG
 						if(p1<0.0) {
@@ -819,7 +674,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 							for(k=0;k<n_pen;k++)	{
 								k1=pen_list[k];
 								k2=((id_array[k1].allele[X_PAT]-1)<<n_bits1)|(id_array[k1].allele[X_MAT]-1);
-								p1*=complex_pen[k][k2];
+								p1*=cm->pen[k][k2];
 							}
 						}
 #ifdef DEBUG
@@ -834,19 +689,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 							k=n_inv-n_out;
 							a=get_index(n_out,k,gt_store,nbts,trans);
 						}
-						if(hash_mode) {
-							k=(int)a;
-							if(!hashtable[k]) hashtable[k]=get_new_element(a,p1);
-							else {
-								hd=hashtable[k]->data;
-								hd->p+=p1;
-							}
-						} else {
-							k=(a>>idx_shift);
-							if(hashtable[k]) {
-								hashtable[k]=insert_node(hashtable[k],a,p1,&k1);
-							} else hashtable[k]=get_new_element(a,p1);
-						}
+						rfs_add(&cm->rfs,a,p1);
 						ef=1;
 					}
 				}
@@ -1008,7 +851,7 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 		if(ef) break;
 	}
 	/* All valid combinations have been visited.  Have we found any ? */
-	if(!n_terms) {
+	if(!cm->rfs.n) {
 		ABT_FUNC("Zero probability!\n");
 	}
 #ifdef DEBUG
@@ -1020,29 +863,16 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 	/* If sampling then sample from output function */
 	if(sampling) {
 		if(n_peel) {
+			rfs_sort(&cm->rfs);
 			do {
-				z=safe_ranf()*prob;
-				p1=0.0;
-				for(j=k=0;k<ht_size;k++) {
-					elem=hashtable[k];
-					if(!elem) continue;
-					if(hash_mode) {
-						hd=elem->data;
-						if(hd->p>0.0) {
-							p1+=hd->p;
-							if(z<=p1) {
-								a=(lk_ulong)k;
-								break;
-							}
-						}
-					} else if(sample_comb(elem,z,&p1,&a)) break;
-				}
+				z=safe_ranf_r(loki->peel->workspace.rng)*prob;
+				k=rfs_sample(&cm->rfs,z,&a);
 #ifdef DEBUG
-				if(k==ht_size) {
+				if(!k) {
 					ABT_FUNC("Internal error\n");
 				}
 #endif
-			} while(k==ht_size);
+			} while(!k);
 			i=0;
 			while(a) {
 				k3=nbts[i];
@@ -1071,26 +901,16 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 	} else { /* Otherwise normalize and store */
 		i=element->out_index;
 		if(i>=0)	{
-			rf[i].n_terms=n_terms;
-			get_rf_memory(rf+i,n_terms,MRK_MBLOCK,loki);
+			rfs_sort(&cm->rfs);
+			rf[i].n_terms=cm->rfs.n;
+			get_rf_memory(rf+i,cm->rfs.n,MRK_MBLOCK,loki);
 			rf[i].flag=1; /* Mark this as a var-bit R-Function */
 			tl=rf[i].index;
 			tp=rf[i].p;
-			if(hash_mode) {
-				for(j=k=0;k<ht_size;k++) {
-					elem=hashtable[k];
-					if(!elem) continue;
-					hd=elem->data;
-					tp[j]=hd->p;
-					tl[j++]=(lk_ulong)k;
-				}
-			} else {
-				for(j=k=0;k<ht_size;k++) {
-					elem=hashtable[k];
-					if(elem) get_nodes(elem,tp,tl,&j);
-				}
+			for(j=0;j<cm->rfs.n;j++) {
+				tl[j]=cm->rfs.idx[j];
+				tp[j]=cm->rfs.p[j]/prob;
 			}
-			for(j=0;j<n_terms;j++) tp[j]/=prob;
 		}
 	}
 	return log(prob)+Konst;
@@ -1100,11 +920,12 @@ double loki_complex_peelop(const struct Complex_Element *element,const int locus
 double loki_trait_complex_peelop(const struct Complex_Element *element,const int locus,const int s_flag,struct R_Func *rf,trait_pen_func *trait_pen,double **freq,struct loki *loki)
 {
 	int i,j,k,k1,k2,k3,n_out,n_peel,n_inv,*inv,n_rf,n_ind,n_other,ef,ef1,sampling=0;
-	int *gt_store,*other_ptr,*other_list,*rf_ptr,n_idx,n_all,*flags;
+	int *gt_store,*other_ptr,*other_list,*rf_ptr,n_idx,n_all,*flags,n_bits1,n_terms;
 	int *off_index[2],*fnd_list,n_fnd=0,all,*pen_list,n_pen,*temp_p[13],n_trans,*trans_idx;
 	double max_terms,*tp,prob=0.0,z,p1,Konst=0.0,*p_rf;
 	struct Id_Record *id_array;
 	struct Locus *loc;
+	struct complex_mem *cm=loki->peel->workspace.cm;
 	
 	id_array=loki->pedigree->id_array;
 	loc=&loki->models->tlocus[-1-locus];
@@ -1142,17 +963,17 @@ double loki_trait_complex_peelop(const struct Complex_Element *element,const int
 	if(sampling) max_terms=log((double)n_all)*(double)n_peel;
 	else max_terms=log((double)n_all)*(double)n_out;
 	i=(int)(.5+exp(max_terms));
-	if(!complex_out_p) {
-		out_p_size=i+n_rf;
-		if(!(complex_out_p=malloc(sizeof(double)*out_p_size))) ABT_FUNC(MMsg);
+	if(!cm->out_p) {
+		cm->out_p_size=i+n_rf;
+		if(!(cm->out_p=malloc(sizeof(double)*cm->out_p_size))) ABT_FUNC(MMsg);
 	}
-	if(i+n_rf>out_p_size) {
-		out_p_size=i+n_rf;
-		if(!(complex_out_p=realloc(complex_out_p,sizeof(double)*out_p_size))) ABT_FUNC(MMsg);
+	if(i+n_rf>cm->out_p_size) {
+		cm->out_p_size=i+n_rf;
+		if(!(cm->out_p=realloc(cm->out_p,sizeof(double)*cm->out_p_size))) ABT_FUNC(MMsg);
 	}
-	p_rf=complex_out_p+i;
-	for(j=0;j<i;j++) complex_out_p[j]=0.0;
-	setup_complex_peel(element,sampling,temp_p,&n_other,&k,&n_trans,id_array);
+	p_rf=cm->out_p+i;
+	for(j=0;j<i;j++) cm->out_p[j]=0.0;
+	setup_complex_peel(cm,element,sampling,temp_p,&n_other,&k,&n_trans,id_array);
 	gt_store=temp_p[0];
 	other_list=temp_p[1];
 	other_ptr=temp_p[2];
@@ -1199,32 +1020,32 @@ double loki_trait_complex_peelop(const struct Complex_Element *element,const int
 		if(id_array[k1].res[0]) pen_list[n_pen++]=k1;
 	}
 	if(n_pen) {
-		if(!complex_pen) {
-			if(!(complex_pen=malloc(sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
-			max_pen1=n_pen*n_idx;
-			if(!(complex_pen[0]=malloc(sizeof(double)*max_pen1))) ABT_FUNC(MMsg);
-			max_pen=n_pen;
+		if(!cm->pen) {
+			if(!(cm->pen=malloc(sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
+			cm->max_pen1=n_pen*n_idx;
+			if(!(cm->pen[0]=malloc(sizeof(double)*cm->max_pen1))) ABT_FUNC(MMsg);
+			cm->max_pen=n_pen;
 		} else {
-			if(n_pen>max_pen)	{
-				max_pen=n_pen;
-				if(!(complex_pen=realloc(complex_pen,sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
+			if(n_pen>cm->max_pen)	{
+				cm->max_pen=n_pen;
+				if(!(cm->pen=realloc(cm->pen,sizeof(void *)*n_pen))) ABT_FUNC(MMsg);
 			}
-			if(n_pen*n_idx>max_pen1) {
-				max_pen1=n_pen*n_idx;
-				if(!(complex_pen[0]=realloc(complex_pen[0],sizeof(double)*max_pen1))) ABT_FUNC(MMsg);
+			if(n_pen*n_idx>cm->max_pen1) {
+				cm->max_pen1=n_pen*n_idx;
+				if(!(cm->pen[0]=realloc(cm->pen[0],sizeof(double)*cm->max_pen1))) ABT_FUNC(MMsg);
 			}
 		}
-		for(k1=0;k1<n_pen*n_idx;k1++) complex_pen[0][k1]=1.0;
-		for(k1=1;k1<n_pen;k1++) complex_pen[k1]=complex_pen[k1-1]+n_idx;
+		for(k1=0;k1<n_pen*n_idx;k1++) cm->pen[0][k1]=1.0;
+		for(k1=1;k1<n_pen;k1++) cm->pen[k1]=cm->pen[k1-1]+n_idx;
 		for(k=0;k<n_pen;k++) {
-			trait_pen(complex_pen[k],pen_list[k],loc,loki);
+			trait_pen(cm->pen[k],pen_list[k],loc,loki);
 			z=0.0;
-			for(k1=0;k1<n_idx;k1++) z+=complex_pen[k][k1];
+			for(k1=0;k1<n_idx;k1++) z+=cm->pen[k][k1];
 			if(z<=0.0) {
 				if(!(s_flag&1)) return -DBL_MAX;
 				ABT_FUNC("Zero probability!\n");
 			}
-			for(k1=0;k1<n_idx;k1++) complex_pen[k][k1]/=z;
+			for(k1=0;k1<n_idx;k1++) cm->pen[k][k1]/=z;
 			Konst+=log(z);
 		}
 	}
@@ -1338,14 +1159,14 @@ double loki_trait_complex_peelop(const struct Complex_Element *element,const int
 							for(k=0;k<n_pen;k++)	{
 								k1=pen_list[k];
 								k2=((id_array[k1].allele[X_PAT]-1)<<n_bits1)|(id_array[k1].allele[X_MAT]-1);
-								p1*=complex_pen[k][k2];
+								p1*=cm->pen[k][k2];
 							}
 						}
 						prob+=p1;
 						k1=0;
 						if(sampling) for(k=n_peel-1;k>=0;k--) k1=k1*n_all+gt_store[k]-1;
 						else for(k=n_inv-1;k>=n_peel;k--) k1=k1*n_all+gt_store[k]-1;
-						complex_out_p[k1]+=p1;
+						cm->out_p[k1]+=p1;
 						k1=0;
 						for(k=n_inv-1;k>=0;k--) k1=k1*n_all+gt_store[k]-1;
 						ef=1;
@@ -1398,11 +1219,11 @@ double loki_trait_complex_peelop(const struct Complex_Element *element,const int
 	/* If sampling then sample from output function */
 	if(sampling) {
 		do {
-			z=ranf()*prob;
+			z=ranf_r(loki->peel->workspace.rng)*prob;
 			p1=0.0;
 			for(k=0;k<n_terms;k++) {
-				if(complex_out_p[k]>0.0) {
-					p1+=complex_out_p[k];
+				if(cm->out_p[k]>0.0) {
+					p1+=cm->out_p[k];
 					if(z<=p1) break;
 				}
 			}
@@ -1425,7 +1246,7 @@ double loki_trait_complex_peelop(const struct Complex_Element *element,const int
 		i=element->out_index;
 		if(i>=0)	{
 			get_rf_memory(rf+i,n_terms,TRT_MBLOCK,loki);
-			for(j=0;j<n_terms;j++) rf[i].p[j]=complex_out_p[j]/prob;
+			for(j=0;j<n_terms;j++) rf[i].p[j]=cm->out_p[j]/prob;
 		}
 	}
 	return log(prob)+Konst;
@@ -53,14 +53,8 @@ int read_dump(int *lp,int *lp1,int *n_ibd,long *old_pos,int *flag,int analysis,s
 	signal(SIGCHLD,SIG_IGN);
 	id_array=loki->pedigree->id_array;
 	k=k1=k2=0;
-	if(loki->names[LK_FILTER]) {
-		errno=0;
-		i=child_open(READ,loki->names[LK_DUMPFILE],loki->names[LK_FILTER]);
-		fdump=fdopen(i,"r");
-		if(errno && errno!=ESPIPE) i=__LINE__;
-		else i=0;
-		errno=0;
-	} else fdump=fopen(loki->names[LK_DUMPFILE],"r");
+	if(loki->names[LK_FILTER]) fdump=filter_open(READ,loki->names[LK_DUMPFILE],loki->names[LK_FILTER]);
+	else fdump=fopen(loki->names[LK_DUMPFILE],"r");
 	if(!fdump || i) (void)fprintf(stderr,"[%s:%d] %s(): File Error.  Couldn't open '%s' for input\n",__FILE__,__LINE__,__func__,loki->names[LK_DUMPFILE]);
 	else {
 		s=fget_string(fdump,s,&tbuf);
@@ -523,14 +517,8 @@ void write_dump(int lp,int lp1,int n_ibd,long old_pos,int flag,int analysis,stru
 		j=loki->sys.syst_var[SYST_BACKUPS].flag?loki->sys.syst_var[SYST_BACKUPS].data.value:1;
 		if(j) i=mkbackup(loki->names[LK_DUMPFILE],j);
 		if(!i) {
-			if(loki->names[LK_FILTER]) {
-				errno=0;
-				i=child_open(WRITE,loki->names[LK_DUMPFILE],loki->names[LK_FILTER]);
-				fdump=fdopen(i,"w");
-				if(errno && errno!=ESPIPE) i=1;
-				else i=0;
-				errno=0;
-			} else fdump=fopen(loki->names[LK_DUMPFILE],"w");
+			if(loki->names[LK_FILTER]) fdump=filter_open(WRITE,loki->names[LK_DUMPFILE],loki->names[LK_FILTER]);
+			else fdump=fopen(loki->names[LK_DUMPFILE],"w");
 			if(!fdump || i) (void)fprintf(stderr,"[%s:%d] %s(): File Error.  Couldn't open '%s' for output\n",__FILE__,__LINE__,__func__,loki->names[LK_DUMPFILE]);
 			else {
 				if(!i && fprintf(fdump,"Loki.dump:%x,%x",lp,lp1)<0) i=1;
@@ -30,6 +30,7 @@
 #include <sys/stat.h>
 #include <errno.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "ranlib.h"
 #include "utils.h"
@@ -42,11 +43,19 @@
 #include "loki_ibd.h"
 #include "lk_malloc.h"
 #include "seg_pen.h"
+#include "locus_index.h"
+#include "seg_kernels.h"
 
 static double *pos_list[2];
 static int *loci,*seg[2],*n_longs,*n_pairs,*inbr,**inb_sparse,**inb_sparse1,n_cmp,***ibd[2];
 static struct Locus **locilist;
 static unsigned long *founders;
+/* Meioses in a batch for sample_segs() */
+#define SEG_LANES 8
+/* With one thread, linkage groups with fewer loci than this are sampled
+ * one meiosis at a time, which is faster there than the batches */
+#define SEG_BATCH_LOCI 500
+
 static char *suff[]={".gz",".bz2",".zip",".Z"};
 
 void get_founder_params(unsigned long **fnd,int **nl,int **np,int **in,const struct loki *loki)
@@ -81,92 +90,271 @@ static void free_IBD(void)
 	}
 }
 
+/* The loci of a linkage group in map order, with the recombination
+ * fractions between them (female, male) */
+struct seg_link {
+	struct Locus **loci;
+	double *recom[2];
+	int n;
+};
+
+/* A share of the meioses, sampled with its own workspace and random
+ * number stream */
+struct seg_thread {
+	struct seg_work w;
+	struct rng_ctx *rng;
+	int lo,hi;
+	pthread_t thread;
+};
+
+static struct seg_link *seg_links;
+static struct seg_thread *seg_th;
+static int *meioses,*mei_start,n_seg_links,n_seg_th;
+
+static void free_seg_sampler(void)
+{
+	int i;
+
+	for(i=0;i<n_seg_th;i++) sk_free(&seg_th[i].w);
+	if(seg_th) free(seg_th);
+	if(seg_links) {
+		free(seg_links[0].loci);
+		free(seg_links[0].recom[0]);
+		free(seg_links);
+	}
+	if(meioses) free(meioses);
+	seg_th=0;
+	seg_links=0;
+	meioses=0;
+	n_seg_th=0;
+}
+
+/* List the meioses (kid, parent) of the components with more than one
+ * member in the order they have always been sampled in, and set up the
+ * space for the ordered loci of each linkage group */
+static void setup_seg_sampler(const struct loki *loki)
+{
+	int i,i1,j,k,comp,cs,n;
+	struct Id_Record *id_array;
+
+	id_array=loki->pedigree->id_array;
+	for(n=i=0;i<loki->pedigree->ped_size;i++) n+=id_array[i].nkids;
+	meioses=lk_malloc(sizeof(int)*(2*n+loki->pedigree->n_comp+1));
+	mei_start=meioses+2*n;
+	for(n=i1=comp=0;comp<loki->pedigree->n_comp;comp++) {
+		mei_start[comp]=n;
+		cs=loki->pedigree->comp_size[comp];
+		if(cs>1) for(i=i1;i<i1+cs;i++) {
+			for(j=0;j<id_array[i].nkids;j++) {
+				meioses[2*n]=id_array[i].kids[j]->idx;
+				meioses[2*n+1]=2-id_array[i].sex;
+				n++;
+			}
+		}
+		i1+=cs;
+	}
+	mei_start[comp]=n;
+	n_seg_links=loki->markers->n_links;
+	seg_links=lk_calloc((size_t)(n_seg_links+1),sizeof(struct seg_link));
+	k=loki->markers->n_markers+n_seg_links*loki->params.max_tloci;
+	seg_links[0].loci=lk_malloc(sizeof(void *)*(k+1));
+	seg_links[0].recom[0]=lk_malloc(sizeof(double)*2*(k+1));
+	for(i=0;i<n_seg_links;i++) {
+		k=loki->markers->linkage[i].n_markers+loki->params.max_tloci;
+		seg_links[i+1].loci=seg_links[i].loci+k;
+		seg_links[i].recom[1]=seg_links[i].recom[0]+k;
+		seg_links[i+1].recom[0]=seg_links[i].recom[1]+k;
+	}
+	if(atexit(free_seg_sampler)) message(WARN_MSG,"Unable to register exit function free_seg_sampler()\n");
+}
+
+/* Make sure there are workspaces for nt threads */
+static void alloc_seg_threads(const int nt,const struct loki *loki)
+{
+	int i,k;
+
+	if(nt<=n_seg_th) return;
+	seg_th=seg_th?lk_realloc(seg_th,sizeof(struct seg_thread)*nt):lk_malloc(sizeof(struct seg_thread)*nt);
+	for(k=i=0;i<loki->markers->n_links;i++)
+		if(loki->markers->linkage[i].n_markers>k) k=loki->markers->linkage[i].n_markers;
+	k+=loki->params.max_tloci;
+	for(i=n_seg_th;i<nt;i++) sk_alloc(&seg_th[i].w,k?k:1,SEG_LANES);
+	n_seg_th=nt;
+}
+
+/* Sample the segregation indicators for meioses lo..hi-1 along the loci
+ * of sl.  The lanes of each batch are filled with female meioses from the
+ * start and male meioses from the end, so that each group shares its
+ * recombination fractions, but the indicators are drawn meiosis by meiosis
+ * in list order */
+static void sample_meioses(const struct seg_link *sl,const int lo,const int hi,struct seg_work *w,struct rng_ctx *rng)
+{
+	int i,j,k,m,nb,n0,n1,*s,kid,par,lane[SEG_LANES];
+	const int n=sl->n;
+	
+	if(!n) return;
+	for(m=lo;m<hi;m+=nb) {
+		nb=hi-m<SEG_LANES?hi-m:SEG_LANES;
+		for(n0=j=0,n1=SEG_LANES;j<nb;j++) lane[j]=meioses[2*(m+j)+1]?--n1:n0++;
+		for(s=w->s,k=0;k<n;k++,s+=SEG_LANES) {
+			for(i=2*m,j=0;j<nb;j++,i+=2) s[lane[j]]=sl->loci[k]->seg[meioses[i+1]][meioses[i]];
+		}
+		if(n0) sk_forward(w,n,0,n0,sl->recom[0]);
+		if(n1<SEG_LANES) sk_forward(w,n,n1,SEG_LANES,sl->recom[1]);
+		for(i=2*m,j=0;j<nb;j++,i+=2) sk_backward(w,n,lane[j],sl->recom[meioses[i+1]],rng);
+		for(s=w->s,k=0;k<n;k++,s+=SEG_LANES) {
+			for(i=2*m,j=0;j<nb;j++,i+=2) {
+				kid=meioses[i];
+				par=meioses[i+1];
+				sl->loci[k]->seg[par][kid]=s[lane[j]];
+			}
+		}
+	}
+}
+
+/* As sample_meioses(), one meiosis at a time without the batches.  p[0]
+ * and p[1] need space for sl->n values */
+static void sample_meioses_seq(const struct seg_link *sl,const int lo,const int hi,double **p,struct rng_ctx *rng)
+{
+	int k,m,s,s1,kid,par;
+	const int n=sl->n;
+	double pp[2],z,z1,*r;
+	struct Locus **loc;
+	
+	if(!n) return;
+	loc=sl->loci;
+	for(m=lo;m<hi;m++) {
+		kid=meioses[2*m];
+		par=meioses[2*m+1];
+		r=sl->recom[par];
+		s=loc[0]->seg[par][kid];
+		if(s<0) {
+			p[0][0]=p[1][0]=.5;
+		} else {
+			p[s][0]=1.0;
+			p[s^1][0]=0.0;
+		}
+		for(k=1;k<n;k++) {
+			s=loc[k]->seg[par][kid];
+			if(s<0) {
+				pp[0]=.5*(p[0][k-1]*(1.0-r[k-1])+p[1][k-1]*r[k-1]);
+				pp[1]=.5*(p[1][k-1]*(1.0-r[k-1])+p[0][k-1]*r[k-1]);
+				z=pp[0]+pp[1];
+				p[0][k]=pp[0]/z;
+				p[1][k]=pp[1]/z;
+			} else {
+				p[s][k]=1.0;
+				p[s^1][k]=0.0;
+			}
+		}
+		if(s<0) {
+			s=(ranf_r(rng)<p[0][n-1])?0:1;
+			loc[n-1]->seg[par][kid]=s;
+		}
+		for(k=n-2;k>=0;k--) {
+			s1=loc[k]->seg[par][kid];
+			if(s1<0) {
+				pp[s]=p[s][k]*(1.0-r[k]);
+				pp[s^1]=p[s^1][k]*r[k];
+				z=pp[0]+pp[1];
+				z1=ranf_r(rng);
+				s1=(z*z1<pp[0])?0:1;
+				loc[k]->seg[par][kid]=s1;
+			}
+			s=s1;
+		}
+	}
+}
+
+static void *seg_worker(void *arg)
+{
+	int link;
+	struct seg_thread *th;
+
+	th=arg;
+	for(link=0;link<n_seg_links;link++) sample_meioses(seg_links+link,th->lo,th->hi,&th->w,th->rng);
+	return 0;
+}
+
+/* Sample the meioses of all components in nt shares, share i using random
+ * number stream i.  The shares only depend on nt, and if a thread can not
+ * be started its share is done afterwards by the calling thread with the
+ * same stream, so runs with the same number of threads are repeatable.
+ * Returns 1 if the streams could not be set up */
+static int sample_meioses_threaded(const int nt,const struct loki *loki)
+{
+	int i,n,*started;
+	struct seg_thread *th;
+
+	if(rng_init_streams(nt)) return 1;
+	alloc_seg_threads(nt,loki);
+	started=lk_calloc((size_t)nt,sizeof(int));
+	n=mei_start[loki->pedigree->n_comp];
+	for(i=0;i<nt;i++) {
+		th=seg_th+i;
+		th->rng=rng_stream(i);
+		th->lo=(int)((long)n*i/nt);
+		th->hi=(int)((long)n*(i+1)/nt);
+	}
+	for(i=1;i<nt;i++) if(!pthread_create(&seg_th[i].thread,0,seg_worker,seg_th+i)) started[i]=1;
+	(void)seg_worker(seg_th);
+	for(i=1;i<nt;i++) {
+		if(started[i]) (void)pthread_join(seg_th[i].thread,0);
+		else (void)seg_worker(seg_th+i);
+	}
+	free(started);
+	return 0;
+}
+
+/* Sample the segregation indicators of the linked loci by forward
+ * filtering / backward sampling along each linkage group for every
+ * meiosis.  Given the genotypes the meioses are independent; with more
+ * than one peeling thread (see set_peel_threads()) they are shared out
+ * between threads, otherwise they are done in the original order, drawing
+ * from the main random number stream */
 void sample_segs(const struct loki *loki) 
 {
-	int i,i1,j,k,comp,link,nloci,nkids,par_flag;
-	int s,s1,kid,cs;
-	double *p[2],pp[2],z,*recom[2],x,x1,*r,z1;
-	struct Id_Record *id_array,**kids;
+	int i,i1,k,comp,link,par_flag,cs,nt;
+	double pp[2];
+	struct Id_Record *id_array;
+	struct Locus *loc;
+	struct seg_link *sl;
 	
 	k=loki->markers->n_markers+loki->params.n_tloci;
 	id_array=loki->pedigree->id_array;
 	if(!k) return;
-	p[0]=lk_malloc(sizeof(double)*k*4);
-	p[1]=p[0]+k;
-	recom[0]=p[1]+k;
-	recom[1]=recom[0]+k;
+	if(!meioses) setup_seg_sampler(loki);
+	for(link=0;link<n_seg_links;link++) {
+		sl=seg_links+link;
+		get_sorted_loci(sl->loci,link,&sl->n,0);
+		for(k=1;k<sl->n;k++) {
+			locus_recom(sl->loci[k-1],sl->loci[k],pp);
+			sl->recom[0][k-1]=pp[0];
+			sl->recom[1][k-1]=pp[1];
+		}
+	}
+	nt=get_peel_threads();
+	i=mei_start[loki->pedigree->n_comp];
+	if(nt>i/SEG_LANES) nt=i/SEG_LANES;
+	if(nt>1 && sample_meioses_threaded(nt,loki)) nt=1;
+	if(nt<=1) alloc_seg_threads(1,loki);
 	for(i1=comp=0;comp<loki->pedigree->n_comp;comp++) {
 		cs=loki->pedigree->comp_size[comp];
 		if(cs>1) {
-			for(link=0;link<loki->markers->n_links;link++) {
-				get_locuslist(locilist,link,&nloci,0);
-				if(!nloci) continue;
-				if(nloci>1) gnu_qsort(locilist,(size_t)nloci,sizeof(void *),cmp_loci);
-				for(par_flag=0;par_flag<2;par_flag++) {
-					x=locilist[0]->pos[par_flag];
-					for(k=1;k<nloci;k++) {
-						x1=locilist[k]->pos[par_flag];
-						recom[par_flag][k-1]=.5*(1.0-exp(0.02*(x-x1)));
-						x=x1;
-					}
-				}
-				for(i=i1;i<i1+cs;i++) {
-					if(id_array[i].nkids) {
-						par_flag=2-id_array[i].sex;
-						r=recom[par_flag];
-						nkids=id_array[i].nkids;
-						kids=id_array[i].kids;
-						for(j=0;j<nkids;j++) {
-							kid=kids[j]->idx;
-							s=locilist[0]->seg[par_flag][kid];
-							if(s<0) {
-								p[0][0]=p[1][0]=.5;
-							} else {
-								p[s][0]=1.0;
-								p[s^1][0]=0.0;
-							}
-							for(k=1;k<nloci;k++) {
-								s=locilist[k]->seg[par_flag][kid];
-								if(s<0) {
-									pp[0]=.5*(p[0][k-1]*(1.0-r[k-1])+p[1][k-1]*r[k-1]);
-									pp[1]=.5*(p[1][k-1]*(1.0-r[k-1])+p[0][k-1]*r[k-1]);
-									z=pp[0]+pp[1];
-									p[0][k]=pp[0]/z;
-									p[1][k]=pp[1]/z;
-								} else {
-									p[s][k]=1.0;
-									p[s^1][k]=0.0;
-								}
-							}
-							if(s<0) {
-								s=(ranf()<p[0][nloci-1])?0:1;
-								locilist[nloci-1]->seg[par_flag][kid]=s;
-							}
-							for(k=nloci-2;k>=0;k--) {
-								s1=locilist[k]->seg[par_flag][kid];
-								if(s1<0) {
-									pp[s]=p[s][k]*(1.0-r[k]);
-									pp[s^1]=p[s^1][k]*r[k];
-									z=pp[0]+pp[1];
-									z1=ranf();
-									s1=(z*z1<pp[0])?0:1;
-									locilist[k]->seg[par_flag][kid]=s1;
-								}
-								s=s1;
-							}
-						}
-					}
-				}
+			if(nt<=1) for(link=0;link<n_seg_links;link++) {
+				sl=seg_links+link;
+				if(sl->n<SEG_BATCH_LOCI) sample_meioses_seq(sl,mei_start[comp],mei_start[comp+1],seg_th[0].w.p,&lk_rng);
+				else sample_meioses(sl,mei_start[comp],mei_start[comp+1],&seg_th[0].w,&lk_rng);
 			}
 			for(k=0;k<loki->params.n_tloci;k++) {
 				if(loki->models->tlocus[k].flag&TL_UNLINKED) {
-					locilist[0]=loki->models->tlocus+k;
+					loc=loki->models->tlocus+k;
 					for(i=i1;i<i1+cs;i++) {
 						if(id_array[i].sire) {
 							for(par_flag=0;par_flag<2;par_flag++) {
-								if(locilist[0]->seg[par_flag][i]<0) {
-									s=ranf()<.5?0:1;
-									locilist[0]->seg[par_flag][i]=ranf()<.5?0:1;
+								if(loc->seg[par_flag][i]<0) {
+									(void)ranf();
+									loc->seg[par_flag][i]=ranf()<.5?0:1;
 								} 
 							}
 						}
@@ -176,7 +364,6 @@ void sample_segs(const struct loki *loki)
 		}
 		i1+=cs;
 	}
-	free(p[0]);
 	return;
 }
 
@@ -451,8 +638,7 @@ void Handle_IBD(const struct loki *loki)
 	genes[1]=genes[0]+loki->pedigree->ped_size;
 	for(i=0;i<loki->markers->n_links;i++) {
 		if(loki->markers->linkage[i].ibd_est_type)	{
-			get_locuslist(locilist,i,&nl,1);
-			gnu_qsort(locilist,(size_t)nl,(size_t)sizeof(void *),cmp_loci);
+			get_sorted_loci(locilist,i,&nl,1);
 			np=get_pos_list(i,nl,loki);
 			for(j=0;j<np;j++,ix++) {
 				for(k=0;k<2;k++) ibd1[k]=ibd[k][ix];
@@ -540,8 +726,7 @@ double score_ibd(int locus,int *k5,int comp,int affn,int *aff,double *pairs,cons
 	ss=loc->seg;
 	if(!loki->params.si_mode) {
 		i=loc->link_group;
-		get_locuslist(locilist,i,&nl,1);
-		gnu_qsort(locilist,(size_t)nl,(size_t)sizeof(void *),cmp_loci);
+		get_sorted_loci(locilist,i,&nl,1);
 		for(k=0;k<nl;k++) if(locilist[k]==loc) break;
 		i1=loki->pedigree->comp_start[comp];
 		Set_Trans(loc->pos,locilist,k,nl,comp,loki);
@@ -604,12 +789,8 @@ static FILE *open_ibd_file(char *name,const struct loki *loki)
 			strncpy(fname+i,suff[cpress],i1+1);
 			k=1;
 		} else fname=name;
-		errno=0;
-		i=child_open1(WRITE,fname,loki->compress->comp_path[cpress][0],cpress==COMPRESS_ZIP?"-":0);
-		fptr=fdopen(i,"w");
-		if(errno && errno!=ESPIPE) i=1;
-		else i=0;
-		errno=0;
+		fptr=compress_open(WRITE,fname,cpress,loki->compress);
+		i=0;
 	} else {
 		fname=name;
 		fptr=fopen(fname,"w");
@@ -762,8 +943,7 @@ void Output_Sample_IBD(int lp,int n_ibd,const struct loki *loki)
 	for(k=link=0;link<loki->markers->n_links;link++) {
 		if(loki->markers->linkage[link].ibd_est_type) {
 			(void)fprintf(fptr,"\n**Linkage group %s:\n",loki->markers->linkage[link].name);
-			get_locuslist(locilist,link,&nl,1);
-			gnu_qsort(locilist,(size_t)nl,(size_t)sizeof(void *),cmp_loci);
+			get_sorted_loci(locilist,link,&nl,1);
 			np=get_pos_list(link,nl,loki);
 			for(l=0;l<np;l++) {
 				if(loki->markers->sex_map) (void)fprintf(fptr,"\n**Position = %g,%g\n",pos_list[X_MAT][l],pos_list[X_PAT][l]);
@@ -824,8 +1004,7 @@ void Output_Merlin_IBD(int lp,const struct loki *loki)
 		n_long=n_longs[comp];
 		for(link=k=0;link<loki->markers->n_links;link++) {
 			if(loki->markers->linkage[link].ibd_est_type) {
-				get_locuslist(locilist,link,&nl,1);
-				gnu_qsort(locilist,(size_t)nl,(size_t)sizeof(void *),cmp_loci);
+				get_sorted_loci(locilist,link,&nl,1);
 				np=get_pos_list(link,nl,loki);
 				for(l=0;l<np;l++) {
 					x=pos_list[X_MAT][l];
@@ -871,8 +1050,7 @@ void Output_Merlin_IBD(int lp,const struct loki *loki)
 	for(comp=0;comp<loki->pedigree->n_comp;comp++) if(loki->pedigree->singleton_flag[comp]) {
 		for(link=k=0;link<loki->markers->n_links;link++) {
 			if(loki->markers->linkage[link].ibd_est_type) {
-				get_locuslist(locilist,link,&nl,1);
-				gnu_qsort(locilist,(size_t)nl,(size_t)sizeof(void *),cmp_loci);
+				get_sorted_loci(locilist,link,&nl,1);
 				np=get_pos_list(link,nl,loki);
 				for(l=0;l<np;l++) {
 					x=pos_list[X_MAT][l];
@@ -940,8 +1118,7 @@ void Output_Solar_IBD(int lp,int *trans,const struct loki *loki)
 			sz=dlen+8+clen+16;
 			if(ibd_md&COMPRESS_IBD) sz+=slen;
 			fname=lk_malloc(sz);
-			get_locuslist(locilist,link,&nl,1);
-			gnu_qsort(locilist,(size_t)nl,(size_t)sizeof(void *),cmp_loci);
+			get_sorted_loci(locilist,link,&nl,1);
 			np=get_pos_list(link,nl,loki);
 			for(l=0;l<np;l++) {
 				x=pos_list[X_MAT][l];
@@ -953,12 +1130,8 @@ void Output_Solar_IBD(int lp,int *trans,const struct loki *loki)
 				if(cpress!=COMPRESS_NONE) {
 					i=strlen(fname);
 					strncpy(fname+i,suff[cpress],sz-i);
-					errno=0;
-					i=child_open1(WRITE,fname,loki->compress->comp_path[cpress][0],cpress==COMPRESS_ZIP?"-":0);
-					fptr=fdopen(i,"w");
-					if(errno && errno!=ESPIPE) i=1;
-					else i=0;
-					errno=0;
+					fptr=compress_open(WRITE,fname,cpress,loki->compress);
+					i=0;
 				} else fptr=fopen(fname,"w");
 				printf("Writing IBD matrices to file %s\n",fname);
 				if(!fptr || i) {
@@ -25,6 +25,7 @@
 #include <stdio.h>
 
 #include "lk_malloc.h"
+#include "lk_sort.h"
 #include "utils.h"
 #include "loki.h"
 #include "loki_peel.h"
@@ -74,18 +75,16 @@ static void print_res_head(FILE *fptr,int self_flag)
   fputc('\n',fptr);
 }
 
-static int cmp_res(const void *s1,const void *s2)
+/* Sort results by standardized IBS sharing */
+static void sort_results(struct result *res,const int n)
 {
-  const struct result *res1,*res2;
-  double x1,x2;
-	
-  res1=s1;
-  res2=s2;
-  x1=(res1->ibs_obs-res1->ibs_exp)/res1->ibs_sd;
-  x2=(res2->ibs_obs-res2->ibs_exp)/res2->ibs_sd;
-  if(x1<x2) return -1;
-  if(x1>x2) return 1;
-  return 0;
+  double *x;
+  int i;
+
+  x=lk_malloc(sizeof(double)*n);
+  for(i=0;i<n;i++) x[i]=(res[i].ibs_obs-res[i].ibs_exp)/res[i].ibs_sd;
+  lk_sort_by_key(res,(size_t)n,sizeof(struct result),x,0);
+  free(x);
 }
 
 struct sample {
@@ -485,22 +484,22 @@ void ibs_check(int no_unrel,struct loki *loki)
   if(n_self) {
     fputs("Sorting results: self\r",stdout);
     fflush(stdout);
-    qsort(results_self,n_self,sizeof(struct result),cmp_res);
+    sort_results(results_self,n_self);
   }
   if(n_rel) {
     fputs("Sorting results: related pairs\r",stdout);
     fflush(stdout);
-    qsort(results,n_rel,sizeof(struct result),cmp_res);
+    sort_results(results,n_rel);
   }
   if(k) {
     fputs("Sorting results: unrelated pairs (within families)\r",stdout);
     fflush(stdout);
-    qsort(results_same_fam,k,sizeof(struct result),cmp_res); 
+    sort_results(results_same_fam,k);
   }
   if(n_diff_fam) {
     fputs("Sorting results: unrelated pairs (between families)\r",stdout);
     fflush(stdout);
-    qsort(results_diff_fam,n_diff_fam,sizeof(struct result),cmp_res);
+    sort_results(results_diff_fam,n_diff_fam);
   }
   fputc('\n',stdout);
   if(n_self) {
@@ -530,7 +529,6 @@ void ibs_check(int no_unrel,struct loki *loki)
   if(n_diff_fam) {
     fputs("Saving results: unrelated pairs (between families)\r",stdout);
     fflush(stdout);
-    qsort(results_diff_fam,n_diff_fam,sizeof(struct result),cmp_res);
     if(!(fptr=fopen("between_fam.dat","w"))) exit(EXIT_FAILURE);
     print_res_head(fptr,0);
     for(i=0;i<n_diff_fam;i++) print_res(fptr,results_diff_fam+i,loki,0);
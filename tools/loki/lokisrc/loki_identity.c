@@ -25,6 +25,7 @@
 #include "loki.h"
 #include "loki_peel.h"
 #include "loki_ibd.h"
+#include "kinship.h"
 
 #define SWAP (a,b) {swap_temp=(a);(a)=(b);(b)=swap_temp;}
 
@@ -41,23 +42,12 @@ static double coeffmat[9][9]={
 
 static const struct Id_Record *id_array;
 
+/* Kinship coefficient, from the table kept by kinship() */
 static double phi2(int a, int b)
 {
-	double x;
-	int swap_temp;
-	
-	if(!(a&&b)) x=0.0;
-	else if (a==b) x=0.5+0.5*phi2(id_array[a-1].sire,id_array[a-1].dam);
-	else {
-		if(a<b) {
-			swap_temp=a;
-			a=b;
-			b=swap_temp;
-		}
-		x=.5*(phi2(id_array[a-1].sire,b)+phi2(id_array[a-1].dam,b));
-	}
-	return x;
+	return kinship(a,b,id_array);
 }
+
 static int intcomp(const void *i,const void *j)
 {
 	int x,y;
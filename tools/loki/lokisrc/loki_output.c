@@ -30,10 +30,12 @@
 #include "version.h"
 #include "loki_ibd.h"
 #include "loki_utils.h"
+#include "arena.h"
 #include "calc_var_locus.h"
 #include "sample_rand.h"
 #include "mat_utils.h"
 #include "loki_output.h"
+#include "locus_index.h"
 
 static double *tot_gen_var;
 
@@ -425,7 +427,7 @@ void OutputHeader(FILE *fptr,struct loki *loki)
 	if(!(loki->params.analysis&NULL_ANALYSIS)) {
 		if(loki->markers->n_links) {
 			(void)fprintf(fptr,"Input map function: %s\nOutput map function: Haldane\n",loki->params.map_function?"Kosambi":"Haldane");
-			if((loki->params.n_tloci+loki->markers->n_markers) && !(locilist=malloc(sizeof(void *)*(loki->params.n_tloci+loki->markers->n_markers)))) ABT_FUNC(MMsg);
+			if(loki->params.n_tloci+loki->markers->n_markers) locilist=arena_alloc(lk_arena(ARENA_OUTPUT),sizeof(void *)*(loki->params.n_tloci+loki->markers->n_markers));
 			(void)fputs("Linkage groups:\n",fptr);
 			for(i=0;i<loki->markers->n_links;i++) {
 				s=loki->markers->linkage[i].name;
@@ -434,8 +436,7 @@ void OutputHeader(FILE *fptr,struct loki *loki)
 				for(k3=0;k3<=loki->markers->sex_map;k3++) (void)fprintf(fptr," (%gcM to %gcM) ",loki->markers->linkage[i].r1[1-k3],loki->markers->linkage[i].r2[1-k3]);
 				(void)fputc('\n',fptr);
 				if(locilist) {
-					get_locuslist(locilist,i,&k2,1);
-					gnu_qsort(locilist,(size_t)k2,sizeof(void *),cmp_loci);
+					get_sorted_loci(locilist,i,&k2,1);
 					for(k1=0;k1<k2;k1++) {
 						(void)fprintf(fptr,"    %s -",loki->markers->marker[locilist[k1]->index].name);
 						for(k3=0;k3<=loki->markers->sex_map;k3++) (void)fprintf(fptr," %g",locilist[k1]->pos[1-k3]);
@@ -462,7 +463,7 @@ void OutputHeader(FILE *fptr,struct loki *loki)
 					break;
 				}
 			}
-			if(locilist) free(locilist);
+			lk_arena_reset(ARENA_OUTPUT);
 			(void)fputs("Total Map Length:",fptr);
 			for(k3=0;k3<=loki->markers->sex_map;k3++) (void)fprintf(fptr," %gcM",loki->markers->total_maplength[1-k3]);
 			(void)fputc('\n',fptr);		}
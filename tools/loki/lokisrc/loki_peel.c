@@ -11,6 +11,12 @@
 *                                                                          *
 * Perform peeling calculations                                             *
 *                                                                          *
+* The pedigree components are independent, so they can be peeled (and      *
+* sampled) by several threads at once, each with its own workspace and     *
+* random number stream.  The number of threads comes from                  *
+* set_peel_threads() or LOKI_PEEL_THREADS in the environment; the default  *
+* is one, which peels the components in order on the calling thread.       *
+*                                                                          *
 * Copyright (C) Simon C. Heath 1997, 2000, 2002                            *
 * This is free software.  You can distribute it and/or modify it           *
 * under the terms of the Modified BSD license, see the file COPYING        *
@@ -19,6 +25,7 @@
 
 #include <config.h>
 #include <stdlib.h>
+#include <string.h>
 #ifdef USE_DMALLOC
 #include <dmalloc.h>
 #endif
@@ -26,6 +33,7 @@
 #include <stdio.h>
 #include <float.h>
 #include <assert.h>
+#include <pthread.h>
 
 #ifndef DBL_MAX
 #define DBL_MAX MAXDOUBLE
@@ -39,77 +47,80 @@
 #include "seg_pen.h"
 #include "get_par_probs.h"
 #include "lk_malloc.h"
+#include "lk_sort.h"
 #include "loki_simple_peel.h"
 #include "loki_trait_simple_peel.h"
+#include "locus_index.h"
+
+/* Per-call details of peel_locus(), shared by the peeling threads */
+struct peel_job {
+	struct Locus *loc;
+	struct Marker *mark;
+	struct Peelseq_Head *pp_head;
+	trait_pen_func *trait_pen;
+	lk_ulong **a_set;
+	double *recom1,*recom2,*eff;
+	int ***seglist;
+	int idx,n_loci,locus,nn_all,linktype,sample_flag,sample_freq,unlinked;
+};
+
+/* A peeling thread has its own copy of the loki structure, pointing to
+ * its own copy of the peeling structure, so that the peeling operations
+ * find its workspace and memory blocks */
+struct peel_thread {
+	struct loki lk;
+	struct lk_peel peel;
+	int *comps,n_comps;
+	pthread_t thread;
+};
 
-static double **freq;
-static struct Peelseq_Head **peel_list;
-static int *peel_alls;
+struct peel_pool {
+	struct peel_thread *th;
+	const struct peel_job *job;
+	double *comp_like;
+	int *comp_start,n_threads,n_busy,gen,quit;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static struct peel_pool *pool;
+static int peel_threads,max_alls;
 static struct loki *lk;
 
-static void peel_dealloc(void)
+void set_peel_threads(int n)
 {
-	int k;
-	struct peel_mem *work;
-	struct peel_mem_block *p,*p1;
-	
-#ifdef TRACE_PEEL
-	if(CHK_PEEL(TRACE_LEVEL_1)) (void)printf("In %s()\n",__func__);
-#endif
-	work=&lk->peel->workspace;
-	if(freq) {
-		if(freq[0]) free(freq[0]);
-		free(freq);
-	}
-	if(work) {
-		if(work->r_funcs) free(work->r_funcs);
-		if(work->s0) free(work->s0);
-		if(work->s1) free(work->s1);
-		if(work->s2) free(work->s2);
-		if(work->s3) free(work->s3);
-		if(work->s4) free(work->s4);
-		if(work->s5) free(work->s5);
-		if(work->s6) free(work->s6);
-		if(work->s7) free(work->s7);
-		if(work->s8) free(work->s8);
-	}
-	for(k=0;k<2;k++) {
-		p1=lk->peel->first_mem_block[k];
-		while(p1) {
-			p=p1->next;
-			if(p1->index) free(p1->index);
-			if(p1->val) free(p1->val);
-			free(p1);
-			p1=p;
-		}
-	}
-	seg_dealloc(lk);
-	free_complex_mem();
+	peel_threads=n>0?n:1;
 }
 
-void peel_alloc(struct loki *loki)
+int get_peel_threads(void)
 {
-	int i,j,i1,k,k1,k2;
-	struct peel_mem *work;
-	
-#ifdef TRACE_PEEL
-	if(CHK_PEEL(TRACE_LEVEL_1)) (void)printf("In %s()\n",__func__);
-#endif
-	lk=loki;
-	work=&loki->peel->workspace;
-	k=loki->models->tlocus?2:0;
-	for(i=0;i<loki->markers->n_markers;i++) {
-		j=loki->markers->marker[i].locus.n_alleles;
-		if(j>k) k=j;
+	char *p;
+
+	if(!peel_threads) {
+		peel_threads=1;
+		if((p=getenv("LOKI_PEEL_THREADS"))) set_peel_threads(atoi(p));
 	}
-	if(!k) return;
-	freq=lk_malloc(sizeof(void *)*2*loki->pedigree->n_genetic_groups);
-	freq[0]=lk_malloc(sizeof(double)*k*2*loki->pedigree->n_genetic_groups);
-	for(i=1;i<loki->pedigree->n_genetic_groups*2;i++) freq[i]=freq[i-1]+k;
+	return peel_threads;
+}
+
+/* Allocate a peeling workspace for up to k alleles */
+static void alloc_workspace(struct peel_mem *work,const int k,const struct loki *loki)
+{
+	int i,j,k1,n_grp;
+
+	n_grp=loki->pedigree->n_genetic_groups;
+	work->freq=lk_malloc(sizeof(void *)*2*n_grp);
+	work->freq[0]=lk_malloc(sizeof(double)*k*2*n_grp);
+	for(i=1;i<n_grp*2;i++) work->freq[i]=work->freq[i-1]+k;
 	k1=k*k;
 	work->s0=lk_malloc(sizeof(struct fset)*k1*k1);
-	work->s1=lk_malloc(sizeof(int)*(k+k1*2));
-	peel_alls=work->s1+2*k1;
+	work->fs.p=(double *)work->s0;
+	work->fs.pat_gene[X_MAT]=(int *)(work->fs.p+k1*k1);
+	work->fs.pat_gene[X_PAT]=work->fs.pat_gene[X_MAT]+k1*k1;
+	work->fs.mat_gene[X_MAT]=work->fs.pat_gene[X_PAT]+k1*k1;
+	work->fs.mat_gene[X_PAT]=work->fs.mat_gene[X_MAT]+k1*k1;
+	work->s1=lk_malloc(sizeof(int)*(k+k1*5));
+	work->alls=work->s1+5*k1;
 	j=num_bits(k);
 	j=1<<(j+j);
 	/* Note the 16 below should change if more than diallelic trait loci are fitted */
@@ -125,12 +136,108 @@ void peel_alloc(struct loki *loki)
 		work->s3=lk_malloc(sizeof(lk_ulong)*loki->peel->max_peel_off*(k+2));
 		work->s4=lk_malloc(sizeof(int)*loki->peel->max_peel_off);
 	}
-	k2=loki->peel->max_peel_ops;
-	work->s5=lk_malloc(sizeof(void *)*k2);
-	i1=loki->markers->n_markers+loki->params.max_tloci;
-	work->s6=lk_malloc(sizeof(void *)*i1);
-	work->s7=lk_malloc(sizeof(double)*2*i1);
-	peel_list=(struct Peelseq_Head **)work->s5;
+	work->s5=lk_malloc(sizeof(void *)*loki->peel->max_peel_ops);
+	i=loki->markers->n_markers+loki->params.max_tloci;
+	work->s6=lk_malloc(sizeof(void *)*i);
+	work->s7=lk_malloc(sizeof(double)*2*i);
+	work->cm=alloc_complex_mem();
+}
+
+static void free_workspace(struct peel_mem *work)
+{
+	if(work->freq) {
+		if(work->freq[0]) free(work->freq[0]);
+		free(work->freq);
+	}
+	if(work->r_funcs) free(work->r_funcs);
+	if(work->s0) free(work->s0);
+	if(work->s1) free(work->s1);
+	if(work->s2) free(work->s2);
+	if(work->s3) free(work->s3);
+	if(work->s4) free(work->s4);
+	if(work->s5) free(work->s5);
+	if(work->s6) free(work->s6);
+	if(work->s7) free(work->s7);
+	if(work->s8) free(work->s8);
+	free_complex_mem(work->cm);
+}
+
+static void free_mem_blocks(struct peel_mem_block *p1)
+{
+	struct peel_mem_block *p;
+
+	while(p1) {
+		p=p1->next;
+		if(p1->index) free(p1->index);
+		if(p1->val) free(p1->val);
+		free(p1);
+		p1=p;
+	}
+}
+
+static void stop_pool(void)
+{
+	int i;
+	struct peel_thread *th;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->quit=1;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	for(i=1;i<pool->n_threads;i++) {
+		th=pool->th+i;
+		(void)pthread_join(th->thread,0);
+		free_workspace(&th->peel.workspace);
+		free_mem_blocks(th->peel.first_mem_block[MRK_MBLOCK]);
+		free_mem_blocks(th->peel.first_mem_block[TRT_MBLOCK]);
+	}
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+	free(pool->th[0].comps);
+	free(pool->th);
+	free(pool->comp_like);
+	free(pool);
+	pool=0;
+}
+
+static void peel_dealloc(void)
+{
+	int k;
+
+#ifdef TRACE_PEEL
+	if(CHK_PEEL(TRACE_LEVEL_1)) (void)printf("In %s()\n",__func__);
+#endif
+	if(pool) {
+		/* If we are exiting from inside a peeling operation the other
+		 * threads may still be running, so leave everything alone */
+		pthread_mutex_lock(&pool->lock);
+		k=pool->n_busy;
+		pthread_mutex_unlock(&pool->lock);
+		if(k) return;
+		stop_pool();
+	}
+	free_workspace(&lk->peel->workspace);
+	for(k=0;k<2;k++) free_mem_blocks(lk->peel->first_mem_block[k]);
+	seg_dealloc(lk);
+}
+
+void peel_alloc(struct loki *loki)
+{
+	int i,j,k;
+
+#ifdef TRACE_PEEL
+	if(CHK_PEEL(TRACE_LEVEL_1)) (void)printf("In %s()\n",__func__);
+#endif
+	lk=loki;
+	k=loki->models->tlocus?2:0;
+	for(i=0;i<loki->markers->n_markers;i++) {
+		j=loki->markers->marker[i].locus.n_alleles;
+		if(j>k) k=j;
+	}
+	if(!k) return;
+	max_alls=k;
+	alloc_workspace(&loki->peel->workspace,k,loki);
+	loki->peel->workspace.rng=&lk_rng;
 	loki->peel->first_mem_block[MRK_MBLOCK]=get_new_memblock(MB_SIZE,MRK_MBLOCK);
 	loki->peel->first_mem_block[TRT_MBLOCK]=get_new_memblock(MB_SIZE,TRT_MBLOCK);
 	seg_alloc(loki);
@@ -164,35 +271,714 @@ static void rearrange_rfuncs(struct Complex_Element *em,struct R_Func *rf)
 	}
 }
 
-/* Peels locus perm[idx] where the n_loci entries in perm are all in 1 linkage group.
-* If sample_flag then the locus is to be sampled */
-double peel_locus(struct Locus **llist,int idx,int n_loci,int sample_flag,struct loki *loki)
+/* Peel (and sample if job->sample_flag is set) component comp, whose
+ * first individual is j.  Returns the log likelihood of the component, or
+ * -DBL_MAX on error */
+static double peel_comp(const struct peel_job *job,const int comp,const int j,struct loki *loki)
 {
-	struct Peelseq_Head *pp,*pp_head;
+	struct Peelseq_Head *pp;
 	struct Simple_Element *simple_em;
 	struct Complex_Element *complex_em; 
 	struct Id_Record *id,*id_array;
+	struct Marker *mark;
+	struct peel_mem *work;
+	struct Peelseq_Head **peel_list;
+	trait_pen_func *trait_pen;
+	int i,i1,k,k1,k2,k3,nn_all,n_peel_ops,ids,idd,allele,grp,cs,*a_trans,idx,n_loci,sample_flag;
+	int rec,nrec,locus,sample_freq,trn[2],**seg,unlinked,*f_flag,*peel_alls;
+	int ***seglist,n_all,linktype,si,*ind_list;
+	double *recom1,*recom2;
+	double like1,z,z1,theta,Mtp[2],Ptp[2],*eff,**freq,**count,*tpp,*freq1,*count1;
+	lk_ulong a,b,c,lump,**a_set;
+	pen_func *pen=0;
+	struct Locus *loc;
+	struct R_Func *rf;
+	
+	id_array=loki->pedigree->id_array;
+	work=&loki->peel->workspace;
+	si=loki->params.si_mode;
+	loc=job->loc;
+	mark=job->mark;
+	trait_pen=job->trait_pen;
+	a_set=job->a_set;
+	recom1=job->recom1;
+	recom2=job->recom2;
+	eff=job->eff;
+	seglist=job->seglist;
+	idx=job->idx;
+	n_loci=job->n_loci;
+	locus=job->locus;
+	nn_all=job->nn_all;
+	linktype=job->linktype;
+	sample_flag=job->sample_flag;
+	sample_freq=job->sample_freq;
+	unlinked=job->unlinked;
+	seg=loc->seg;
+	freq=work->freq;
+	count=freq+loki->pedigree->n_genetic_groups;
+	peel_alls=work->alls;
+	peel_list=(struct Peelseq_Head **)work->s5;
+	for(k=0;k<2;k++) {
+		loki->peel->mem_block[k]=loki->peel->first_mem_block[k];
+		loki->peel->mem_block[k]->ptr=0;
+	}
+	rf=loki->peel->workspace.r_funcs;
+	ind_list=loki->peel->workspace.s8;
+	if(locus<0)	{
+		n_all=nn_all;
+		lump=0;
+	} else {
+		a_trans=mark->allele_trans[comp];
+		n_all=mark->n_all1[comp];
+		if(n_all<2) return 0.0;
+		for(i=0;i<nn_all;i++) {
+			for(grp=0;grp<loki->pedigree->n_genetic_groups;grp++) freq[grp][i]=0.0;
+			peel_alls[i]=n_all-1;
+		}
+		for(i=0;i<nn_all;i++) if((k=a_trans[i])>=0) peel_alls[k]=i;
+		for(grp=0;grp<loki->pedigree->n_genetic_groups;grp++)
+			for(i=0;i<nn_all;i++) freq[grp][peel_alls[i]]+=loc->freq[grp][i];
+		lump=0;
+		for(i=0;i<nn_all;i++) if(peel_alls[i]==n_all-1) lump|=(1<<i);
+	}
+	n_peel_ops=0;
+	cs=loki->pedigree->comp_size[comp];
+	id=id_array+j;
+	i=cs;
+	i1=j;
+	f_flag=loc->founder_flag+j;
+	while(i--) {
+		id->flag=0;
+		id->allele[X_MAT]=id->allele[X_PAT]= -1;
+		k3=*(f_flag++);
+		if(k3==2) {
+			id++;
+			i1++;
+			continue;
+		}
+		/* Set up transmission probs. */
+		if(!k3 && n_loci>1) {
+			for(k=idx-1;k>=0;k--) {
+				k2=seglist[k][X_MAT][i1];
+				if(k2<0) continue;
+				theta=recom1[k];
+				if(theta<1.0e-16) {
+					fprintf(stderr,"Warning: [1] theta very low (%g) for locus %d\n",theta,locus);
+				}
+				Mtp[k2]=1.0-theta;
+				Mtp[1-k2]=theta;
+				break;
+			}
+			if(k<0) Mtp[0]=Mtp[1]=1.0;
+			for(k=idx-1;k>=0;k--) {
+				k2=seglist[k][X_PAT][i1];
+				if(k2<0) continue;
+				theta=recom2[k];
+				if(theta<1.0e-16) {
+					fprintf(stderr,"Warning: [2] theta very low (%g) for locus %d\n",theta,locus);
+				}
+				Ptp[k2]=1.0-theta;
+				Ptp[1-k2]=theta;
+				break;
+			}
+			if(k<0) Ptp[0]=Ptp[1]=1.0;
+			for(k=idx;k<n_loci-1;k++) {
+				k2=seglist[k][X_MAT][i1];
+				if(k2<0) continue;
+				theta=recom1[k];
+				if(theta<1.0e-16) theta=1.0e-16;
+				Mtp[k2]*=1.0-theta;
+				Mtp[1-k2]*=theta;
+				break;
+			}
+			for(k=idx;k<n_loci-1;k++) {
+				k2=seglist[k][X_PAT][i1];
+				if(k2<0) continue;
+				theta=recom2[k];
+				if(theta<1.0e-16) theta=1.0e-16;
+				Ptp[k2]*=1.0-theta;
+				Ptp[1-k2]*=theta;
+				break;
+			}
+			z=1.0/(Mtp[0]+Mtp[1]);
+			z1=1.0/(Ptp[0]+Ptp[1]);
+			for(k=0;k<2;k++) {
+				Mtp[k]*=z;
+				Ptp[k]*=z1;
+				id->tpp[X_MAT][k]=Mtp[k];
+				id->tpp[X_PAT][k]=Ptp[k];
+			}
+			id->tp[X_MM_PM]=Mtp[X_MAT]*Ptp[X_MAT];
+			id->tp[X_MM_PP]=Mtp[X_MAT]*Ptp[X_PAT];
+			id->tp[X_MP_PM]=Mtp[X_PAT]*Ptp[X_MAT];
+			id->tp[X_MP_PP]=Mtp[X_PAT]*Ptp[X_PAT];
+		} else {	
+			for(k=0;k<2;k++) id->tpp[X_MAT][k]=id->tpp[X_PAT][k]=0.5;
+			for(k=0;k<4;k++) id->tp[k]=0.25;
+		}
+		id->rfp= -1;
+		if(locus>=0) {
+			for(k=0;k<2;k++) {
+				if(mark->nhaps[k][i1]==1) {
+					a=mark->temp[k][i1];
+					k1=1;
+					while(!(a&1)) {
+						a>>=1;
+						k1++;
+					}
+					id->allele[k]=k1;
+				}
+			}
+			if(mark->ngens[i1]==1) id->flag|=(SAMPLED_MAT|SAMPLED_PAT);
+		}
+		id++;
+		i1++;
+	}
+	if(locus>=0 && mark->mterm && mark->mterm[0]) pen=&penetrance;
+	sample_flag&=~OP_SAMPLING;
+#ifdef TRACE_PEEL
+	if(CHK_PEEL(TRACE_LEVEL_2)) (void)printf("Peeling component %d\n",comp+1);
+#endif
+	/* Go through all operations in peeling sequence */
+	pp=job->pp_head+comp;
+	like1=0.0;
+	while(pp->type) {
+		if(pp->type==PEEL_SIMPLE) {
+			simple_em=pp->ptr.simple;
+			if(sample_flag && simple_em->pivot) peel_list[n_peel_ops++]=pp;
+			if(simple_em->pivot>0) {
+				k=simple_em->out_index;
+				k1=simple_em->pivot;
+				rf[k].id_list=ind_list;
+				rf[k].n_ind=2;
+				*ind_list++=k1;
+				*ind_list++=-k1;
+			} else if(simple_em->pivot<0) {
+				k=simple_em->out_index;
+				rf[k].id_list=ind_list;
+				rf[k].n_ind=2;
+				k1=simple_em->sire;
+				*ind_list++=k1;
+				*ind_list++=-k1;
+				rf[k+1].id_list=ind_list;
+				rf[k+1].n_ind=2;
+				k1=simple_em->dam;
+				*ind_list++=k1;
+				*ind_list++=-k1;
+			}
+			if(locus<0)	{
+				z=loki_trait_simple_peelop(simple_em,locus,sample_flag,freq,rf,trait_pen,loki);
+				if(z== -DBL_MAX) {
+					if(sample_flag&1) ABT_FUNC("Internal error - shouldn't be here\n");
+					/* Error return on likelihood (not sampling) run.  Clean up and return error */
+					return z;
+				}
+				like1+=z;
+			} else {
+				switch(linktype) {
+					case LINK_AUTO:
+						z=loki_simple_peelop(simple_em,locus,sample_flag,*pen,a_set,freq,rf,loki);
+						break;
+					case LINK_X:
+						z=loki_simple_peelop_x(simple_em,locus,sample_flag,*pen,a_set,freq,rf,loki);
+						break;
+					default:
+						ABT_FUNC("Link type not implemented\n");
+				}
+				if(z== -DBL_MAX) {
+					if(sample_flag&1) {
+						ABT_FUNC("Internal error - shouldn't be here\n");
+					}
+					/* Error return on likelihood (not sampling) run.  Clean up and return error */
+					return z;
+				}
+				like1+=z;
+			}
+			pp= &simple_em->next;
+		} else {
+			complex_em=pp->ptr.complex;
+			k=complex_em->out_index;
+			if(k>=0) {
+				rf[k].id_list=ind_list;
+				k2=complex_em->n_involved-complex_em->n_out;
+				for(k1=0;k2<complex_em->n_involved;k2++) {
+					*ind_list++=complex_em->involved[k2];
+					k1++;
+				}
+				rf[k].n_ind=k1;
+			}
+			if(sample_flag && k>=0) peel_list[n_peel_ops++]=pp;
+			rearrange_rfuncs(complex_em,rf);
+			if(locus<0)	{
+				z=loki_trait_complex_peelop(complex_em,locus,sample_flag,rf,trait_pen,freq,loki);
+				if(z== -DBL_MAX) {
+					if(sample_flag&1) ABT_FUNC("Internal error - shouldn't be here\n");
+					/* Error return on likelihood (not sampling) run.  Clean up and return error */
+					return z;
+				}
+				like1+=z;
+			} else {	
+				z=loki_complex_peelop(complex_em,locus,sample_flag,*pen,n_all,rf,freq,loki);
+				if(z== -DBL_MAX) {
+					if(sample_flag&1) ABT_FUNC("Internal error - shouldn't be here\n");
+					/* Error return on likelihood (not sampling) run.  Clean up and return error */
+					return z;
+				}
+				like1+=z;
+			}
+			pp= &complex_em->next;
+		}
+	}
+	/* If we're sampling, do them again in reverse */
+	if(sample_flag) {
+		sample_flag|=OP_SAMPLING;
+		for(i=n_peel_ops-1;i>=0;i--) {
+			pp=peel_list[i];
+			if(pp->type==PEEL_SIMPLE) {
+				simple_em=pp->ptr.simple;
+				if(simple_em->pivot== -2) {
+					k1=simple_em->out_index;
+				} else {
+					if(locus<0) (void)loki_trait_simple_sample(simple_em,locus,sample_flag,freq,rf,trait_pen,loki);
+					else {
+						if(linktype==LINK_AUTO) (void)loki_simple_sample(simple_em,locus,*pen,a_set,freq,rf,loki);
+						else (void)loki_simple_sample(simple_em,locus,*pen,a_set,freq,rf,loki);
+					}
+				}
+			} else {
+				complex_em=pp->ptr.complex;	
+				if(locus<0) (void)loki_trait_complex_peelop(complex_em,locus,sample_flag,rf,trait_pen,freq,loki);
+				else (void)loki_complex_peelop(complex_em,locus,sample_flag,*pen,n_all,rf,freq,loki);
+			}
+		}
+		/* Get allele counts for frequency update */
+		if(sample_freq) {
+			f_flag=loc->founder_flag+j;
+			if(locus>=0) {
+				a_trans=mark->allele_trans[comp];
+				for(id=id_array+j,i=0;i<cs;i++,id++) {
+					if(*(f_flag++)!=1) continue;
+					i1=i+j;
+					grp=id->group-1;
+					freq1=loc->freq[grp];
+					count1=count[grp];
+					for(k1=0;k1<2;k1++) {
+						allele=id->allele[k1]-1;
+						assert(allele>=0 && allele<n_all); /* Check if sampled allele is in range */
+						a=mark->req_set[k1][i1];
+						if(a&(1<<allele)) {
+							z=0.0;
+							k=0;
+							while(a) {
+								if(a&1) {
+									k2=a_trans[k];
+									if(k2<0) {
+										b=lump;
+										k3=0;
+										while(b) {
+											if(b&1) z+=freq1[k3];
+											b>>=1;
+											k3++;
+										}
+									} else z+=freq1[k2];
+								}
+								a>>=1;
+								k++;
+							}
+							z=1.0/z;
+							k=0;
+							a=mark->req_set[k1][i1];
+							while(a) {
+								if(a&1) {
+									k2=a_trans[k];
+									if(k2<0) {
+										b=lump;
+										k3=0;
+										while(b) {
+											if(b&1) count1[k3]+=z*freq1[k3];
+											b>>=1;
+											k3++;
+										}
+									} else count1[k2]+=z*freq1[k2];
+								}
+								a>>=1;
+								k++;
+							}
+						} else {
+							k2=a_trans[allele];
+							if(k2<0) {
+								z=0.0;
+								k3=0;
+								b=lump;
+								while(b) {
+									if(b&1) z+=freq1[k3];
+									b>>=1;
+									k3++;
+								}
+								z=1.0/z;
+								k3=0;
+								b=lump;
+								while(b) {
+									if(b&1) count1[k3]+=z*freq1[k3];
+									b>>=1;
+									k3++;
+								}
+							} else count1[k2]+=1.0;
+						}
+					}
+				}
+			} else {
+				for(id=id_array+j,i=0;i<cs;i++,id++) {
+					if(*(f_flag++)!=1) continue;
+					grp=id->group-1;
+					for(k1=0;k1<2;k1++) {
+						allele=id->allele[k1]-1;
+						count[grp][allele]+=1.0;
+					}
+				}
+			}
+		}
+		/* Correct residuals, get segregation pattern */
+		if(locus<0) { 
+			/* For trait loci */
+			id=id_array+j;
+			for(i=0;i<cs;i++,id++) {
+				i1=i+j;
+				if(loc->pruned_flag[i1]) continue;
+				k=id->allele[X_MAT];
+				k1=id->allele[X_PAT];
+				if(k>k1) k=k*(k-1)/2+k1;
+				else k=k1*(k1-1)/2+k;
+				/* Correct residuals for new genotypes */
+				if(id->res[0]) {
+					nrec=id->n_rec;
+					k1=(loc->flag&LOCUS_SAMPLED)?loc->gt[i1]:1;
+					if(k1!=k) {
+						z=(k1>1)?eff[k1-2]:0.0;
+						if(k>1) z-=eff[k-2];
+						for(rec=0;rec<nrec;rec++) {
+							id->res[0][rec]+=z;
+						}
+					}
+				} 
+				loc->gt[i1]=k;
+				idd=id->dam;
+				if(idd && !loc->pruned_flag[idd-1])	{
+					k=id->allele[X_MAT];
+					for(k1=0;k1<2;k1++)
+						trn[k1]=(k==id_array[idd-1].allele[k1])?1:0;
+					assert(trn[0] || trn[1]);
+					if(trn[0] && trn[1])	{
+						if(si || unlinked)	{
+							tpp=id->tpp[X_MAT];
+							z=ranf_r(work->rng)*(tpp[0]+tpp[1]);
+							seg[X_MAT][i1]=(z<=tpp[0])?0:1;
+						} else seg[X_MAT][i1]= -2;
+					} else if(trn[0]) seg[X_MAT][i1]=0;
+					else seg[X_MAT][i1]=1;
+				} else seg[X_MAT][i1]= -1;
+				ids=id->sire;
+				if(ids && !loc->pruned_flag[ids-1])	{
+					k=id->allele[X_PAT];
+					for(k1=0;k1<2;k1++)
+						trn[k1]=(k==id_array[ids-1].allele[k1])?1:0;
+					assert(trn[0] || trn[1]);
+					if(trn[0] && trn[1])	{
+						if(si || unlinked)	{
+							tpp=id->tpp[X_PAT];
+							z=ranf_r(work->rng)*(tpp[0]+tpp[1]);
+							seg[X_PAT][i1]=(z<=tpp[0])?0:1;
+						} else seg[X_PAT][i1]= -2;
+					} else if(trn[0]) seg[X_PAT][i1]=0;
+					else seg[X_PAT][i1]=1;
+				} else seg[X_PAT][i1]= -1;
+			}
+		} else { 
+			/* For marker loci */
+			id=id_array+j;
+			for(i=0;i<cs;i++,id++) {
+				i1=i+j;
+				if(loc->pruned_flag[i1]) continue;
+				k=id->allele[X_MAT];
+				k1=id->allele[X_PAT];
+				if(k>k1) k=k*(k-1)/2+k1;
+				else k=k1*(k1-1)/2+k;
+				if(eff) {
+					if(id->res[0]) {
+						nrec=id->n_rec;
+						k1=(loc->flag&LOCUS_SAMPLED)?loc->gt[i1]:1;
+						if(k1!=k) {
+							z=(k1>1)?eff[k1-2]:0.0;
+							if(k>1) z-=eff[k-2];
+							for(rec=0;rec<nrec;rec++) {
+								id->res[0][rec]+=z;
+							}
+						}
+					}
+				}
+				loc->gt[i1]=k;
+				idd=id->dam;
+				if(idd && !loc->pruned_flag[idd-1]) {
+					c=mark->req_set[X_MAT][i1];
+					k=id->allele[X_MAT]-1;
+					assert(k>=0 && k<n_all); /* Check if sampled allele is in range */
+					a=1<<k;
+					if(a&c) a=c;
+					for(k1=0;k1<2;k1++) {
+						k=id_array[idd-1].allele[k1]-1;
+						b=1<<k;
+						trn[k1]=(a&b)?1:0;
+					}
+					assert(trn[0] || trn[1]);
+					if(trn[0] && trn[1])	{
+						if(si)	{
+							tpp=id->tpp[X_MAT];
+							z=ranf_r(work->rng)*(tpp[0]+tpp[1]);
+							seg[X_MAT][i1]=(z<=tpp[0])?0:1;
+						} else seg[X_MAT][i1]= -2;
+					} else {
+						seg[X_MAT][i1]=trn[0]?0:1;
+					}
+				} else seg[X_MAT][i1]= -1;
+				ids=id->sire;
+				if(ids && !loc->pruned_flag[ids-1]) {
+					c=mark->req_set[X_PAT][i1];
+					k=id->allele[X_PAT]-1;
+					assert(k>=0 && k<n_all); /* Check if sampled allele is in range */
+					a=1<<k;
+					if(a&c) a=c;
+					for(k1=0;k1<2;k1++) {
+						k=id_array[ids-1].allele[k1]-1;
+						b=1<<k;
+						trn[k1]=(a&b)?1:0;
+					}
+					assert(trn[0] || trn[1]);
+					if(trn[0] && trn[1]) {
+						if(si)	{
+							tpp=id->tpp[X_PAT];
+							z=ranf_r(work->rng)*(tpp[0]+tpp[1]);
+							seg[X_PAT][i1]=(z<=tpp[0])?0:1;
+						} else seg[X_PAT][i1]= -2;
+					} else {
+						seg[X_PAT][i1]=trn[0]?0:1;
+					}
+				} else seg[X_PAT][i1]= -1;
+			}
+		}
+	}
+	return like1;
+}
+
+/* Set up the allele counts for a frequency update and, for trait loci, the
+ * allele frequencies in a workspace.  Only the first thread starts the
+ * counts from the prior; the others start from zero and are added in at
+ * the end */
+static void setup_freq(const struct peel_job *job,struct peel_mem *work,const int first,const struct loki *loki)
+{
+	int i,j,n_grp,nn_all;
+	double z,**count;
+
+	n_grp=loki->pedigree->n_genetic_groups;
+	nn_all=job->nn_all;
+	count=work->freq+n_grp;
+	if(job->sample_freq) {
+		for(j=0;j<n_grp;j++) {
+			z=1.0/(double)nn_all;
+			if(!first) for(i=0;i<nn_all;i++) count[j][i]=0.0;
+			else if(job->locus>=0 && job->mark->count_flag[j]) for(i=0;i<nn_all;i++) count[j][i]=job->mark->counts[j][i]+z;
+			else for(i=0;i<nn_all;i++) count[j][i]=z;
+		}
+	}
+	if(job->locus<0)	{
+		for(i=0;i<nn_all;i++) {
+			work->alls[i]=i;
+			for(j=0;j<n_grp;j++) work->freq[j][i]=job->loc->freq[j][i];
+		}
+	}
+}
+
+static void run_comps(const struct peel_thread *th,struct loki *loki)
+{
+	int i,comp;
+
+	for(i=0;i<th->n_comps;i++) {
+		comp=th->comps[i];
+		pool->comp_like[comp]=peel_comp(pool->job,comp,pool->comp_start[comp],loki);
+	}
+}
+
+static void *peel_worker(void *arg)
+{
+	struct peel_thread *th=arg;
+	int gen=0;
+
+	pthread_mutex_lock(&pool->lock);
+	for(;;) {
+		if(pool->quit) break;
+		if(pool->gen==gen) {
+			pthread_cond_wait(&pool->cond,&pool->lock);
+			continue;
+		}
+		gen=pool->gen;
+		pthread_mutex_unlock(&pool->lock);
+		run_comps(th,&th->lk);
+		pthread_mutex_lock(&pool->lock);
+		if(!--pool->n_busy) pthread_cond_broadcast(&pool->cond);
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return 0;
+}
+
+/* Start nt-1 peeling threads (the caller is thread 0) and share out the
+ * components between them: largest first, each to the thread with the
+ * fewest individuals so far.  The split only depends on the number of
+ * threads, so runs with the same number of threads are repeatable.
+ * Returns the number of threads, 1 if none could be started */
+static int start_pool(const int nt,const struct loki *loki)
+{
+	int i,j,k,n_comp,*comps,*owner,*load;
+	struct peel_thread *th;
+
+	if(pool) stop_pool();
+	if(rng_init_streams(nt)) {
+		message(WARN_MSG,"Unable to set up random number streams for peeling threads\n");
+		set_peel_threads(1);
+		return 1;
+	}
+	n_comp=loki->pedigree->n_comp;
+	pool=lk_calloc((size_t)1,sizeof(struct peel_pool));
+	pool->th=lk_calloc((size_t)nt,sizeof(struct peel_thread));
+	pool->comp_like=lk_malloc(sizeof(double)*n_comp);
+	comps=lk_malloc(sizeof(int)*(2*n_comp+nt));
+	pool->th[0].comps=comps;
+	pool->comp_start=comps+n_comp;
+	load=pool->comp_start+n_comp;
+	pthread_mutex_init(&pool->lock,0);
+	pthread_cond_init(&pool->cond,0);
+	pool->n_threads=1;
+	for(i=1;i<nt;i++) {
+		th=pool->th+i;
+		th->peel=*loki->peel;
+		memset(&th->peel.workspace,0,sizeof(struct peel_mem));
+		alloc_workspace(&th->peel.workspace,max_alls,loki);
+		th->peel.workspace.rng=rng_stream(i);
+		th->peel.first_mem_block[MRK_MBLOCK]=get_new_memblock(MB_SIZE,MRK_MBLOCK);
+		th->peel.first_mem_block[TRT_MBLOCK]=get_new_memblock(MB_SIZE,TRT_MBLOCK);
+		if(pthread_create(&th->thread,0,peel_worker,th)) {
+			free_workspace(&th->peel.workspace);
+			free_mem_blocks(th->peel.first_mem_block[MRK_MBLOCK]);
+			free_mem_blocks(th->peel.first_mem_block[TRT_MBLOCK]);
+			break;
+		}
+		pool->n_threads++;
+	}
+	if(pool->n_threads<nt) {
+		message(WARN_MSG,"Only able to start %d of %d peeling threads\n",pool->n_threads,nt);
+		set_peel_threads(pool->n_threads);
+	}
+	if(pool->n_threads==1) {
+		stop_pool();
+		return 1;
+	}
+	/* Share out the components, using comp_like to hold the sort keys */
+	for(i=k=0;i<n_comp;i++) {
+		pool->comp_start[i]=k;
+		k+=loki->pedigree->comp_size[i];
+		pool->comp_like[i]=(double)loki->pedigree->comp_size[i];
+		comps[i]=i;
+	}
+	lk_sort_index(comps,(size_t)n_comp,pool->comp_like,LK_SORT_DESCEND);
+	owner=lk_malloc(sizeof(int)*n_comp);
+	for(i=0;i<pool->n_threads;i++) load[i]=0;
+	for(i=0;i<n_comp;i++) {
+		for(k=0,j=1;j<pool->n_threads;j++) if(load[j]<load[k]) k=j;
+		load[k]+=loki->pedigree->comp_size[comps[i]];
+		owner[comps[i]]=k;
+		pool->th[k].n_comps++;
+	}
+	for(k=i=0;i<pool->n_threads;i++) {
+		pool->th[i].comps=comps+k;
+		k+=pool->th[i].n_comps;
+		pool->th[i].n_comps=0;
+	}
+	for(i=0;i<n_comp;i++) {
+		th=pool->th+owner[i];
+		th->comps[th->n_comps++]=i;
+	}
+	free(owner);
+	return pool->n_threads;
+}
+
+/* Peel the components of a locus across the thread pool.  The component
+ * log likelihoods are added up in component order and the allele counts
+ * in thread order, so the result does not depend on the timing */
+static double peel_parallel(const struct peel_job *job,struct loki *loki)
+{
+	int i,j,k,n_grp;
+	double like=0.0,**count,**count1;
+	struct peel_thread *th;
+	struct peel_mem work;
+	struct peel_mem_block *mb[2];
+
+	for(i=1;i<pool->n_threads;i++) {
+		th=pool->th+i;
+		work=th->peel.workspace;
+		for(k=0;k<2;k++) mb[k]=th->peel.first_mem_block[k];
+		th->peel=*loki->peel;
+		th->peel.workspace=work;
+		for(k=0;k<2;k++) th->peel.first_mem_block[k]=th->peel.mem_block[k]=mb[k];
+		th->lk=*loki;
+		th->lk.peel=&th->peel;
+		setup_freq(job,&th->peel.workspace,0,loki);
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->job=job;
+	pool->n_busy=pool->n_threads-1;
+	pool->gen++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+	run_comps(pool->th,loki);
+	pthread_mutex_lock(&pool->lock);
+	while(pool->n_busy) pthread_cond_wait(&pool->cond,&pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+	for(i=0;i<loki->pedigree->n_comp;i++) {
+		if(pool->comp_like[i]== -DBL_MAX) return -DBL_MAX;
+		like+=pool->comp_like[i];
+	}
+	if(job->sample_freq) {
+		n_grp=loki->pedigree->n_genetic_groups;
+		count=loki->peel->workspace.freq+n_grp;
+		for(i=1;i<pool->n_threads;i++) {
+			count1=pool->th[i].peel.workspace.freq+n_grp;
+			for(j=0;j<n_grp;j++) for(k=0;k<job->nn_all;k++) count[j][k]+=count1[j][k];
+		}
+	}
+	return like;
+}
+
+/* Peels locus perm[idx] where the n_loci entries in perm are all in 1 linkage group.
+* If sample_flag then the locus is to be sampled */
+double peel_locus(struct Locus **llist,int idx,int n_loci,int sample_flag,struct loki *loki)
+{
+	struct Peelseq_Head *pp_head;
 	struct Marker *mark=0;
 	struct peel_mem *work;
+	struct peel_job job;
 	trait_pen_func *trait_pen=0;
-	int comp,i,i1,j,k,k1,k2,k3,nn_all,n_peel_ops,ids,idd,allele,grp,cs,*a_trans;
-	int rec,nrec,mtype,locus,sample_freq=0,trn[2],locus1,**seg,unlinked=0,*f_flag;
-	int ***seglist,n_all,linktype,n_markers,si,*ind_list;
+	int comp,i,i1,j,k,k2,nn_all,grp,n_threads;
+	int mtype,locus,sample_freq=0,locus1,unlinked=0;
+	int ***seglist,linktype,n_markers;
 	double *recom1,*recom2;
-	double like=0.0,like1,z,z1,theta,Mtp[2],Ptp[2],*pos,*eff,**count,*tpp,*freq1,*count1;
+	double like=0.0,like1,z,z1,*eff,**count,*freq1,*count1,rr[2];
 	signed char *freq_set;
-	lk_ulong a,b,c,lump,**a_set=0;
-	pen_func *pen=0;
+	lk_ulong **a_set=0;
 	struct Locus *loc,*loc1;
-	struct R_Func *rf;
 	
 #ifdef TRACE_PEEL
 	if(CHK_PEEL(TRACE_LEVEL_1)) (void)printf("In %s(%p,%d,%d,%d)\n",__func__,(void *)llist,idx,n_loci,sample_flag);
 #endif
-	id_array=loki->pedigree->id_array;
 	n_markers=loki->markers->n_markers;
 	work=&loki->peel->workspace;
-	si=loki->params.si_mode;
 	seglist=(int ***)work->s6;
 	recom1=work->s7;
 	recom2=recom1+n_markers+loki->params.n_tloci;
@@ -232,8 +1018,6 @@ double peel_locus(struct Locus **llist,int idx,int n_loci,int sample_flag,struct
 		linktype=loki->markers->linkage[j].type&LINK_TYPES_MASK;
 		pp_head=loki->peel->peelseq_head[locus];
 	}
-	pos=loc->pos;
-	seg=loc->seg;
 #ifdef TRACE_PEEL
 	if(CHK_PEEL(TRACE_LEVEL_2)) {
 		(void)printf("locus %s, sample_flag=%d, nn_all=%d, linktype=%d\n",locus<0?"QTL":mark->name,sample_flag,nn_all,linktype);
@@ -242,35 +1026,13 @@ double peel_locus(struct Locus **llist,int idx,int n_loci,int sample_flag,struct
 	if(nn_all<2) return 0.0;
 	if(n_loci>1) {
 		k2=0;
-		for(i=0;i<idx;i++) {
+		for(i=0;i<n_loci;i++) if(i!=idx) {
 			loc1=llist[i];
 			seglist[k2]=loc1->seg;
-			recom1[k2]=.5*(1.0-exp(-0.02*(pos[X_MAT]-loc1->pos[X_MAT])));
-			recom2[k2++]=.5*(1.0-exp(-0.02*(pos[X_PAT]-loc1->pos[X_PAT])));
-			if(recom1[k2-1]<=1.0e-8) recom1[k2-1]=1.0e-8;
-			if(recom2[k2-1]<=1.0e-8) recom2[k2-1]=1.0e-8;
-		}
-		for(i=idx+1;i<n_loci;i++) {
-			loc1=llist[i];
-			seglist[k2]=loc1->seg;
-			recom1[k2]=.5*(1.0-exp(0.02*(pos[X_MAT]-loc1->pos[X_MAT])));
-			recom2[k2++]=.5*(1.0-exp(0.02*(pos[X_PAT]-loc1->pos[X_PAT])));
-			if(recom1[k2-1]<=1.0e-8) recom1[k2-1]=1.0e-8;
-			if(recom2[k2-1]<=1.0e-8) recom2[k2-1]=1.0e-8;
-		}
-	}
-	count=freq+loki->pedigree->n_genetic_groups;
-	if(sample_freq) {
-		for(j=0;j<loki->pedigree->n_genetic_groups;j++) {
-			z=1.0/(double)nn_all;
-			if(locus>=0 && mark->count_flag[j]) for(i=0;i<nn_all;i++) count[j][i]=mark->counts[j][i]+z;
-			else for(i=0;i<nn_all;i++) count[j][i]=z;
-		}
-	}
-	if(locus<0)	{
-		for(i=0;i<nn_all;i++) {
-			peel_alls[i]=i;
-			for(j=0;j<loki->pedigree->n_genetic_groups;j++) freq[j][i]=loc->freq[j][i];
+			if(i<idx) locus_recom(loc1,loc,rr);
+			else locus_recom(loc,loc1,rr);
+			recom1[k2]=rr[X_MAT]<=1.0e-8?1.0e-8:rr[X_MAT];
+			recom2[k2++]=rr[X_PAT]<=1.0e-8?1.0e-8:rr[X_PAT];
 		}
 	}
 	eff=0;
@@ -279,461 +1041,39 @@ double peel_locus(struct Locus **llist,int idx,int n_loci,int sample_flag,struct
 		mtype=loki->models->models[0].var.type;
 		eff=loc->eff[0];
 	}
-	for(j=comp=0;comp<loki->pedigree->n_comp;comp++) {
-		for(k=0;k<2;k++) {
-			loki->peel->mem_block[k]=loki->peel->first_mem_block[k];
-			loki->peel->mem_block[k]->ptr=0;
-		}
-		rf=loki->peel->workspace.r_funcs;
-		ind_list=loki->peel->workspace.s8;
-		if(locus<0)	{
-			n_all=nn_all;
-			lump=0;
-		} else {
-			a_trans=mark->allele_trans[comp];
-			n_all=mark->n_all1[comp];
-			if(n_all<2)	{
-				j+=loki->pedigree->comp_size[comp];
-				continue;
-			}
-			for(i=0;i<nn_all;i++) {
-				for(grp=0;grp<loki->pedigree->n_genetic_groups;grp++) freq[grp][i]=0.0;
-				peel_alls[i]=n_all-1;
-			}
-			for(i=0;i<nn_all;i++) if((k=a_trans[i])>=0) peel_alls[k]=i;
-			for(grp=0;grp<loki->pedigree->n_genetic_groups;grp++)
-				for(i=0;i<nn_all;i++) freq[grp][peel_alls[i]]+=loc->freq[grp][i];
-			lump=0;
-			for(i=0;i<nn_all;i++) if(peel_alls[i]==n_all-1) lump|=(1<<i);
-		}
-		n_peel_ops=0;
-		cs=loki->pedigree->comp_size[comp];
-		id=id_array+j;
-		i=cs;
-		i1=j;
-		f_flag=loc->founder_flag+j;
-		while(i--) {
-			id->flag=0;
-			id->allele[X_MAT]=id->allele[X_PAT]= -1;
-			k3=*(f_flag++);
-			if(k3==2) {
-				id++;
-				i1++;
-				continue;
-			}
-			/* Set up transmission probs. */
-			if(!k3 && n_loci>1) {
-				for(k=idx-1;k>=0;k--) {
-					k2=seglist[k][X_MAT][i1];
-					if(k2<0) continue;
-					theta=recom1[k];
-					if(theta<1.0e-16) {
-						fprintf(stderr,"Warning: [1] theta very low (%g) for locus %d\n",theta,locus);
-					}
-					Mtp[k2]=1.0-theta;
-					Mtp[1-k2]=theta;
-					break;
-				}
-				if(k<0) Mtp[0]=Mtp[1]=1.0;
-				for(k=idx-1;k>=0;k--) {
-					k2=seglist[k][X_PAT][i1];
-					if(k2<0) continue;
-					theta=recom2[k];
-					if(theta<1.0e-16) {
-						fprintf(stderr,"Warning: [2] theta very low (%g) for locus %d\n",theta,locus);
-					}
-					Ptp[k2]=1.0-theta;
-					Ptp[1-k2]=theta;
-					break;
-				}
-				if(k<0) Ptp[0]=Ptp[1]=1.0;
-				for(k=idx;k<n_loci-1;k++) {
-					k2=seglist[k][X_MAT][i1];
-					if(k2<0) continue;
-					theta=recom1[k];
-					if(theta<1.0e-16) theta=1.0e-16;
-					Mtp[k2]*=1.0-theta;
-					Mtp[1-k2]*=theta;
-					break;
-				}
-				for(k=idx;k<n_loci-1;k++) {
-					k2=seglist[k][X_PAT][i1];
-					if(k2<0) continue;
-					theta=recom2[k];
-					if(theta<1.0e-16) theta=1.0e-16;
-					Ptp[k2]*=1.0-theta;
-					Ptp[1-k2]*=theta;
-					break;
-				}
-				z=1.0/(Mtp[0]+Mtp[1]);
-				z1=1.0/(Ptp[0]+Ptp[1]);
-				for(k=0;k<2;k++) {
-					Mtp[k]*=z;
-					Ptp[k]*=z1;
-					id->tpp[X_MAT][k]=Mtp[k];
-					id->tpp[X_PAT][k]=Ptp[k];
-				}
-				id->tp[X_MM_PM]=Mtp[X_MAT]*Ptp[X_MAT];
-				id->tp[X_MM_PP]=Mtp[X_MAT]*Ptp[X_PAT];
-				id->tp[X_MP_PM]=Mtp[X_PAT]*Ptp[X_MAT];
-				id->tp[X_MP_PP]=Mtp[X_PAT]*Ptp[X_PAT];
-			} else {	
-				for(k=0;k<2;k++) id->tpp[X_MAT][k]=id->tpp[X_PAT][k]=0.5;
-				for(k=0;k<4;k++) id->tp[k]=0.25;
-			}
-			id->rfp= -1;
-			if(locus>=0) {
-				for(k=0;k<2;k++) {
-					if(mark->nhaps[k][i1]==1) {
-						a=mark->temp[k][i1];
-						k1=1;
-						while(!(a&1)) {
-							a>>=1;
-							k1++;
-						}
-						id->allele[k]=k1;
-					}
-				}
-				if(mark->ngens[i1]==1) id->flag|=(SAMPLED_MAT|SAMPLED_PAT);
-			}
-			id++;
-			i1++;
-		}
-		if(locus>=0 && mark->mterm && mark->mterm[0]) pen=&penetrance;
-		sample_flag&=~OP_SAMPLING;
-#ifdef TRACE_PEEL
-		if(CHK_PEEL(TRACE_LEVEL_2)) (void)printf("Peeling component %d\n",comp+1);
-#endif
-		/* Go through all operations in peeling sequence */
-		pp=pp_head+comp;
-		like1=0.0;
-		while(pp->type) {
-			if(pp->type==PEEL_SIMPLE) {
-				simple_em=pp->ptr.simple;
-				if(sample_flag && simple_em->pivot) peel_list[n_peel_ops++]=pp;
-				if(simple_em->pivot>0) {
-					k=simple_em->out_index;
-					k1=simple_em->pivot;
-					rf[k].id_list=ind_list;
-					rf[k].n_ind=2;
-					*ind_list++=k1;
-					*ind_list++=-k1;
-				} else if(simple_em->pivot<0) {
-					k=simple_em->out_index;
-					rf[k].id_list=ind_list;
-					rf[k].n_ind=2;
-					k1=simple_em->sire;
-					*ind_list++=k1;
-					*ind_list++=-k1;
-					rf[k+1].id_list=ind_list;
-					rf[k+1].n_ind=2;
-					k1=simple_em->dam;
-					*ind_list++=k1;
-					*ind_list++=-k1;
-				}
-				if(locus<0)	{
-					z=loki_trait_simple_peelop(simple_em,locus,sample_flag,freq,rf,trait_pen,loki);
-					if(z== -DBL_MAX) {
-						if(sample_flag&1) ABT_FUNC("Internal error - shouldn't be here\n");
-						/* Error return on likelihood (not sampling) run.  Clean up and return error */
-						return z;
-					}
-					like1+=z;
-				} else {
-					switch(linktype) {
-						case LINK_AUTO:
-							z=loki_simple_peelop(simple_em,locus,sample_flag,*pen,a_set,freq,rf,loki);
-							break;
-						case LINK_X:
-							z=loki_simple_peelop_x(simple_em,locus,sample_flag,*pen,a_set,freq,rf,loki);
-							break;
-						default:
-							ABT_FUNC("Link type not implemented\n");
-					}
-					if(z== -DBL_MAX) {
-						if(sample_flag&1) {
-							ABT_FUNC("Internal error - shouldn't be here\n");
-						}
-						/* Error return on likelihood (not sampling) run.  Clean up and return error */
-						return z;
-					}
-					like1+=z;
-				}
-				pp= &simple_em->next;
-			} else {
-				complex_em=pp->ptr.complex;
-				k=complex_em->out_index;
-				if(k>=0) {
-					rf[k].id_list=ind_list;
-					k2=complex_em->n_involved-complex_em->n_out;
-					for(k1=0;k2<complex_em->n_involved;k2++) {
-						*ind_list++=complex_em->involved[k2];
-						k1++;
-					}
-					rf[k].n_ind=k1;
-				}
-				if(sample_flag && k>=0) peel_list[n_peel_ops++]=pp;
-				rearrange_rfuncs(complex_em,rf);
-				if(locus<0)	{
-					z=loki_trait_complex_peelop(complex_em,locus,sample_flag,rf,trait_pen,freq,loki);
-					if(z== -DBL_MAX) {
-						if(sample_flag&1) ABT_FUNC("Internal error - shouldn't be here\n");
-						/* Error return on likelihood (not sampling) run.  Clean up and return error */
-						return z;
-					}
-					like1+=z;
-				} else {	
-					z=loki_complex_peelop(complex_em,locus,sample_flag,*pen,n_all,rf,freq,loki);
-					if(z== -DBL_MAX) {
-						if(sample_flag&1) ABT_FUNC("Internal error - shouldn't be here\n");
-						/* Error return on likelihood (not sampling) run.  Clean up and return error */
-						return z;
-					}
-					like1+=z;
-				}
-				pp= &complex_em->next;
-			}
-		}
-		/* If we're sampling, do them again in reverse */
-		if(sample_flag) {
-			sample_flag|=OP_SAMPLING;
-			for(i=n_peel_ops-1;i>=0;i--) {
-				pp=peel_list[i];
-				if(pp->type==PEEL_SIMPLE) {
-					simple_em=pp->ptr.simple;
-					if(simple_em->pivot== -2) {
-						k1=simple_em->out_index;
-					} else {
-						if(locus<0) (void)loki_trait_simple_sample(simple_em,locus,sample_flag,freq,rf,trait_pen,loki);
-						else {
-							if(linktype==LINK_AUTO) (void)loki_simple_sample(simple_em,locus,*pen,a_set,freq,rf,loki);
-							else (void)loki_simple_sample(simple_em,locus,*pen,a_set,freq,rf,loki);
-						}
-					}
-				} else {
-					complex_em=pp->ptr.complex;	
-					if(locus<0) (void)loki_trait_complex_peelop(complex_em,locus,sample_flag,rf,trait_pen,freq,loki);
-					else (void)loki_complex_peelop(complex_em,locus,sample_flag,*pen,n_all,rf,freq,loki);
-				}
-			}
-			/* Get allele counts for frequency update */
-			if(sample_freq) {
-				f_flag=loc->founder_flag+j;
-				if(locus>=0) {
-					a_trans=mark->allele_trans[comp];
-					for(id=id_array+j,i=0;i<cs;i++,id++) {
-						if(*(f_flag++)!=1) continue;
-						i1=i+j;
-						grp=id->group-1;
-						freq1=loc->freq[grp];
-						count1=count[grp];
-						for(k1=0;k1<2;k1++) {
-							allele=id->allele[k1]-1;
-							assert(allele>=0 && allele<n_all); /* Check if sampled allele is in range */
-							a=mark->req_set[k1][i1];
-							if(a&(1<<allele)) {
-								z=0.0;
-								k=0;
-								while(a) {
-									if(a&1) {
-										k2=a_trans[k];
-										if(k2<0) {
-											b=lump;
-											k3=0;
-											while(b) {
-												if(b&1) z+=freq1[k3];
-												b>>=1;
-												k3++;
-											}
-										} else z+=freq1[k2];
-									}
-									a>>=1;
-									k++;
-								}
-								z=1.0/z;
-								k=0;
-								a=mark->req_set[k1][i1];
-								while(a) {
-									if(a&1) {
-										k2=a_trans[k];
-										if(k2<0) {
-											b=lump;
-											k3=0;
-											while(b) {
-												if(b&1) count1[k3]+=z*freq1[k3];
-												b>>=1;
-												k3++;
-											}
-										} else count1[k2]+=z*freq1[k2];
-									}
-									a>>=1;
-									k++;
-								}
-							} else {
-								k2=a_trans[allele];
-								if(k2<0) {
-									z=0.0;
-									k3=0;
-									b=lump;
-									while(b) {
-										if(b&1) z+=freq1[k3];
-										b>>=1;
-										k3++;
-									}
-									z=1.0/z;
-									k3=0;
-									b=lump;
-									while(b) {
-										if(b&1) count1[k3]+=z*freq1[k3];
-										b>>=1;
-										k3++;
-									}
-								} else count1[k2]+=1.0;
-							}
-						}
-					}
-				} else {
-					for(id=id_array+j,i=0;i<cs;i++,id++) {
-						if(*(f_flag++)!=1) continue;
-						grp=id->group-1;
-						for(k1=0;k1<2;k1++) {
-							allele=id->allele[k1]-1;
-							count[grp][allele]+=1.0;
-						}
-					}
-				}
-			}
-			/* Correct residuals, get segregation pattern */
-			if(locus<0) { 
-				/* For trait loci */
-				id=id_array+j;
-				for(i=0;i<cs;i++,id++) {
-					i1=i+j;
-					if(loc->pruned_flag[i1]) continue;
-					k=id->allele[X_MAT];
-					k1=id->allele[X_PAT];
-					if(k>k1) k=k*(k-1)/2+k1;
-					else k=k1*(k1-1)/2+k;
-					/* Correct residuals for new genotypes */
-					if(id->res[0]) {
-						nrec=id->n_rec;
-						k1=(loc->flag&LOCUS_SAMPLED)?loc->gt[i1]:1;
-						if(k1!=k) {
-							z=(k1>1)?eff[k1-2]:0.0;
-							if(k>1) z-=eff[k-2];
-							for(rec=0;rec<nrec;rec++) {
-								id->res[0][rec]+=z;
-							}
-						}
-					} 
-					loc->gt[i1]=k;
-					idd=id->dam;
-					if(idd && !loc->pruned_flag[idd-1])	{
-						k=id->allele[X_MAT];
-						for(k1=0;k1<2;k1++)
-							trn[k1]=(k==id_array[idd-1].allele[k1])?1:0;
-						assert(trn[0] || trn[1]);
-						if(trn[0] && trn[1])	{
-							if(si || unlinked)	{
-								tpp=id->tpp[X_MAT];
-								z=ranf()*(tpp[0]+tpp[1]);
-								seg[X_MAT][i1]=(z<=tpp[0])?0:1;
-							} else seg[X_MAT][i1]= -2;
-						} else if(trn[0]) seg[X_MAT][i1]=0;
-						else seg[X_MAT][i1]=1;
-					} else seg[X_MAT][i1]= -1;
-					ids=id->sire;
-					if(ids && !loc->pruned_flag[ids-1])	{
-						k=id->allele[X_PAT];
-						for(k1=0;k1<2;k1++)
-							trn[k1]=(k==id_array[ids-1].allele[k1])?1:0;
-						assert(trn[0] || trn[1]);
-						if(trn[0] && trn[1])	{
-							if(si || unlinked)	{
-								tpp=id->tpp[X_PAT];
-								z=ranf()*(tpp[0]+tpp[1]);
-								seg[X_PAT][i1]=(z<=tpp[0])?0:1;
-							} else seg[X_PAT][i1]= -2;
-						} else if(trn[0]) seg[X_PAT][i1]=0;
-						else seg[X_PAT][i1]=1;
-					} else seg[X_PAT][i1]= -1;
-				}
-			} else { 
-				/* For marker loci */
-				id=id_array+j;
-				for(i=0;i<cs;i++,id++) {
-					i1=i+j;
-					if(loc->pruned_flag[i1]) continue;
-					k=id->allele[X_MAT];
-					k1=id->allele[X_PAT];
-					if(k>k1) k=k*(k-1)/2+k1;
-					else k=k1*(k1-1)/2+k;
-					if(eff) {
-						if(id->res[0]) {
-							nrec=id->n_rec;
-							k1=(loc->flag&LOCUS_SAMPLED)?loc->gt[i1]:1;
-							if(k1!=k) {
-								z=(k1>1)?eff[k1-2]:0.0;
-								if(k>1) z-=eff[k-2];
-								for(rec=0;rec<nrec;rec++) {
-									id->res[0][rec]+=z;
-								}
-							}
-						}
-					}
-					loc->gt[i1]=k;
-					idd=id->dam;
-					if(idd && !loc->pruned_flag[idd-1]) {
-						c=mark->req_set[X_MAT][i1];
-						k=id->allele[X_MAT]-1;
-						assert(k>=0 && k<n_all); /* Check if sampled allele is in range */
-						a=1<<k;
-						if(a&c) a=c;
-						for(k1=0;k1<2;k1++) {
-							k=id_array[idd-1].allele[k1]-1;
-							b=1<<k;
-							trn[k1]=(a&b)?1:0;
-						}
-						assert(trn[0] || trn[1]);
-						if(trn[0] && trn[1])	{
-							if(si)	{
-								tpp=id->tpp[X_MAT];
-								z=ranf()*(tpp[0]+tpp[1]);
-								seg[X_MAT][i1]=(z<=tpp[0])?0:1;
-							} else seg[X_MAT][i1]= -2;
-						} else {
-							seg[X_MAT][i1]=trn[0]?0:1;
-						}
-					} else seg[X_MAT][i1]= -1;
-					ids=id->sire;
-					if(ids && !loc->pruned_flag[ids-1]) {
-						c=mark->req_set[X_PAT][i1];
-						k=id->allele[X_PAT]-1;
-						assert(k>=0 && k<n_all); /* Check if sampled allele is in range */
-						a=1<<k;
-						if(a&c) a=c;
-						for(k1=0;k1<2;k1++) {
-							k=id_array[ids-1].allele[k1]-1;
-							b=1<<k;
-							trn[k1]=(a&b)?1:0;
-						}
-						assert(trn[0] || trn[1]);
-						if(trn[0] && trn[1]) {
-							if(si)	{
-								tpp=id->tpp[X_PAT];
-								z=ranf()*(tpp[0]+tpp[1]);
-								seg[X_PAT][i1]=(z<=tpp[0])?0:1;
-							} else seg[X_PAT][i1]= -2;
-						} else {
-							seg[X_PAT][i1]=trn[0]?0:1;
-						}
-					} else seg[X_PAT][i1]= -1;
-				}
-			}
+	job.loc=loc;
+	job.mark=mark;
+	job.pp_head=pp_head;
+	job.trait_pen=trait_pen;
+	job.a_set=a_set;
+	job.recom1=recom1;
+	job.recom2=recom2;
+	job.eff=eff;
+	job.seglist=seglist;
+	job.idx=idx;
+	job.n_loci=n_loci;
+	job.locus=locus;
+	job.nn_all=nn_all;
+	job.linktype=linktype;
+	job.sample_flag=sample_flag;
+	job.sample_freq=sample_freq;
+	job.unlinked=unlinked;
+	setup_freq(&job,work,1,loki);
+	n_threads=loki->pedigree->n_comp>1?get_peel_threads():1;
+	if(n_threads>1 && (!pool || pool->n_threads!=n_threads)) n_threads=start_pool(n_threads,loki);
+	if(n_threads>1) {
+		like=peel_parallel(&job,loki);
+		if(like== -DBL_MAX) return like;
+	} else {
+		for(j=comp=0;comp<loki->pedigree->n_comp;comp++) {
+			like1=peel_comp(&job,comp,j,loki);
+			/* Error return on likelihood (not sampling) run */
+			if(like1== -DBL_MAX) return like1;
+			like+=like1;
+			j+=loki->pedigree->comp_size[comp];
 		}
-		like+=like1;
-		j+=cs;
 	}
+	count=work->freq+loki->pedigree->n_genetic_groups;
 	if(sample_freq) {
 		for(grp=0;grp<loki->pedigree->n_genetic_groups;grp++) {
 			z1=0.0;
@@ -56,9 +56,24 @@ struct fset
   double p;
 };
 
+/* The parental genotype combinations as separate arrays for the peeling
+ * kernels (see peel_kernels.c).  These share the memory of s0 */
+struct fset_list
+{
+  double *p;
+  int *pat_gene[2];
+  int *mat_gene[2];
+};
+
+struct complex_mem;
+struct rng_ctx;
+
+/* Scratch space for peeling a component.  With more than one peeling
+ * thread each thread has its own */
 struct peel_mem
 {
   struct fset *s0;
+  struct fset_list fs;
   int *s1;
   double *s2;
   lk_ulong *s3;
@@ -68,6 +83,10 @@ struct peel_mem
   double *s7;
   int *s8;
   struct R_Func *r_funcs;
+  double **freq; /* Recoded allele frequencies, then allele counts */
+  int *alls;
+  struct complex_mem *cm;
+  struct rng_ctx *rng;
 };
 
 struct lk_peel {
@@ -108,7 +127,10 @@ double q_penetrance(int,int,struct Locus *,const struct loki *);
 
 void prt_peel_trace(const int, const char *, ...);
 double peel_locus(struct Locus **,int,int,int,struct loki *);
-void free_complex_mem(void);
+struct complex_mem *alloc_complex_mem(void);
+void free_complex_mem(struct complex_mem *);
+void set_peel_threads(int);
+int get_peel_threads(void);
 void set_sort_sex(const int);
 void peel_alloc(struct loki *);
 double loki_complex_peelop(const struct Complex_Element *,const int,const int,pen_func,const int,struct R_Func *,double **,struct loki *);
@@ -49,6 +49,10 @@ void penetrance(double *val,int id,struct Locus *loc,int n_all,int n_bits,const
   res=loki->models->residual_var[0];
   kon1=1.0/(2.0*res);
   kon2=sqrt(kon1/M_PI);
+  if(loki->models->temper!=1.0) {
+    kon2=pow(kon2,loki->models->temper);
+    kon1*=loki->models->temper;
+  }
   sd=sqrt(res);
   mod=loki->models->models;
   idx=mod->var.var_index;
@@ -125,6 +129,10 @@ void s_penetrance(double *val,int id,struct Locus *loc,const struct loki *loki)
   mtype=loki->models->models[0].var.type;
   kon1=1.0/(2.0*res);
   kon2=sqrt(kon1/M_PI);
+  if(loki->models->temper!=1.0) {
+    kon2=pow(kon2,loki->models->temper);
+    kon1*=loki->models->temper;
+  }
   if(!(mtype&ST_CENSORED) || censor_mode) {
     for(rec=0;rec<nrec;rec++) {
       y=idr->res[0][rec];
@@ -201,6 +209,10 @@ void s_penetrance1(double *val,int id,struct Locus *loc,const struct loki *loki)
   eff=loc->eff[0];
   kon1=-1.0/(2.0*loki->models->residual_var[0]);
   kon2=sqrt(-kon1/M_PI);
+  if(loki->models->temper!=1.0) {
+    kon2=pow(kon2,loki->models->temper);
+    kon1*=loki->models->temper;
+  }
   idr=loki->pedigree->id_array+id;
   y=idr->res[0][0];
   if((k=loc->gt[id])>1) y+=eff[k-2];
@@ -247,6 +259,10 @@ double q_penetrance(int id,int gt,struct Locus *locp,const struct loki *loki)
   res=loki->models->residual_var[0];
   kon1=1.0/(2.0*res);
   kon2=log(sqrt(kon1/M_PI));
+  if(loki->models->temper!=1.0) {
+    kon2*=loki->models->temper;
+    kon1*=loki->models->temper;
+  }
   if(!(mtype&ST_CENSORED) || censor_mode) {
     for(rec=0;rec<nrec;rec++) {
       y=idr->res[0][rec];
@@ -40,6 +40,7 @@
 #include "loki.h"
 #include "loki_peel.h"
 #include "loki_utils.h"
+#include "arena.h"
 #include "seg_pen.h"
 #include "gen_pen.h"
 #include "loki_ibd.h"
@@ -63,6 +64,8 @@
 #include "pseudo_chrom.h"
 #include "loki_haplo.h"
 #include "loki_xmlout.h"
+#include "loki_chains.h"
+#include "locus_index.h"
 
 #define SEGS_COMPLETE 1
 #define MK_GENES_OK 2
@@ -71,7 +74,7 @@
 
 void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 {
-	int lp,i,j,i1,j2,k,k1,k2,flag=0,comp,*naffect=0,**affs=0,dumped=0,ibdflag,*ntl_linked=0,*ntl_linked1=0,lp1;
+	int lp,i,j,i1,j2,k,k1,k2,flag=0,comp,*naffect=0,**affs=0,dumped=0,ibdflag,*ntl_linked=0,*ntl_linked1=0,lp1,cold=1;
 	int **haplo_store[2]={0,0},analysis,polygenic_flag,num_iter;
 	FILE *fptr=0,*ffreq=0,*fpos=0,*fmpos=0,*hapfile=0,*qptr=0;
 	double z,*ss=0,*ss2=0,**pairs=0,*trpos=0,*trpos1=0;
@@ -231,8 +234,7 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 		if(!(locilist=malloc(sizeof(void *)*n_markers))) ABT_FUNC(MMsg);
 		if(!(mpos_perm=malloc(sizeof(void *)*n_markers))) ABT_FUNC(MMsg);
 		for(k2=k1=0;k1<loki->markers->n_links;k1++) {
-			get_locuslist(locilist,k1,&k,1);
-			gnu_qsort(locilist,(size_t)k,sizeof(void *),cmp_loci);
+			get_sorted_loci(locilist,k1,&k,1);
 			for(j=0;j<k;j++) mpos_perm[k2++]=locilist[j];
 		}
 		free(locilist);
@@ -339,6 +341,8 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 	loki->sys.catch_sigs=1;
 	num_iter=loki->params.num_iter;
 	for(++lp;!loki->sys.sig_caught && (!num_iter || lp<=num_iter);lp++) {
+		/* Scratch space from the previous iteration */
+		lk_arena_reset(ARENA_ITER);
 #ifdef USE_DMALLOC
 		if(dmalloc_verify(0)==DMALLOC_ERROR) {
 			(void)fprintf(stderr,"[%s:%d] %s(): Error returned from dmalloc_verify().\nAttempting to abort nicely.\n",__FILE__,__LINE__,__func__);
@@ -457,8 +461,7 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 			if(loki->params.sample_freq[0] && lp>=loki->params.sample_from[0] && !(lp%loki->params.sample_freq[0])) {
 				(void)fprintf(fptr,"%d",lp);
 				for(k1=0;k1<loki->markers->n_links;k1++) {
-					get_locuslist(locilist,k1,&k2,1);
-					gnu_qsort(locilist,(size_t)k2,sizeof(void *),cmp_loci);
+					get_sorted_loci(locilist,k1,&k2,1);
 					for(k=0;k<k2;k++) (void)fprintf(fptr," %g",ss[locilist[k]->index]);
 				}
 				(void)fputc('\n',fptr);
@@ -466,8 +469,7 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 			if(loki->params.sample_freq[1] && lp>=loki->params.sample_from[1] && !(lp%loki->params.sample_freq[1])) {
 				(void)fprintf(stdout,"%d",lp);
 				for(k1=0;k1<loki->markers->n_links;k1++) {
-					get_locuslist(locilist,k1,&k2,1);
-					gnu_qsort(locilist,(size_t)k2,sizeof(int),cmp_loci);
+					get_sorted_loci(locilist,k1,&k2,1);
 					for(k=0;k<k2;k++) (void)fprintf(stdout," %g",ss[locilist[k]->index]);
 				}
 				(void)fputc('\n',stdout);
@@ -512,22 +514,28 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 			z=Recalc_Res(0,loki);
 			if(z>1.0e-8) printf("Warning: err=%g\n",z);
 #endif
+			/* Heated chains swap temperatures, and only write output when cold */
+			chain_exchange(lp,loki);
+			cold=(loki->models->temper==1.0);
 			k=0;
 			loc=loki->models->tlocus;
-			if(loki->params.sample_freq[0] && lp>=loki->params.sample_from[0] && !(lp%loki->params.sample_freq[0])) {
+			if(cold && loki->params.sample_freq[0] && lp>=loki->params.sample_from[0] && !(lp%loki->params.sample_freq[0])) {
 				for(i=0;i<loki->params.n_tloci;i++) if(loc[i].flag) calc_var_locus(loc+i,loki);
 				OutputSample(fptr,lp,loki);
 				if(qptr) OutputQTLvect(qptr,lp,loki);
 				if(ffreq) OutputFreq(ffreq,lp,loki);
 				k=1;
 			}
-			if(loki->params.sample_freq[1] && lp>=loki->params.sample_from[1] && !(lp%loki->params.sample_freq[1])) {
+			if(cold && loki->params.sample_freq[1] && lp>=loki->params.sample_from[1] && !(lp%loki->params.sample_freq[1])) {
 				if(!k) {
 					for(i=0;i<loki->params.n_tloci;i++) if(loc[i].flag) calc_var_locus(loc+i,loki);
 				}
 				OutputSample(stdout,lp,loki);
 			}
-			if(ntl_linked && fpos && lp>=loki->params.sample_from[0]) {
+			if(ntl_linked && fpos && lp>=loki->params.sample_from[0] && !cold) {
+				/* Leave heated iterations out of the run lengths */
+				if(lp1) lp1++;
+			} else if(ntl_linked && fpos && lp>=loki->params.sample_from[0]) {
 				for(k=0;k<=loki->markers->n_links;k++) ntl_linked[k]=0;
 				for(k1=0;k1<loki->params.n_tloci;k1++) if(loc[k1].flag && !(loc[k1].flag&TL_LINKED)) ntl_linked[0]++;
 				for(k2=k=0;k<loki->markers->n_links;k++) {
@@ -573,7 +581,7 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 				(void)fflush(fpos);
 			}
 		}
-		if(loki->params.sample_freq[0] && lp>=loki->params.sample_from[0] && !(lp%loki->params.sample_freq[0])) {
+		if(cold && loki->params.sample_freq[0] && lp>=loki->params.sample_from[0] && !(lp%loki->params.sample_freq[0])) {
 			if(!(flag&SEGS_COMPLETE)) {
 				sample_segs(loki);
 				flag|=SEGS_COMPLETE;
@@ -616,10 +624,9 @@ void SampleLoop(int read_dump_flag,int append_output_flag,struct loki *loki)
 				Output_Merlin_IBD(n_ibd,loki);
 				break;
 			case SOLAR_IBD_MODE:
-				if(!(solar_trans=malloc(sizeof(int)*loki->pedigree->ped_size))) ABT_FUNC(MMsg);
+				solar_trans=arena_alloc(lk_arena(ARENA_ITER),sizeof(int)*loki->pedigree->ped_size);
 				read_solar_idfile(solar_trans,loki);
 				Output_Solar_IBD(n_ibd,solar_trans,loki);
-				free(solar_trans);
 				break;
 		}
 	}
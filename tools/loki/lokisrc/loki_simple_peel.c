@@ -13,18 +13,33 @@
 #include "loki_peel.h"
 #include "get_par_probs.h"
 #include "loki_simple_peel.h"
+#include "peel_kernels.h"
+
+/* List the genotypes allowed by an individual's allele sets as indices into
+ * a genotype table, in the order the bitmask walks visit them.  a1 has the
+ * possible maternal alleles and as[] the paternal alleles for each */
+static int list_gtypes(lk_ulong a1,const lk_ulong *as,const int n_bits,int *gl)
+{
+	int i,j,n=0;
+	lk_ulong a;
+	
+	for(i=0;a1;i++,a1>>=1) if(a1&1) {
+		for(a=as[i],j=i;a;a>>=1,j+=1<<n_bits) if(a&1) gl[n++]=j;
+	}
+	return n;
+}
 
 /* Performs simple (i.e., nuclear family based) peeling operation */
 double loki_simple_peelop(const struct Simple_Element *element,const int locus,const int s_flag,pen_func pen,
 								  lk_ulong **a_set,double **freq,struct R_Func *rf,struct loki *loki)
 {
-	int ids,idd,i,j,k,k1,l,l1,i1,j2,m,n,pivot,fsp=0,n_off,*off,kid,gt[4],of=0,nb1,nmc,no2=0;
-	int comp,n_all,n_idx,n_bits,*id_set1,*id_set2;
-	double prob=0.0,*tp,p1,z,*tmp,*tmp1,*tpp1,*tpp2;
+	int ids,idd,i,j,k,k1,l,l1,i1,j2,m,n,pivot,fsp=0,n_off,*off,kid,gt[4],of=0,nb1,no2=0;
+	int comp,n_all,n_idx,n_bits,*id_set1,*id_set2,*gl_s,*gl_d,*gl_p,n_s,n_d,n_p=0;
+	double prob=0.0,*tp,p1,z,*tmp;
 	double *qval,*pval,*mval,*pivval,*id_set;
-	lk_ulong a,b,a1,b1,cm[2],*tmp_idx,*tmp_idx1,*cmm[2],mask;
+	lk_ulong a,b,a1,cm[2],*tmp_idx,*tmp_idx1,*cmm[2],mask;
 	lk_ulong *tt_all;
-	struct fset *peel_fs,*t_fset;
+	struct fset_list *fs;
 	struct peel_mem *work;
 	struct Id_Record *id_array;
 	struct Marker *mark;
@@ -56,7 +71,7 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 			prob+=log(p1);
 			if(s_flag) {
 				do {
-					z=ranf();
+					z=ranf_r(work->rng);
 					p1=0.0;
 					for(i=0;i<n_idx;i++) if(qval[i]>0.0) {
 						p1+=qval[i];
@@ -81,110 +96,34 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 	pval=qval+n_idx;
 	mval=pval+n_idx;
 	pivval=mval+n_idx;
-	peel_fs=work->s0;
+	fs=&work->fs;
 	id_set1=work->s1;
 	id_set2=id_set1+k;
+	gl_s=id_set2+k;
+	gl_d=gl_s+k;
+	gl_p=gl_d+k;
 	tt_all=work->s3;
 	cmm[0]=mark->req_set[0];
 	cmm[1]=mark->req_set[1];
 	nb1=1<<n_bits;
+	n_d=list_gtypes(mark->temp[X_MAT][idd],a_set[idd],n_bits,gl_d);
 	if(idd!=pivot && pivot!= -2 && element->dam>0) {
 		p1=get_par_probs(mval,idd,mark,pen,a_set,freq,rf,loki);
 		prob+=log(p1);
-	} else {
-		a1=mark->temp[X_MAT][idd];
-		j=0;
-		if((k=id_array[idd].rfp)>=0) { /* Insert Previously computed R_Func */
-			while(a1) {
-				if(a1&1) {
-					a=a_set[idd][j];
-					l=j;
-					while(a) {
-						if(a&1) mval[l]=0.0;
-						a>>=1;
-						l+=nb1;
-					}
-				}
-				a1>>=1;
-				j++;
-			}
-			for(j=0;j<rf[k].n_terms;j++) mval[rf[k].index[j]]=rf[k].p[j];
-		} else {
-			while(a1) {
-				if(a1&1) {
-					a=a_set[idd][j];
-					l=j;
-					while(a) {
-						if(a&1) mval[l]=1.0;
-						a>>=1;
-						l+=nb1;
-					}
-				}
-				a1>>=1;
-				j++;
-			}
-		}
-	}
+	} else if((k=id_array[idd].rfp)>=0) { /* Insert Previously computed R_Func */
+		for(j=0;j<n_d;j++) mval[gl_d[j]]=0.0;
+		for(j=0;j<rf[k].n_terms;j++) mval[rf[k].index[j]]=rf[k].p[j];
+	} else for(j=0;j<n_d;j++) mval[gl_d[j]]=1.0;
+	n_s=list_gtypes(mark->temp[X_MAT][ids],a_set[ids],n_bits,gl_s);
 	if(ids!=pivot && pivot!= -2 && element->sire>0) {
 		p1=get_par_probs(pval,ids,mark,pen,a_set,freq,rf,loki);
 		prob+=log(p1);
-	} else {
-		a1=mark->temp[X_MAT][ids];
-		j=0;
-		if((k=id_array[ids].rfp)>=0) { /* Insert Previously computed R_Func */
-			while(a1) {
-				if(a1&1) {
-					a=a_set[ids][j];
-					l=j;
-					while(a) {
-						if(a&1) pval[l]=0.0;
-						a>>=1;
-						l+=nb1;
-					}
-				}
-				a1>>=1;
-				j++;
-			}
-			for(j=0;j<rf[k].n_terms;j++) pval[rf[k].index[j]]=rf[k].p[j];
-		} else {
-			while(a1) {
-				if(a1&1) {
-					a=a_set[ids][j];
-					l=j;
-					while(a) {
-						if(a&1) pval[l]=1.0;
-						a>>=1;
-						l+=nb1;
-					}
-				}
-				a1>>=1;
-				j++;
-			}
-		}
-	}
-	/* Construct set of possible parental genotype combinations */
-	nmc=0;
-	k=0;
-	b1=mark->temp[X_MAT][idd];
-	while(b1) {
-		if(b1&1) {
-			b=a_set[idd][k];
-			l=0;
-			m=k;
-			while(b) {
-				if(b&1) {
-					id_set1[nmc]=k;
-					id_set2[nmc]=l;
-					id_set[nmc++]=mval[m];
-				}
-				b>>=1;
-				l++;
-				m+=nb1;
-			}
-		}
-		b1>>=1;
-		k++;
-	}
+	} else if((k=id_array[ids].rfp)>=0) { /* Insert Previously computed R_Func */
+		for(j=0;j<n_s;j++) pval[gl_s[j]]=0.0;
+		for(j=0;j<rf[k].n_terms;j++) pval[rf[k].index[j]]=rf[k].p[j];
+	} else for(j=0;j<n_s;j++) pval[gl_s[j]]=1.0;
+	/* Probabilities of possible maternal genotypes */
+	for(j=0;j<n_d;j++) id_set[j]=mval[gl_d[j]];
 	tmp_idx=tt_all;
 	k1=0;
 	for(m=0;m<n_off;m++) {
@@ -221,130 +160,27 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 			tmp_idx+=n_all;
 		}
 	}
-	t_fset=peel_fs;
-	a1=mark->temp[X_MAT][ids];
-	i=0;
-	switch(no2) {
-	 case 0:
-		while(a1) {
-			if(a1&1) {
-				a=a_set[ids][i];
-				j=0;
-				while(a) {
-					if(a&1) {
-						p1=pval[(j<<n_bits)|i];
-						for(k1=0;k1<nmc;k1++) {
-							t_fset->pat_gene[X_MAT]=i;
-							t_fset->pat_gene[X_PAT]=j;
-							t_fset->mat_gene[X_MAT]=id_set1[k1];
-							t_fset->mat_gene[X_PAT]=id_set2[k1];
-							(t_fset++)->p=p1*id_set[k1];
-							fsp++;
-						} 
-					}
-					a>>=1;
-					j++;
-				}
+	/* Construct set of possible parental genotype combinations, keeping
+	 * those that could give every distinct offspring allele set */
+	for(i1=0;i1<n_s;i1++) {
+		i=gl_s[i1]&mask;
+		j=gl_s[i1]>>n_bits;
+		p1=pval[gl_s[i1]];
+		b=(1<<i)|(1<<j);
+		for(k1=0;k1<n_d;k1++) {
+			k=gl_d[k1]&mask;
+			l=gl_d[k1]>>n_bits;
+			tmp_idx=tt_all;
+			for(m=0;m<no2;m++) {
+				if(!((tmp_idx[k]&b)||(tmp_idx[l]&b))) break;
+				tmp_idx+=n_all;
 			}
-			a1>>=1;
-			i++;
-		}
-		break;
-	 case 1:
-		while(a1) {
-			if(a1&1) {
-				a=a_set[ids][i];
-				j=0;
-				while(a) {
-					if(a&1) {
-						p1=pval[(j<<n_bits)|i];
-						b=(1<<i)|(1<<j);
-						for(k1=0;k1<nmc;k1++) {
-							k=id_set1[k1];
-							l=id_set2[k1];
-							if((tt_all[k]&b)||(tt_all[l]&b)) {
-								t_fset->pat_gene[X_MAT]=i;
-								t_fset->pat_gene[X_PAT]=j;
-								t_fset->mat_gene[X_MAT]=k;
-								t_fset->mat_gene[X_PAT]=l;
-								(t_fset++)->p=p1*id_set[k1];
-								fsp++;
-							} 
-						}
-					}
-					a>>=1;
-					j++;
-				}
-			}
-			a1>>=1;
-			i++;
-		}
-		break;
-	 case 2:
-		tmp_idx=tt_all+n_all;
-		while(a1) {
-			if(a1&1) {
-				a=a_set[ids][i];
-				j=0;
-				while(a) {
-					if(a&1) {
-						p1=pval[(j<<n_bits)|i];
-						b=(1<<i)|(1<<j);
-						for(k1=0;k1<nmc;k1++) {
-							k=id_set1[k1];
-							l=id_set2[k1];
-							if(((tt_all[k]&b)||(tt_all[l]&b))&&((tmp_idx[k]&b)||(tmp_idx[l]&b))) {
-								t_fset->pat_gene[X_MAT]=i;
-								t_fset->pat_gene[X_PAT]=j;
-								t_fset->mat_gene[X_MAT]=k;
-								t_fset->mat_gene[X_PAT]=l;
-								(t_fset++)->p=p1*id_set[k1];
-								fsp++;
-							} 
-						}
-					}
-					a>>=1;
-					j++;
-				}
-			}
-			a1>>=1;
-			i++;
-		}
-		break;
-	 default:
-		while(a1) {
-			if(a1&1) {
-				a=a_set[ids][i];
-				j=0;
-				while(a) {
-					if(a&1) {
-						p1=pval[(j<<n_bits)|i];
-						b=(1<<i)|(1<<j);
-						for(k1=0;k1<nmc;k1++) {
-							k=id_set1[k1];
-							l=id_set2[k1];
-							m=no2;
-							tmp_idx=tt_all;
-							while(m--) {
-								if(!((tmp_idx[k]&b)||(tmp_idx[l]&b))) break;
-								tmp_idx+=n_all;
-							}
-							if(m<0) {
-								t_fset->pat_gene[X_MAT]=i;
-								t_fset->pat_gene[X_PAT]=j;
-								t_fset->mat_gene[X_MAT]=k;
-								t_fset->mat_gene[X_PAT]=l;
-								(t_fset++)->p=p1*id_set[k1];
-								fsp++;
-							} 
-						}
-					}
-					a>>=1;
-					j++;
-				}
-			}
-			a1>>=1;
-			i++;
+			if(m<no2) continue;
+			fs->pat_gene[X_MAT][fsp]=i;
+			fs->pat_gene[X_PAT][fsp]=j;
+			fs->mat_gene[X_MAT][fsp]=k;
+			fs->mat_gene[X_PAT][fsp]=l;
+			fs->p[fsp++]=p1*id_set[k1];
 		}
 	}
 	/* Add contributions from non-pivot offspring */
@@ -354,25 +190,22 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 		tp=id_array[kid].tp;
 		cm[0]=cmm[0][kid];
 		cm[1]=cmm[1][kid];
-		t_fset=peel_fs;
 		if(id_array[kid].flag&SAMPLED_MAT) { /* If kid is fixed */
 			j=id_array[kid].allele[X_MAT]-1;
 			k=id_array[kid].allele[X_PAT]-1;
 			l1=(k<<n_bits)|j;
 			if(!(cm[0] || cm[1])) {
 				for(n=0;n<fsp;n++) {
-					i=t_fset->pat_gene[X_MAT];
-					j=t_fset->pat_gene[X_PAT];
-					k=t_fset->mat_gene[X_MAT];
-					l=t_fset->mat_gene[X_PAT];
-					i1=i<<n_bits;
-					j2=j<<n_bits;
+					i1=fs->pat_gene[X_MAT][n]<<n_bits;
+					j2=fs->pat_gene[X_PAT][n]<<n_bits;
+					k=fs->mat_gene[X_MAT][n];
+					l=fs->mat_gene[X_PAT][n];
 					z=0.0;
 					if((i1|k)==l1) z+=tp[X_MM_PM];
 					if((j2|k)==l1) z+=tp[X_MM_PP];
 					if((i1|l)==l1) z+=tp[X_MP_PM];
 					if((j2|l)==l1) z+=tp[X_MP_PP];
-					(t_fset++)->p*=z;
+					fs->p[n]*=z;
 				}
 			} else {
 				l=(n_all-1)<<n_bits;
@@ -382,16 +215,16 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 					id_set2[i]=(cm[X_MAT]&j)?n_all-1:i;
 				}
 				for(n=0;n<fsp;n++) {
-					i1=id_set1[t_fset->pat_gene[X_MAT]];
-					j2=id_set1[t_fset->pat_gene[X_PAT]];
-					k=id_set2[t_fset->mat_gene[X_MAT]];
-					l=id_set2[t_fset->mat_gene[X_PAT]];
+					i1=id_set1[fs->pat_gene[X_MAT][n]];
+					j2=id_set1[fs->pat_gene[X_PAT][n]];
+					k=id_set2[fs->mat_gene[X_MAT][n]];
+					l=id_set2[fs->mat_gene[X_PAT][n]];
 					z=0.0;
 					if((i1|k)==l1) z+=tp[X_MM_PM];
 					if((j2|k)==l1) z+=tp[X_MM_PP];
 					if((i1|l)==l1) z+=tp[X_MP_PM];
 					if((j2|l)==l1) z+=tp[X_MP_PP];
-					(t_fset++)->p*=z;
+					fs->p[n]*=z;
 				}
 			}
 		} else { /* Kid not fixed */
@@ -466,57 +299,35 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 				}
 				pen(qval,kid,&mark->locus,n_all,n_bits,loki);
 			}
-			if(!(cm[0] || cm[1])) {
-				for(n=0;n<fsp;n++) {
-					i1=t_fset->pat_gene[X_MAT]<<n_bits;
-					k=t_fset->mat_gene[X_MAT];
-					j2=t_fset->pat_gene[X_PAT]<<n_bits;
-					l=t_fset->mat_gene[X_PAT];
-					z=tp[X_MM_PM]*qval[i1|k]+tp[X_MM_PP]*qval[j2|k]+tp[X_MP_PM]*qval[i1|l]+tp[X_MP_PP]*qval[j2|l];
-					(t_fset++)->p*=z;
-				}
-			} else {
-				tpp1=id_array[kid].tpp[X_PAT];
-				tpp2=id_array[kid].tpp[X_MAT];
+			if(!(cm[0] || cm[1])) pk_trans_combine(fs->p,fs->pat_gene[X_MAT],fs->pat_gene[X_PAT],fs->mat_gene[X_MAT],fs->mat_gene[X_PAT],qval,tp,n_bits,fsp);
+			else {
 				l=(n_all-1)<<n_bits;
 				j2=1<<n_bits;
 				for(i=i1=0,j=1;i<n_all;i++,j<<=1,i1+=j2) {
 					id_set1[i]=(cm[X_PAT]&j)?l:i1;
 					id_set2[i]=(cm[X_MAT]&j)?n_all-1:i;
 				}
-				for(n=0;n<fsp;n++) {
-					i1=id_set1[t_fset->pat_gene[X_MAT]];
-					j2=id_set1[t_fset->pat_gene[X_PAT]];
-					k=id_set2[t_fset->mat_gene[X_MAT]];
-					l=id_set2[t_fset->mat_gene[X_PAT]];
-					if(i1!=j2) {
-						if(k!=l) z=tp[X_MM_PM]*qval[i1|k]+tp[X_MM_PP]*qval[j2|k]+tp[X_MP_PM]*qval[i1|l]+tp[X_MP_PP]*qval[j2|l];
-						else z=tpp1[X_MAT]*qval[i1|k]+tpp1[X_PAT]*qval[j2|k];
-					} else if(k!=l) z=tpp2[X_MAT]*qval[i1|k]+tpp2[X_PAT]*qval[i1|l];
-					else z=qval[i1|k];
-					(t_fset++)->p*=z;
-				}
+				pk_trans_combine_map(fs->p,fs->pat_gene[X_MAT],fs->pat_gene[X_PAT],fs->mat_gene[X_MAT],fs->mat_gene[X_PAT],qval,tp,
+											id_array[kid].tpp[X_PAT],id_array[kid].tpp[X_MAT],id_set1,id_set2,fsp);
 			}
 		}
 	}
 	assert(fsp);
 	if(pivot== -2) { /* Peeling to joint on both parents */
 		p1=0.0;
-		t_fset=peel_fs;
-		for(n=0;n<fsp;n++) p1+=(t_fset++)->p;
+		for(n=0;n<fsp;n++) p1+=fs->p[n];
 		prob+=log(p1);
 		k=element->out_index;
 		rf[k].n_ind=4;
 		rf[k].n_terms=n;
 		get_rf_memory(rf+k,n,MRK_MBLOCK,loki);
-		t_fset=peel_fs;
 		for(n=0;n<fsp;n++) {
-			gt[0]=t_fset->mat_gene[X_MAT]+1;
-			gt[1]=t_fset->mat_gene[X_PAT]+1;
-			gt[2]=t_fset->pat_gene[X_MAT]+1;
-			gt[3]=t_fset->pat_gene[X_PAT]+1;
+			gt[0]=fs->mat_gene[X_MAT][n]+1;
+			gt[1]=fs->mat_gene[X_PAT][n]+1;
+			gt[2]=fs->pat_gene[X_MAT][n]+1;
+			gt[3]=fs->pat_gene[X_PAT][n]+1;
 			rf[k].index[n]=get_index1(4,gt,n_bits);
-			rf[k].p[n]=(t_fset++)->p/p1;
+			rf[k].p[n]=fs->p[n]/p1;
 		}
 #ifdef TRACE_PEEL
 		if(CHK_PEEL(TRACE_LEVEL_2)) {
@@ -527,44 +338,24 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 	}
 	/* If pivot is an offspring, bring in previous R-Function and zero out
 	 * illegal genotypes */
+	if(pivot>=0) n_p=list_gtypes(((lk_ulong)1<<n_all)-1,a_set[pivot],n_bits,gl_p);
 	if(pivot>=0 && pivot!=ids && pivot!=idd) {
 		tp=id_array[pivot].tp;
 		cm[0]=cmm[0][pivot];
 		cm[1]=cmm[1][pivot];
-		j=0;
 		if((k=id_array[pivot].rfp)>=0) { /* Insert Previously computed R_Func */
-			for(j=0;j<n_all;j++) {
-				a=a_set[pivot][j];
-				l=j;
-				while(a) {
-					if(a&1) pivval[l]=0.0;
-					a>>=1;
-					l+=nb1;
-				}
-			}
+			for(j=0;j<n_p;j++) pivval[gl_p[j]]=0.0;
 			for(j=0;j<rf[k].n_terms;j++) pivval[rf[k].index[j]]=rf[k].p[j];
-		} else {
-			j=0;
-			for(j=0;j<n_all;j++) {
-				a=a_set[pivot][j];
-				l=j;
-				while(a) {
-					if(a&1) pivval[l]=1.0;
-					a>>=1;
-					l+=nb1;
-				}
-			}
-		}
+		} else for(j=0;j<n_p;j++) pivval[gl_p[j]]=1.0;
 		of=1;
 	} else {
 		tp=0;
 		cm[0]=cm[1]=0;
 	}
 	/* Assemble output function in qval */
-	t_fset=peel_fs;
 	if(pivot<0) {
 		p1=0.0;
-		for(n=0;n<fsp;n++) p1+=(t_fset++)->p;
+		for(n=0;n<fsp;n++) p1+=fs->p[n];
 		prob+=log(p1);
 	} else {
 		for(j=0;j<n_all;j++) {
@@ -579,62 +370,28 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 				id_set2[i]=(cm[X_MAT]&j)?n_all-1:i;
 			}
 			for(n=0;n<fsp;n++) {
-				i1=id_set1[t_fset->pat_gene[X_MAT]];
-				j2=id_set1[t_fset->pat_gene[X_PAT]];
-				k=id_set2[t_fset->mat_gene[X_MAT]];
-				l=id_set2[t_fset->mat_gene[X_PAT]];
-				z=(t_fset++)->p;
+				i1=id_set1[fs->pat_gene[X_MAT][n]];
+				j2=id_set1[fs->pat_gene[X_PAT][n]];
+				k=id_set2[fs->mat_gene[X_MAT][n]];
+				l=id_set2[fs->mat_gene[X_PAT][n]];
+				z=fs->p[n];
 				qval[i1|k]+=tp[X_MM_PM]*z;
 				qval[j2|k]+=tp[X_MM_PP]*z;
 				qval[i1|l]+=tp[X_MP_PM]*z;
 				qval[j2|l]+=tp[X_MP_PP]*z;
 			}
-		} else  {
-			if(idd==pivot) {
-				for(n=0;n<fsp;n++) {
-					k=t_fset->mat_gene[X_MAT];
-					l=t_fset->mat_gene[X_PAT];
-					z=(t_fset++)->p;
-					qval[(l<<n_bits)|k]+=z;
-				}
-			} else {
-				for(n=0;n<fsp;n++) {
-					i=t_fset->pat_gene[X_MAT];
-					j=t_fset->pat_gene[X_PAT];
-					z=(t_fset++)->p;
-					qval[(j<<n_bits)|i]+=z;
-				}
-			}
+		} else if(idd==pivot) {
+			for(n=0;n<fsp;n++) qval[(fs->mat_gene[X_PAT][n]<<n_bits)|fs->mat_gene[X_MAT][n]]+=fs->p[n];
+		} else {
+			for(n=0;n<fsp;n++) qval[(fs->pat_gene[X_PAT][n]<<n_bits)|fs->pat_gene[X_MAT][n]]+=fs->p[n];
 		}
-		i=0;
 		p1=0.0;
 		if(of) {
-			for(j=0;j<n_all;j++) {
-				a=a_set[pivot][j];
-				l=j;
-				while(a) {
-					if(a&1) {
-						p1+=(qval[l]*=pivval[l]);
-						i++;
-					}
-					l+=nb1;
-					a>>=1;
-				}
+			for(j=0;j<n_p;j++) {
+				l=gl_p[j];
+				p1+=(qval[l]*=pivval[l]);
 			}
-		} else {
-			for(j=0;j<n_all;j++) {
-				a=a_set[pivot][j];
-				l=j;
-				while(a) {
-					if(a&1) {
-						p1+=qval[l];
-						i++;
-					}
-					l+=nb1;
-					a>>=1;
-				}
-			}
-		}
+		} else for(j=0;j<n_p;j++) p1+=qval[gl_p[j]];
 #ifdef DEBUG
 		if(p1<=0.0) {
 			fprintf(stderr,"Prob. %g in peeling operation for locus %s",p1,mark->name);
@@ -646,30 +403,20 @@ double loki_simple_peelop(const struct Simple_Element *element,const int locus,c
 		k=element->out_index;
 		id_array[pivot].rfp=k;
 		rf[k].n_ind=2;
-		rf[k].n_terms=i;
+		rf[k].n_terms=n_p;
 #ifdef DEBUG
-		if(!i) ABT_FUNC("Internal error - zero possible combinations\n");
+		if(!n_p) ABT_FUNC("Internal error - zero possible combinations\n");
 #endif
-		get_rf_memory(rf+k,i,MRK_MBLOCK,loki);
+		get_rf_memory(rf+k,n_p,MRK_MBLOCK,loki);
 		p1=1.0/p1;
-		tmp1=rf[k].p;
-		tmp_idx=rf[k].index;
-		for(j=0;j<n_all;j++) {
-			a=a_set[pivot][j];
-			l=j;
-			while(a) {
-				if(a&1) {
-					z=qval[l];
-					*(tmp1++)=z*p1;
-					*(tmp_idx++)=(lk_ulong)l;
-				}
-				a>>=1;
-				l+=nb1;
-			}
+		for(j=0;j<n_p;j++) {
+			l=gl_p[j];
+			rf[k].p[j]=qval[l]*p1;
+			rf[k].index[j]=(lk_ulong)l;
 		}
 #ifdef TRACE_PEEL
 		if(CHK_PEEL(TRACE_LEVEL_3)) {
-			for(j=0;j<i;j++) {
+			for(j=0;j<n_p;j++) {
 				l=(int)rf[k].index[j];
 				printf("%d %d %g\n",(int)(1+(l&mask)),1+(l>>n_bits),rf[k].p[j]/p1);
 			}
@@ -747,7 +494,7 @@ double loki_simple_peelop_x(const struct Simple_Element *element,const int locus
 			if(s_flag) {
 				if(sex==1) {
 					do {
-						z=ranf();
+						z=ranf_r(work->rng);
 						p1=0.0;
 						for(i=0;i<n_all;i++) if(qval[i]>0.0) {
 							p1+=qval[i];
@@ -758,7 +505,7 @@ double loki_simple_peelop_x(const struct Simple_Element *element,const int locus
 					id_array[kid].allele[X_PAT]=1;
 				} else {
 					do {
-						z=ranf();
+						z=ranf_r(work->rng);
 						p1=0.0;
 						for(i=0;i<n_idx;i++) if(qval[i]>0.0) {
 							p1+=qval[i];
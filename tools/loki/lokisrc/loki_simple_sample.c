@@ -514,7 +514,7 @@ double loki_simple_sample(const struct Simple_Element *element,const int locus,p
 	prob+=log(p1);
 	if(!((id_array[ids].flag&SAMPLED_MAT)&&(id_array[idd].flag&SAMPLED_MAT))) {
 		do {
-			z=ranf()*p1;
+			z=ranf_r(work->rng)*p1;
 			p2=0.0;
 			t_fset=peel_fs;
 			for(n=0;n<fsp;n++,t_fset++) {
@@ -604,7 +604,7 @@ double loki_simple_sample(const struct Simple_Element *element,const int locus,p
 		p1+=(pp[X_MP_PP]=tp[X_MP_PP]*qval[j2|l]);
 		if(p1<=0.0) ABT_FUNC("Internal error - zero probability for child sample\n");
 		do {
-			z=ranf()*p1;
+			z=ranf_r(work->rng)*p1;
 			p2=0.0;
 			tmp=pp+3;
 			n=4;
@@ -38,6 +38,7 @@
 #include "handle_res.h"
 #include "sample_cens.h"
 #include "lk_malloc.h"
+#include "locus_index.h"
 
 static int *perm;
 static struct Locus **locilist;
@@ -114,8 +115,7 @@ static double interval_size(int j,int k,struct Link *lk,int sex_map,struct Locus
 
 struct Locus **get_sorted_locuslist(const int link,int *count,int flag)
 {
-  get_locuslist(locilist,link,count,flag);
-  gnu_qsort(locilist,(size_t)*count,(size_t)sizeof(void *),cmp_loci);
+  get_sorted_loci(locilist,link,count,flag);
   return locilist;
 }
 
@@ -261,8 +261,7 @@ void Sample_LinkageGroup(const int link,struct loki *loki)
   /*   	sample_mpos(link); */
   work=&loki->peel->workspace;
   k2=loki->markers->linkage[link].n_markers+loki->params.n_tloci;
-  get_locuslist(locilist,link,&k3,0);
-  gnu_qsort(locilist,(size_t)k3,sizeof(void *),cmp_loci);
+  get_sorted_loci(locilist,link,&k3,0);
   for(i=0;i<k3;i++) perm[i]=i;
   gen_perm(perm,k3);
   for(i=0;i<k3;i++) {
@@ -290,8 +289,7 @@ double calc_tl_like(struct Locus *loc,const int sflag,struct loki *loki)
     i=0;
     k=1;
   } else {
-    get_locuslist(locilist,link,&k,0);
-    gnu_qsort(locilist,(size_t)k,sizeof(void *),cmp_loci);
+    get_sorted_loci(locilist,link,&k,0);
     for(i=0;i<k;i++) if(locilist[i]==loc) break;
   }
   l=peel_locus(locilist,i,k,sflag,loki);
@@ -403,7 +401,7 @@ void Flip_TL_Mode(const int tl,struct loki *loki)
  */
 void Sample_TL_Position(const int tl,struct loki *loki)
 {
-  int i,j,j2,k,k1,k2,fg,link,oldlink,step,n_links;
+  int i,j,j2,k,k1,k2,link,oldlink,step,n_links;
   double l,l1,old_pos[2],map_length,z,z1,z2,r,*prob,ttm,p_i[3],p_i1[3],s1,s2;
   struct Locus *loc;
   struct Link *linkage;
@@ -471,11 +469,11 @@ void Sample_TL_Position(const int tl,struct loki *loki)
     } else {
       if(link) r-=prob[link-1]; /* Get position within the chromosome we've landed on relative to left of linkage map */
       /* Get list of loci on linkage group (excluding current locus) */
-      fg=loc->flag;
-      loc->flag&=~TL_LINKED;
-      get_locuslist(locilist,link,&k,0);
-      gnu_qsort(locilist,(size_t)k,(size_t)sizeof(void *),cmp_loci);
-      loc->flag=fg;
+      get_sorted_loci(locilist,link,&k,0);
+      for(j=0;j<k && locilist[j]!=loc;j++);
+      if(j<k) {
+	for(k--;j<k;j++) locilist[j]=locilist[j+1];
+      }
       if(loki->markers->sex_map)	{ /* Find interval */
 	for(j=0;j<k;j++) {
 	  z=locilist[j]->pos[0]-linkage[link].r1[0];
@@ -509,8 +507,7 @@ void Sample_TL_Position(const int tl,struct loki *loki)
     }
   } else { /* 'Small' move - move at most 1 interval from current location */
     step=4;
-    get_locuslist(locilist,link,&k,0);
-    gnu_qsort(locilist,(size_t)k,(size_t)sizeof(int),cmp_loci);
+    get_sorted_loci(locilist,link,&k,0);
     for(j=0;j<k;j++) if(locilist[j]==loc) break;
     assert(j<k);
     for(j2=j+1;j2<k;j2++) locilist[j2-1]=locilist[j2];
@@ -624,12 +621,11 @@ int get_tl_position(double *pos,const struct loki *loki)
   if(link<0) pos[0]=pos[1]=0.0;
   else if(loki->markers->sex_map) {
     /* Get list of loci on linkage group */
-    get_locuslist(locilist,link,&k,0);
-    gnu_qsort(locilist,(size_t)k,(size_t)sizeof(void *),cmp_loci);
+    get_sorted_loci(locilist,link,&k,0);
     /* Find interval */
     for(j=0;j<k;j++) {
-      z=locilist[j]->pos[0]=linkage[link].r1[0];
-      z+=locilist[j]->pos[1]=linkage[link].r1[1];
+      z=locilist[j]->pos[0]-linkage[link].r1[0];
+      z+=locilist[j]->pos[1]-linkage[link].r1[1];
       if(z>=z1) break;
     }
     /* Sample male and female positions (independently) within chosen interval */
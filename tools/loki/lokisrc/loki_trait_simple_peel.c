@@ -80,7 +80,7 @@ double loki_trait_simple_peelop(const struct Simple_Element *element,const int l
       prob+=log(p1);
       if(s_flag) {
 	do {
-	  z=ranf();
+	  z=ranf_r(work->rng);
 	  p1=0.0;
 	  for(i=0;i<n_idx;i++) if(qval[i])	{
 	    p1+=qval[i];
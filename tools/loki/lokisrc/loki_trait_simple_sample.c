@@ -201,7 +201,7 @@ double loki_trait_simple_sample(const struct Simple_Element *element,const int l
 	}
 	prob+=log(p1);
 	do {
-		z=ranf()*p1;
+		z=ranf_r(work->rng)*p1;
 		p2=0.0;
 		tmp=peel_famval;
 		for(i=0;i<16;i++) {
@@ -260,7 +260,7 @@ double loki_trait_simple_sample(const struct Simple_Element *element,const int l
 #ifdef DEBUG
 				if(p1<=0.0) ABT_FUNC("Internal error - no offspring combination possible\n");
 #endif
-				z=ranf()*p1;
+				z=ranf_r(work->rng)*p1;
 				id_array[kid].allele[X_MAT]=(z<=pp[X_MAT])?k2:l2;
 				id_array[kid].allele[X_PAT]=i2;
 			} else if(jj==2) {
@@ -271,7 +271,7 @@ double loki_trait_simple_sample(const struct Simple_Element *element,const int l
 #ifdef DEBUG
 				if(p1<=0.0) ABT_FUNC("Internal error - no offspring combination possible\n");
 #endif
- 				z=ranf()*p1;
+ 				z=ranf_r(work->rng)*p1;
 				id_array[kid].allele[X_PAT]=(z<=pp[X_MAT])?i2:j2;
 				id_array[kid].allele[X_MAT]=k2;
 			} else {
@@ -284,7 +284,7 @@ double loki_trait_simple_sample(const struct Simple_Element *element,const int l
 #ifdef DEBUG
 				if(p1<=0.0) ABT_FUNC("Internal error - no offspring combination possible\n");
 #endif
-				z=safe_ranf()*p1;
+				z=safe_ranf_r(work->rng)*p1;
 				p2=0.0;
 				for(n=0;n<4;n++) {
 					if(pp[n]>0.0) {
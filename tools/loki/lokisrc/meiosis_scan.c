@@ -30,16 +30,18 @@
 #include "utils.h"
 #include "loki.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "loki_peel.h"
 #include "loki_utils.h"
 #include "seg_pen.h"
 #include "gen_pen.h"
 #include "meiosis_scan.h"
+#include "locus_index.h"
 
-static int *nnfd_st,*par_st,*gpfam_st,*fam_st,mem_list_size,mem_list_ptr;
+static int *nnfd_st,*par_st,*gpfam_st,*fam_st;
 static int *nnfd_list,*par_list,*fam_list,*gpfam_list,*temp_list;
 static struct nuc_family *families;
-static void **mem_list;
+static struct arena *ms_arena;
 
 static double mscan_prob[]={MSCAN_INDIVIDUAL,
 	  MSCAN_HS_FAMILY,
@@ -77,36 +79,6 @@ int set_mscan_probs(double *p)
 	return err;
 }
 
-static void *realloc_and_remember(void *p,size_t size)
-{
-	int i;
-	
-	for(i=0;i<mem_list_ptr;i++) if(mem_list[i]==p) break;
-	if(i<mem_list_ptr) {
-		p=realloc(p,size);
-		mem_list[i]=p;
-	} else p=0;
-	return p;
-}
-
-static void *malloc_and_remember(size_t size)
-{
-	void *p;
-	
-	if(mem_list_ptr==mem_list_size) {
-		if(mem_list_size) {
-			mem_list_size*=1.5;
-			mem_list=lk_realloc(mem_list,sizeof(void *)*mem_list_size);
-		} else {
-			mem_list_size=16;
-			mem_list=lk_malloc(sizeof(void *)*mem_list_size);
-		}
-	}
-	p=malloc(size);
-	if(p) mem_list[mem_list_ptr++]=p;
-	return p;
-}
-
 static void init_families(const struct loki *loki)
 {
 	int j,i1,cs,comp,nnfd,npar,nfam,ngpfam;
@@ -115,11 +87,11 @@ static void init_families(const struct loki *loki)
 	
 	n_comp=loki->pedigree->n_comp;
 	ped_size=loki->pedigree->ped_size;
-	if(!(nnfd_st=malloc_and_remember(sizeof(int)*(n_comp+1)*4))) ABT_FUNC(MMsg);
+	nnfd_st=arena_alloc(ms_arena,sizeof(int)*(n_comp+1)*4);
 	par_st=nnfd_st+n_comp+1;
 	fam_st=par_st+n_comp+1;
 	gpfam_st=fam_st+n_comp+1;
-	if(!(nnfd_list=malloc_and_remember(sizeof(int)*3*ped_size))) ABT_FUNC(MMsg);
+	nnfd_list=arena_alloc(ms_arena,sizeof(int)*3*ped_size);
 	par_list=nnfd_list+ped_size;
 	temp_list=par_list+ped_size;
 	id_array=loki->pedigree->id_array;
@@ -155,8 +127,8 @@ static void init_families(const struct loki *loki)
 		for(comp=0;comp<=n_comp;comp++) fam_st[comp]=gpfam_st[comp]=0;
 		return;
 	}
-	if(!(families=malloc_and_remember(sizeof(struct nuc_family)*nfam))) ABT_FUNC(MMsg);
-	if(!(fam_list=malloc_and_remember(sizeof(int)*(nfam+ngpfam+nk)))) ABT_FUNC(MMsg);
+	families=arena_alloc(ms_arena,sizeof(struct nuc_family)*nfam);
+	fam_list=arena_alloc(ms_arena,sizeof(int)*(nfam+ngpfam+nk));
 	gpfam_list=fam_list+nfam;
 	kid_list=gpfam_list+ngpfam;
 	for(nk=nfam=ngpfam=j=comp=0;comp<n_comp;comp++) {
@@ -199,7 +171,7 @@ void meiosis_scan(int link,const struct loki *loki)
 	int i,i1,j,k,k1,k2,k3,kk,n_loci,s,s1,s2,s3,s1a=0,s2a=0,ss,locus,comp;
 	int idd,ids,mf,ffg[4],scl,update_type,cs,nkids,state;
 	int sex,**seg,**seg1,kid1,kid,nkids1,*kids,lffg,symflag,n_qtl;
-	double x,x1,xx,xx1,xx2,rr[2],z,z1,z2,zz,zz1[4];
+	double xx,xx1,xx2,rr[2],z,z1,z2,zz,zz1[4];
 	static double *recom[2],*pp[4],*pen[4],*lks[4],**lk_store;
 	static int *loc_fg,***seg_list,ctr,*tmp_arr=0,tmp_arr_size=0;
 	static struct Locus **loci1,*qtl;
@@ -207,12 +179,8 @@ void meiosis_scan(int link,const struct loki *loki)
 	struct Marker *marker;
 
 	if(link<0) { /* Free space and prevent reuse */
-		if(mem_list) {
-			for(i=0;i<mem_list_ptr;i++) if(mem_list[i]) free(mem_list[i]);
-			free(mem_list);
-			mem_list=0;
-			mem_list_size=mem_list_ptr=0;
-		}
+		arena_free(ms_arena);
+		ms_arena=0;
 		return;
 	}
 	n_loci=loki->markers->linkage[link].n_markers+loki->params.max_tloci;
@@ -220,12 +188,13 @@ void meiosis_scan(int link,const struct loki *loki)
 	id_array=loki->pedigree->id_array;
 	marker=loki->markers->marker;
 	if(!pp[0]) { /* Allocate space on first time through */
+		ms_arena=arena_new("meiosis_scan",0);
 		for(j=i=0;i<loki->markers->n_links;i++) {
 			k=loki->markers->linkage[i].n_markers;
 			if(k>j) j=k;
 		}
 		j+=loki->params.max_tloci;
-		if(!(pp[0]=malloc_and_remember(sizeof(double)*(14*j-1)))) ABT_FUNC(MMsg);
+		pp[0]=arena_alloc(ms_arena,sizeof(double)*(14*j-1));
 		pen[0]=pp[0]+4*j;
 		lks[0]=pen[0]+4*j;
 		recom[0]=lks[0]+4*j;
@@ -235,10 +204,10 @@ void meiosis_scan(int link,const struct loki *loki)
 			pen[i]=pen[i-1]+j;
 			lks[i]=lks[i-1]+j;
 		}
-		if(!(seg_list=malloc_and_remember(sizeof(void *)*j*2))) ABT_FUNC(MMsg);
+		seg_list=arena_alloc(ms_arena,sizeof(void *)*j*2);
 		lk_store=(void *)(seg_list+j);
-		if(!(loc_fg=malloc_and_remember(sizeof(int)*j))) ABT_FUNC(MMsg);
-		if(!(loci1=malloc_and_remember(sizeof(void *)*j))) ABT_FUNC(MMsg);
+		loc_fg=arena_alloc(ms_arena,sizeof(int)*j);
+		loci1=arena_alloc(ms_arena,sizeof(void *)*j);
 		init_families(loki);
 		/* Normalize mscan type probabilities */
 		for(z1=0.0,update_type=0;update_type<4;update_type++) z1+=mscan_prob[update_type];
@@ -246,7 +215,7 @@ void meiosis_scan(int link,const struct loki *loki)
 		z1=1.0/z1;
 		for(update_type=0;update_type<4;update_type++) mscan_prob[update_type]*=z1;
 		tmp_arr_size=32;
-		if(!(tmp_arr=malloc_and_remember(sizeof(int)*tmp_arr_size))) ABT_FUNC(MMsg);
+		tmp_arr=arena_alloc(ms_arena,sizeof(int)*tmp_arr_size);
 		if(atexit(free_meiosis_scan)) message(WARN_MSG,"Unable to register exit function free_meiosis_scan()\n");
 	}
 	z=safe_ranf();
@@ -302,14 +271,13 @@ void meiosis_scan(int link,const struct loki *loki)
 				loci1[k2]->lk_store[comp]=z;
 			}
 		} 
-		gnu_qsort(loci1,(size_t)n_loci,sizeof(void *),cmp_loci);
-		for(s=0;s<2;s++) {
-			x=loci1[0]->pos[s];
-			for(k=1;k<n_loci;k++) {
-				x1=loci1[k]->pos[s];
-				recom[s][k-1]=.5*(1.0-exp(0.02*(x-x1)));
-				x=x1;
-			}
+		/* The same markers in map order */
+		get_sorted_loci(loci1,link,&k,1);
+		for(k1=k2=0;k2<k;k2++) if(loki->markers->marker[loci1[k2]->index].n_all1[comp]>=2) loci1[k1++]=loci1[k2];
+		for(k=1;k<n_loci;k++) {
+			locus_recom(loci1[k-1],loci1[k],rr);
+			recom[0][k-1]=rr[0];
+			recom[1][k-1]=rr[1];
 		}
 		for(k=0;k<n_loci;k++) {
 			seg_list[k]=loci1[k]->seg;
@@ -562,7 +530,7 @@ void meiosis_scan(int link,const struct loki *loki)
 				sex=id_array[i].sex;
 				if(nkids>tmp_arr_size) {
 					tmp_arr_size=nkids;
-					if(!(tmp_arr=realloc_and_remember(tmp_arr,sizeof(int)*nkids))) ABT_FUNC(MMsg);
+					tmp_arr=arena_alloc(ms_arena,sizeof(int)*nkids);
 				}
 				kids=tmp_arr;
 				for(k=0;k<nkids;k++) kids[k]=id_array[i].kids[k]->idx;
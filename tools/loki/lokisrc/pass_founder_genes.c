@@ -23,13 +23,14 @@
 #include "loki.h"
 #include "loki_peel.h"
 #include "seg_pen.h"
+#include "update_segs.h"
 
 static struct cg_stack *stack;
 static int stack_size=256;
 
 void pass_founder_genes(struct Locus *loc,const struct loki *loki)
 {
-  int i,i1,j,s,**genes,**seg,comp,cs;
+  int i,i1,j,s,**genes,**seg,comp,cs,g[2],ch;
   struct Id_Record *id_array;
 	
   genes=loc->genes;
@@ -37,8 +38,11 @@ void pass_founder_genes(struct Locus *loc,const struct loki *loki)
   id_array=loki->pedigree->id_array;
   for(i=comp=0;comp<loki->pedigree->n_comp;comp++) { 
     cs=loki->pedigree->comp_size[comp];
+    ch=0;
     if(!(loki->pedigree->singleton_flag[comp])) {
       for(i1=j=0;i1<cs;i1++,i++) {
+	g[X_PAT]=genes[X_PAT][i];
+	g[X_MAT]=genes[X_MAT][i];
 	s=seg[X_PAT][i];
 #ifdef DEBUG
 	if(s<-1) ABT_FUNC("Shouldn't happen!\n");
@@ -67,6 +71,7 @@ void pass_founder_genes(struct Locus *loc,const struct loki *loki)
 #endif
 	  genes[X_MAT][i]= ++j;
 	}
+	if(genes[X_PAT][i]!=g[X_PAT] || genes[X_MAT][i]!=g[X_MAT]) ch=1;
       }
 #ifdef DEBUG
       if(j>loki->pedigree->comp_ngenes[comp]) {
@@ -75,10 +80,13 @@ void pass_founder_genes(struct Locus *loc,const struct loki *loki)
 #endif
     } else {
       for(i1=j=0;i1<cs;i1++,i++) {
+	if(genes[X_MAT][i]!=j+1 || genes[X_PAT][i]!=j+2) ch=1;
 	genes[X_MAT][i]=++j;
 	genes[X_PAT][i]=++j;
       }
     }
+    /* Only components where the genes have changed need seg_pen() again */
+    if(ch) seg_dirty(loc,comp);
   }
 }
 
@@ -159,6 +167,7 @@ int pass_founder_genes1(const int locus,int i,int par_flag,const struct loki *lo
     hap=mark->haplo;
     if(mark->mterm && mark->mterm[0]) locus_type=1;
     else locus_type=0;
+    seg_dirty(loc,id_array[i].comp);
     genes=loc->genes;
     seg=loc->seg;
     g=genes[par_flag][i];
@@ -264,6 +273,7 @@ int pass_founder_genes1a(const int locus,const int *kids,const int nkids,int par
     loc=&mark->locus;
     if(mark->mterm && mark->mterm[0]) locus_type=1;
     else locus_type=0;
+    seg_dirty(loc,id_array[i].comp);
     genes=loc->genes;
     seg=loc->seg;
     hap=mark->haplo;
@@ -380,6 +390,7 @@ int pass_founder_genes1b(const int locus,const int *kids,const int nkids,const s
     loc=&mark->locus;
     if(mark->mterm && mark->mterm[0]) locus_type=1;
     else locus_type=0;
+    seg_dirty(loc,id_array[i].comp);
     genes=loc->genes;
     seg=loc->seg;
     hap=mark->haplo;
@@ -486,6 +497,7 @@ int pass_founder_genes2(const int locus,const int comp,int **seg,const struct lo
   mark=loki->markers->marker+locus;
   if(mark->n_all1[comp]<2) return fg; 
   id_array=loki->pedigree->id_array;
+  seg_dirty(&mark->locus,comp);
   genes=mark->locus.genes;
   hap=mark->haplo;
   i=loki->pedigree->comp_start[comp];
@@ -26,6 +26,7 @@
 #include "utils.h"
 #include "loki.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "bin_tree.h"
 #include "loki_utils.h"
 #include "ped_utils.h"
@@ -192,8 +193,7 @@ void build_families(struct loki *loki)
     n_kids+=2;
   }
   if(!n_kids) return;
-  kd=lk_malloc(sizeof(void *)*n_kids);
-  loki->sys.RemBlock=AddRemem(kd,loki->sys.RemBlock);
+  kd=arena_alloc(lk_arena(ARENA_SETUP),sizeof(void *)*n_kids);
   for(i=0;i<ped_size;i++) {
     if(id_array[i].nkids) {
       id_array[i].kids=kd;
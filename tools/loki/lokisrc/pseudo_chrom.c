@@ -43,14 +43,21 @@
 #include "loki_compress.h"
 #include "loki_tlmoves.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "locus.h"
 #include "seg_pen.h"
 #include "gen_elim.h"
 #include "get_peelseq.h"
 #include "pseudo_chrom.h"
+#include "locus_index.h"
+#include "update_segs.h"
+#include "seg_kernels.h"
 
 #define link my_link
 
+/* Non-founders in a batch for sample_pseudo_segs() */
+#define PS_LANES 4
+
 void handle_pseudochrom(struct loki *loki)
 {
   int link,i,n,n1,*mk_ix;
@@ -68,8 +75,7 @@ void handle_pseudochrom(struct loki *loki)
     i=n+loki->markers->n_markers;
     loki->markers->marker=lk_realloc(loki->markers->marker,(size_t)i*sizeof(struct Marker));
     memset(loki->markers->marker+loki->markers->n_markers,0,n*sizeof(struct Marker));
-    mk_ix=lk_malloc(sizeof(int)*n);
-    loki->sys.RemBlock=AddRemem(mk_ix,loki->sys.RemBlock);
+    mk_ix=arena_alloc(lk_arena(ARENA_SETUP),sizeof(int)*n);
     /* Now add extra linkage groups */
     n1+=loki->markers->n_links;
     loki->markers->linkage=lk_realloc(loki->markers->linkage,sizeof(struct Link)*n1);
@@ -100,8 +106,7 @@ void handle_pseudochrom(struct loki *loki)
 	mk=loki->markers->marker+lk->mk_index[i];
 	mk1=loki->markers->marker+lk1->mk_index[i];
 	s=strlen(mk->name);
-	mk1->name=lk_malloc(s+2);
-	loki->sys.RemBlock=AddRemem(mk1->name,loki->sys.RemBlock);
+	mk1->name=arena_alloc(lk_arena(ARENA_SETUP),s+2);
 	memcpy(mk1->name,mk->name,s);
 	mk1->name[s]='\'';
 	mk1->name[s+1]=0;
@@ -119,9 +124,10 @@ void handle_pseudochrom(struct loki *loki)
 
 static void sample_pseudo_segs(int link,struct loki *loki)
 {
-  int i,j,k,n,par,pedsize,**seg,s,newlink;
+  int i,j,k,n,nb,par,pedsize,**seg,s,newlink,ids[PS_LANES],*sk;
   struct Locus **list,**list1;
-  double *recom[2],x,x1,*p[2],pp[2],z,z1,newpos[2],oldpos[2];
+  double *recom[2],pp[2],z,z1,newpos[2],oldpos[2],*u;
+  struct seg_work w;
   struct Id_Record *id_array;
   struct Link *lk,*lk_real;
   struct Marker *mk,*mk1;
@@ -144,13 +150,10 @@ static void sample_pseudo_segs(int link,struct loki *loki)
   if(!n) return;
   recom[0]=lk_malloc(sizeof(double)*2*n);
   recom[1]=recom[0]+n;
-  for(par=0;par<2;par++) {
-    x=list[0]->pos[par];
-    for(j=1;j<n;j++) {
-      x1=list[j]->pos[par];
-      recom[par][j-1]=.5*(1.0-exp(.02*(x-x1)));
-      x=x1;
-    }
+  for(j=1;j<n;j++) {
+    locus_recom(list[j-1],list[j],pp);
+    recom[0][j-1]=pp[0];
+    recom[1][j-1]=pp[1];
   }
   /* Do we have any linked trait loci ? */
   for(i=j=0;i<n;i++) if(list[i]->type&ST_TRAITLOCUS) j++;
@@ -197,55 +200,42 @@ static void sample_pseudo_segs(int link,struct loki *loki)
   }
   /* Still have linked trait loci? */
   if(j) {/* Yes - sample segs conditional on trait locus pattern */
-    p[0]=lk_malloc(sizeof(double)*2*n);
-    p[1]=p[0]+n;
-    for(i=0;i<pedsize;i++) {
-      if(id_array[i].sire) {
-	for(par=0;par<2;par++) {
-	  if(list[0]->type&ST_TRAITLOCUS) {
-	    s=list[0]->seg[par][i];
-	    if(s>=0) {
-	      p[s][0]=1.0;
-	      p[s^1][0]=0.0;
-	    } else p[0][0]=p[1][0]=0.5;
-	  } else p[0][0]=p[1][0]=0.5;
-	  for(j=1;j<n;j++) {
-	    if(list[j]->type&ST_TRAITLOCUS) {
-	      s=list[j]->seg[par][i];
-	      if(s>=0) {
-		pp[s]=1.0;
-		pp[s^1]=0.0;
-	      } else pp[0]=pp[1]=0.5;
-	    } else pp[0]=pp[1]=0.5;
-	    z=recom[par][j-1];
-	    p[0][j]=pp[0]*((1.0-z)*p[0][j-1]+z*p[1][j-1]);
-	    p[1][j]=pp[1]*((1.0-z)*p[1][j-1]+z*p[0][j-1]);
-	  }
-	  j--;
-	  z=p[0][j]+p[1][j];
-	  s=(ranf()*z<p[0][j])?0:1;
-	  list[j--]->seg[par][i]=s;
-	  for(;j>=0;j--) {
-	    pp[s]=p[s][j]*((1.0-z)*p[s][j+1]+z*p[s^1][j+1]);
-	    pp[s^1]=p[s^1][j]*((1.0-z)*p[s^1][j+1]+z*p[s][j+1]);
-	    z=pp[0]+pp[1];
-	    s=(ranf()*z<pp[0])?0:1;
-	    list[j]->seg[par][i]=s;
-	  }
+    /* Batches of PS_LANES non-founders, with the maternal meioses in the
+     * first PS_LANES lanes and the paternal ones in the rest */
+    sk_alloc(&w,n,2*PS_LANES);
+    for(i=0;i<pedsize;) {
+      for(nb=0;i<pedsize && nb<PS_LANES;i++) {
+	if(id_array[i].sire) ids[nb++]=i;
+	else for(j=0;j<n;j++) {
+	  seg=list[j]->seg;
+	  seg[X_MAT][i]=seg[X_PAT][i]=-1;
 	}
-      } else for(j=0;j<n;j++) {
-	seg=list[j]->seg;
-	seg[X_MAT][i]=seg[X_PAT][i]=-1;
+      }
+      if(!nb) break;
+      for(j=0;j<n;j++) {
+	sk=w.s+j*w.n_lanes;
+	for(par=0;par<2;par++,sk+=PS_LANES) {
+	  if(list[j]->type&ST_TRAITLOCUS) for(k=0;k<nb;k++) sk[k]=list[j]->seg[par][ids[k]];
+	  else for(k=0;k<nb;k++) sk[k]=-1;
+	}
+      }
+      for(par=0;par<2;par++) sk_forward(&w,n,par*PS_LANES,par*PS_LANES+nb,recom[par]);
+      for(k=0;k<nb;k++) for(par=0;par<2;par++) sk_backward(&w,n,par*PS_LANES+k,recom[par],&lk_rng);
+      for(j=0;j<n;j++) {
+	sk=w.s+j*w.n_lanes;
+	for(par=0;par<2;par++,sk+=PS_LANES) for(k=0;k<nb;k++) list[j]->seg[par][ids[k]]=sk[k];
       }
     }
-    free(p[0]);
+    sk_free(&w);
   } else { /* No, assign seg pattern at random */
+    u=lk_malloc(sizeof(double)*2*n);
     for(i=0;i<pedsize;i++) {
       if(id_array[i].sire) {
-	for(par=0;par<2;par++) {
-	  s=list[0]->seg[par][i]=ranf()<.5?1:0;
+	ranf_block(u,2*n);
+	for(k=par=0;par<2;par++) {
+	  s=list[0]->seg[par][i]=u[k++]<.5?1:0;
 	  for(j=1;j<n;j++) {
-	    if(ranf()<recom[par][j-1]) s^=1;
+	    if(u[k++]<recom[par][j-1]) s^=1;
 	    list[j]->seg[par][i]=s;
 	  }
 	}
@@ -254,6 +244,7 @@ static void sample_pseudo_segs(int link,struct loki *loki)
 	seg[X_MAT][i]=seg[X_PAT][i]=-1;
       }
     }
+    free(u);
   }
   free(recom[0]);
 }
@@ -347,6 +338,8 @@ void sample_pseudo_chromosomes(struct loki *loki)
 	  }
 	  loki->peel->peelseq_head[j]=get_peelseq(&loki->markers->marker[j].locus,loki,ltype);
 	  loki->markers->marker[j].locus.flag|=LOCUS_SAMPLED;
+	  /* The haplotypes have changed */
+	  seg_dirty(&loki->markers->marker[j].locus,-1);
 	}
 	get_peelseq(0,0,0);
 	min_deg(0,0,0,0,0);
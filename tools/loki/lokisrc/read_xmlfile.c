@@ -42,8 +42,10 @@
 #include "loki_utils.h"
 #include "loki_compress.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "xml.h"
 #include "locus.h"
+#include "hash_map.h"
 
 #define link my_link
 
@@ -76,7 +78,7 @@ typedef struct rec {
 
 typedef struct {
 	char *name;
-	struct bin_node *var_list;
+	struct hash_map *var_list;
 	var *var_list1;
 	record *rec_list;
 	int type;
@@ -318,42 +320,15 @@ static int goto_tab2[]={
 
 /* End of automatically generated section                                    */
 
-static int cmp_var(const void *p1,const void *p2)
-{
-	const var *v1,*v2;
-	
-	v1=p1;
-	v2=p2;
-	return strcmp(v1->name,v2->name);
-}
-
-static struct bin_node *new_var(const void *p)
-{
-	struct bin_node *nd;
-	
-	nd=lk_malloc(sizeof(struct bin_node));
-	nd->left=nd->right=0;
-	nd->balance=0;
-	nd->data=(void *)p;
-	return nd; 
-}
-
 static var *find_var(char *s,int *g)
 {
 	int i;
-	var *vv=0,v;
-	struct bin_node *nd;
+	var *vv=0;
 	
-	v.name=s;
 	for(i=0;i<n_grps;i++) {
-		nd=grps[i].var_list;
-		if(nd) {
-			nd=find_bin_node(nd,&v,cmp_var);
-			if(nd) {
-				vv=nd->data;
-				if(g) *g=i;
-				break;
-			}
+		if(grps[i].var_list && (vv=hmap_find(grps[i].var_list,s))) {
+			if(g) *g=i;
+			break;
 		}
 	}
 	return vv;
@@ -388,17 +363,22 @@ static void change_state(int i)
 	} else state=goto_tab2[j];
 }
 
-static var *link_vars(struct bin_node *nd,var *v)
+/* Link the variables of a group into a list sorted by name */
+static var *link_vars(struct hash_map *hm)
 {
-	var *vv;
+	struct hmap_entry **ent;
+	var *v=0,*vv;
+	size_t i;
 	
-	if(nd->left) v=link_vars(nd->left,v);
-	vv=nd->data;
-	vv->next=v;
-	v=vv;
-	if(nd->right) v=link_vars(nd->right,v);
+	ent=hmap_sorted(hm);
+	for(i=hm->n;i>0;i--) {
+		vv=ent[i-1]->data;
+		vv->next=v;
+		v=vv;
+	}
+	free(ent);
 	return v;
-}				
+}
 
 static void sort_records(void)
 {
@@ -415,7 +395,6 @@ static void sort_records(void)
 	struct Id_Record *id_array;
 	struct Link *link;
 	struct Marker *mark;
-	struct bin_node *nd;
 	
 	if(err_ct) {
 		state=__ERR_STAGE;
@@ -435,9 +414,8 @@ static void sort_records(void)
 			/* Variables with data */
 			k=0; 
 			gflag=0;
-			nd=grps[i].var_list;
-			if(nd) {
-				vv=link_vars(nd,0);
+			if(grps[i].var_list) {
+				vv=link_vars(grps[i].var_list);
 				grps[i].var_list1=vv;
 				while(vv) {
 					if(!vv->type) ABT_FUNC("Internal error - untyped variable\n");
@@ -489,8 +467,7 @@ static void sort_records(void)
 			}
 			k2+=k1*k;
 		} else {
-			nd=grps[i].var_list;
-			vv=nd?link_vars(nd,0):0;
+			vv=grps[i].var_list?link_vars(grps[i].var_list):0;
 			grps[i].var_list1=vv;
 			while(vv) {
 				switch(vv->type) {
@@ -530,11 +507,9 @@ static void sort_records(void)
 	}
 	/* Set up storage for permanent data records */
 	if(k2) {
-		iddata=lk_malloc(sizeof(struct id_data)*k2);
-		loki->sys.RemBlock=AddRemem(iddata,loki->sys.RemBlock);
+		iddata=arena_alloc(lk_arena(ARENA_SETUP),sizeof(struct id_data)*k2);
 		if(k3) {
-			iddata_p=lk_malloc(sizeof(void *)*k3);
-			loki->sys.RemBlock=AddRemem(iddata_p,loki->sys.RemBlock);
+			iddata_p=arena_alloc(lk_arena(ARENA_SETUP),sizeof(void *)*k3);
 		}
 	}
 	if(n_markers) {
@@ -549,8 +524,7 @@ static void sort_records(void)
 	for(k1=i=0;i<loki->pedigree->ped_size;i++) k1+=id_array[i].n_gt_sets;
 	if(k1) {
 		int *tmp_p;
-		tmp_p=lk_malloc(sizeof(int)*k1);
-		loki->sys.RemBlock=AddRemem(tmp_p,loki->sys.RemBlock);
+		tmp_p=arena_alloc(lk_arena(ARENA_SETUP),sizeof(int)*k1);
 		for(k1=i=0;i<loki->pedigree->ped_size;i++) {
 			k=id_array[i].n_gt_sets;
 			if(k) {
@@ -697,8 +671,7 @@ static void sort_records(void)
 			k+=k1;
 		}
 		if(k) {
-			mk_ix=lk_malloc(sizeof(int)*k);
-			loki->sys.RemBlock=AddRemem(mk_ix,loki->sys.RemBlock);
+			mk_ix=arena_alloc(lk_arena(ARENA_SETUP),sizeof(int)*k);
 		} else mk_ix=0;
 		er=0;
 		for(j=0;j<loki->markers->n_links;j++) {
@@ -813,10 +786,10 @@ static void sort_records(void)
 							}
 								if(k) {
 								if(vv->type==2) {
-									data->data.rvalue=strtod(tok->toks[j],&p1);
+									data->data.rvalue=lk_strtod(tok->toks[j],&p1);
 									data->flag|=ST_REALTYPE;
 								} else {
-									data->data.value=(int)strtol(tok->toks[j],&p1,10);
+									data->data.value=(int)lk_strtol(tok->toks[j],&p1);
 									data->flag|=ST_INTTYPE;
 								}
 								if(*p1) {
@@ -829,7 +802,7 @@ static void sort_records(void)
 					case 4: /* Microsatellite genotypes */
 					case 8: /* SNPs */
 						if(k) {
-							k1=(int)strtol(tok->toks[j],&p1,10);
+							k1=(int)lk_strtol(tok->toks[j],&p1);
 							if(*p1) {
 								fprintf(stderr,"Bad numeric data '%s' for marker '%s'\n",tok->toks[j],vv->name);
 								ABT_FUNC(AbMsg);
@@ -1166,6 +1139,7 @@ static void var_func(const args *attr)
 {
 	int i;
 	var *cvar;
+	struct hmap_entry *e;
 	const args *attr1;
 	
 	attr1=get_single_attr(attr,"name","var");
@@ -1191,7 +1165,9 @@ static void var_func(const args *attr)
 	if(attr1) cvar->flags=strdup(attr1->att);
 	attr1=get_single_attr(attr,"parent",0);
 	if(attr1) cvar->parent=strdup(attr1->att);
-	grps[n_grps-1].var_list=insert_bin_node(grps[n_grps-1].var_list,cvar,0,cmp_var,new_var);
+	if(!grps[n_grps-1].var_list) grps[n_grps-1].var_list=hmap_new(HMAP_STRING,0);
+	e=hmap_insert(grps[n_grps-1].var_list,cvar->name,&i);
+	if(!i) e->data=cvar;
 	vlist=cvar;
 }
 
@@ -1633,8 +1609,7 @@ static void close_loki(void)
 		/* Allocate storage for models */
 		if(n_models) {
 			loki->models->models=malloc(sizeof(struct Model)*n_models);
-			terms=lk_malloc(sizeof(struct Model_Term)*n_terms);
-			loki->sys.RemBlock=AddRemem(terms,loki->sys.RemBlock);
+			terms=arena_alloc(lk_arena(ARENA_SETUP),sizeof(struct Model_Term)*n_terms);
 			n_models=n_terms=0;
 			mod=modlist;
 			while(mod) {
@@ -1704,12 +1679,10 @@ static void close_loki(void)
 			use_student_t=loki->models->use_student_t;
 			i=1+(use_student_t?1:0)+(cens_flag?1:0);
 			i*=n_models*loki->pedigree->ped_size;
-			tpp=lk_malloc(sizeof(void *)*i);
+			tpp=arena_alloc(lk_arena(ARENA_SETUP),sizeof(void *)*i);
 			for(j=0;j<i;j++) tpp[j]=0;
-			loki->sys.RemBlock=AddRemem(tpp,loki->sys.RemBlock);
 			if(poly_flag) {
-				td=lk_malloc(sizeof(double)*loki->pedigree->ped_size*n_models*3);
-				loki->sys.RemBlock=AddRemem(td,loki->sys.RemBlock);
+				td=arena_alloc(lk_arena(ARENA_SETUP),sizeof(double)*loki->pedigree->ped_size*n_models*3);
 			} else td=0;
 			id_array=loki->pedigree->id_array;
 			for(j=0;j<loki->pedigree->ped_size;j++) {
@@ -1744,8 +1717,7 @@ static void close_loki(void)
 					} else j+=id_array[i].n_rec*k1;
 				}
 				if(j) {
-					td=lk_malloc(sizeof(double)*j);
-					loki->sys.RemBlock=AddRemem(td,loki->sys.RemBlock);
+					td=arena_alloc(lk_arena(ARENA_SETUP),sizeof(double)*j);
 					for(i=0;i<loki->pedigree->ped_size;i++) {
 						if(type&ST_CONSTANT) {
 							data=id_array[i].data;
@@ -1875,6 +1847,7 @@ static void FreeXMLFile(void)
 			free(vv);
 			vv=vv1;
 		}
+		hmap_free(grps[i].var_list,0);
 		free(grps[i].name);
 	}
 	if(grps) free(grps); 
@@ -37,9 +37,17 @@
 #include "sparse.h"
 #include "loki.h"
 #include "loki_utils.h"
+#include "arena.h"
 #include "sample_rand.h"
 #include "sample_effects.h"
 #include "min_deg.h"
+#include "sn_chol.h"
+#include "loki_peel.h"
+
+/* Models with this many levels (other than the mean and QTLs) or more are
+ * factorized with sn_chol.c, unless candidate genes are in the model (their
+ * levels in X'X move around as the genotypes are resampled) */
+#define SN_MIN_LEVELS 2000
 
 static int n_var,n_lev,cov_start,mk_start,rand_start,poly_start;
 static int bsize=1024,*order,XX_size,entry_size,*zero,init_flag;
@@ -55,6 +63,12 @@ static double **full_xx;
 static struct entry *entry;
 static int full_store=60;
 static struct loki *loki;
+/* Supernodal path: the levels of the mean and QTLs (equation positions
+ * below sn_blev) are kept in full_xx, the others in sn_fac, and the
+ * elements between them in the first sn_blev columns of sn_w */
+static struct sn_chol *sn_fac;
+static double *sn_w;
+static int sn_wcols,sn_blev,sn_tlev;
 
 static struct Off *alloc_new_nodes(int n)
 {
@@ -64,8 +78,7 @@ static struct Off *alloc_new_nodes(int n)
 #ifdef DEBUG
   if(!n) ABT_FUNC("Internal error - called with zero argument\n");
 #endif
-  if(!(p=malloc(sizeof(struct Off)*n))) ABT_FUNC(MMsg);
-  loki->sys.RemBlock=AddRemem(p,loki->sys.RemBlock);
+  p=arena_alloc(lk_arena(ARENA_SETUP),sizeof(struct Off)*n);
   /* Link blocks together */
   for(i=0;i<n-1;i++) p[i].Next=p+i+1;
   p[n-1].Next=0;
@@ -134,6 +147,8 @@ static void free_sample_effects(void)
   if(B) free(B);
   if(entry) free(entry);
   if(order) free(order);
+  if(sn_fac) sn_free(sn_fac);
+  if(sn_w) free(sn_w);
   if(full_xx) {
     if(full_xx[0]) free(full_xx[0]);
     free(full_xx);
@@ -145,12 +160,34 @@ static void free_sample_effects(void)
   zero=0;
   XX_size=entry_size=0;
   full_xx=0;
+  sn_fac=0;
+  sn_w=0;
+  sn_wcols=0;
   init_flag=1;
 }
 
+/* Add z to element (i,j) of X'X on the supernodal path */
+static void sn_add(int i,int j,double z)
+{
+  int k;
+  double *p;
+
+  if(i<j) {
+    k=i;
+    i=j;
+    j=k;
+  }
+  if(i<sn_blev) full_xx[i][j]+=z;
+  else if(j<sn_blev) sn_w[j*n_lev+sn_tlev-1-i]+=z;
+  else {
+    if(!(p=sn_entry(sn_fac,sn_tlev-1-i,sn_tlev-1-j))) ABT_FUNC("Internal error - element not in pattern\n");
+    *p+=z;
+  }
+}
+
 static void init_sample_effects(void)
 {
-  int i,j,k,k1,k2,k3,type,rec,nrec,n_lev1,n_var1,comp,*order1,*mat;
+  int i,j,k,k1,k2,k3,type,rec,nrec,n_lev1,n_var1,comp,*order1,*mat,*sn_ptr,*sn_idx,*perm;
   struct id_data *data;
   struct SparseMatRec *AI;
   struct Off *p,*p1;
@@ -348,6 +385,24 @@ static void init_sample_effects(void)
   /* Get factorization order */
   min_deg(n_lev,mat,order1,0,0);
   for(i=0;i<n_lev;i++) order[order1[i]]=i+1;
+  if(mk_start<0 && n_lev>=SN_MIN_LEVELS) {
+    /* Symbolic factorization for the supernodal path, done once.  Its
+       postordering of the elimination tree becomes the order of equations */
+    if(!(sn_ptr=malloc(sizeof(int)*(2*n_lev+1+j)))) ABT_FUNC(MMsg);
+    sn_idx=sn_ptr+n_lev+1;
+    perm=sn_idx+j;
+    for(i=0;i<=n_lev;i++) sn_ptr[i]=0;
+    for(i=0;i<n_lev;i++) sn_ptr[order[i]]+=mat[i+1]-mat[i];
+    for(i=0;i<n_lev;i++) sn_ptr[i+1]+=sn_ptr[i];
+    for(i=0;i<n_lev;i++) perm[i]=sn_ptr[i];
+    for(i=0;i<n_lev;i++) {
+      k=order[i]-1;
+      for(k1=mat[i];k1<mat[i+1];k1++) sn_idx[perm[k]++]=order[mat[k1]]-1;
+    }
+    sn_fac=sn_analyse(n_lev,sn_ptr,sn_idx,perm);
+    for(i=0;i<n_lev;i++) order[order1[perm[i]]]=i+1;
+    free(sn_ptr);
+  }
   free(order1);
   min_deg(0,0,0,0,0);
 }
@@ -355,8 +410,8 @@ static void init_sample_effects(void)
 void sample_effects(struct loki *lk)
 {
   int i,j,k,k1,k2,k3,mtype,type,idx,rec,nrec,n_qt,n_qtlev,n_var1,n_lev1,comp;
-  int b_var,b_lev,t_var,t_lev,qt_start;
-  double y,z,z1,ss,ssn,wt,wt1,*tdp,*tdp1,*tdp2,*tdp3;
+  int b_var,b_lev,t_var,t_lev,qt_start,sn,e;
+  double y,z,z1,ss,ssn,wt,wt1,*tdp,*tdp1,*tdp2,*tdp3,*nrm;
   struct id_data *data;
   struct SparseMatRec *AI;
   struct Id_Record *id;
@@ -405,6 +460,19 @@ void sample_effects(struct loki *lk)
     k=j*(j+1)/2;
     while(k--) *(tdp++)=0;
   }
+  /* The supernodal path needs the mean and QTLs in full_xx */
+  if((sn=(sn_fac && b_lev<=full_store))) {
+    sn_blev=b_lev;
+    sn_tlev=t_lev;
+    if(b_lev+2>sn_wcols) {
+      sn_wcols=b_lev+2;
+      if(!(sn_w=realloc(sn_w,sizeof(double)*n_lev*sn_wcols))) ABT_FUNC(MMsg);
+    }
+    tdp=sn_w;
+    k=n_lev*b_lev;
+    while(k--) *(tdp++)=0;
+    sn_zero(sn_fac);
+  }
   if(t_var>entry_size) {
     entry_size=(int)(1.1*(double)t_var);
     if(!(entry=realloc(entry,sizeof(struct entry)*entry_size))) ABT_FUNC(MMsg);
@@ -543,7 +611,7 @@ void sample_effects(struct loki *lk)
 #endif
 	entry[k].pos=k1;
       }
-      wt1=1.0/(wt*loki->models->residual_var[0]);
+      wt1=loki->models->temper/(wt*loki->models->residual_var[0]);
       if(t_lev<=full_store) {
 	for(k=0;k<n_var1;k++) {
 	  k1=entry[k].pos;
@@ -560,6 +628,16 @@ void sample_effects(struct loki *lk)
 	    }
 	  }
 	}
+      } else if(sn) {
+	for(k=0;k<n_var1;k++) {
+	  k1=entry[k].pos;
+	  if(k1>=0) {
+	    z=entry[k].val;
+	    if(fabs(z)<DBL_EPSILON) continue;
+	    sn_add(k1,k1,z*z*wt1);
+	    for(k2=k+1;k2<n_var1;k2++) sn_add(entry[k2].pos,k1,z*entry[k2].val*wt1);
+	  }
+	}
       } else {
 	for(k=0;k<n_var1;k++) {
 	  k1=entry[k].pos;
@@ -601,7 +679,10 @@ void sample_effects(struct loki *lk)
       AI=loki->models->AIMatrix[comp];
       for(i=0;i<loki->pedigree->comp_size[comp];i++) {
 	k=n_lev+b_lev-order[j+i];
-	if(k<full_store) {
+	if(sn) {
+	  sn_add(k,k,z*AI[i].val);
+	  for(k1=AI[i].x;k1<AI[i+1].x;k1++) sn_add(n_lev+b_lev-order[AI[k1].x+j],k,z*AI[k1].val);
+	} else if(k<full_store) {
 	  tdp=full_xx[k];
 	  tdp[k]+=z*AI[i].val;
 	  for(k1=AI[i].x;k1<AI[i+1].x;k1++) {
@@ -633,7 +714,8 @@ void sample_effects(struct loki *lk)
       z=1.0/loki->models->c_var[i][0];
       for(k1=0;k1<mod->term[k].df;k1++) {
 	k2=n_lev+b_lev-order[j++];
-	if(k2>=full_store) XX[k2].val+=z;
+	if(sn) sn_add(k2,k2,z);
+	else if(k2>=full_store) XX[k2].val+=z;
 	else full_xx[k2][k2]+=z;
       }
       i++;
@@ -669,7 +751,31 @@ void sample_effects(struct loki *lk)
     }
   }
   /* Gaussian elimination step  - sparse region */
-  for(i=t_lev-1;i>=full_store && i>0;i--) {
+  if(sn) {
+    /* Factorize as L D L' and absorb into the mean and QTLs: with W the
+       elements between the two, full_xx -= Y' D^-1 Y where Y=L^-1 W, and
+       W is replaced by D^-1 Y for the sampling step.  Row e of L and W is
+       for equation position t_lev-1-e */
+    if(sn_factor(sn_fac,1.0e-12,get_peel_threads())>=0) ABT_FUNC("Effects matrix not positive definite\n");
+    sn_lsolve(sn_fac,sn_w,b_lev,n_lev);
+    tdp1=sn_w+n_lev*b_lev;
+    for(e=0;e<n_lev;e++) {
+      y=*sn_entry(sn_fac,e,e);
+      if((zero[t_lev-1-e]=(y==0.0))) {
+	for(k=0;k<b_lev;k++) sn_w[k*n_lev+e]=0.0;
+	continue;
+      }
+      y=1.0/y;
+      tdp1[e]=y;
+      for(k=0;k<b_lev;k++) if((z=sn_w[k*n_lev+e])!=0.0) {
+	z*=y;
+	tdp=full_xx[k];
+	for(k1=0;k1<=k;k1++) tdp[k1]-=z*sn_w[k1*n_lev+e];
+      }
+      for(k=0;k<b_lev;k++) sn_w[k*n_lev+e]*=y;
+    }
+    i=b_lev-1;
+  } else for(i=t_lev-1;i>=full_store && i>0;i--) {
     y=XX[i].val;
     if(fabs(y)<1.0e-12) {
       zero[i]=1;
@@ -768,14 +874,20 @@ void sample_effects(struct loki *lk)
       *(tdp1++)+=z1*z;
     }
   }
-  /* And now go backwards, sampling as we go */
-  k=full_store>t_lev?t_lev:full_store;
+  /* And now go backwards, sampling as we go.  The normal deviates
+   * (one per non-zero level) are drawn in one block beforehand */
+  for(i=1,k2=0;i<t_lev;i++) if(!zero[i]) k2++;
+  nrm=arena_alloc(lk_arena(ARENA_ITER),sizeof(double)*k2);
+  snorm_block(nrm,k2);
+  k2=0;
+  if(sn) k=b_lev;
+  else k=full_store>t_lev?t_lev:full_store;
   for(i=1;i<k;i++) if(!zero[i]) {
     tdp=full_xx[i];
     y=*tdp;
     for(j=1;j<i;j++) if(!zero[j]) y-=B[j]*tdp[j];
     z=1.0/tdp[i];
-    B[i]=y*z+snorm()*sqrt(z);
+    B[i]=y*z+nrm[k2++]*sqrt(z);
     if(loki->models->no_overdominant && n_qt && i>qt_start && i<qt_start+n_qtlev) {
       for(j=qt_start,k1=0;i>j && k1<loki->params.n_tloci;k1++) if(loki->models->tlocus[k1].flag)	{
 	if(i==j+1) {
@@ -790,7 +902,24 @@ void sample_effects(struct loki *lk)
       }
     }
   }
-  for(;i<t_lev;i++) if(!zero[i]) {
+  if(sn) {
+    /* Right hand side for the sparse region (zero levels are left out by
+       setting them to 0, as their columns in L have been cleared) */
+    tdp1=sn_w+n_lev*b_lev;
+    tdp2=tdp1+n_lev;
+    for(;i<t_lev;i++) {
+      e=t_lev-1-i;
+      if(zero[i]) {
+	tdp2[e]=0.0;
+	continue;
+      }
+      y=sn_w[e];
+      for(j=1;j<b_lev;j++) if(!zero[j]) y-=B[j]*sn_w[j*n_lev+e];
+      tdp2[e]=y+nrm[k2++]*sqrt(tdp1[e]);
+    }
+    sn_ltsolve(sn_fac,tdp2);
+    for(i=b_lev;i<t_lev;i++) if(!zero[i]) B[i]=tdp2[t_lev-1-i];
+  } else for(;i<t_lev;i++) if(!zero[i]) {
     if((p=XX[i].First)) {
       p1=p;
       if(!p->col) {
@@ -810,7 +939,7 @@ void sample_effects(struct loki *lk)
       }
     } else y=0.0;
     z=1.0/XX[i].val;
-    B[i]=y*z+snorm()*sqrt(z);
+    B[i]=y*z+nrm[k2++]*sqrt(z);
     if(loki->models->no_overdominant && n_qt && i>qt_start && i<qt_start+n_qtlev) {
       for(j=qt_start,k1=0;i>j && k1<loki->params.n_tloci;k1++) if(loki->models->tlocus[k1].flag)	{
 	if(i==j+1) {
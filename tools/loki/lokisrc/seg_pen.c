@@ -32,6 +32,7 @@
 #include "handle_res.h"
 #include "seg_pen.h"
 #include "lk_malloc.h"
+#include "arena.h"
 #include "gen_pen.h"
 
 static double **seg_freq;
@@ -62,10 +63,8 @@ static void setup_groups(struct loki *loki)
 		}
 	}
 	if(!nfd) return;
-	temp_p=lk_malloc(sizeof(void *)*(n_markers+ntl)*n_comp);
-	loki->sys.RemBlock=AddRemem(temp_p,loki->sys.RemBlock);
-	temp_p1=lk_malloc(sizeof(int)*nfd);
-	loki->sys.RemBlock=AddRemem(temp_p1,loki->sys.RemBlock);
+	temp_p=arena_alloc(lk_arena(ARENA_SETUP),sizeof(void *)*(n_markers+ntl)*n_comp);
+	temp_p1=arena_alloc(lk_arena(ARENA_SETUP),sizeof(int)*nfd);
 	for(locus=0;locus<n_markers+ntl;locus++) {
 		if(locus<n_markers) {
 			loki->markers->marker[locus].group=temp_p;
@@ -18,16 +18,87 @@
 
 #include <config.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <math.h>
 
 #include "utils.h"
+#include "lk_malloc.h"
 #include "loki.h"
 #include "loki_peel.h"
 #include "seg_pen.h"
 #include "gen_pen.h"
 #include "update_segs.h"
 
+/* Cache of the marker seg_pen() terms.  When nothing is being sampled the
+ * value for a component only changes if the founder genes of the component
+ * or the allele frequencies change.  The writers of the genes call
+ * seg_dirty(); the frequencies are compared with a copy taken when the
+ * values were calculated */
+static double *sc_val,**sc_freq;
+static char *sc_clean;
+static int sc_ncomp;
+static unsigned long sc_lookups,sc_hits;
+
+static void free_seg_cache(void)
+{
+	if(getenv("LOKI_SEG_CACHE_STATS") && sc_lookups)
+		(void)fprintf(stderr,"seg_pen cache: %lu lookups, %lu hits (%.1f%%)\n",sc_lookups,sc_hits,100.0*(double)sc_hits/(double)sc_lookups);
+	if(sc_val) free(sc_val);
+	if(sc_freq) {
+		if(sc_freq[0]) free(sc_freq[0]);
+		free(sc_freq);
+	}
+	sc_val=0;
+	sc_freq=0;
+	sc_clean=0;
+}
+
+static void alloc_seg_cache(const struct loki *loki)
+{
+	int k,nm;
+	size_t sz;
+
+	nm=loki->markers->n_markers;
+	sc_ncomp=loki->pedigree->n_comp;
+	sz=(size_t)nm*sc_ncomp;
+	sc_val=lk_malloc((sizeof(double)+1)*sz);
+	sc_clean=(char *)(sc_val+sz);
+	memset(sc_clean,0,sz);
+	sc_freq=lk_malloc(sizeof(void *)*nm);
+	for(sz=0,k=0;k<nm;k++) sz+=loki->markers->marker[k].locus.n_alleles;
+	sz*=loki->pedigree->n_genetic_groups;
+	sc_freq[0]=lk_calloc(sz,sizeof(double));
+	for(k=1;k<nm;k++) sc_freq[k]=sc_freq[k-1]+loki->markers->marker[k-1].locus.n_alleles*loki->pedigree->n_genetic_groups;
+	if(atexit(free_seg_cache)) message(WARN_MSG,"Unable to register exit function free_seg_cache()\n");
+}
+
+/* Mark the seg_pen() term of marker loc for component comp (or all
+ * components if comp<0) as needing recalculation */
+void seg_dirty(const struct Locus *loc,const int comp)
+{
+	if(!sc_clean || !(loc->type&ST_MARKER)) return;
+	if(comp<0) memset(sc_clean+loc->index*sc_ncomp,0,sc_ncomp);
+	else sc_clean[loc->index*sc_ncomp+comp]=0;
+}
+
+/* Check the allele frequencies of marker k against the cached copy */
+static void check_freq(const int k,const struct Locus *loc,const struct loki *loki)
+{
+	int i,j,n_all,fg=0;
+	double *p;
+
+	n_all=loc->n_alleles;
+	p=sc_freq[k];
+	for(j=0;j<loki->pedigree->n_genetic_groups;j++,p+=n_all) {
+		for(i=0;i<n_all;i++) if(p[i]!=loc->freq[j][i]) {
+			p[i]=loc->freq[j][i];
+			fg=1;
+		}
+	}
+	if(fg) memset(sc_clean+k*sc_ncomp,0,sc_ncomp);
+}
+
 /* 
  * fg controls whether we are sampling, and whether we will update frequency estimates.
  * If bit 1 is set, we sample marker genotypes.  If bit 2 is set, we sample QTL genotypes.
@@ -40,15 +111,35 @@
  */
 void update_seg_probs(int fg,int fg1,struct loki *loki)
 {
-	int i,k,comp;
+	int i,k,comp,cache;
 	struct Locus *loc;
-	double z;
+	double z,*val;
+	char *clean;
 	
+	if(!sc_val && loki->markers->n_markers) alloc_seg_cache(loki);
 	for(k=0;k<loki->markers->n_markers;k++) {
 		loc=&loki->markers->marker[k].locus;
 		if(fg&12) seg_init_freq(loc,loki);
 		if(fg1&1) pass_founder_genes(loc,loki);
+		/* Markers with effects on the traits depend on the residuals, and
+		 * when sampling seg_pen() has to be called anyway */
+		cache=(!(fg&~2) && !loc->eff);
+		if(cache) check_freq(k,loc,loki);
+		val=sc_val+k*sc_ncomp;
+		clean=sc_clean+k*sc_ncomp;
 		for(comp=0;comp<loki->pedigree->n_comp;comp++) {
+			if(cache) {
+				sc_lookups++;
+				if(clean[comp]) {
+					sc_hits++;
+#ifdef DEBUG
+					z=seg_pen(loc,comp,&i,0,loki);
+					if(i || z!=val[comp]) ABT_FUNC("Stale seg_pen cache entry\n");
+#endif
+					loc->lk_store[comp]=val[comp];
+					continue;
+				}
+			}
 			loc->lk_store[comp]=seg_pen(loc,comp,&i,fg&~2,loki);
 			if(i) {
 				(void)fprintf(stderr,"seg_pen returned error code %d for marker %s",(int)loc->lk_store[comp],loki->markers->marker[k].name);
@@ -61,6 +152,10 @@ void update_seg_probs(int fg,int fg1,struct loki *loki)
 				fprintf(stderr,"seg_pen returned illegal value %g (loc=%s, comp=%d, fg=%d, fg1=%d)\n",z,loc->name,comp,fg,fg1);
 			}
 #endif
+			if(cache) {
+				val[comp]=loc->lk_store[comp];
+				clean[comp]=1;
+			}
 		}
 		if(fg&4) {
 			seg_sample_freq(loc,loki);
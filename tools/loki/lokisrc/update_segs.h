@@ -3,5 +3,6 @@
 
 void update_seg_probs(int,int,struct loki *);
 void reprune_segs(struct loki *);
+void seg_dirty(const struct Locus *,const int);
 
 #endif
@@ -51,23 +51,14 @@ void write_xml_dump(int lp,int lp1,int n_ibd _U_,long old_pos _U_,int flag _U_,i
 	
   lkc=loki->compress;
   filter=loki->names[LK_FILTER];
-  if(!filter && (lkc->default_compress<COMPRESS_NONE)) {
-    j=lkc->default_compress;
-    filter=lkc->comp_path[j][j==COMPRESS_ZIP?1:0];
-  }
   if(!loki->names[LK_DUMPFILE]) loki->names[LK_DUMPFILE]=make_file_name(".dump");
   if(loki->names[LK_DUMPFILE]) {
     j=loki->sys.syst_var[SYST_BACKUPS].flag?loki->sys.syst_var[SYST_BACKUPS].data.value:1;
     if(j) i=mkbackup(loki->names[LK_DUMPFILE],j);
     if(!i) {
-      if(filter) {
-	errno=0;
-	i=child_open(WRITE,loki->names[LK_DUMPFILE],filter);
-	fdump=fdopen(i,"w");
-	if(errno && errno!=ESPIPE) i=1;
-	else i=0;
-	errno=0;
-      } else fdump=fopen(loki->names[LK_DUMPFILE],"w");
+      if(filter) fdump=filter_open(WRITE,loki->names[LK_DUMPFILE],filter);
+      else if(lkc->default_compress<COMPRESS_NONE) fdump=compress_open(WRITE,loki->names[LK_DUMPFILE],lkc->default_compress,lkc);
+      else fdump=fopen(loki->names[LK_DUMPFILE],"w");
       if(!fdump || i) (void)fprintf(stderr,"[%s:%d] %s(): File Error.  Couldn't open '%s' for output\n",__FILE__,__LINE__,__func__,loki->names[LK_DUMPFILE]);
       else {
 	lkp=&loki->params;
@@ -29,26 +29,13 @@
 #include <stdio.h>
 
 #include "utils.h"
+#include "lk_sort.h"
 #include "prep_utils.h"
 #include "libhdr.h"
 #include "scan.h"
 
 static double *u;
 
-static int cmp_inbr(const void *s1,const void *s2)
-{
-	double x1,x2;
-	int i;
-	
-	i=*((const int *)s1);
-	x1=u[i];
-	i=*((const int *)s2);
-	x2=u[i];
-	if(x1<x2) return 1;
-	if(x1>x2) return -1;
-	return 0;
-}
-
 void Check_Inbr(char *LogFile)
 {
 	int id,i,j,k,k1,idd,ids,idd1,ids1,comp,max_comp=0,n_inbr;
@@ -134,7 +121,7 @@ void Check_Inbr(char *LogFile)
 			(void)fprintf(flog,"       Average inbreeding coefficient (inbred individuals only) = %g\n",avg_inbr/(double)n_inbr);
 			(void)fputs("\n       Ids and inbreeding coefficients of inbred individuals:\n\n",flog);
 			for(k=j=0;j<comp_size[comp];j++) if(u[j]>1.0) temp[k++]=j;
-			gnu_qsort(temp,(size_t)k,sizeof(int),cmp_inbr); 
+			lk_sort_index(temp,(size_t)k,u,LK_SORT_DESCEND);
 			for(j=0;j<n_inbr;j++) {
 				k1=temp[j];
 				xx=u[k1]-1.0;
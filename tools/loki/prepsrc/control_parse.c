@@ -265,6 +265,7 @@ typedef union YYSTYPE {
 
 #include "scan.h"
 #include "scanner.h"
+#include "hash_map.h"
 
 static struct format_atom *make_f_atom(int,int);
 static struct format_clause *add_f_atom(struct format_clause *,struct format_atom *);
@@ -312,6 +313,7 @@ static struct var_element *pedlist[4];
 static int f_atom_n,f_atom_size=32,pedflag;
 struct operation *Affected,*Unaffected,*Proband;
 struct bin_node *root_var;
+static struct hash_map *var_map;
 struct InFile *Infiles;
 struct Link *links;
 struct Miss *Miss;
@@ -3673,15 +3675,21 @@ static void Check_var(struct bin_node *node)
 	if(node->right) Check_var(node->right);
 }
 
+/* Variables are looked up through var_map; root_var keeps them in name order */
 static struct bin_node *create_var(char *p)
 {
 	int k;
 	struct bin_node *node;
+	struct hmap_entry *e;
 	
+	if(!var_map) var_map=hmap_new(HMAP_NOCASE,0);
+	e=hmap_insert(var_map,p,&k);
+	if(k) return e->data;
 	if(!root_var) node=root_var=alloc_var(p);
 	else {
 		root_var=find_var(p,root_var,&node,&k);
 	}
+	e->data=node;
 	return node;
 }
 
@@ -4418,6 +4426,8 @@ int ReadControl(FILE *fptr,char *cname,char **lfile)
 	syst_var[ERROR_CHECK]=1;
 	if((i=yyparse())) print_scan_err("Error: yyparse returned error %d\n",i);
 	yy_cleanup();
+	hmap_free(var_map,0);
+	var_map=0;
 	if(strip_vars) check_vars_1(root_var,strip_names);
 	/* Sanity check! */
 	if(!scan_error_n)	{
@@ -38,19 +38,17 @@
 #include "utils.h"
 #include "y.tab.h"
 #include "scan.h"
+#include "hash_map.h"
 
 #define INIT_BLOCK_SIZE 128 /* Start allocating memory in blocks of INIT_BLOCK_SIZE records, doubling */
 #define MAX_BLOCK_SIZE 512  /* the size if more space required up to MAX_BLOCK_SIZE */
-#define S_BLOCK_SIZE 512   /* For string allocation: should be at least as big as BUFFER_SIZE */
 #define BUFFER_SIZE 511   /* Maximum size of columns for free format reads */
 #define LINE_COUNT 5000     /* How often to print 'At line' */
 
-static char *StringData=0;
 static char *default_rsformat="\n";
-static size_t StringPos;
 static struct miss_var_tag *miss_var;
 static struct DataBlock *DataBlock;
-static struct bin_node *node_strings,*node_ints,*node_ped_int,*node_fam_int,*node_ped_str,*node_fam_str;
+static struct hash_map *node_strings,*node_ints,*node_ped_int,*node_fam_int,*node_ped_str,*node_fam_str;
 static int num_nodes;
 struct label_data **ped_recode,**family_recode,***factor_recode;
 int *ped_recode1;
@@ -161,169 +159,44 @@ static void process_missing(struct InFile *infile)
 	}
 }
 
-static struct bin_node *alloc_node(const void *s,int type)
+/* Returns the label for s in the table *hm, adding it if not already present.
+ * String labels point to the copy of the key kept by the table */
+static struct label_data *insert_node(struct hash_map **hm,const void *s,int type)
 {
-	struct bin_node *node;
+	struct hmap_entry *e;
 	struct label_data *data;
-	size_t i;
-	char *p,*p1;
+	int found;
 	
-	if(!(node=malloc(sizeof(struct bin_node)))) ABT_FUNC(MMsg);
-	node->left=node->right=0;
-	node->balance=0;
-	if(!(data=malloc(sizeof(struct label_data)))) ABT_FUNC(MMsg);
-	node->data=data;
-	data->type=type;
-	data->index=num_nodes++;
-	switch(type) {
-	 case STRING:
-		p1=(char *)s;
-		i=strlen(p1)+1;
-		if(i>(S_BLOCK_SIZE-StringPos)) {
-			if(i>S_BLOCK_SIZE) ABT_FUNC("String too long - increase S_BLOCK_SIZE\n");
-			if(!(StringData=malloc(S_BLOCK_SIZE))) ABT_FUNC(MMsg);
-			RemBlock=AddRemem(StringData,RemBlock);
-			StringPos=0;
-		}
-		p=StringData+StringPos;
-		data->data.string=p;
-		if(!syst_var[IGNORE_CASE]) (void)strncpy(p,p1,i);
-		else {
-			p1=(char *)s;
-			while(*p1) *p++=toupper((int)(*p1++));
-			*p=0;
-		}
-		StringPos+=i;
-		break;
-	 case INTEGER:
-		data->data.value= *(long *)s;
-		break;
-	 default:
-		ABT_FUNC("Internal error - invalid type\n");
-	}
-	return node;
-}
-
-static struct label_data *find_inode(struct bin_node *node,const long s)
-{
-	long i;
-	struct label_data *data;
-	
-	data=node->data;
-	i=s-data->data.value;
-	if(i<0) {
-		if(node->left) data=find_inode(node->left,s);
-		else data=0;
-	} else if(i>0) {
-		if(node->right) data=find_inode(node->right,s);
-		else data=0;
+	if(!*hm) *hm=hmap_new(type==INTEGER?HMAP_INT:(syst_var[IGNORE_CASE]?HMAP_NOCASE:HMAP_STRING),0);
+	e=hmap_insert(*hm,s,&found);
+	if(!found) {
+		if(!(data=malloc(sizeof(struct label_data)))) ABT_FUNC(MMsg);
+		data->type=type;
+		data->index=num_nodes++;
+		if(type==INTEGER) data->data.value=e->key.value;
+		else data->data.string=e->key.str;
+		e->data=data;
 	}
-	return data;
-}
-
-static struct label_data *find_snode(struct bin_node *node,const char *s)
-{
-	long i;
-	struct label_data *data;
-	
-	data=node->data;
-	if(!syst_var[IGNORE_CASE]) i=strcmp(s,data->data.string);
-	else i=strcasecmp(s,data->data.string);
-	if(i<0) {
-		if(node->left) data=find_snode(node->left,s);
-		else data=0;
-	} else if(i>0) {
-		if(node->right) data=find_snode(node->right,s);
-		else data=0;
-	}
-	return data;
-}
-
-static struct bin_node *insert_node(struct bin_node *node,const void *s,struct label_data **node1,int *balanced,int type)
-{
-	long i;
-	struct label_data *data;
-	
-	data=node->data;
-	if(type==INTEGER) i=*((long *)s)-data->data.value;
-	else {
-		if(!syst_var[IGNORE_CASE]) i=strcmp(s,data->data.string);
-		else i=strcasecmp((char *)s,data->data.string);
-	}
-	if(i<0) {
-		if(node->left) node->left=insert_node(node->left,s,node1,balanced,type);
-		else {
-			node->left=alloc_node(s,type);
-			*node1=node->left->data;
-			*balanced=0;
-		}
-		if(!(*balanced)) {
-			switch(node->balance) {
-			 case -1:
-				node=rotate_left(node);
-				*balanced=1;
-				break;
-			 case 0:
-				node->balance=-1;
-				break;
-			 case 1:
-				node->balance=0;
-				*balanced=1;
-			}
-		}
-	} else if(i>0) {
-		if(node->right) node->right=insert_node(node->right,s,node1,balanced,type);
-		else {
-			node->right=alloc_node(s,type);
-			*node1=node->right->data;
-			*balanced=0;
-		}
-		if(!(*balanced)) {
-			switch(node->balance) {
-			 case -1:
-				node->balance=0;
-				*balanced=1;
-				break;
-			 case 0:
-				node->balance=1;
-				break;
-			 case 1:
-				node=rotate_right(node);
-				*balanced=1;
-			}
-		}
-	} else {
-		*node1=node->data;
-		*balanced=1;
-	}
-	return node;
+	return e->data;
 }
 
 struct label_data *find_node(const void *s,int type,int flag)
 {
-	struct bin_node *node;
-	struct label_data *data=0;
+	struct hash_map *hm;
 
-	if(type==INTEGER) {
-		if(flag) node=node_fam_int;
-		else node=node_ped_int;
-		if(node) data=find_inode(node,*((long *)s));
-	} else {
-		if(flag) node=node_fam_str;
-		else node=node_ped_str;
-		if(node) data=find_snode(node,(char *)s);
-	}
-	return data;
+	if(type==INTEGER) hm=flag?node_fam_int:node_ped_int;
+	else hm=flag?node_fam_str:node_ped_str;
+	return hm?hmap_find(hm,s):0;
 }
 
 void free_nodes(void)
 {
-	if(node_ints) free_bin_tree(node_ints,free);
-	if(node_strings) free_bin_tree(node_strings,free);
-	if(node_ped_int) free_bin_tree(node_ped_int,free);
-	if(node_ped_str) free_bin_tree(node_ped_str,free);
-	if(node_fam_int) free_bin_tree(node_fam_int,free);
-	if(node_fam_str) free_bin_tree(node_fam_str,free);
+	hmap_free(node_ints,free);
+	hmap_free(node_strings,free);
+	hmap_free(node_ped_int,free);
+	hmap_free(node_ped_str,free);
+	hmap_free(node_fam_int,free);
+	hmap_free(node_fam_str,free);
 	node_ints=node_strings=node_ped_int=node_ped_str=node_fam_int=node_fam_str=0;
 }
 
@@ -364,10 +237,10 @@ static int check_miss(char *string,struct express *miss,int elem_type)
 			p++;
 		}
 		if(*p) {
-			ep.arg.rvalue=strtod(miss->arg.string,&p);
+			ep.arg.rvalue=lk_strtod(miss->arg.string,&p);
 			if(!*p) ep.type=ST_REAL;
 		} else {
-			ep.arg.value=strtol(miss->arg.string,&p,10);
+			ep.arg.value=lk_strtol(miss->arg.string,&p);
 			if(!*p) ep.type=ST_INTEGER;
 		}
 	} 
@@ -386,15 +259,15 @@ static int check_miss(char *string,struct express *miss,int elem_type)
 			p++;
 		}
 		if(*p) {
-			rval=strtod(string,&p);
+			rval=lk_strtod(string,&p);
 			if(!*p && fabs(rval-(double)ep.arg.value)<1.0e-12) match=1;
 		} else {
-			val=strtol(string,&p,10);
+			val=lk_strtol(string,&p);
 			if(!*p && val==ep.arg.value) match=1;
 		}
 		break;
 	 case ST_REAL:
-		rval=strtod(string,&p);
+		rval=lk_strtod(string,&p);
 		if(!*p && fabs(rval-ep.arg.rvalue)<1.0e-12) match=1;
 		break;
 	 case 0:
@@ -485,7 +358,7 @@ static int handle_string(char *string,struct InFile *infile,struct var_element *
 					gt->node1=gt->node2=0;	
 					if(elem->type&(ST_INTTYPE)) {
 						if(p1) {
-							value=strtol(p1,&sptr,10);
+							value=lk_strtol(p1,&sptr);
 							if(*sptr) {
 								if(!syst_var[SKIP_BAD_INTS]) 
 								  print_scan_err("[%s:%d] %s(): Line %d column %d - Malformed integer %s\n",__FILE__,__LINE__,__func__,lineno,col+1,p1);
@@ -493,15 +366,12 @@ static int handle_string(char *string,struct InFile *infile,struct var_element *
 								free(gt);
 								gt=0;
 							} else {
-								if(!node_ints) {
-									node_ints=alloc_node(&value,INTEGER);
-									node=node_ints->data;
-								} else node_ints=insert_node(node_ints,&value,&node,&i,INTEGER);
+								node=insert_node(&node_ints,&value,INTEGER);
 								gt->node1=node;
 							}
 						}
 						if(!miss && p2) {
-							value=strtol(p2,&sptr,10);
+							value=lk_strtol(p2,&sptr);
 							if(*sptr) {
 								if(!syst_var[SKIP_BAD_INTS]) 
 								  print_scan_err("[%s:%d] %s(): Line %d column %d - Malformed integer %s\n",__FILE__,__LINE__,__func__,lineno,col+1,p2);
@@ -509,27 +379,18 @@ static int handle_string(char *string,struct InFile *infile,struct var_element *
 								free(gt);
 								gt=0;
 							} else {
-								if(!node_ints) {
-									node_ints=alloc_node(&value,INTEGER);
-									node=node_ints->data;
-								} else node_ints=insert_node(node_ints,&value,&node,&i,INTEGER);
+								node=insert_node(&node_ints,&value,INTEGER);
 								gt->node2=node;
 							}
 						}
 						DataBlock->records[DataBlock->record_ptr*ncol+col].gt_data=gt;
 					} else {
 						if(p1) {
-							if(!node_strings) {
-								node_strings=alloc_node(p1,STRING);
-								node=node_strings->data;
-							} else node_strings=insert_node(node_strings,p1,&node,&i,STRING);
+							node=insert_node(&node_strings,p1,STRING);
 							gt->node1=node;
 						}
 						if(p2) {
-							if(!node_strings) {
-								node_strings=alloc_node(p2,STRING);
-								node=node_strings->data;
-							} else node_strings=insert_node(node_strings,p2,&node,&i,STRING);
+							node=insert_node(&node_strings,p2,STRING);
 							gt->node2=node;
 						}
 						DataBlock->records[DataBlock->record_ptr*ncol+col].gt_data=gt;
@@ -537,53 +398,35 @@ static int handle_string(char *string,struct InFile *infile,struct var_element *
 				} else miss=1;
 			} else {
 				if(elem->type&ST_INTTYPE) {
-					value=strtol(string,&sptr,10);
+					value=lk_strtol(string,&sptr);
 					if(*sptr) {
 						if(!syst_var[SKIP_BAD_INTS]) 
 						  print_scan_err("[%s:%d] %s(): Line %d column %d - Malformed integer %s\n",__FILE__,__LINE__,__func__,lineno,col+1,string);
 						miss=1;
 					} else {
 						if(elem->type&(ST_ID|ST_SIRE|ST_DAM))	{
-							if(!node_ped_int) {
-								node_ped_int=alloc_node(&value,INTEGER);
-								node=node_ped_int->data;
-							} else node_ped_int=insert_node(node_ped_int,&value,&node,&i,INTEGER);
+							node=insert_node(&node_ped_int,&value,INTEGER);
 						} else if(elem->type&(ST_FAMILY)) {
-							if(!node_fam_int) {
-								node_fam_int=alloc_node(&value,INTEGER);
-								node=node_fam_int->data;
-							} else node_fam_int=insert_node(node_fam_int,&value,&node,&i,INTEGER);
+							node=insert_node(&node_fam_int,&value,INTEGER);
 						} else {
-							if(!node_ints) {
-								node_ints=alloc_node(&value,INTEGER);
-								node=node_ints->data;
-							} else node_ints=insert_node(node_ints,&value,&node,&i,INTEGER);
+							node=insert_node(&node_ints,&value,INTEGER);
 						}
 						DataBlock->records[DataBlock->record_ptr*ncol+col].node=node;
 					}
 				} else {
 					if(elem->type&(ST_ID|ST_SIRE|ST_DAM))	{
-						if(!node_ped_str) {
-							node_ped_str=alloc_node(string,STRING);
-							node=node_ped_str->data;
-						} else node_ped_str=insert_node(node_ped_str,string,&node,&i,STRING);
+						node=insert_node(&node_ped_str,string,STRING);
 					} else if(elem->type&(ST_FAMILY)) {
-						if(!node_fam_str) {
-							node_fam_str=alloc_node(string,STRING);
-							node=node_fam_str->data;
-						} else node_fam_str=insert_node(node_fam_str,string,&node,&i,STRING);
+						node=insert_node(&node_fam_str,string,STRING);
 					} else {
-						if(!node_strings) {
-							node_strings=alloc_node(string,STRING);
-							node=node_strings->data;
-						} else node_strings=insert_node(node_strings,string,&node,&i,STRING);
+						node=insert_node(&node_strings,string,STRING);
 					}
 					DataBlock->records[DataBlock->record_ptr*ncol+col].node=node;
 				}
 			}
 		} else {
-			if(elem->type&ST_INTTYPE) DataBlock->records[DataBlock->record_ptr*ncol+col].value=strtol(string,&sptr,10);
-			else DataBlock->records[DataBlock->record_ptr*ncol+col].rvalue=strtod(string,&sptr);
+			if(elem->type&ST_INTTYPE) DataBlock->records[DataBlock->record_ptr*ncol+col].value=lk_strtol(string,&sptr);
+			else DataBlock->records[DataBlock->record_ptr*ncol+col].rvalue=lk_strtod(string,&sptr);
 			if(*sptr) {
 				if(elem->type&ST_INTTYPE) {
 					if(!syst_var[SKIP_BAD_INTS])
@@ -635,9 +478,6 @@ void ReadData(char *lfile)
 #endif
 
 	infile=Infiles;
-	if(!(StringData=malloc(S_BLOCK_SIZE))) ABT_FUNC(MMsg);
-	RemBlock=AddRemem(StringData,RemBlock);
-	StringPos=0;
 	if(lfile && (tname=add_file_dir(lfile))) {
 		flog=fopen(tname,"a");
 		free(tname);
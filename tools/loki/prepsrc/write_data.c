@@ -150,16 +150,11 @@ void WriteXMLData(char *LogFile,struct lk_compress *lkc)
 	
   errno=0;
   filter=Filter;
-  if(!filter && (lkc->default_compress<COMPRESS_NONE)) {
-    j=lkc->default_compress;
-    filter=lkc->comp_path[j][j==COMPRESS_ZIP?1:0];
-  }
   fname=make_file_name(".xml");
-  if(filter) {
-    i=child_open(WRITE,fname,filter);
-    if(!(fptr=fdopen(i,"w"))) DataFileError(fname);
-    if(errno && errno!=ESPIPE) DataFileError(fname);
-    errno=0;
+  if(filter || (lkc->default_compress<COMPRESS_NONE)) {
+    if(filter) fptr=filter_open(WRITE,fname,filter);
+    else fptr=compress_open(WRITE,fname,lkc->default_compress,lkc);
+    if(!fptr) DataFileError(fname);
   } else if(!(fptr=fopen(fname,"w"))) abt(__FILE__,__LINE__,"%s(): File Error.  Couldn't open '%s' for writing\n",__func__,fname);
   (void)fputs("<?xml version='1.0' encoding='UTF-8' standalone='no'?>\n",fptr);
   (void)fputs("<!DOCTYPE loki SYSTEM 'http://loki.homeunix.net/loki.dtd'>\n",fptr);
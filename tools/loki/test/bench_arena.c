@@ -0,0 +1,99 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_arena.c:                                                           *
+ *                                                                          *
+ * Allocates many small blocks of mixed sizes per round and then frees      *
+ * them all, first by mallocing each block and remembering it in a list    *
+ * (the old malloc_and_remember() scheme) and then from an arena that is    *
+ * reset every round.  Reports time and calls to malloc() for both.         *
+ *                                                                          *
+ * Usage: bench_arena [rounds] [allocations per round]                      *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "lk_malloc.h"
+#include "arena.h"
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static size_t block_size(unsigned long *x)
+{
+  *x=*x*6364136223846793005UL+1442695040888963407UL;
+  return 8+((*x>>40)%120);
+}
+
+int main(int argc,char *argv[])
+{
+  int i,j,rounds=200,n=50000,err=0;
+  unsigned long x,n_malloc=0,sum1=0,sum2=0;
+  size_t sz,*sizes;
+  void **mem_list;
+  char *p;
+  struct arena *a;
+  double t;
+
+  if(argc>1) rounds=atoi(argv[1]);
+  if(argc>2) n=atoi(argv[2]);
+  mem_list=lk_malloc(sizeof(void *)*n);
+  sizes=lk_malloc(sizeof(size_t)*n);
+  t=wall_time();
+  for(i=0;i<rounds;i++) {
+    x=i;
+    for(j=0;j<n;j++) {
+      sz=block_size(&x);
+      p=lk_malloc(sz);
+      n_malloc++;
+      p[0]=(char)j;
+      p[sz-1]=(char)sz;
+      mem_list[j]=p;
+      sizes[j]=sz;
+    }
+    for(j=0;j<n;j++) sum1+=((unsigned char *)mem_list[j])[0]+((unsigned char *)mem_list[j])[sizes[j]-1];
+    for(j=0;j<n;j++) free(mem_list[j]);
+  }
+  printf("%-24s %8.3f s %12lu mallocs\n","malloc and remember",wall_time()-t,n_malloc);
+  t=wall_time();
+  a=arena_new("bench",0);
+  for(i=0;i<rounds;i++) {
+    x=i;
+    for(j=0;j<n;j++) {
+      sz=block_size(&x);
+      p=arena_alloc(a,sz);
+      p[0]=(char)j;
+      p[sz-1]=(char)sz;
+      mem_list[j]=p;
+      sizes[j]=sz;
+    }
+    for(j=0;j<n;j++) sum2+=((unsigned char *)mem_list[j])[0]+((unsigned char *)mem_list[j])[sizes[j]-1];
+    arena_reset(a);
+  }
+  printf("%-24s %8.3f s %12lu mallocs\n","arena",wall_time()-t,a->stats.n_malloc);
+  if(sum1!=sum2) err=1;
+  /* Growing the last allocation should stay in place, others are copied */
+  p=arena_alloc(a,100);
+  memset(p,1,100);
+  if(arena_realloc(a,p,100,200)!=p) err=1;
+  p=arena_realloc(a,mem_list[0]=arena_alloc(a,16),16,1<<20);
+  if(p==mem_list[0] || (a->stats.in_use&(ARENA_ALIGN-1))) err=1;
+  arena_free(a);
+  free(mem_list);
+  free(sizes);
+  if(err) fprintf(stderr,"bench_arena: results disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
@@ -0,0 +1,368 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_chol.c:                                                            *
+ *                                                                          *
+ * Factorizes the mixed model equations for a polygenic model with one      *
+ * fixed factor on synthetic pedigrees, both by Gaussian elimination on     *
+ * linked lists as sample_effects.c did (fill-in being added to the lists   *
+ * as it is found) and with sn_chol.c, where the pattern is analysed once   *
+ * and only the numerical factorization is repeated.  Both use the same     *
+ * elimination order, and the pivots are compared.                          *
+ *                                                                          *
+ * Usage: bench_chol [individuals ...]                                      *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "arena.h"
+#include "sparse.h"
+#include "min_deg.h"
+#include "sn_chol.h"
+
+#define LIST_MAX 10000 /* Largest pedigree factorized with the linked lists */
+#define REPS 3         /* Numerical factorizations timed */
+#define NEAR 100       /* How far parents are from an individual's place */
+
+/* Lower triangle of the equations by rows, diagonal first */
+struct mme {
+  int n,*ptr,*col;
+  double *val;
+};
+
+static unsigned long seed=12345;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static int rnd(const int n)
+{
+  seed=seed*6364136223846793005UL+1442695040888963407UL;
+  return (int)((seed>>33)%(unsigned long)n);
+}
+
+/* Add z to element (i,j) */
+static void add_elem(struct mme *m,int i,int j,const double z)
+{
+  int k;
+
+  if(i<j) {
+    k=i;
+    i=j;
+    j=k;
+  }
+  if(i==j) {
+    m->val[m->ptr[i]]+=z;
+    return;
+  }
+  for(k=m->ptr[i]+1;k<m->ptr[i+1];k++) if(m->col[k]==j || m->col[k]<0) break;
+  if(k==m->ptr[i+1]) abort();
+  m->col[k]=j;
+  m->val[k]+=z;
+}
+
+/* Ten generations, with parents from near the same place in the previous
+ * generation, except for one sire in ten who is one of a few used widely.
+ * One parent in five is unknown.  Individuals 0..n_ind-1 have polygenic
+ * effects, and n_ind..n-1 are the levels of a factor (herd) with about 40
+ * neighbouring individuals per level, with one in ten moved at random.
+ * The A^-1 elements are added by Henderson's rules (without inbreeding) */
+static void make_mme(const int n_ind,struct mme *m)
+{
+  int i,j,k,s,d,n_herd,gen,*sire,*dam,*herd,*cnt;
+  double a;
+
+  seed=12345+(unsigned long)n_ind;
+  n_herd=n_ind/40+1;
+  m->n=n_ind+n_herd;
+  sire=lk_malloc(sizeof(int)*(n_ind*3+m->n));
+  dam=sire+n_ind;
+  herd=dam+n_ind;
+  cnt=herd+n_ind;
+  gen=n_ind/10+1;
+  for(i=0;i<n_ind;i++) {
+    sire[i]=dam[i]=-1;
+    if(i>=gen) {
+      j=i-gen;
+      if(rnd(5)) sire[i]=rnd(10)?j+rnd(2*NEAR+1)-NEAR:j-j%gen+rnd(20);
+      if(rnd(5)) dam[i]=j+rnd(2*NEAR+1)-NEAR;
+      if(sire[i]>=i-i%gen) sire[i]=-1;
+      if(dam[i]>=i-i%gen) dam[i]=-1;
+      if(sire[i]==dam[i]) dam[i]=-1;
+    }
+    herd[i]=n_ind+(rnd(10)?i/40:rnd(n_herd));
+  }
+  /* Count the elements of each row (an upper limit, mates may repeat) */
+  for(i=0;i<m->n;i++) cnt[i]=1;
+  for(i=0;i<n_ind;i++) {
+    s=sire[i];
+    d=dam[i];
+    if(s>=0) cnt[i]++;
+    if(d>=0) cnt[i]++;
+    if(s>=0 && d>=0) cnt[s>d?s:d]++;
+    cnt[herd[i]]++;
+  }
+  m->ptr=lk_malloc(sizeof(int)*(m->n+1));
+  m->ptr[0]=0;
+  for(i=0;i<m->n;i++) m->ptr[i+1]=m->ptr[i]+cnt[i];
+  k=m->ptr[m->n];
+  m->col=lk_malloc(sizeof(int)*k);
+  m->val=lk_calloc((size_t)k,sizeof(double));
+  for(i=0;i<m->n;i++) {
+    m->col[m->ptr[i]]=i;
+    for(j=m->ptr[i]+1;j<m->ptr[i+1];j++) m->col[j]=-1;
+  }
+  for(i=0;i<n_ind;i++) {
+    s=sire[i];
+    d=dam[i];
+    a=2.0/(1.0-.25*((s>=0)+(d>=0)));
+    add_elem(m,i,i,a+1.0);
+    if(s>=0) {
+      add_elem(m,i,s,-.5*a);
+      add_elem(m,s,s,.25*a);
+    }
+    if(d>=0) {
+      add_elem(m,i,d,-.5*a);
+      add_elem(m,d,d,.25*a);
+    }
+    if(s>=0 && d>=0) add_elem(m,s,d,.25*a);
+    add_elem(m,herd[i],herd[i],1.0);
+    add_elem(m,herd[i],i,1.0);
+  }
+  free(sire);
+}
+
+static struct Off *freelist;
+static struct arena *list_arena;
+
+static struct Off *get_node(void)
+{
+  int i;
+  struct Off *p;
+
+  if(!freelist) {
+    freelist=arena_alloc(list_arena,sizeof(struct Off)*1024);
+    for(i=0;i<1023;i++) freelist[i].Next=freelist+i+1;
+    freelist[i].Next=0;
+  }
+  p=freelist;
+  freelist=p->Next;
+  return p;
+}
+
+/* Add z to element (x,y), x>y, of the linked list matrix */
+static void add_list(struct Diag *XX,const int x,const int y,const double z)
+{
+  struct Off *p,*p2,**pp;
+
+  pp=&XX[x].First;
+  while((p=*pp) && p->col<y) pp=&p->Next;
+  if(p && p->col==y) p->val+=z;
+  else {
+    p2=get_node();
+    p2->col=y;
+    p2->val=z;
+    p2->Next=p;
+    *pp=p2;
+  }
+}
+
+/* Gaussian elimination from the last row down, the rows being held as
+ * sorted linked lists of the elements left of the diagonal, as in
+ * sample_effects.c (without the dense region).  Equation k of m is row
+ * idx[k], and the pivots are returned in piv */
+static void list_factor(const struct mme *m,const int *idx,double *piv)
+{
+  int i,j,k,k1;
+  double y,z,z1;
+  struct Diag *XX;
+  struct Off *p,*p1,*p2,*p3,*p4,**pp;
+
+  list_arena=arena_new("bench_chol",0);
+  freelist=0;
+  XX=lk_malloc(sizeof(struct Diag)*m->n);
+  for(i=0;i<m->n;i++) {
+    XX[i].First=0;
+    XX[i].val=0.0;
+  }
+  for(k=0;k<m->n;k++) {
+    XX[idx[k]].val+=m->val[m->ptr[k]];
+    for(j=m->ptr[k]+1;j<m->ptr[k+1] && m->col[j]>=0;j++) {
+      i=idx[k];
+      k1=idx[m->col[j]];
+      if(i>k1) add_list(XX,i,k1,m->val[j]);
+      else add_list(XX,k1,i,m->val[j]);
+    }
+  }
+  for(i=m->n-1;i>0;i--) {
+    y=piv[i]=XX[i].val;
+    if(fabs(y)<1.0e-12) continue;
+    y=1.0/y;
+    if(!(p=XX[i].First)) continue;
+    z=p->val;
+    XX[p->col].val-=z*z*y;
+    p2=p;
+    p=p->Next;
+    while(p) {
+      j=p->col;
+      p1=p2;
+      z1=p->val;
+      z=-z1*y;
+      pp=&XX[j].First;
+      k1=p1->col;
+      while((p3=*pp)) {
+	if(p3->col==k1) {
+	  p3->val+=p1->val*z;
+	  p1=p1->Next;
+	  if(p1==p) break;
+	  pp=&p3->Next;
+	  k1=p1->col;
+	} else if(p3->col>k1) {
+	  p4=get_node();
+	  p4->col=k1;
+	  p4->val=p1->val*z;
+	  p4->Next=p3;
+	  *pp=p4;
+	  p1=p1->Next;
+	  if(p1==p) break;
+	  pp=&p4->Next;
+	  k1=p1->col;
+	} else pp=&p3->Next;
+      }
+      if(p1!=p) {
+	do {
+	  p3=get_node();
+	  p3->col=p1->col;
+	  p3->val=p1->val*z;
+	  *pp=p3;
+	  pp=&p3->Next;
+	  p1=p1->Next;
+	} while(p1!=p);
+	*pp=0;
+      }
+      XX[j].val-=z1*z1*y;
+      p=p->Next;
+    }
+  }
+  piv[0]=XX[0].val;
+  free(XX);
+  arena_free(list_arena);
+}
+
+/* Pattern of the equations by columns in elimination order (equation k
+ * being eliminated pos[k]'th), for sn_analyse() */
+static void sn_pattern(const struct mme *m,const int *pos,int **col_ptr,int **row_idx)
+{
+  int i,j,k,*cp,*ri,*nx;
+
+  cp=lk_calloc((size_t)m->n+1,sizeof(int));
+  for(k=0;k<m->n;k++) cp[pos[k]+1]+=m->ptr[k+1]-m->ptr[k];
+  for(i=0;i<m->n;i++) cp[i+1]+=cp[i];
+  ri=lk_malloc(sizeof(int)*cp[m->n]);
+  nx=lk_malloc(sizeof(int)*m->n);
+  memcpy(nx,cp,sizeof(int)*m->n);
+  for(k=0;k<m->n;k++) for(j=m->ptr[k];j<m->ptr[k+1];j++) {
+    i=m->col[j]<0?k:m->col[j];
+    ri[nx[pos[k]]++]=pos[i];
+  }
+  free(nx);
+  *col_ptr=cp;
+  *row_idx=ri;
+}
+
+/* Fill in the values (element (i,j) going to position (pos[i],pos[j])) */
+static void sn_assemble(struct sn_chol *s,const struct mme *m,const int *pos)
+{
+  int j,k;
+
+  sn_zero(s);
+  for(k=0;k<m->n;k++) {
+    *sn_entry(s,pos[k],pos[k])+=m->val[m->ptr[k]];
+    for(j=m->ptr[k]+1;j<m->ptr[k+1] && m->col[j]>=0;j++) *sn_entry(s,pos[k],pos[m->col[j]])+=m->val[j];
+  }
+}
+
+int main(int argc,char *argv[])
+{
+  int i,j,k,r,nt,n_ind,err=0,*mm,*order,*pos,*perm,*cp,*ri;
+  int sizes[]={2000,10000,50000};
+  double t,t1,x,dmax,*piv;
+  struct mme m;
+  struct sn_chol *s;
+
+  k=argc>1?argc-1:(int)(sizeof(sizes)/sizeof(int));
+  printf("%-9s %-8s %-14s %10s %12s\n","Pedigree","Levels","Method","Time (s)","Factor size");
+  for(i=0;i<k;i++) {
+    n_ind=argc>1?atoi(argv[i+1]):sizes[i];
+    if(n_ind<10) continue;
+    make_mme(n_ind,&m);
+    /* Ordering, as in init_sample_effects() */
+    order=lk_malloc(sizeof(int)*m.n*3);
+    pos=order+m.n;
+    perm=pos+m.n;
+    mm=lk_malloc(sizeof(int)*(m.n+1+m.ptr[m.n]));
+    mm[0]=m.n+1;
+    for(r=0;r<m.n;r++) {
+      mm[r+1]=mm[r];
+      for(j=m.ptr[r]+1;j<m.ptr[r+1] && m.col[j]>=0;j++) mm[mm[r+1]++]=m.col[j];
+    }
+    min_deg(m.n,mm,order,0,0);
+    min_deg(0,0,0,0,0);
+    free(mm);
+    for(r=0;r<m.n;r++) pos[order[r]]=r;
+    t=wall_time();
+    sn_pattern(&m,pos,&cp,&ri);
+    s=sn_analyse(m.n,cp,ri,perm);
+    t=wall_time()-t;
+    free(cp);
+    free(ri);
+    for(r=0;r<m.n;r++) pos[order[perm[r]]]=r;
+    printf("%-9d %-8d %-14s %10.3f %12lu\n",n_ind,m.n,"sn_analyse",t,(unsigned long)s->x_ptr[s->n_sn]);
+    for(nt=1;nt<=4;nt*=4) {
+      t=wall_time();
+      for(r=0;r<REPS;r++) {
+	sn_assemble(s,&m,pos);
+	if(sn_factor(s,1.0e-12,nt)>=0) err=1;
+      }
+      printf("%-9d %-8d %-11s x%d %10.3f\n",n_ind,m.n,"sn_factor",nt,(wall_time()-t)/REPS);
+    }
+    if(n_ind<=LIST_MAX) {
+      /* Row n-1-e of the lists is eliminated e'th */
+      piv=lk_malloc(sizeof(double)*m.n);
+      for(r=0;r<m.n;r++) order[r]=m.n-1-pos[r];
+      t=wall_time();
+      list_factor(&m,order,piv);
+      t1=wall_time()-t;
+      for(dmax=0.0,r=0;r<m.n;r++) {
+	x=fabs(*sn_entry(s,r,r)-piv[m.n-1-r])/fabs(piv[m.n-1-r]);
+	if(x>dmax) dmax=x;
+      }
+      if(dmax>1.0e-8) err=1;
+      printf("%-9d %-8d %-14s %10.3f %12s (pivots differ by %.1e)\n",n_ind,m.n,"linked lists",t1,"",dmax);
+      free(piv);
+    } else printf("%-9d %-8d %-14s %10s\n",n_ind,m.n,"linked lists","skipped");
+    sn_free(s);
+    free(order);
+    free(m.ptr);
+    free(m.col);
+    free(m.val);
+  }
+  if(err) fprintf(stderr,"bench_chol: factorizations differ\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
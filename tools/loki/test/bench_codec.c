@@ -0,0 +1,152 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_codec.c:                                                           *
+ *                                                                          *
+ * Writes generated text through the in process gzip (1 and n threads) and *
+ * bzip2 streams and through a gzip child process, reads each file back    *
+ * in process and checks the output against the input.  Files are also     *
+ * checked with gzip -dc / bzip2 -dc when those programs are on the PATH.  *
+ *                                                                          *
+ * Usage: bench_codec [megabytes] [threads]                                 *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "libhdr.h"
+#include "lk_malloc.h"
+#include "loki_compress.h"
+#include "string_utils.h"
+
+static char tmp_file[]="bench_codec.tmp";
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static void report(const char *name,double t,size_t bytes)
+{
+  printf("%-28s %8.3f s %8.1f MB/s\n",name,t,(double)bytes/(1048576.0*t));
+}
+
+static int write_data(FILE *fptr,const char *buf,size_t size)
+{
+  size_t n;
+
+  /* Uneven writes so members and stdio buffers do not line up */
+  for(n=0;n<size;) {
+    size_t k=size-n<7919?size-n:7919;
+    if(fwrite(buf+n,(size_t)1,k,fptr)!=k) return 1;
+    n+=k;
+  }
+  return fclose(fptr)?1:0;
+}
+
+static int check_data(FILE *fptr,const char *buf,size_t size)
+{
+  char tbuf[32768];
+  size_t n,pos=0;
+  int err=0;
+
+  if(!fptr) return 1;
+  while(!err && (n=fread(tbuf,(size_t)1,sizeof(tbuf),fptr))) {
+    if(pos+n>size || memcmp(tbuf,buf+pos,n)) err=1;
+    pos+=n;
+  }
+  if(ferror(fptr)) err=1;
+  if(fclose(fptr)) err=1;
+  return err || pos!=size;
+}
+
+static int run(const char *name,int type,const char *prog,const char *buf,size_t size)
+{
+  FILE *fptr;
+  string *s;
+  double t;
+  int err;
+
+  t=wall_time();
+  if(!(fptr=codec_open(WRITE,tmp_file,type)) || write_data(fptr,buf,size)) {
+    fprintf(stderr,"bench_codec: %s: write failed\n",name);
+    return 1;
+  }
+  report(name,wall_time()-t,size);
+  t=wall_time();
+  err=check_data(codec_open(READ,tmp_file,type),buf,size);
+  report("  read back",wall_time()-t,size);
+  if(err) {
+    fprintf(stderr,"bench_codec: %s: data read back differs\n",name);
+    return 1;
+  }
+  if(prog) {
+    s=strprintf(0,"%s -dc %s",prog,tmp_file);
+    err=check_data(popen(get_cstring(s),"r"),buf,size);
+    free_string(s);
+    if(err) {
+      fprintf(stderr,"bench_codec: %s: %s -dc output differs\n",name,prog);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int main(int argc,char *argv[])
+{
+  int mb=32,nt=4,k,err=0;
+  size_t i,size=0;
+  char *buf,*prog;
+  string *s;
+  FILE *fptr;
+  struct lk_compress *lkc;
+  double t;
+
+  if(argc>1) mb=atoi(argv[1]);
+  if(argc>2) nt=atoi(argv[2]);
+  lkc=init_compress();
+  if(!codec_available(COMPRESS_GZIP) && !codec_available(COMPRESS_BZIP2)) {
+    printf("bench_codec: no in process codecs, skipped\n");
+    return EXIT_SUCCESS;
+  }
+  buf=lk_malloc(((size_t)mb<<20)+256);
+  for(i=0;size<(size_t)mb<<20;i++)
+    size+=(size_t)sprintf(buf+size,"%lu ped_%lu %lu %lu %g 1/2 2/2 1/1 0/0\n",(unsigned long)i,
+			  (unsigned long)(i%97),(unsigned long)(i>>1),(unsigned long)(i>>2),0.5*(double)i);
+  if(codec_available(COMPRESS_GZIP)) {
+    if((prog=lkc->comp_path[COMPRESS_GZIP][0])) {
+      t=wall_time();
+      if(!(fptr=fdopen(child_open(WRITE,tmp_file,prog),"w")) || write_data(fptr,buf,size)) {
+	fprintf(stderr,"bench_codec: gzip child: write failed\n");
+	err=1;
+      }
+      while(wait(&k)>0);
+      report("gzip (child process)",wall_time()-t,size);
+    }
+    set_codec_threads(1);
+    if(!err) err=run("gzip (1 thread)",COMPRESS_GZIP,prog,buf,size);
+    set_codec_threads(nt);
+    s=strprintf(0,"gzip (%d threads)",nt);
+    if(!err) err=run(get_cstring(s),COMPRESS_GZIP,prog,buf,size);
+    free_string(s);
+  }
+  if(!err && codec_available(COMPRESS_BZIP2)) {
+    size>>=2;
+    err=run("bzip2",COMPRESS_BZIP2,lkc->comp_path[COMPRESS_BZIP2][0],buf,size);
+  }
+  free(buf);
+  remove(tmp_file);
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
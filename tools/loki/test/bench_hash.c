@@ -0,0 +1,108 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_hash.c:                                                            *
+ *                                                                          *
+ * Inserts and looks up pedigree style string IDs and integer IDs in an     *
+ * AVL tree (bin_tree.c) and in the hash table (hash_map.c), checking that  *
+ * both agree.                                                              *
+ *                                                                          *
+ * Usage: bench_hash [ids]                                                  *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "lk_malloc.h"
+#include "bin_tree.h"
+#include "hash_map.h"
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static int cmp_str(const void *s1,const void *s2)
+{
+  return strcmp(s2,s1);
+}
+
+static int cmp_long(const void *s1,const void *s2)
+{
+  long a=*(const long *)s1,b=*(const long *)s2;
+
+  return b<a?-1:(b>a?1:0);
+}
+
+int main(int argc,char *argv[])
+{
+  int i,n=1000000,k,err=0;
+  char **ids;
+  long *ival;
+  struct bin_node *root=0;
+  long *v;
+  struct hash_map *hm;
+  struct hmap_entry *e,**ent;
+  double t;
+  unsigned long x=12345;
+
+  if(argc>1) n=atoi(argv[1]);
+  ids=lk_malloc(sizeof(char *)*n);
+  ival=lk_malloc(sizeof(long)*n);
+  for(i=0;i<n;i++) {
+    x=x*6364136223846793005UL+1442695040888963407UL;
+    ids[i]=lk_malloc(24);
+    sprintf(ids[i],"FAM%lu_ID%d",(x>>40)%50000,i);
+    ival[i]=(long)(x>>20);
+  }
+  /* String IDs */
+  t=wall_time();
+  for(i=0;i<n;i++) root=insert_bin_node(root,ids[i],0,cmp_str,alloc_bin_node);
+  for(i=0;i<n;i++) if(!find_bin_node(root,ids[i],cmp_str)) err=1;
+  printf("%-28s %8.3f s\n","bin_tree, string keys",wall_time()-t);
+  free_bin_tree(root,0);
+  t=wall_time();
+  hm=hmap_new(HMAP_STRING,0);
+  for(i=0;i<n;i++) {
+    e=hmap_insert(hm,ids[i],&k);
+    if(!k) e->data=ids[i];
+  }
+  for(i=0;i<n;i++) if(hmap_find(hm,ids[i])!=ids[i]) err=1;
+  printf("%-28s %8.3f s\n","hash_map, string keys",wall_time()-t);
+  if(hm->n!=(size_t)n) err=1;
+  ent=hmap_sorted(hm);
+  for(i=1;i<n;i++) if(strcmp(ent[i-1]->key.str,ent[i]->key.str)>=0) err=1;
+  free(ent);
+  hmap_free(hm,0);
+  /* Integer IDs */
+  root=0;
+  t=wall_time();
+  for(i=0;i<n;i++) root=insert_bin_node(root,ival+i,0,cmp_long,alloc_bin_node);
+  for(i=0;i<n;i++) if(!find_bin_node(root,ival+i,cmp_long)) err=1;
+  printf("%-28s %8.3f s\n","bin_tree, integer keys",wall_time()-t);
+  free_bin_tree(root,0);
+  t=wall_time();
+  hm=hmap_new(HMAP_INT,0);
+  for(i=0;i<n;i++) {
+    e=hmap_insert(hm,ival+i,&k);
+    if(!k) e->data=ival+i;
+  }
+  for(i=0;i<n;i++) if(!(v=hmap_find(hm,ival+i)) || *v!=ival[i]) err=1;
+  printf("%-28s %8.3f s\n","hash_map, integer keys",wall_time()-t);
+  hmap_free(hm,0);
+  for(i=0;i<n;i++) free(ids[i]);
+  free(ids);
+  free(ival);
+  if(err) fprintf(stderr,"bench_hash: lookups disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
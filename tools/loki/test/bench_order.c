@@ -0,0 +1,297 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_order.c:                                                           *
+ *                                                                          *
+ * Orders the genes of synthetic pedigrees for peeling with greedy() and    *
+ * min_deg() as they were (the best of the four greedy() orderings, as      *
+ * chosen by get_peelseq.c) and with amd_order(), printing the time taken   *
+ * and the cost of the resulting peeling sequence.  The costs are checked   *
+ * by carrying out each elimination sequence on the graph, and the old      *
+ * orderings are skipped for pedigrees where they would take too long.      *
+ *                                                                          *
+ * Usage: bench_order [individuals ...]                                     *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "min_deg.h"
+
+#define GREEDY_MAX 4000    /* Largest number of genes ordered with greedy() */
+#define MIN_DEG_MAX 250000 /* and with min_deg() */
+
+/* Gene graph of a pedigree: each individual has a maternal gene 2i and a
+ * paternal gene 2i+1, joined to each other and to both genes of the
+ * parent they come from */
+struct ped_graph {
+  int n,*mm;
+  double *wt;
+  struct pair_wt *wt1;
+};
+
+static unsigned long seed=12345;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static int rnd(const int n)
+{
+  seed=seed*6364136223846793005UL+1442695040888963407UL;
+  return (int)((seed>>33)%(unsigned long)n);
+}
+
+/* Families of one to four kids, most of whom marry in from outside.
+ * One in sixteen marries someone from a nearby family in the same
+ * generation, which closes a loop in the pedigree */
+static void make_pedigree(const int n_ind,struct ped_graph *g)
+{
+  int i,j,k,n,n_cpl,n_cpl1,gen,*sire,*dam,*cpl,*cpl1,*spouse,*cnt,nz=0;
+
+  seed=12345+(unsigned long)n_ind;
+  sire=lk_malloc(sizeof(int)*n_ind*7);
+  dam=sire+n_ind;
+  spouse=dam+n_ind;
+  cpl=spouse+n_ind;
+  cpl1=cpl+2*n_ind;
+  for(n=0;n<n_ind && n<64;n++) {
+    sire[n]=dam[n]=-1;
+    if(n&1) {
+      cpl[n-1]=n-1;
+      cpl[n]=n;
+    }
+  }
+  n_cpl=n/2;
+  while(n<n_ind && n_cpl) {
+    gen=n;
+    for(i=0;i<n_cpl && n<n_ind;i++) {
+      k=1+rnd(4);
+      for(j=0;j<k && n<n_ind;j++) {
+	sire[n]=cpl[2*i];
+	dam[n]=cpl[2*i+1];
+	spouse[n++]=-1;
+      }
+    }
+    k=n;
+    for(n_cpl1=0,i=gen;i<k;i++) if(spouse[i]<0) {
+	j=-1;
+	if(!rnd(16)) {
+	  j=i+1+rnd(32);
+	  if(j>=k || spouse[j]>=0) j=-1;
+	}
+	if(j<0) {
+	  if(n==n_ind) continue;
+	  j=n++;
+	  sire[j]=dam[j]=-1;
+	}
+	spouse[i]=j;
+	if(j<k) spouse[j]=i;
+	cpl1[2*n_cpl1]=i;
+	cpl1[2*n_cpl1+1]=j;
+	n_cpl1++;
+      }
+    memcpy(cpl,cpl1,sizeof(int)*2*n_cpl1);
+    n_cpl=n_cpl1;
+  }
+  g->n=2*n;
+  cnt=lk_malloc(sizeof(int)*g->n);
+  for(i=0;i<n;i++) {
+    cnt[2*i]=dam[i]>=0?2:0;
+    cnt[2*i+1]=sire[i]>=0?3:1;
+    nz+=cnt[2*i]+cnt[2*i+1];
+  }
+  g->mm=lk_malloc(sizeof(int)*(g->n+1+nz));
+  k=g->n+1;
+  for(i=0;i<n;i++) {
+    g->mm[2*i]=k;
+    if(dam[i]>=0) {
+      g->mm[k++]=2*dam[i];
+      g->mm[k++]=2*dam[i]+1;
+    }
+    g->mm[2*i+1]=k;
+    g->mm[k++]=2*i;
+    if(sire[i]>=0) {
+      g->mm[k++]=2*sire[i];
+      g->mm[k++]=2*sire[i]+1;
+    }
+  }
+  g->mm[g->n]=k;
+  g->wt=lk_malloc(sizeof(double)*g->n);
+  g->wt1=lk_malloc(sizeof(struct pair_wt)*g->n);
+  for(i=0;i<n;i++) {
+    j=2+rnd(4);
+    k=2+rnd(4);
+    g->wt[2*i]=log((double)j);
+    g->wt[2*i+1]=log((double)k);
+    g->wt1[2*i].pair_node=2*i+1;
+    g->wt1[2*i+1].pair_node=2*i;
+    g->wt1[2*i].wt=g->wt1[2*i+1].wt=log(0.5*(double)(j*k+1));
+  }
+  free(cnt);
+  free(sire);
+}
+
+/* Carry out the elimination sequence, each pivot being eliminated along
+ * with the nodes grouped with it, and add up the cost as greedy() does */
+static double peel_cost(const struct ped_graph *g,const int *order,const int *group)
+{
+  int i,j,k,x,y,n=g->n,ns,nl,st=0,**adj,*len,*size,*done,*mark,*seen,*lst;
+  double cost=0.0,z;
+
+  adj=lk_malloc(sizeof(int *)*n);
+  len=lk_calloc((size_t)n*6,sizeof(int));
+  size=len+n;
+  done=size+n;
+  mark=done+n;
+  seen=mark+n;
+  lst=seen+n;
+  for(i=0;i<n;i++) for(j=g->mm[i];j<g->mm[i+1];j++) {
+      len[i]++;
+      len[g->mm[j]]++;
+    }
+  for(i=0;i<n;i++) {
+    size[i]=len[i]+4;
+    adj[i]=lk_malloc(sizeof(int)*size[i]);
+    len[i]=0;
+  }
+  for(i=0;i<n;i++) for(j=g->mm[i];j<g->mm[i+1];j++) {
+      adj[i][len[i]++]=g->mm[j];
+      adj[g->mm[j]][len[g->mm[j]]++]=i;
+    }
+  for(i=0;i<n;) {
+    /* The group and its uneliminated neighbours */
+    st++;
+    ns=0;
+    do {
+      x=order[i++];
+      done[x]=1;
+      mark[x]=st;
+      lst[ns++]=x;
+    } while(i<n && !group[i]);
+    nl=ns;
+    for(k=0;k<ns;k++) for(j=0;j<len[lst[k]];j++) {
+	y=adj[lst[k]][j];
+	if(!done[y] && mark[y]!=st) {
+	  mark[y]=st;
+	  lst[nl++]=y;
+	}
+      }
+    for(z=0.0,k=0;k<nl;k++) {
+      x=lst[k];
+      y=g->wt1[x].pair_node;
+      if(mark[y]==st) {
+	if(x<y) z+=g->wt1[x].wt;
+      } else z+=g->wt[x];
+    }
+    cost+=exp(z);
+    /* Join the neighbours up */
+    for(k=ns;k<nl;k++) {
+      x=lst[k];
+      for(j=0;j<len[x];j++) seen[adj[x][j]]=x+1;
+      for(j=ns;j<nl;j++) {
+	y=lst[j];
+	if(y==x || seen[y]==x+1) continue;
+	if(len[x]==size[x]) {
+	  size[x]*=2;
+	  adj[x]=lk_realloc(adj[x],sizeof(int)*size[x]);
+	}
+	adj[x][len[x]++]=y;
+      }
+    }
+  }
+  for(i=0;i<n;i++) free(adj[i]);
+  free(adj);
+  free(len);
+  return cost;
+}
+
+static int check_order(const int n,const int *order,const int *group)
+{
+  int i,*seen,err=0;
+
+  seen=lk_calloc((size_t)n,sizeof(int));
+  for(i=0;i<n;i++) {
+    if(order[i]<0 || order[i]>=n || seen[order[i]]++) err=1;
+  }
+  if(group && !group[0]) err=1;
+  free(seen);
+  return err;
+}
+
+static int check_cost(const struct ped_graph *g,const int *order,const int *group,const double cost)
+{
+  double c=peel_cost(g,order,group);
+
+  return fabs(c-cost)>1.0e-9*c;
+}
+
+int main(int argc,char *argv[])
+{
+  int i,k,fg,n_ind,err=0,*order,*group,*order1;
+  int sizes[]={2000,10000,30000,100000};
+  double t,t1,cost,best;
+  struct ped_graph g;
+
+  k=argc>1?argc-1:(int)(sizeof(sizes)/sizeof(int));
+  printf("%-9s %-8s %-12s %10s %12s\n","Pedigree","Genes","Ordering","Time (s)","log10(cost)");
+  for(i=0;i<k;i++) {
+    n_ind=argc>1?atoi(argv[i+1]):sizes[i];
+    if(n_ind<2) continue;
+    make_pedigree(n_ind,&g);
+    order=lk_malloc(sizeof(int)*g.n*3);
+    group=order+g.n;
+    order1=group+g.n;
+    if(g.n<=GREEDY_MAX) {
+      set_amd_min_size(INT_MAX);
+      for(t1=0.0,best=-1.0,fg=0;fg<4;fg++) {
+	t=wall_time();
+	greedy(g.n,g.mm,order,group,g.wt,g.wt1,fg,&cost);
+	t1+=wall_time()-t;
+	if(best<0.0 || cost<best) best=cost;
+	err|=check_order(g.n,order,group)|check_cost(&g,order,group,cost);
+      }
+      printf("%-9d %-8d %-12s %10.3f %12.2f\n",n_ind,g.n,"greedy",t1,log10(best));
+    } else printf("%-9d %-8d %-12s %10s\n",n_ind,g.n,"greedy","skipped");
+    set_amd_min_size(0);
+    t=wall_time();
+    greedy(g.n,g.mm,order,group,g.wt,g.wt1,0,&cost);
+    printf("%-9d %-8d %-12s %10.3f %12.2f\n",n_ind,g.n,"amd weighted",wall_time()-t,log10(cost));
+    err|=check_order(g.n,order,group)|check_cost(&g,order,group,cost);
+    if(g.n<=MIN_DEG_MAX) {
+      set_amd_min_size(INT_MAX);
+      t=wall_time();
+      min_deg(g.n,g.mm,order1,group,0);
+      printf("%-9d %-8d %-12s %10.3f %12.2f\n",n_ind,g.n,"min_deg",wall_time()-t,log10(peel_cost(&g,order1,group)));
+      err|=check_order(g.n,order1,group);
+    } else printf("%-9d %-8d %-12s %10s\n",n_ind,g.n,"min_deg","skipped");
+    set_amd_min_size(0);
+    t=wall_time();
+    min_deg(g.n,g.mm,order1,group,0);
+    printf("%-9d %-8d %-12s %10.3f %12.2f\n",n_ind,g.n,"amd",wall_time()-t,log10(peel_cost(&g,order1,group)));
+    err|=check_order(g.n,order1,group);
+    min_deg(0,0,0,0,0);
+    free(order);
+    free(g.mm);
+    free(g.wt);
+    free(g.wt1);
+  }
+  set_amd_min_size(AMD_MIN_SIZE);
+  if(err) fprintf(stderr,"bench_order: bad ordering or cost\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
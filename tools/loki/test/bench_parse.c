@@ -0,0 +1,368 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_parse.c:                                                           *
+ *                                                                          *
+ * Splits the lines of a synthetic pedigree/phenotype/genotype file with    *
+ * tokenize() as it was and as it is now, and converts the columns with     *
+ * strtol()/strtod() and with lk_strtol()/lk_strtod(), printing the times   *
+ * for each step and for a whole pass over the file of the kind that        *
+ * ReadData() makes.  Every token and every number is checked against the   *
+ * library versions, as are a set of awkward strings, a few million random  *
+ * doubles printed in various formats and random strings to split.          *
+ *                                                                          *
+ * Usage: bench_parse [lines]                                               *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+
+#define N_TRAITS 4
+#define N_MARKERS 40
+
+static unsigned long seed=12345;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static unsigned long rnd(void)
+{
+  seed=seed*6364136223846793005UL+1442695040888963407UL;
+  return seed>>16;
+}
+
+static double rnd_double(void)
+{
+  return (double)(rnd()>>11)*(1.0/9007199254740992.0);
+}
+
+/* tokenize() as it was before the tokens were left in place */
+static void old_qstrip(char *s1)
+{
+  char *p,*p1;
+
+  p=s1;
+  p1=s1-1;
+  while(*s1) {
+    if(!isspace((int)*s1)) break;
+    s1++;
+  }
+  while(*s1) {
+    if(!isspace((int)*s1)) p1=p;
+    *(p++)= *(s1++);
+  }
+  *(++p1)='\0';
+}
+
+static tokens *old_tokenize(char *s,const int ch,tokens *tok)
+{
+  int n_toks=0;
+  char **p,*p1;
+
+  p=tok->toks;
+  if((p1=s)) {
+    if(!ch) {
+      for(;;) {
+	while(*s && isspace((int)*s)) s++;
+	if(!*s) break;
+	if(n_toks==tok->size) {
+	  tok->size<<=1;
+	  p=tok->toks=lk_realloc(p,sizeof(void *)*tok->size);
+	}
+	p[n_toks++]=p1;
+	while(*s && !isspace((int)*s)) *p1++=*s++;
+	if(*s) s++;
+	*p1++=0;
+      }
+    } else {
+      for(;;) {
+	if(!*s) break;
+	if(n_toks==tok->size) {
+	  tok->size<<=1;
+	  p=tok->toks=lk_realloc(p,sizeof(void *)*tok->size);
+	}
+	p[n_toks++]=p1;
+	while(*s && *s!=ch) *p1++=*s++;
+	if(*s) s++;
+	*p1++=0;
+	old_qstrip(p[n_toks-1]);
+      }
+    }
+  }
+  if(n_toks==1 && !*p[0]) n_toks--;
+  tok->n_tok=n_toks;
+  return tok;
+}
+
+/* id sire dam sex, the traits and then the marker genotypes as pairs of
+ * alleles, with the occasional missing value */
+static char *make_file(const int n,const int ch,size_t *len)
+{
+  int i,j,k;
+  size_t sz=(size_t)n*(64+N_TRAITS*28+N_MARKERS*8),l=0;
+  char *buf,sep[4];
+  const char *fmt[]={"%.4f","%g","%.17g","%.3e","%.1f","%.10g"};
+  double x;
+
+  buf=lk_malloc(sz);
+  sep[0]=ch?(char)ch:' ';
+  sep[1]=0;
+  for(i=0;i<n;i++) {
+    l+=(size_t)sprintf(buf+l,"%d%s%d%s%d%s%d",i+1,sep,i>100?(int)(rnd()%(unsigned long)i)+1:0,sep,
+		       i>100?(int)(rnd()%(unsigned long)i)+1:0,sep,1+(int)(rnd()&1));
+    for(j=0;j<N_TRAITS;j++) {
+      k=(int)(rnd()%6);
+      x=(rnd_double()-0.3)*(k==3?1.0e-4:(k==1?1.0e3:100.0));
+      if(!(rnd()%50)) l+=(size_t)sprintf(buf+l,"%s%s",sep,".");
+      else {
+	l+=(size_t)sprintf(buf+l,"%s",sep);
+	l+=(size_t)sprintf(buf+l,fmt[k],x);
+      }
+    }
+    for(j=0;j<N_MARKERS;j++) {
+      if(!(rnd()%20)) l+=(size_t)sprintf(buf+l,"%s0%s0",sep,sep);
+      else l+=(size_t)sprintf(buf+l,"%s%d%s%d",sep,1+(int)(rnd()%12),sep,1+(int)(rnd()%12));
+    }
+    buf[l++]='\n';
+  }
+  buf[l]=0;
+  *len=l;
+  return buf;
+}
+
+static int check_long(const char *s)
+{
+  char *e1,*e2;
+  long x1,x2;
+  int er1,er2;
+
+  errno=0;
+  x1=strtol(s,&e1,10);
+  er1=errno;
+  errno=0;
+  x2=lk_strtol(s,&e2);
+  er2=errno;
+  if(x1!=x2 || e1!=e2 || er1!=er2) {
+    fprintf(stderr,"bench_parse: lk_strtol(\"%s\") gives %ld, strtol() %ld\n",s,x2,x1);
+    return 1;
+  }
+  return 0;
+}
+
+static int check_double(const char *s)
+{
+  char *e1,*e2;
+  double x1,x2;
+  int er1,er2;
+
+  errno=0;
+  x1=strtod(s,&e1);
+  er1=errno;
+  errno=0;
+  x2=lk_strtod(s,&e2);
+  er2=errno;
+  if(memcmp(&x1,&x2,sizeof(double)) && !(x1!=x1 && x2!=x2)) er1=-1;
+  if(e1!=e2 || er1!=er2) {
+    fprintf(stderr,"bench_parse: lk_strtod(\"%s\") gives %.17g, strtod() %.17g\n",s,x2,x1);
+    return 1;
+  }
+  return 0;
+}
+
+/* Random strings of spaces, delimiters and short words, split by both
+ * versions of tokenize() and by scan_tokens() */
+static int check_split(tokens *tok1,tokens *tok2)
+{
+  int i,j,k,n,ch,err=0,size=0;
+  char s[3][160];
+  struct tok_span *sp=0;
+  const char chars[]=" \t\n\v\f\r,,:ab1.\xe9";
+
+  for(i=0;i<200000;i++) {
+    ch=(int)(rnd()%3);
+    ch=ch?(ch==1?',':'\t'):0;
+    k=(int)(rnd()%150);
+    for(j=0;j<k;j++) s[0][j]=chars[rnd()%(sizeof(chars)-1)];
+    s[0][k]=0;
+    memcpy(s[1],s[0],(size_t)k+1);
+    memcpy(s[2],s[0],(size_t)k+1);
+    old_tokenize(s[1],ch,tok1);
+    tokenize(s[2],ch,tok2);
+    n=scan_tokens(s[0],ch,&sp,&size);
+    if(tok1->n_tok!=tok2->n_tok || n!=tok1->n_tok) err=1;
+    else for(j=0;j<n;j++) {
+	if(strcmp(tok1->toks[j],tok2->toks[j]) || tok2->toks[j]!=s[2]+sp[j].start || 
+	   (int)strlen(tok2->toks[j])!=sp[j].len) err=1;
+      }
+  }
+  if(sp) free(sp);
+  if(err) fprintf(stderr,"bench_parse: tokens disagree\n");
+  return err;
+}
+
+/* Splits each line of buf into the tokens of tok, returning the number
+ * of tokens found */
+static long split_lines(char *buf,const int ch,tokens *tok,const int old,void (*fn)(tokens *,const int))
+{
+  char *p=buf,*p1;
+  long n=0;
+
+  while(*p) {
+    p1=strchr(p,'\n');
+    *p1=0;
+    if(old) old_tokenize(p,ch,tok);
+    else tokenize(p,ch,tok);
+    n+=tok->n_tok;
+    if(fn) fn(tok,old);
+    p=p1+1;
+  }
+  return n;
+}
+
+static double sum;
+
+/* The columns converted as ReadData() does */
+static void convert(tokens *tok,const int old)
+{
+  int i;
+  char *e;
+
+  for(i=0;i<tok->n_tok;i++) {
+    if(i<4 || i>=4+N_TRAITS) sum+=(double)(old?strtol(tok->toks[i],&e,10):lk_strtol(tok->toks[i],&e));
+    else if(tok->toks[i][0]!='.') sum+=old?strtod(tok->toks[i],&e):lk_strtod(tok->toks[i],&e);
+  }
+}
+
+int main(int argc,char *argv[])
+{
+  int i,j,k,n=200000,ch,err=0,ni,nr;
+  size_t len;
+  long n1,n2;
+  char *buf,*buf1,*buf2,*p1,*p2,*q1,*q2,str[64],*e,**ip,**rp;
+  double t,t1,x,s1,s2;
+  tokens *tok1,*tok2;
+  const char *odd[]={"","  ","-","+","+0","-0","-0.0","0x1f","0X1P3","1e","1e+","1e-x",".5","5.",".","-.e1",
+    "inf","-Infinity","nan","NAN(12)","1,5","1.5.2","123456789012345678901234","12345678901234567890",
+    "1234567890123456789","9007199254740993","9007199254740992","1e22","1e23","123e-22","1e-23","4.9e-324",
+    "1.7976931348623157e308","1e400","1e-400","  42","\t\n42 ","42abc","00012","-000","0000000000000000000001",
+    "-9223372036854775808","9223372036854775807","9223372036854775808","-9223372036854775809",
+    "999999999999999999","-999999999999999999","0.1","0.30000000000000004","1e0000000000000000005",
+    "3.14159265358979323846","1.00000000000000000000","2.2250738585072014e-308","\xa0""1","1\xa0"};
+  const char *fmt[]={"%.17g","%.15g","%g","%.3f","%.6e","%.20f","%.1f"};
+
+  if(argc>1) n=atoi(argv[1]);
+  for(i=0;i<(int)(sizeof(odd)/sizeof(char *));i++) err|=check_long(odd[i])|check_double(odd[i]);
+  for(i=0;i<2000000;i++) {
+    k=(int)(rnd()%7);
+    x=rnd_double();
+    j=(int)(rnd()%40)-20;
+    if(rnd()&1) x=-x;
+    while(j>0) {
+      x*=10.0;
+      j--;
+    }
+    while(j<0) {
+      x/=10.0;
+      j++;
+    }
+    sprintf(str,fmt[k],x);
+    err|=check_double(str);
+    sprintf(str,"%ld",(long)(rnd()>>(rnd()%48)));
+    err|=check_long(str);
+  }
+  ip=lk_malloc(sizeof(char *)*(size_t)n*(4+2*N_MARKERS));
+  rp=lk_malloc(sizeof(char *)*(size_t)n*N_TRAITS);
+  tok1=tokenize(0,0,0);
+  tok2=tokenize(0,0,0);
+  err|=check_split(tok1,tok2);
+  printf("%-24s %10s %10s\n","","Old (s)","New (s)");
+  for(ch=0;ch<2;ch++) {
+    buf=make_file(n,ch?',':0,&len);
+    buf1=lk_malloc(len+1);
+    buf2=lk_malloc(len+1);
+    /* The tokens and the numbers agree */
+    memcpy(buf1,buf,len+1);
+    memcpy(buf2,buf,len+1);
+    ni=nr=0;
+    for(p1=buf1,p2=buf2;*p1;p1=q1+1,p2=q2+1) {
+      *(q1=strchr(p1,'\n'))=0;
+      *(q2=strchr(p2,'\n'))=0;
+      old_tokenize(p1,ch?',':0,tok1);
+      tokenize(p2,ch?',':0,tok2);
+      if(tok1->n_tok!=tok2->n_tok) err=1;
+      else for(i=0;i<tok1->n_tok;i++) if(strcmp(tok1->toks[i],tok2->toks[i])) err=1;
+      for(i=0;i<tok2->n_tok;i++) {
+	err|=check_double(tok2->toks[i]);
+	if(i<4 || i>=4+N_TRAITS) {
+	  err|=check_long(tok2->toks[i]);
+	  if(!ch) ip[ni++]=tok2->toks[i];
+	} else if(!ch && tok2->toks[i][0]!='.') rp[nr++]=tok2->toks[i];
+      }
+    }
+    if(!ch) {
+      /* Conversion alone, on tokens that have already been split */
+      t=wall_time();
+      for(s1=0.0,i=0;i<ni;i++) s1+=(double)strtol(ip[i],&e,10);
+      t1=wall_time()-t;
+      t=wall_time();
+      for(s2=0.0,i=0;i<ni;i++) s2+=(double)lk_strtol(ip[i],&e);
+      printf("%-24s %10.3f %10.3f\n","integer columns",t1,wall_time()-t);
+      if(s1!=s2) err=1;
+      t=wall_time();
+      for(s1=0.0,i=0;i<nr;i++) s1+=strtod(rp[i],&e);
+      t1=wall_time()-t;
+      t=wall_time();
+      for(s2=0.0,i=0;i<nr;i++) s2+=lk_strtod(rp[i],&e);
+      printf("%-24s %10.3f %10.3f\n","real columns",t1,wall_time()-t);
+      if(s1!=s2) err=1;
+    }
+    memcpy(buf1,buf,len+1);
+    memcpy(buf2,buf,len+1);
+    t=wall_time();
+    n1=split_lines(buf1,ch?',':0,tok1,1,0);
+    t1=wall_time()-t;
+    t=wall_time();
+    n2=split_lines(buf2,ch?',':0,tok2,0,0);
+    printf("%-24s %10.3f %10.3f\n",ch?"tokenize, commas":"tokenize, white space",t1,wall_time()-t);
+    if(n1!=n2) err=1;
+    /* Split and convert every line */
+    memcpy(buf1,buf,len+1);
+    memcpy(buf2,buf,len+1);
+    sum=0.0;
+    t=wall_time();
+    split_lines(buf1,ch?',':0,tok1,1,convert);
+    t1=wall_time()-t;
+    s1=sum;
+    sum=0.0;
+    t=wall_time();
+    split_lines(buf2,ch?',':0,tok2,0,convert);
+    printf("%-24s %10.3f %10.3f\n",ch?"read pass, commas":"read pass, white space",t1,wall_time()-t);
+    if(s1!=sum) err=1;
+    free(buf);
+    free(buf1);
+    free(buf2);
+  }
+  free_tokens(tok1);
+  free_tokens(tok2);
+  free(ip);
+  free(rp);
+  if(err) fprintf(stderr,"bench_parse: results disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
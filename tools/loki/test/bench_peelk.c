@@ -0,0 +1,200 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_peelk.c:                                                           *
+ *                                                                          *
+ * Runs the offspring step of synthetic nuclear family peeling operations   *
+ * (multiplying each parental genotype combination by the probability of an *
+ * offspring's genotype) with the array of structs loops loki_simple_peel.c *
+ * used to use and with the kernels in peel_kernels.c.  Half the offspring  *
+ * have lumped alleles, so use the mapped kernel.  The two must give        *
+ * identical results.  With the default scalar kernels the two run at the   *
+ * same speed; build with -mavx2 or -mavx512f in CFLAGS to time the vector  *
+ * code.                                                                    *
+ *                                                                          *
+ * Usage: bench_peelk                                                       *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "lk_long.h"
+#include "shared_peel.h"
+#include "peel_kernels.h"
+
+/* Build the old loops the way the kernels are built */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+/* The layout loki_simple_peel.c used */
+struct fset {
+  int pat_gene[2];
+  int mat_gene[2];
+  double p;
+};
+
+/* A nuclear family: n_all alleles, n_off offspring, and the fraction of
+ * parental genotype combinations that are possible */
+struct family {
+  const char *name;
+  int n_all,n_off,reps;
+  double keep;
+};
+
+static unsigned long seed=12345;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static double rnd(void)
+{
+  seed=seed*6364136223846793005UL+1442695040888963407UL;
+  return ((double)(seed>>11)+0.5)*(1.0/9007199254740992.0);
+}
+
+static void old_combine(struct fset *fs,const int fsp,const double *qval,const double *tp,const int n_bits)
+{
+  int n,i1,j2,k,l;
+  double z;
+
+  for(n=0;n<fsp;n++) {
+    i1=fs->pat_gene[X_MAT]<<n_bits;
+    k=fs->mat_gene[X_MAT];
+    j2=fs->pat_gene[X_PAT]<<n_bits;
+    l=fs->mat_gene[X_PAT];
+    z=tp[X_MM_PM]*qval[i1|k]+tp[X_MM_PP]*qval[j2|k]+tp[X_MP_PM]*qval[i1|l]+tp[X_MP_PP]*qval[j2|l];
+    (fs++)->p*=z;
+  }
+}
+
+static void old_combine_map(struct fset *fs,const int fsp,const double *qval,const double *tp,const double *tpp1,
+			    const double *tpp2,const int *id_set1,const int *id_set2)
+{
+  int n,i1,j2,k,l;
+  double z;
+
+  for(n=0;n<fsp;n++) {
+    i1=id_set1[fs->pat_gene[X_MAT]];
+    j2=id_set1[fs->pat_gene[X_PAT]];
+    k=id_set2[fs->mat_gene[X_MAT]];
+    l=id_set2[fs->mat_gene[X_PAT]];
+    if(i1!=j2) {
+      if(k!=l) z=tp[X_MM_PM]*qval[i1|k]+tp[X_MM_PP]*qval[j2|k]+tp[X_MP_PM]*qval[i1|l]+tp[X_MP_PP]*qval[j2|l];
+      else z=tpp1[X_MAT]*qval[i1|k]+tpp1[X_PAT]*qval[j2|k];
+    } else if(k!=l) z=tpp2[X_MAT]*qval[i1|k]+tpp2[X_PAT]*qval[i1|l];
+    else z=qval[i1|k];
+    (fs++)->p*=z;
+  }
+}
+
+int main(void)
+{
+  int i,j,k,l,m,r,n_all,n_bits,n_idx,fsp,err=0,*gene[4],*id_set1,*id_set2;
+  lk_ulong cm[2];
+  double *p,*p0,*qval,*tp,*tpp,t,t_old,t_new;
+  struct fset *fs;
+  struct family fam[]={
+    {"diallelic",2,4,40000,1.0},
+    {"snp",4,4,4000,0.6},
+    {"micro 12",12,6,40,0.3},
+    {"micro 30",30,6,4,0.2}
+  };
+
+#if defined(__AVX512F__)
+  printf("Kernels: AVX-512\n");
+#elif defined(__AVX2__)
+  printf("Kernels: AVX2\n");
+#else
+  printf("Kernels: scalar\n");
+#endif
+  printf("%-10s %7s %9s %9s %9s\n","Family","Alleles","Combs","Old(s)","New(s)");
+  for(i=0;i<(int)(sizeof(fam)/sizeof(struct family));i++) {
+    n_all=fam[i].n_all;
+    n_bits=num_bits(n_all);
+    n_idx=1<<(n_bits+n_bits);
+    j=n_all*n_all*n_all*n_all;
+    fs=lk_malloc(sizeof(struct fset)*j);
+    p=lk_malloc(sizeof(double)*j*2);
+    p0=p+j;
+    gene[0]=lk_malloc(sizeof(int)*j*4);
+    for(k=1;k<4;k++) gene[k]=gene[k-1]+j;
+    for(fsp=j=0;j<n_all*n_all*n_all*n_all;j++) if(rnd()<fam[i].keep) {
+	for(m=j,k=0;k<4;k++,m/=n_all) gene[k][fsp]=m%n_all;
+	fs[fsp].pat_gene[X_MAT]=gene[0][fsp];
+	fs[fsp].pat_gene[X_PAT]=gene[1][fsp];
+	fs[fsp].mat_gene[X_MAT]=gene[2][fsp];
+	fs[fsp].mat_gene[X_PAT]=gene[3][fsp];
+	p0[fsp++]=rnd();
+      }
+    qval=lk_malloc(sizeof(double)*n_idx*fam[i].n_off);
+    tp=lk_malloc(sizeof(double)*8*fam[i].n_off);
+    tpp=tp+4*fam[i].n_off;
+    id_set1=lk_malloc(sizeof(int)*n_all*2*fam[i].n_off);
+    id_set2=id_set1+n_all*fam[i].n_off;
+    for(m=0;m<fam[i].n_off;m++) {
+      for(j=0;j<n_idx;j++) qval[m*n_idx+j]=rnd()<0.2?0.0:rnd();
+      for(j=0;j<4;j++) tp[4*m+j]=0.25*rnd();
+      for(j=0;j<4;j++) tpp[4*m+j]=0.5*rnd();
+      /* Odd offspring have lumped alleles */
+      cm[0]=cm[1]=0;
+      if(m&1) for(j=0;j<n_all;j++) {
+	  if(rnd()<0.3) cm[X_MAT]|=(lk_ulong)1<<j;
+	  if(rnd()<0.3) cm[X_PAT]|=(lk_ulong)1<<j;
+	}
+      k=(n_all-1)<<n_bits;
+      for(j=0;j<n_all;j++) {
+	id_set1[m*n_all+j]=((cm[X_PAT]>>j)&1)?k:(j<<n_bits);
+	id_set2[m*n_all+j]=((cm[X_MAT]>>j)&1)?n_all-1:j;
+      }
+    }
+    t_old=t_new=0.0;
+    for(r=0;r<fam[i].reps;r++) {
+      for(j=0;j<fsp;j++) fs[j].p=p0[j];
+      t=wall_time();
+      for(m=0;m<fam[i].n_off;m++) {
+	if(m&1) old_combine_map(fs,fsp,qval+m*n_idx,tp+4*m,tpp+4*m,tpp+4*m+2,id_set1+m*n_all,id_set2+m*n_all);
+	else old_combine(fs,fsp,qval+m*n_idx,tp+4*m,n_bits);
+      }
+      t_old+=wall_time()-t;
+      memcpy(p,p0,sizeof(double)*fsp);
+      t=wall_time();
+      for(m=0;m<fam[i].n_off;m++) {
+	if(m&1) pk_trans_combine_map(p,gene[0],gene[1],gene[2],gene[3],qval+m*n_idx,tp+4*m,tpp+4*m,tpp+4*m+2,
+				     id_set1+m*n_all,id_set2+m*n_all,fsp);
+	else pk_trans_combine(p,gene[0],gene[1],gene[2],gene[3],qval+m*n_idx,tp+4*m,n_bits,fsp);
+      }
+      t_new+=wall_time()-t;
+    }
+    for(j=0;j<fsp;j++) if(memcmp(&fs[j].p,p+j,sizeof(double))) break;
+    if(j<fsp) {
+      fprintf(stderr,"bench_peelk: %s: results differ at combination %d\n",fam[i].name,j);
+      err=1;
+    }
+    printf("%-10s %7d %9d %9.3f %9.3f\n",fam[i].name,n_all,fsp,t_old,t_new);
+    free(fs);
+    free(p);
+    free(gene[0]);
+    free(qval);
+    free(tp);
+    free(id_set1);
+  }
+  if(err) fprintf(stderr,"bench_peelk: kernels disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
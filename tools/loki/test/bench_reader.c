@@ -0,0 +1,116 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_reader.c:                                                          *
+ *                                                                          *
+ * Reads a generated text file line by line with fget_string() and with     *
+ * the line reader on the mapped file and through a pipe, checking that     *
+ * all three see the same lines.                                            *
+ *                                                                          *
+ * Usage: bench_reader [megabytes]                                          *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "string_utils.h"
+#include "line_reader.h"
+
+static char tmp_file[]="bench_reader.tmp";
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static void report(const char *name,double t,size_t n,size_t bytes)
+{
+  printf("%-24s %9lu lines %8.3f s %8.1f MB/s\n",name,(unsigned long)n,t,(double)bytes/(1048576.0*t));
+}
+
+static size_t read_lr(FILE *fptr,size_t *bytes)
+{
+  struct line_reader *lr;
+  size_t n=0,len;
+
+  *bytes=0;
+  lr=lr_open(fptr,0);
+  while(lr_getline(lr,&len)) {
+    *bytes+=len+1;
+    n++;
+  }
+  lr_close(lr);
+  return n;
+}
+
+int main(int argc,char *argv[])
+{
+  int mb=64;
+  size_t i,n,n1,bytes,bytes1,size=0;
+  FILE *fptr;
+  string *s=0;
+  void *tbuf=0;
+  double t;
+
+  if(argc>1) mb=atoi(argv[1]);
+  if(!(fptr=fopen(tmp_file,"w"))) {
+    perror(tmp_file);
+    return EXIT_FAILURE;
+  }
+  for(i=0;size<(size_t)mb<<20;i++) {
+    int k=fprintf(fptr,"%lu ped_%lu %lu %lu %g 1/2 2/2 1/1 0/0\n",(unsigned long)i,
+		  (unsigned long)(i%97),(unsigned long)(i>>1),(unsigned long)(i>>2),0.5*(double)i);
+    if(k<0) return EXIT_FAILURE;
+    size+=(size_t)k;
+  }
+  fclose(fptr);
+  /* fget_string() */
+  fptr=fopen(tmp_file,"r");
+  t=wall_time();
+  bytes=n=0;
+  while((s=fget_string(fptr,s,&tbuf))->len) {
+    bytes+=s->len;
+    n++;
+  }
+  t=wall_time()-t;
+  fclose(fptr);
+  free_fget_buffer(&tbuf);
+  free_string(s);
+  report("fget_string",t,n,bytes);
+  /* Mapped file */
+  fptr=fopen(tmp_file,"r");
+  t=wall_time();
+  n1=read_lr(fptr,&bytes1);
+  t=wall_time()-t;
+  fclose(fptr);
+  report("lr_getline (mmap)",t,n1,bytes1);
+  if(n1!=n || bytes1!=bytes) {
+    fprintf(stderr,"bench_reader: line reader saw %lu lines, fget_string %lu\n",(unsigned long)n1,(unsigned long)n);
+    return EXIT_FAILURE;
+  }
+  /* Pipe */
+  s=strprintf(0,"cat %s",tmp_file);
+  fptr=popen(get_cstring(s),"r");
+  t=wall_time();
+  n1=read_lr(fptr,&bytes1);
+  t=wall_time()-t;
+  pclose(fptr);
+  free_string(s);
+  report("lr_getline (pipe)",t,n1,bytes1);
+  if(n1!=n || bytes1!=bytes) {
+    fprintf(stderr,"bench_reader: piped line reader saw %lu lines, fget_string %lu\n",(unsigned long)n1,(unsigned long)n);
+    return EXIT_FAILURE;
+  }
+  remove(tmp_file);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,412 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_rfstore.c:                                                         *
+ *                                                                          *
+ * Assembles the output R-Functions of synthetic complex peeling operations *
+ * from looped pedigrees, storing the terms with the bucketed AVL trees     *
+ * that loki_complex_peel.c used to use and with rf_store.c.  Each output   *
+ * function is then either read off in index order (peeling) or sampled    *
+ * from (the reverse pass).  The two stores must give identical functions   *
+ * and identical samples.                                                   *
+ *                                                                          *
+ * Usage: bench_rfstore                                                     *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "bin_tree.h"
+#include "shared_peel.h"
+#include "rf_store.h"
+
+#define N_DRAWS 1000
+
+/* The old store: 2056 direct slots for indices of up to 11 bits, otherwise
+ * 256 buckets on the top 8 bits of the index, each an AVL tree */
+#define IDX_PART_BIT 8
+#define IDX_PART (1<<IDX_PART_BIT)
+#define HASHTABLE_SIZE 2056
+#define HB_SIZE 2048
+
+struct term {
+  lk_ulong index;
+  double p;
+};
+
+struct term_block {
+  struct term_block *next;
+  struct bin_node *elements;
+  struct term *hd;
+  int size,ptr;
+};
+
+struct old_store {
+  struct bin_node *hashtable[HASHTABLE_SIZE];
+  struct term_block *first,*cur;
+  int n_terms,hash_mode,ht_size,idx_shift;
+};
+
+/* One peeling operation: n_out output genes and n_peel genes peeled out,
+ * each with n_all alleles */
+struct peel_op {
+  const char *name;
+  int n_all,n_out,n_peel,reps;
+  double keep;
+};
+
+static unsigned long seed=12345;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static double rnd(void)
+{
+  seed=seed*6364136223846793005UL+1442695040888963407UL;
+  return ((double)(seed>>11)+0.5)*(1.0/9007199254740992.0);
+}
+
+static struct bin_node *old_element(struct old_store *s,const lk_ulong idx,const double p)
+{
+  struct bin_node *element;
+  struct term *hd;
+
+  while(s->cur->ptr>=s->cur->size) {
+    if(!s->cur->next) {
+      s->cur->next=lk_malloc(sizeof(struct term_block));
+      s->cur=s->cur->next;
+      s->cur->next=0;
+      s->cur->elements=lk_malloc(sizeof(struct bin_node)*HB_SIZE);
+      s->cur->hd=lk_malloc(sizeof(struct term)*HB_SIZE);
+      s->cur->size=HB_SIZE;
+    } else s->cur=s->cur->next;
+    s->cur->ptr=0;
+  }
+  hd=s->cur->hd+s->cur->ptr;
+  element=s->cur->elements+s->cur->ptr++;
+  element->left=element->right=0;
+  element->balance=0;
+  hd->index=idx;
+  hd->p=p;
+  element->data=hd;
+  s->n_terms++;
+  return element;
+}
+
+static struct bin_node *old_insert(struct old_store *s,struct bin_node *node,const lk_ulong idx,const double p,int *bal)
+{
+  int bb;
+  struct term *hd=node->data;
+
+  if(idx!=hd->index) {
+    bb=node->balance;
+    if(idx<hd->index) {
+      if(node->left) node->left=old_insert(s,node->left,idx,p,bal);
+      else {
+	node->left=old_element(s,idx,p);
+	*bal=0;
+      }
+      if(!(*bal)) {
+	switch(bb) {
+	case -1:
+	  node=rotate_left(node);
+	  *bal=1;
+	  break;
+	case 0:
+	  node->balance=-1;
+	  break;
+	case 1:
+	  node->balance=0;
+	  *bal=1;
+	}
+      }
+    } else {
+      if(node->right) node->right=old_insert(s,node->right,idx,p,bal);
+      else {
+	node->right=old_element(s,idx,p);
+	*bal=0;
+      }
+      if(!(*bal)) {
+	switch(bb) {
+	case -1:
+	  node->balance=0;
+	  *bal=1;
+	  break;
+	case 0:
+	  node->balance=1;
+	  break;
+	case 1:
+	  node=rotate_right(node);
+	  *bal=1;
+	}
+      }
+    }
+  } else {
+    *bal=1;
+    hd->p+=p;
+  }
+  return node;
+}
+
+static void old_init(struct old_store *s,const int k)
+{
+  int i;
+  struct term_block *b;
+
+  if(!s->first) {
+    s->first=lk_malloc(sizeof(struct term_block));
+    s->first->elements=lk_malloc(sizeof(struct bin_node)*HB_SIZE);
+    s->first->hd=lk_malloc(sizeof(struct term)*HB_SIZE);
+    s->first->next=0;
+    s->first->size=HB_SIZE;
+  }
+  for(b=s->first;b;b=b->next) b->ptr=0;
+  s->cur=s->first;
+  s->n_terms=0;
+  s->hash_mode=(log(2.0)*k<log((double)HASHTABLE_SIZE));
+  if(s->hash_mode) s->ht_size=(1<<k);
+  else {
+    s->ht_size=IDX_PART;
+    s->idx_shift=k-IDX_PART_BIT;
+  }
+  for(i=0;i<s->ht_size;i++) s->hashtable[i]=0;
+}
+
+static void old_add(struct old_store *s,const lk_ulong a,const double p)
+{
+  int k,k1;
+
+  if(s->hash_mode) {
+    k=(int)a;
+    if(!s->hashtable[k]) s->hashtable[k]=old_element(s,a,p);
+    else ((struct term *)s->hashtable[k]->data)->p+=p;
+  } else {
+    k=(int)(a>>s->idx_shift);
+    if(s->hashtable[k]) s->hashtable[k]=old_insert(s,s->hashtable[k],a,p,&k1);
+    else s->hashtable[k]=old_element(s,a,p);
+  }
+}
+
+static void old_nodes(struct bin_node *node,double *tp,lk_ulong *tl,int *j)
+{
+  struct term *hd;
+
+  if(node->left) old_nodes(node->left,tp,tl,j);
+  hd=node->data;
+  tp[*j]=hd->p;
+  tl[(*j)++]=hd->index;
+  if(node->right) old_nodes(node->right,tp,tl,j);
+}
+
+static void old_get(const struct old_store *s,double *tp,lk_ulong *tl)
+{
+  int j,k;
+  struct term *hd;
+
+  for(j=k=0;k<s->ht_size;k++) if(s->hashtable[k]) {
+      if(s->hash_mode) {
+	hd=s->hashtable[k]->data;
+	tp[j]=hd->p;
+	tl[j++]=(lk_ulong)k;
+      } else old_nodes(s->hashtable[k],tp,tl,&j);
+    }
+}
+
+static int old_comb(struct bin_node *node,const double z,double *p,lk_ulong *idx)
+{
+  struct term *hd;
+
+  if(node->left) if(old_comb(node->left,z,p,idx)) return 1;
+  hd=node->data;
+  if(hd->p>0.0) {
+    *p+=hd->p;
+    if(*p>=z) {
+      *idx=hd->index;
+      return 1;
+    }
+  }
+  if(node->right) if(old_comb(node->right,z,p,idx)) return 1;
+  return 0;
+}
+
+static int old_sample(const struct old_store *s,const double z,lk_ulong *a)
+{
+  int k;
+  double p1=0.0;
+  struct term *hd;
+
+  for(k=0;k<s->ht_size;k++) {
+    if(!s->hashtable[k]) continue;
+    if(s->hash_mode) {
+      hd=s->hashtable[k]->data;
+      if(hd->p>0.0) {
+	p1+=hd->p;
+	if(z<=p1) {
+	  *a=(lk_ulong)k;
+	  return 1;
+	}
+      }
+    } else if(old_comb(s->hashtable[k],z,&p1,a)) return 1;
+  }
+  return 0;
+}
+
+static void old_free(struct old_store *s)
+{
+  struct term_block *b;
+
+  while(s->first) {
+    b=s->first->next;
+    free(s->first->elements);
+    free(s->first->hd);
+    free(s->first);
+    s->first=b;
+  }
+}
+
+/* The contributions to the output function, in the order the peeling
+ * operation visits them: every combination of alleles for the involved
+ * genes, the output genes varying fastest, with the combinations that are
+ * inconsistent with the input R-Functions dropped */
+static int make_stream(const struct peel_op *op,lk_ulong **idx,double **p,double *tot)
+{
+  int i,j,nb,n_genes,n=0,size=1024,*gt;
+  lk_ulong a;
+  double z;
+
+  nb=num_bits(op->n_all);
+  n_genes=op->n_out+op->n_peel;
+  gt=lk_calloc((size_t)n_genes,sizeof(int));
+  *idx=lk_malloc(sizeof(lk_ulong)*size);
+  *p=lk_malloc(sizeof(double)*size);
+  *tot=0.0;
+  for(;;) {
+    if(rnd()<op->keep) {
+      for(a=0,i=op->n_out-1;i>=0;i--) a=(a<<nb)|(lk_ulong)gt[i];
+      if(n==size) {
+	size*=2;
+	*idx=lk_realloc(*idx,sizeof(lk_ulong)*size);
+	*p=lk_realloc(*p,sizeof(double)*size);
+      }
+      z=rnd()*rnd();
+      (*idx)[n]=a;
+      (*p)[n++]=z;
+      *tot+=z;
+    }
+    for(j=0;j<n_genes;j++) {
+      if(++gt[j]<op->n_all) break;
+      gt[j]=0;
+    }
+    if(j==n_genes) break;
+  }
+  free(gt);
+  return n;
+}
+
+int main(void)
+{
+  int i,j,k,n,n_terms,r,err=0,k1,k2;
+  lk_ulong *idx,*tl,*tl1,a,a1;
+  double *p,*tp,*tp1,t,t_old[2],t_new[2],tot,*z;
+  struct old_store os;
+  struct rf_store rs;
+  struct peel_op ops[]={
+    {"nuclear",4,5,2,400,0.5},
+    {"two loops",4,8,2,6,0.3},
+    {"inbred",6,7,1,4,0.2},
+    {"marker",10,6,1,2,0.05}
+  };
+
+  memset(&os,0,sizeof(os));
+  memset(&rs,0,sizeof(rs));
+  printf("%-10s %5s %9s %9s %9s %9s %9s %9s\n","Op","Bits","Adds","Terms","Tree(s)","Store(s)","Tree(s)","Store(s)");
+  printf("%-10s %5s %9s %9s %19s %19s\n","","","","","peel","sample");
+  z=lk_malloc(sizeof(double)*N_DRAWS);
+  for(i=0;i<(int)(sizeof(ops)/sizeof(struct peel_op));i++) {
+    n=make_stream(ops+i,&idx,&p,&tot);
+    k=num_bits(ops[i].n_all)*ops[i].n_out;
+    for(j=0;j<N_DRAWS;j++) z[j]=(j?rnd():1.0)*tot;
+    t_old[0]=t_old[1]=t_new[0]=t_new[1]=0.0;
+    /* Peeling: assemble and read off in index order */
+    tl=tl1=0;
+    tp=tp1=0;
+    n_terms=0;
+    for(r=0;r<ops[i].reps;r++) {
+      t=wall_time();
+      old_init(&os,k);
+      for(j=0;j<n;j++) old_add(&os,idx[j],p[j]);
+      if(!tl) {
+	n_terms=os.n_terms;
+	tl=lk_malloc(sizeof(lk_ulong)*n_terms*2);
+	tl1=tl+n_terms;
+	tp=lk_malloc(sizeof(double)*n_terms*2);
+	tp1=tp+n_terms;
+      }
+      old_get(&os,tp,tl);
+      t_old[0]+=wall_time()-t;
+      t=wall_time();
+      rfs_init(&rs,k);
+      for(j=0;j<n;j++) rfs_add(&rs,idx[j],p[j]);
+      rfs_sort(&rs);
+      for(j=0;j<rs.n;j++) {
+	tl1[j]=rs.idx[j];
+	tp1[j]=rs.p[j];
+      }
+      t_new[0]+=wall_time()-t;
+    }
+    if(rs.n!=n_terms || memcmp(tl,tl1,sizeof(lk_ulong)*n_terms) || memcmp(tp,tp1,sizeof(double)*n_terms)) {
+      fprintf(stderr,"bench_rfstore: %s: functions differ\n",ops[i].name);
+      err=1;
+    }
+    /* Sampling: assemble and draw one term */
+    for(r=0;r<ops[i].reps;r++) {
+      t=wall_time();
+      old_init(&os,k);
+      for(j=0;j<n;j++) old_add(&os,idx[j],p[j]);
+      k1=old_sample(&os,z[r%N_DRAWS],&a);
+      t_old[1]+=wall_time()-t;
+      t=wall_time();
+      rfs_init(&rs,k);
+      for(j=0;j<n;j++) rfs_add(&rs,idx[j],p[j]);
+      rfs_sort(&rs);
+      k2=rfs_sample(&rs,z[r%N_DRAWS],&a1);
+      t_new[1]+=wall_time()-t;
+      if(k1!=k2 || (k1 && a!=a1)) err=1;
+    }
+    /* Check many draws from the last function, including the total */
+    for(j=0;j<N_DRAWS;j++) {
+      k1=old_sample(&os,z[j],&a);
+      k2=rfs_sample(&rs,z[j],&a1);
+      if(k1!=k2 || (k1 && a!=a1)) {
+	fprintf(stderr,"bench_rfstore: %s: samples differ\n",ops[i].name);
+	err=1;
+	break;
+      }
+    }
+    printf("%-10s %5d %9d %9d %9.3f %9.3f %9.3f %9.3f\n",ops[i].name,k,n,n_terms,t_old[0],t_new[0],t_old[1],t_new[1]);
+    free(tl);
+    free(tp);
+    free(idx);
+    free(p);
+  }
+  free(z);
+  old_free(&os);
+  rfs_free(&rs);
+  if(err) fprintf(stderr,"bench_rfstore: stores disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_rng.c:                                                             *
+ *                                                                          *
+ * Checks the Mersenne Twister against its reference output, checks that   *
+ * rng_jump() lands where stepping the generator does and that the block   *
+ * generators give the same numbers as single calls, then times single     *
+ * and block generation of uniform and normal deviates and the setup of    *
+ * independent streams.                                                     *
+ *                                                                          *
+ * Usage: bench_rng [draws] [streams]                                       *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "ranlib.h"
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+/* Jump c by 2^log2 and compare with stepping a copy */
+static int check_jump(struct rng_ctx *c,const int log2)
+{
+  static struct rng_ctx c1;
+  unsigned long i;
+  int k,err=0;
+
+  c1=*c;
+  for(i=0;i<(1UL<<log2);i++) (void)genint_r(&c1);
+  if(rng_jump(c,log2)) return 1;
+  for(k=0;k<2000;k++) if(genint_r(c)!=genint_r(&c1)) err=1;
+  return err;
+}
+
+/* Block generation against single draws, with blocks crossing state boundaries */
+static int check_block(void)
+{
+  static struct rng_ctx c,c1;
+  double x[1500];
+  int i,k,err=0;
+
+  sgenrand_r(&c,4357U);
+  c1=c;
+  for(k=1;k<1500;k+=333) {
+    genrand_block_r(&c,x,k);
+    for(i=0;i<k;i++) if(x[i]!=genrand_r(&c1)) err=1;
+    safe_genrand_block_r(&c,x,k);
+    for(i=0;i<k;i++) if(x[i]!=safe_genrand_r(&c1)) err=1;
+    snorm_block_r(&c,x,k);
+    for(i=0;i<k;i++) if(x[i]!=snorm_r(&c1)) err=1;
+  }
+  return err;
+}
+
+int main(int argc,char *argv[])
+{
+  static struct rng_ctx c;
+  int i,j,n=10000000,ns=8,err=0;
+  double t,z=0.0,x[256];
+
+  if(argc>1) n=atoi(argv[1]);
+  if(argc>2) ns=atoi(argv[2]);
+  /* Reference output of mt19937ar.c for seed 5489 */
+  sgenrand_r(&c,5489U);
+  if(genint_r(&c)!=3499211612U) err=1;
+  /* Jumps from a fresh state, part way through a block and for another generator */
+  sgenrand_r(&c,4357U);
+  err|=check_jump(&c,10);
+  for(i=0;i<300;i++) (void)genint_r(&c);
+  err|=check_jump(&c,12);
+  memset(&c,0,sizeof(c));
+  (void)set_mt_idx_r(&c,5);
+  sgenrand_r(&c,99U);
+  for(i=0;i<1000;i++) (void)genint_r(&c);
+  err|=check_jump(&c,11);
+  err|=check_block();
+  if(err) fprintf(stderr,"bench_rng: generator check failed\n");
+  sgenrand(4357U);
+  t=wall_time();
+  if(rng_init_streams(ns)) err=1;
+  printf("%-28s %8.3f s\n","setup of streams",wall_time()-t);
+  t=wall_time();
+  for(i=0;i<n;i++) z+=genrand();
+  printf("%-28s %8.3f s\n","genrand()",wall_time()-t);
+  t=wall_time();
+  for(i=0;i<n;i++) z+=genrand_r(rng_stream(ns-1));
+  printf("%-28s %8.3f s\n","genrand_r()",wall_time()-t);
+  t=wall_time();
+  for(i=0;i<n;i+=256) {
+    genrand_block(x,256);
+    for(j=0;j<256;j++) z+=x[j];
+  }
+  printf("%-28s %8.3f s\n","genrand_block()",wall_time()-t);
+  t=wall_time();
+  for(i=0;i<n/10;i++) z+=snorm();
+  printf("%-28s %8.3f s\n","snorm()",wall_time()-t);
+  t=wall_time();
+  for(i=0;i<n/10;i+=256) {
+    snorm_block(x,256);
+    for(j=0;j<256;j++) z+=x[j];
+  }
+  printf("%-28s %8.3f s\n","snorm_block()",wall_time()-t);
+  t=wall_time();
+  for(i=0;i<n/10;i++) z+=gennor_r(rng_stream(ns-1),0.0,1.0)+sgamma_r(rng_stream(ns-1),2.5);
+  printf("%-28s %8.3f s\n","gennor_r()+sgamma_r()",wall_time()-t);
+  if(z<0.0) printf("%g\n",z);
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
@@ -0,0 +1,191 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_segk.c:                                                            *
+ *                                                                          *
+ * Samples the segregation indicators of synthetic meioses along a linkage *
+ * group with the one meiosis at a time loops of sample_segs() and          *
+ * with the batched kernels in seg_kernels.c, starting from the same random *
+ * number state.  Female and male meioses are mixed as in a pedigree.  The  *
+ * two must sample identical indicators.  The last column gives the one     *
+ * sample_segs() uses with one thread for a group of that many loci.        *
+ *                                                                          *
+ * Usage: bench_segk                                                        *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "ranlib.h"
+#include "seg_kernels.h"
+
+/* Build the old loops the way the kernels are built */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC optimize ("fp-contract=off")
+#endif
+
+#define LANES 8
+/* As SEG_BATCH_LOCI in loki_ibd.c */
+#define BATCH_LOCI 500
+
+/* A linkage group: n_loci loci, n_mei meioses, and the fraction of
+ * indicators that are known */
+struct group {
+  const char *name;
+  int n_loci,n_mei,reps;
+  double known;
+};
+
+static unsigned long seed=12345;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static double rnd(void)
+{
+  seed=seed*6364136223846793005UL+1442695040888963407UL;
+  return ((double)(seed>>11)+0.5)*(1.0/9007199254740992.0);
+}
+
+/* seg[k][m] is the indicator of meiosis m at locus k */
+static void old_sample(int **seg,const int n_loci,const int n_mei,const int *par,double **recom,double **p)
+{
+  int j,k,s,s1;
+  double pp[2],z,z1,*r;
+
+  for(j=0;j<n_mei;j++) {
+    r=recom[par[j]];
+    s=seg[0][j];
+    if(s<0) {
+      p[0][0]=p[1][0]=.5;
+    } else {
+      p[s][0]=1.0;
+      p[s^1][0]=0.0;
+    }
+    for(k=1;k<n_loci;k++) {
+      s=seg[k][j];
+      if(s<0) {
+	pp[0]=.5*(p[0][k-1]*(1.0-r[k-1])+p[1][k-1]*r[k-1]);
+	pp[1]=.5*(p[1][k-1]*(1.0-r[k-1])+p[0][k-1]*r[k-1]);
+	z=pp[0]+pp[1];
+	p[0][k]=pp[0]/z;
+	p[1][k]=pp[1]/z;
+      } else {
+	p[s][k]=1.0;
+	p[s^1][k]=0.0;
+      }
+    }
+    if(s<0) {
+      s=(ranf()<p[0][n_loci-1])?0:1;
+      seg[n_loci-1][j]=s;
+    }
+    for(k=n_loci-2;k>=0;k--) {
+      s1=seg[k][j];
+      if(s1<0) {
+	pp[s]=p[s][k]*(1.0-r[k]);
+	pp[s^1]=p[s^1][k]*r[k];
+	z=pp[0]+pp[1];
+	z1=ranf();
+	s1=(z*z1<pp[0])?0:1;
+	seg[k][j]=s1;
+      }
+      s=s1;
+    }
+  }
+}
+
+/* As sample_meioses() in loki_ibd.c */
+static void new_sample(int **seg,const int n_loci,const int n_mei,const int *par,double **recom,struct seg_work *w)
+{
+  int j,k,m,nb,n0,n1,*s,lane[LANES];
+
+  for(m=0;m<n_mei;m+=nb) {
+    nb=n_mei-m<LANES?n_mei-m:LANES;
+    for(n0=j=0,n1=LANES;j<nb;j++) lane[j]=par[m+j]?--n1:n0++;
+    for(s=w->s,k=0;k<n_loci;k++,s+=LANES) for(j=0;j<nb;j++) s[lane[j]]=seg[k][m+j];
+    if(n0) sk_forward(w,n_loci,0,n0,recom[0]);
+    if(n1<LANES) sk_forward(w,n_loci,n1,LANES,recom[1]);
+    for(j=0;j<nb;j++) sk_backward(w,n_loci,lane[j],recom[par[m+j]],&lk_rng);
+    for(s=w->s,k=0;k<n_loci;k++,s+=LANES) for(j=0;j<nb;j++) seg[k][m+j]=s[lane[j]];
+  }
+}
+
+int main(void)
+{
+  int i,j,k,r,n,err=0,*par,**seg0,**seg1,**seg2;
+  double *recom[2],*p[2],t,t_old,t_new;
+  struct seg_work w;
+  struct group grp[]={
+    {"snp dense",2000,400,20,0.1},
+    {"micro",200,4000,20,0.3},
+    {"sparse",20,40000,20,0.5}
+  };
+
+  printf("%-10s %6s %8s %9s %9s %5s\n","Group","Loci","Meioses","Old(s)","New(s)","Used");
+  for(i=0;i<(int)(sizeof(grp)/sizeof(struct group));i++) {
+    n=grp[i].n_loci;
+    recom[0]=lk_malloc(sizeof(double)*4*n);
+    recom[1]=recom[0]+n;
+    p[0]=recom[1]+n;
+    p[1]=p[0]+n;
+    for(k=0;k<n-1;k++) {
+      recom[0][k]=0.5*rnd()*rnd();
+      recom[1][k]=0.5*rnd()*rnd();
+    }
+    par=lk_malloc(sizeof(int)*grp[i].n_mei);
+    for(j=0;j<grp[i].n_mei;j++) par[j]=rnd()<0.5?0:1;
+    seg0=lk_malloc(sizeof(void *)*3*n);
+    seg1=seg0+n;
+    seg2=seg1+n;
+    seg0[0]=lk_malloc(sizeof(int)*3*n*grp[i].n_mei);
+    for(k=0;k<n;k++) {
+      seg0[k]=seg0[0]+k*grp[i].n_mei;
+      seg1[k]=seg0[k]+n*grp[i].n_mei;
+      seg2[k]=seg1[k]+n*grp[i].n_mei;
+      for(j=0;j<grp[i].n_mei;j++) seg0[k][j]=rnd()<grp[i].known?(rnd()<0.5?0:1):-1;
+    }
+    sk_alloc(&w,n,LANES);
+    t_old=t_new=0.0;
+    for(r=0;r<grp[i].reps;r++) {
+      memcpy(seg1[0],seg0[0],sizeof(int)*n*grp[i].n_mei);
+      memcpy(seg2[0],seg0[0],sizeof(int)*n*grp[i].n_mei);
+      init_ranf(1234+r);
+      t=wall_time();
+      old_sample(seg1,n,grp[i].n_mei,par,recom,p);
+      t_old+=wall_time()-t;
+      init_ranf(1234+r);
+      t=wall_time();
+      new_sample(seg2,n,grp[i].n_mei,par,recom,&w);
+      t_new+=wall_time()-t;
+      if(memcmp(seg1[0],seg2[0],sizeof(int)*n*grp[i].n_mei)) {
+	fprintf(stderr,"bench_segk: %s: sampled indicators differ (rep %d)\n",grp[i].name,r);
+	err=1;
+	break;
+      }
+    }
+    printf("%-10s %6d %8d %9.3f %9.3f %5s\n",grp[i].name,n,grp[i].n_mei,t_old,t_new,n<BATCH_LOCI?"Old":"New");
+    sk_free(&w);
+    free(seg0[0]);
+    free(seg0);
+    free(par);
+    free(recom[0]);
+  }
+  if(err) fprintf(stderr,"bench_segk: kernels disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
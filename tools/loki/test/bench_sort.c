@@ -0,0 +1,122 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_sort.c:                                                            *
+ *                                                                          *
+ * Sorts doubles, ints and index lists with gnu_qsort() and with the radix  *
+ * sorts in lk_sort.c, single threaded and with several threads, checking   *
+ * that the results agree and that sorts by key are stable.                 *
+ *                                                                          *
+ * Usage: bench_sort [n] [threads]                                          *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "utils.h"
+#include "lk_malloc.h"
+#include "lk_sort.h"
+
+static double *key;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static int cmp_doubles(const void *s1,const void *s2)
+{
+  double x1=*(const double *)s1,x2=*(const double *)s2;
+
+  return x1<x2?-1:(x1>x2?1:0);
+}
+
+static int cmp_ints(const void *s1,const void *s2)
+{
+  int i1=*(const int *)s1,i2=*(const int *)s2;
+
+  return i1<i2?-1:(i1>i2?1:0);
+}
+
+/* Descending by key, ties by index to give the stable order */
+static int cmp_idx(const void *s1,const void *s2)
+{
+  int i1=*(const int *)s1,i2=*(const int *)s2;
+
+  if(key[i1]>key[i2]) return -1;
+  if(key[i1]<key[i2]) return 1;
+  return i1<i2?-1:(i1>i2?1:0);
+}
+
+int main(int argc,char *argv[])
+{
+  int i,n=2000000,nt=4,pass,err=0,*ia,*ib,*xa;
+  double *a,*b,*c,t,t1;
+  unsigned long x=12345;
+  const char *name[]={"single thread","threaded"};
+
+  if(argc>1) n=atoi(argv[1]);
+  if(argc>2) nt=atoi(argv[2]);
+  a=lk_malloc(sizeof(double)*n);
+  b=lk_malloc(sizeof(double)*n);
+  c=lk_malloc(sizeof(double)*n);
+  key=lk_malloc(sizeof(double)*n);
+  ia=lk_malloc(sizeof(int)*n);
+  ib=lk_malloc(sizeof(int)*n);
+  xa=lk_malloc(sizeof(int)*n);
+  for(i=0;i<n;i++) {
+    x=x*6364136223846793005UL+1442695040888963407UL;
+    a[i]=(double)(long)(x>>11)*1.0e-12-4.0e6;
+    xa[i]=(int)(x>>33)-(1<<30);
+    /* Few distinct values, so there are plenty of ties */
+    key[i]=(double)((x>>40)%1000)*0.125;
+  }
+  for(pass=0;pass<2;pass++) {
+    set_sort_threads(pass?nt:1);
+    memcpy(b,a,sizeof(double)*n);
+    memcpy(c,a,sizeof(double)*n);
+    t=wall_time();
+    gnu_qsort(b,(size_t)n,sizeof(double),cmp_doubles);
+    t1=wall_time()-t;
+    t=wall_time();
+    lk_sort_doubles(c,(size_t)n);
+    printf("%-16s %-20s %8.3f s (gnu_qsort %.3f s)\n",name[pass],"doubles",wall_time()-t,t1);
+    if(memcmp(b,c,sizeof(double)*n)) err=1;
+    memcpy(ia,xa,sizeof(int)*n);
+    memcpy(ib,xa,sizeof(int)*n);
+    t=wall_time();
+    gnu_qsort(ia,(size_t)n,sizeof(int),cmp_ints);
+    t1=wall_time()-t;
+    t=wall_time();
+    lk_sort_ints(ib,(size_t)n);
+    printf("%-16s %-20s %8.3f s (gnu_qsort %.3f s)\n",name[pass],"ints",wall_time()-t,t1);
+    if(memcmp(ia,ib,sizeof(int)*n)) err=1;
+    for(i=0;i<n;i++) ia[i]=ib[i]=i;
+    t=wall_time();
+    gnu_qsort(ia,(size_t)n,sizeof(int),cmp_idx);
+    t1=wall_time()-t;
+    t=wall_time();
+    lk_sort_index(ib,(size_t)n,key,LK_SORT_DESCEND);
+    printf("%-16s %-20s %8.3f s (gnu_qsort %.3f s)\n",name[pass],"index, descending",wall_time()-t,t1);
+    if(memcmp(ia,ib,sizeof(int)*n)) err=1;
+  }
+  free(a);
+  free(b);
+  free(c);
+  free(key);
+  free(ia);
+  free(ib);
+  free(xa);
+  if(err) fprintf(stderr,"bench_sort: sorts disagree\n");
+  return err?EXIT_FAILURE:EXIT_SUCCESS;
+}
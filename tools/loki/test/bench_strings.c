@@ -0,0 +1,151 @@
+/****************************************************************************
+ *                                                                          *
+ *     Loki - Programs for genetic analysis of complex traits using MCMC    *
+ *                                                                          *
+ * bench_strings.c:                                                         *
+ *                                                                          *
+ * Multi-threaded churn of the string library: every thread reads a file    *
+ * with fget_string() and builds/frees strings with strprintf(), then one   *
+ * thread allocates strings that another thread frees.                      *
+ *                                                                          *
+ * Usage: bench_strings [threads] [iterations]                              *
+ *                                                                          *
+ * This is free software.  You can distribute it and/or modify it           *
+ * under the terms of the Modified BSD license, see the file COPYING        *
+ *                                                                          *
+ ****************************************************************************/
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "lk_malloc.h"
+#include "string_utils.h"
+
+#define N_LINES 20000
+#define HANDOFF 1024
+
+static char tmp_file[]="bench_strings.tmp";
+static int n_iter=20;
+
+static double wall_time(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv,0);
+  return (double)tv.tv_sec+1.0e-6*(double)tv.tv_usec;
+}
+
+static void *churn(void *arg)
+{
+  int i,j,*ck=arg;
+  FILE *fptr;
+  string *s=0,*s1;
+  void *b=0;
+
+  for(i=0;i<n_iter;i++) {
+    if(!(fptr=fopen(tmp_file,"r"))) abort();
+    while((s=fget_string(fptr,s,&b))->len) {
+      s1=strprintf(0,"%d:%s",i,get_cstring(s));
+      s1=add_cstring_to_string(s1," tail");
+      *ck+=(int)s1->len;
+      free_string(s1);
+    }
+    fclose(fptr);
+    for(j=0;j<N_LINES;j++) {
+      s1=copy_string(s);
+      s1=strprintf(s1,"marker_%d",j);
+      free_string(s1);
+    }
+  }
+  free_string(s);
+  if(b) free_fget_buffer(&b);
+  return 0;
+}
+
+/* Strings allocated by the producer are freed by the consumer */
+static string *handoff[HANDOFF];
+static int n_handoff,done;
+static pthread_mutex_t handoff_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t handoff_cond=PTHREAD_COND_INITIALIZER;
+
+static void *producer(void *arg)
+{
+  int i,k;
+
+  for(i=0;i<n_iter*N_LINES;) {
+    pthread_mutex_lock(&handoff_mutex);
+    while(n_handoff==HANDOFF) pthread_cond_wait(&handoff_cond,&handoff_mutex);
+    for(k=n_handoff;k<HANDOFF && i<n_iter*N_LINES;k++,i++) handoff[k]=strprintf(0,"id_%d",i);
+    n_handoff=k;
+    pthread_cond_broadcast(&handoff_cond);
+    pthread_mutex_unlock(&handoff_mutex);
+  }
+  pthread_mutex_lock(&handoff_mutex);
+  done=1;
+  pthread_cond_broadcast(&handoff_cond);
+  pthread_mutex_unlock(&handoff_mutex);
+  return arg;
+}
+
+static void *consumer(void *arg)
+{
+  int k,n;
+  string *batch[HANDOFF];
+
+  for(;;) {
+    pthread_mutex_lock(&handoff_mutex);
+    while(!n_handoff && !done) pthread_cond_wait(&handoff_cond,&handoff_mutex);
+    n=n_handoff;
+    memcpy(batch,handoff,sizeof(string *)*n);
+    n_handoff=0;
+    pthread_cond_broadcast(&handoff_cond);
+    pthread_mutex_unlock(&handoff_mutex);
+    if(!n) break;
+    for(k=0;k<n;k++) free_string(batch[k]);
+  }
+  return arg;
+}
+
+int main(int argc,char *argv[])
+{
+  int i,nt=4,*ck;
+  FILE *fptr;
+  pthread_t *th;
+  double t;
+
+  if(argc>1) nt=atoi(argv[1]);
+  if(argc>2) n_iter=atoi(argv[2]);
+  if(nt<1) nt=1;
+  if(!(fptr=fopen(tmp_file,"w"))) {
+    perror(tmp_file);
+    return EXIT_FAILURE;
+  }
+  for(i=0;i<N_LINES;i++) fprintf(fptr,"%d ped_%d %d %d %g\n",i,i%97,i>>1,i>>2,0.5*i);
+  fclose(fptr);
+  th=lk_malloc(sizeof(pthread_t)*nt);
+  ck=lk_calloc((size_t)nt,sizeof(int));
+  t=wall_time();
+  for(i=0;i<nt;i++) pthread_create(th+i,0,churn,ck+i);
+  for(i=0;i<nt;i++) pthread_join(th[i],0);
+  t=wall_time()-t;
+  for(i=1;i<nt;i++) if(ck[i]!=ck[0]) {
+    fprintf(stderr,"bench_strings: thread %d read %d bytes, thread 0 read %d\n",i,ck[i],ck[0]);
+    return EXIT_FAILURE;
+  }
+  printf("fget_string/strprintf churn: %d threads x %d passes: %.3f s\n",nt,n_iter,t);
+  t=wall_time();
+  pthread_create(th,0,producer,0);
+  pthread_create(th+1,0,consumer,0);
+  pthread_join(th[0],0);
+  pthread_join(th[1],0);
+  t=wall_time()-t;
+  printf("cross thread free: %d strings: %.3f s\n",n_iter*N_LINES,t);
+  free(th);
+  free(ck);
+  free_string_lib();
+  remove(tmp_file);
+  return EXIT_SUCCESS;
+}
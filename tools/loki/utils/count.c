@@ -9,6 +9,7 @@
 #include <assert.h>
 
 #include "string_utils.h"
+#include "line_reader.h"
 #include "lk_malloc.h"
 #include "lkgetopt.h"
 #include "read_output.h"
@@ -32,6 +33,8 @@ int main(int argc,char *argv[])
 	struct ro_link *link,**lnk;
 	string *s=0;
 	void *tbuf=0;
+	struct line_reader *rd;
+	char *ln;
 	struct t_bin *t_bin[2],*t_bin1;
 	struct loki loki;
 	while((c=getopt(argc,argv,"hf:p:b:i:"))!=-1) switch(c) {
@@ -171,9 +174,10 @@ int main(int argc,char *argv[])
 		if(!posfile) posfile="loki.pos";
                 fptr=open_readfile_and_check(posfile,&fflag,loki.compress);
 		if(!(fptr)) exit(EXIT_FAILURE);
+		rd=lr_open(fptr,LR_CSTR);
 		do {
-			s=fget_string(fptr,s,&tbuf);
-			p1=p=get_cstring(s);
+			ln=lr_getline(rd,0);
+			p1=p=ln?ln:"";
 			while(*p1 && *(p1++)!=':');
 			if(*p1) {
 				rep=atoi(p1);
@@ -238,8 +242,9 @@ int main(int argc,char *argv[])
 					}
 				}
 			}
-			if(!s->len) break;
+			if(!ln) break;
 		} while(skip<2);
+		lr_close(rd);
 		fclose(fptr);
 		if(s) {
 			free_string(s);
@@ -10,6 +10,7 @@
 #include <assert.h>
 
 #include "string_utils.h"
+#include "line_reader.h"
 #include "lk_malloc.h"
 #include "lkgetopt.h"
 #include "read_output.h"
@@ -35,6 +36,8 @@ int main(int argc,char *argv[])
 	struct ro_mark *mark;
 	string *s=0,**tmpnames[2],*tmpcontrol=0;
 	void *tbuf=0;
+	struct line_reader *rd;
+	char *ln;
 	struct t_bin *t_bin[2],*t_bin1;
 	struct loki loki;
 	
@@ -233,9 +236,10 @@ int main(int argc,char *argv[])
 		if(!posfile) posfile="loki.pos";
                 fptr=open_readfile_and_check(posfile,&fflag,loki.compress);
 		if(!(fptr)) exit(EXIT_FAILURE);
+		rd=lr_open(fptr,LR_CSTR);
 		do {
-			s=fget_string(fptr,s,&tbuf);
-			p1=p=get_cstring(s);
+			ln=lr_getline(rd,0);
+			p1=p=ln?ln:"";
 			while(*p1 && *(p1++)!=':');
 			if(*p1) {
 				rep=atoi(p1);
@@ -281,8 +285,9 @@ int main(int argc,char *argv[])
 					}
 				}
 			}
-			if(!s->len) break;
+			if(!ln) break;
 		} while(skip<2);
+		lr_close(rd);
 		fclose(fptr);
 		if(it) {
 			z=1.0/(double)it;
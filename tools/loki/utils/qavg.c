@@ -6,6 +6,8 @@
 #include <string.h>
 #include <float.h>
 
+#include "lk_sort.h"
+
 #define BLKSIZE 4096
 static int bufsize,ncol,maxcol,**coldata,*ncols,*cols,blkptr,ldsize,rec,*nn;
 static char *buf,*MMsg="Out of memory error\n";
@@ -166,17 +168,6 @@ static void read_cols(FILE *fptr,int logopt,int start,int ppoint)
 	return;
 }
 
-static int cmp_doubles(const void *s1,const void *s2)
-{
-	double x1,x2;
-
-	x1=*((const double *)s1);
-	x2=*((const double *)s2);
-	if(x1>x2) return 1;
-	if(x2>x1) return -1;
-	return 0;
-}
-
 int main(int argc, char *argv[])
 {
 	char *p;
@@ -238,7 +229,7 @@ int main(int argc, char *argv[])
 			}
 			if(k!=nn[i]) abt("Internal error - mismatch in record count\n");
 			z/=(double)k;
-			qsort(tx,(size_t)k,sizeof(double),cmp_doubles);
+			lk_sort_doubles(tx,(size_t)k);
 			(void)printf("     Q1 = %g, Q2 = %g, Q3 = %g, %g%% Lim = %g -> %g, p = %g\n",tx[(int)(nn[i]*.25)],
 					 tx[(int)(nn[i]*.5)],tx[(int)(nn[i]*.75)],100.0*ppoint,tx[(int)(nn[i]*ppoint)],tx[(int)(nn[i]*(1.0-ppoint))],z);
 		}